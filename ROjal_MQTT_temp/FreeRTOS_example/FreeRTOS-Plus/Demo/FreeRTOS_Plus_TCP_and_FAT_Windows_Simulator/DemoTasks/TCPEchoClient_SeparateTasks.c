@@ -140,9 +140,17 @@ int32_t lShuttingDown = pdFALSE;
 
 static MQTT_shared_data_t mqtt_shared_data;
 static uint8_t a_output_buffer[1024]; /* Shared buffer */
+static uint8_t a_input_buffer[FREERTOS_MAX_MQTT_SIZE]; /* Reassembly buffer for split packets */
+static uint8_t a_input_chunk[FREERTOS_MAX_MQTT_SIZE]; /* Socket receive buffer */
 static Socket_t xSocket = FREERTOS_INVALID_SOCKET;
+static MQTT_store_ring_t outbound_store; /* Publishes made while connection is down */
+static uint8_t a_store_buffer[1024];
+static MQTT_publish_queue_t publish_queue; /* Publish task queues, Alive task sends */
+static MQTT_publish_slot_t a_publish_slots[8];
+static uint8_t a_publish_data[8 * MQTT_PUBLISH_QUEUE_SLOT(19, 4)];
 
 static const uint32_t gKeepAliveTime = 60000; // in milliseconds
+static const uint32_t gDrainPeriod = 100; // in milliseconds
 
 /*-----------------------------------------------------------*/
 
@@ -156,6 +164,9 @@ void vStartTCPEchoClientTasks_SeparateTasks( uint16_t usTaskStackSize, UBaseType
 	/* Create the event group used by the Tx and Rx tasks to synchronise prior
 	to commencing a cycle using a new socket. */
 	xSyncEventGroup = xEventGroupCreate();
+
+	mqtt_store_ring_init(&outbound_store, a_store_buffer, sizeof(a_store_buffer));
+	mqtt_publish_queue_init(&publish_queue, a_publish_slots, 8, a_publish_data, sizeof(a_publish_data));
 	configASSERT( xSyncEventGroup );
 
 	/* Create the task that sends to an echo server, but lets a different task
@@ -175,17 +186,18 @@ void vStartTCPEchoClientTasks_SeparateTasks( uint16_t usTaskStackSize, UBaseType
 }
 /*-----------------------------------------------------------*/
 
-void connected_cb(MQTTErrorCodes_t a_status)
+void connected_cb(MQTT_shared_data_t * a_shared_ptr, MQTTErrorCodes_t a_status)
 {
 	if (Successfull == a_status) {
+		/* Subscription and birth message were sent together with CONNECT */
 		FreeRTOS_printf(("Connected CB SUCCESSFULL\n"));
-		mqtt_subscribe("RMQTTin", 7, 5);
 	} else {
 		FreeRTOS_printf(("Connected CB FAIL %i\n", a_status));
 	}
 }
 
-void subscrbe_cb(MQTTErrorCodes_t a_status,
+void subscrbe_cb(MQTT_shared_data_t * a_shared_ptr,
+				 MQTTErrorCodes_t a_status,
 			 	 uint8_t * a_data_ptr,
 			 	 uint32_t a_data_len,
 				 uint8_t * a_topic_ptr,
@@ -206,7 +218,7 @@ void subscrbe_cb(MQTTErrorCodes_t a_status,
 }
 
 
-void socket_write(uint8_t * a_data_ptr, size_t a_amount)
+int socket_write(MQTT_shared_data_t * a_shared_ptr, uint8_t * a_data_ptr, size_t a_amount)
 {
 
 	int lTransmitted = 0;
@@ -247,7 +259,9 @@ void socket_write(uint8_t * a_data_ptr, size_t a_amount)
 		FreeRTOS_printf(("Socket error\r\n"));
 		lShuttingDown = pdTRUE;
 		xSocket = FREERTOS_INVALID_SOCKET;
+		return -1;
 	}
+	return lTransmitted;
 }
 
 static void prvConnectTask(void *pvParameters)
@@ -255,6 +269,17 @@ static void prvConnectTask(void *pvParameters)
 	struct freertos_sockaddr xEchoServerAddress;
 	BaseType_t lReturned = 0;
 	WinProperties_t xWinProps;
+	MQTT_subscribe_t xSubscribeTopic = {QoS0, (uint8_t *)"RMQTTin", 7};
+	MQTT_subscribe_list_t xSubscribe = {&xSubscribeTopic, 1, NULL};
+	MQTT_publish_t xBirth;
+
+	/* "online" is published right behind CONNECT and SUBSCRIBE, in the same write */
+	mqtt_memset(&xBirth, 0, sizeof(xBirth));
+	xBirth.flags.qos = QoS0;
+	xBirth.topic_ptr = (uint8_t *)"state";
+	xBirth.topic_length = 5;
+	xBirth.message_buffer_ptr = (uint8_t *)"online";
+	xBirth.message_buffer_size = 7;
 
 	/* Avoid warning about unused parameter. */
 	(void)pvParameters;
@@ -298,28 +323,28 @@ static void prvConnectTask(void *pvParameters)
 				configASSERT(lReturned == pdPASS);
 				lReturned = xQueueSend(xSocketPassingQueue, &xSocket, portMAX_DELAY);
 				configASSERT(lReturned == pdPASS);
-				lReturned = xQueueSend(xSocketPassingQueue, &xSocket, portMAX_DELAY);
-				configASSERT(lReturned == pdPASS);
 
-				if (mqtt_connect(FREERTOS_CLIENT_ID,
+				if (mqtt_connect_pipelined(&mqtt_shared_data,
+								FREERTOS_CLIENT_ID,
 								gKeepAliveTime / 1000, // in seconds
 								"",
 								"",
 								"",
 								"",
-								&mqtt_shared_data,
 								a_output_buffer,
 								sizeof(a_output_buffer),
 								1,
 								&socket_write,
 								&connected_cb,
 								&subscrbe_cb,
+								&xSubscribe,
+								&xBirth,
 								10)) {
 
-					mqtt_publish("state",
-								  5,
-								  "online",
-								  7);
+					mqtt_receive_buffer(&mqtt_shared_data, a_input_buffer, sizeof(a_input_buffer));
+
+					/* Messages stored during the outage are sent when CONNACK is received */
+					mqtt_outbound_store(&mqtt_shared_data, &(outbound_store.store));
 
 					while (xSocket!= FREERTOS_INVALID_SOCKET) {
 						vTaskDelay(100 / portTICK_PERIOD_MS);
@@ -349,29 +374,6 @@ static void prvConnectTask(void *pvParameters)
 }
 /*-----------------------------------------------------------*/
 
-int32_t get_remainingsize(uint8_t * a_input_ptr)
-{
-	uint32_t multiplier = 1;
-	uint32_t value = 0;
-	uint8_t  cnt = 1;
-	uint8_t  aByte = 0;
-
-	/* Verify input parameters */
-	if (NULL == a_input_ptr)
-		return -1;
-
-	do {
-		aByte = a_input_ptr[cnt++];
-		value += (aByte & 127) * multiplier;
-		if (multiplier > (128 * 128 * 128))
-			return -2;
-
-		multiplier *= 128;
-	} while ((aByte & 128) != 0);
-	value += (cnt); //Add count header to the overal size of MQTT packet to be received
-	return value;
-}
-
 static void prvReceiveTask( void *pvParameters )
 {
 BaseType_t lReceived, lReturned = 0;
@@ -386,28 +388,11 @@ Socket_t xSocketTmp = FREERTOS_INVALID_SOCKET;
 		while ((xSocketTmp != FREERTOS_INVALID_SOCKET) &&
 				(pdFALSE == lShuttingDown)) {
 
-			char header[32] = { 0 };
-			int bytes_read = FreeRTOS_recv((xSocketTmp), header, sizeof(header) - 1, 0);
+			/* Read as much as available, MQTT client reassembles packets from the stream */
+			int bytes_read = FreeRTOS_recv(xSocketTmp, a_input_chunk, sizeof(a_input_chunk), 0);
 
-			if (2 <= bytes_read) {
-				uint32_t remaining_bytes = get_remainingsize((uint8_t*)header) - bytes_read;
-
-				if (0 < remaining_bytes && FREERTOS_MAX_MQTT_SIZE > remaining_bytes) {
-					/* Need to read more data */
-					char * buff = (char*)pvPortMalloc(remaining_bytes + bytes_read + 128 /* safety buffer*/);
-					memcpy(buff, header, bytes_read);
-					while (remaining_bytes) {
-						int nxt_bytes_read = FreeRTOS_recv(xSocketTmp, &buff[bytes_read], remaining_bytes, 0);
-						remaining_bytes -= nxt_bytes_read;
-						bytes_read += nxt_bytes_read;
-					}
-					mqtt_receive((uint8_t*)buff, (uint32_t)bytes_read);
-					vPortFree(buff);
-				}
-				else {
-					/* Send packets dirctly to the MQTT client, which fit into 32B buffer */
-					mqtt_receive((uint8_t*)header, (uint32_t)bytes_read);
-				}
+			if (0 < bytes_read) {
+				mqtt_receive(&mqtt_shared_data, a_input_chunk, (uint32_t)bytes_read);
 			} else if (0 > bytes_read) {
 				xSocket = FREERTOS_INVALID_SOCKET;
 				lShuttingDown = pdTRUE;
@@ -427,15 +412,16 @@ static void prvAliveTask(void *pvParameters)
 		/* Wait to receive the socket that will be used from the Tx task. */
 		xQueueReceive(xSocketPassingQueue, &xSocketTmp, portMAX_DELAY);
 
-		if (0 < gKeepAliveTime) {
-			for (;; ) {
-				vTaskDelay((gKeepAliveTime/2) / portTICK_PERIOD_MS); // Divided by 2, because of windows inaccurate ticks
-				FreeRTOS_printf(("MQTT WD Feed\r\n"));
-				if (false == mqtt_keepalive(gKeepAliveTime / 4 * 3)) {
-					xSocketTmp = FREERTOS_INVALID_SOCKET;
-					lShuttingDown = pdTRUE;
-					break;
-				}
+		/* Only this task writes to the socket, other tasks queue their publishes */
+		for (;; ) {
+			vTaskDelay(gDrainPeriod / portTICK_PERIOD_MS);
+			mqtt_publish_queue_drain(&mqtt_shared_data, &publish_queue, 0);
+
+			if ((0 < gKeepAliveTime) &&
+				(false == mqtt_keepalive(&mqtt_shared_data, gDrainPeriod / 2 * 3))) { // More than slept, because of windows inaccurate ticks
+				xSocketTmp = FREERTOS_INVALID_SOCKET;
+				lShuttingDown = pdTRUE;
+				break;
 			}
 		}
 	}
@@ -443,27 +429,23 @@ static void prvAliveTask(void *pvParameters)
 
 static void prvPublishTask(void *pvParameters)
 {
-	Socket_t xSocketTmp = FREERTOS_INVALID_SOCKET;
 	(void)pvParameters;
 
-	for (;; )
-	{
-		/* Wait to receive the socket that will be used from the Tx task. */
-		xQueueReceive(xSocketPassingQueue, &xSocketTmp, portMAX_DELAY);
-		const char topic[] = "/lampotila/alakerta";
-		for (;;) {
-			uint32_t cntr = xTaskGetTickCount();
-			vTaskDelay( 1000 / portTICK_PERIOD_MS); // Divided by 2, because of windows inaccurate ticks
-			FreeRTOS_printf(("MQTT Publish Lampotila\r\n"));
-
-			if (false == mqtt_publish(topic,
-									  sizeof(topic) - 1, // Do not count null into the length
-									  &cntr,
-									  sizeof(cntr))){
-				xSocketTmp = FREERTOS_INVALID_SOCKET;
-				lShuttingDown = pdTRUE;
-				break;
-			}
+	/* Publishes are queued also while connection is down, Alive task sends them after reconnect */
+	const char topic[] = "/lampotila/alakerta";
+	for (;;) {
+		uint32_t cntr = xTaskGetTickCount();
+		vTaskDelay( 1000 / portTICK_PERIOD_MS);
+		FreeRTOS_printf(("MQTT Publish Lampotila\r\n"));
+
+		/* Never blocks, Alive task sends it. Full queue drops the reading */
+		if (false == mqtt_publish_enqueue(&publish_queue,
+										  topic,
+										  sizeof(topic) - 1, // Do not count null into the length
+										  &cntr,
+										  sizeof(cntr),
+										  false)) {
+			FreeRTOS_printf(("MQTT Publish queue full\r\n"));
 		}
 	}
 }
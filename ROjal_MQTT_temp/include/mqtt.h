@@ -30,7 +30,7 @@
 #include <stddef.h>  // size_t
 #include <stdbool.h> // bool
 
-#define MQTT_MAX_MESSAGE_SIZE (0x80000000 - 1)
+#define MQTT_MAX_MESSAGE_SIZE 268435455 /* 4 bytes of remaining length */
 
 /**
  * @brief MQTT connection state
@@ -56,7 +56,16 @@ typedef enum MQTTAction
     ACTION_SUBSCRIBE,
     ACTION_KEEPALIVE,
     ACTION_INIT,
-    ACTION_PARSE_INPUT_STREAM
+    ACTION_PARSE_INPUT_STREAM,
+    ACTION_PARSE_INPUT_CHUNK,
+    ACTION_PARSE_INPUT_BATCH,
+    ACTION_PUBLISH_BEGIN,
+    ACTION_PUBLISH_APPEND,
+    ACTION_PUBLISH_END,
+    ACTION_SUBSCRIBE_LIST,
+    ACTION_UNSUBSCRIBE_LIST,
+    ACTION_PUBLISH_PREPARED,
+    ACTION_CONNECT_PIPELINED
 } MQTTAction_t;
 
 /**
@@ -95,6 +104,13 @@ typedef enum MQTTErrorCodes
     NoConnection,
     AllreadyConnected,
     PingNotSend,
+    PacketIncomplete,
+    BufferOverflow,
+    PublishStreamOpen,
+    InflightWindowFull,
+    DuplicatePublish,
+    PingTimeout,
+    PayloadNotKept,
     Successfull     = 0,
     InvalidVersion  = 1,
     InvalidIdentifier,
@@ -128,8 +144,8 @@ typedef enum MQTTQoSLevel
 typedef struct struct_flags_and_type
 {
     uint8_t retain:1;      /* Retain or not                            */
-    uint8_t dup:1;         /* one bit value, duplicate or not          */
     uint8_t qos:2;         /* Quality of service 0-2 @see MQTTQoSLevel */
+    uint8_t dup:1;         /* one bit value, duplicate or not          */
     uint8_t message_type:4;/* @see MQTTMessageType                     */
 } struct_flags_and_type_t;
 
@@ -174,17 +190,26 @@ typedef struct MQTT_connect
     uint8_t                              * client_id;
 } MQTT_connect_t;
 
+/****************************************************************************************
+ * @section client context                                                              *
+ * Every client session keeps its state in own MQTT_shared_data_t context. Context is   *
+ * given to all API functions and callbacks, so one process can run many sessions.      *
+ ****************************************************************************************/
+typedef struct MQTT_shared_data MQTT_shared_data_t;
+
 /****************************************************************************************
  * @section state and data handling function pointers                                   *
  * Following function pointers are used with connection and subscribe functionalities.  *
  ****************************************************************************************/
-typedef void (*connected_fptr_t)(MQTTErrorCodes_t a_status);
+typedef void (*connected_fptr_t)(MQTT_shared_data_t * a_shared_ptr,
+                                 MQTTErrorCodes_t     a_status);
 
-typedef void (*subscrbe_fptr_t)(MQTTErrorCodes_t   a_status,
-                                uint8_t          * a_data_ptr,
-                                uint32_t           a_data_len,
-                                uint8_t          * a_topic_ptr,
-                                uint16_t           a_topic_len);
+typedef void (*subscrbe_fptr_t)(MQTT_shared_data_t * a_shared_ptr,
+                                MQTTErrorCodes_t     a_status,
+                                uint8_t            * a_data_ptr,
+                                uint32_t             a_data_len,
+                                uint8_t            * a_topic_ptr,
+                                uint16_t             a_topic_len);
 
 
 /****************************************************************************************
@@ -192,17 +217,440 @@ typedef void (*subscrbe_fptr_t)(MQTTErrorCodes_t   a_status,
  * Following function pointers are used to send and receive MQTT messages.              *
  * Must be implemnted.                                                                  *
  ****************************************************************************************/
-typedef int (*data_stream_in_fptr_t)(uint8_t * a_data_ptr, size_t a_amount);
+typedef int (*data_stream_in_fptr_t)(MQTT_shared_data_t * a_shared_ptr,
+                                     uint8_t            * a_data_ptr,
+                                     size_t               a_amount);
+
+typedef int (*data_stream_out_fptr_t)(MQTT_shared_data_t * a_shared_ptr,
+                                      uint8_t            * a_data_ptr,
+                                      size_t               a_amount);
+
+/****************************************************************************************
+ * @section output vector                                                               *
+ * Optional scatter-gather output. PUBLISH is given to the output as vector of header,  *
+ * topic and payload chunks by reference, so only header is written to the transmit    *
+ * buffer and payload can be bigger than the buffer. Order of chunks must be kept.      *
+ ****************************************************************************************/
+#define MQTT_OUTPUT_VECTOR_MAX 4
+
+typedef struct MQTT_iovec
+{
+    uint8_t  * data;
+    size_t     size;
+} MQTT_iovec_t;
 
-typedef int (*data_stream_out_fptr_t)(uint8_t * a_data_ptr, size_t a_amount);
+/* Return total amount of bytes sent or negative value in case of failure */
+typedef int (*data_stream_outv_fptr_t)(MQTT_shared_data_t * a_shared_ptr,
+                                       MQTT_iovec_t       * a_iov_ptr,
+                                       uint32_t             a_iov_cnt);
 
 
+/****************************************************************************************
+ * @section output gather                                                               *
+ * Pipelined connect collects CONNECT, SUBSCRIBE and PUBLISH one after another into     *
+ * the transmit buffer and writes them with one out_fptr call. While buffer is set the  *
+ * encoded packets are appended to it instead of sending.                               *
+ ****************************************************************************************/
+typedef struct MQTT_output_gather
+{
+    uint8_t                * buffer;                  /* NULL = output is sent directly */
+    uint32_t                 size;                    /* Size of the whole buffer       */
+    uint32_t                 fill;                    /* Bytes of collected packets     */
+} MQTT_output_gather_t;
+
+/****************************************************************************************
+ * @section output coalescing                                                           *
+ * Optional staging of small PUBLISH packets. Packets are copied one after another into *
+ * the staging buffer and written with one out_fptr call when the threshold is reached, *
+ * the oldest staged packet gets older than the max delay, other packet type is sent,   *
+ * mqtt_flush is called or a blocking call starts waiting its ack.                      *
+ ****************************************************************************************/
+typedef struct MQTT_output_coalesce
+{
+    uint8_t                * buffer;                  /* NULL = output is sent directly */
+    uint32_t                 size;                    /* Size of the staging buffer     */
+    uint32_t                 fill;                    /* Bytes of staged packets        */
+    uint32_t                 threshold;               /* Flush when fill reaches this   */
+    uint32_t                 max_delay_in_us;         /* Max time a packet is staged    */
+    uint32_t                 staged_in_us;            /* Time of the oldest packet      */
+} MQTT_output_coalesce_t;
+
+/****************************************************************************************
+ * @section packet view.                                                                *
+ * Decoded packet points into the receive buffer, nothing is copied. All views are      *
+ * checked against the remaining length before they are given out, so a view never      *
+ * reaches over the packet. Views are valid as long as the receive buffer is.           *
+ ****************************************************************************************/
+typedef struct MQTT_view
+{
+    uint8_t                * ptr;                     /* Into the buffer, NULL = none   */
+    uint32_t                 len;                     /* Bytes in the view              */
+} MQTT_view_t;
+
+typedef struct MQTT_packet_view
+{
+    MQTTMessageType_t        type;
+    MQTTQoSLevel_t           qos;                     /* PUBLISH only, else QoS0        */
+    bool                     dup;
+    bool                     retain;
+    uint16_t                 packet_id;               /* 0 = packet has none            */
+    uint32_t                 packet_size;             /* Fixed header included          */
+    MQTT_view_t              body;                    /* Variable header and payload    */
+    MQTT_view_t              topic;                   /* PUBLISH topic name             */
+    MQTT_view_t              payload;                 /* After the variable header      */
+} MQTT_packet_view_t;
+
+/****************************************************************************************
+ * @section input framer.                                                               *
+ * Framer collects MQTT packets from arbitrary sized input chunks. Packets split over   *
+ * several chunks are reassembled into the receive buffer given by the user.            *
+ ****************************************************************************************/
+typedef struct MQTT_input_framer
+{
+    uint8_t                * buffer;                  /* Packet reassembly buffer       */
+    size_t                   buffer_size;             /* Size of reassembly buffer      */
+    uint32_t                 fill;                    /* Bytes stored into buffer       */
+    uint32_t                 packet_size;             /* Size of packet, 0 = unknown    */
+    uint32_t                 discard;                 /* Bytes to skip (too big packet) */
+    bool                     stream_payload;          /* PUBLISH payload passed through */
+    uint32_t                 stream_left;             /* Payload bytes still to pass    */
+    MQTTQoSLevel_t           stream_qos;              /* QoS of streamed PUBLISH        */
+    uint16_t                 stream_id;               /* Its packet id, acked when done */
+} MQTT_input_framer_t;
+
+/****************************************************************************************
+ * @section receive stream.                                                             *
+ * Optional streaming receive of PUBLISH. Only fixed and variable header are collected  *
+ * into the reassembly buffer, payload is passed to the application in the chunks it   *
+ * arrives, so payload size is not limited by the buffer. subscribe_cb_fptr is still   *
+ * used for SUBACK.                                                                     *
+ ****************************************************************************************/
+typedef void (*receive_topic_fptr_t)(MQTT_shared_data_t * a_shared_ptr,
+                                     uint8_t            * a_topic_ptr,
+                                     uint16_t             a_topic_len,
+                                     uint32_t             a_payload_size);
+
+typedef void (*receive_chunk_fptr_t)(MQTT_shared_data_t * a_shared_ptr,
+                                     uint8_t            * a_data_ptr,
+                                     uint32_t             a_data_len);
+
+typedef void (*receive_complete_fptr_t)(MQTT_shared_data_t * a_shared_ptr,
+                                        MQTTErrorCodes_t     a_status);
+
+typedef struct MQTT_receive_stream
+{
+    receive_topic_fptr_t     topic_fptr;              /* Topic, called first            */
+    receive_chunk_fptr_t     chunk_fptr;              /* Payload chunk, NULL = disabled */
+    receive_complete_fptr_t  complete_fptr;           /* Whole payload received         */
+} MQTT_receive_stream_t;
+
+/****************************************************************************************
+ * @section publish stream.                                                             *
+ * PUBLISH which payload is given in chunks. Header is sent with the declared payload   *
+ * size and chunks go directly to the output, so payload can be bigger than the         *
+ * transmit buffer. Stream owns the output until all payload is sent.                   *
+ * Acks of received publishes (PUBACK, PUBREC, PUBREL, PUBCOMP) can not be written into *
+ * the payload, they are held and sent right after the last chunk. Acks over the held   *
+ * count are dropped, broker sends the publish again after reconnect.                   *
+ ****************************************************************************************/
+#ifndef MQTT_PUBLISH_STREAM_ACKS
+#define MQTT_PUBLISH_STREAM_ACKS 8
+#endif
+
+typedef struct MQTT_held_ack
+{
+    uint8_t                  type;                    /* @see MQTTMessageType_t         */
+    uint16_t                 packet_id;
+} MQTT_held_ack_t;
+
+typedef struct MQTT_publish_stream
+{
+    bool                     open;                    /* Stream started, not ended      */
+    uint32_t                 left;                    /* Payload bytes still expected   */
+    uint8_t                  acks_held;               /* Acks waiting end of payload    */
+    MQTT_held_ack_t          acks[MQTT_PUBLISH_STREAM_ACKS];
+} MQTT_publish_stream_t;
+
+/****************************************************************************************
+ * @section prepared publish.                                                           *
+ * Fixed header flags, topic length and topic of often used publish are encoded once   *
+ * into the user given buffer. Per message only remaining length (into the room left    *
+ * before the topic) and packet identifier are written, header and payload are then     *
+ * given to the output as two chunks. Buffer is modified by every publish, so one       *
+ * prepared publish is used by one task at a time.                                     *
+ ****************************************************************************************/
+#define MQTT_PREPARED_HEADER_ROOM 5 /* Flags byte and 4 bytes of remaining length */
+
+/* Buffer size needed for topic of given length */
+#define MQTT_PREPARED_SIZE(topic_length) (MQTT_PREPARED_HEADER_ROOM + 2 + (topic_length) + 2)
+
+typedef struct MQTT_prepared_publish
+{
+    uint8_t                * buffer;                  /* Header room, topic, packet id  */
+    uint8_t                  flags;                   /* First byte of fixed header     */
+    MQTTQoSLevel_t           qos;                     /* QoS of every publish           */
+    bool                     retain;                  /* Retain of every publish        */
+    uint16_t                 topic_length;            /* Topic is after its length      */
+    uint8_t                * message_ptr;             /* Payload of publish being sent  */
+    uint32_t                 message_size;            /* Size of the payload            */
+    uint16_t                 packet_identifier;       /* [out] packet id of QoS 1 and 2 */
+} MQTT_prepared_publish_t;
+
+/****************************************************************************************
+ * @section publish queue.                                                              *
+ * Thread safe front end for QoS 0 publishes. Any thread or task encodes its publish    *
+ * into a slot of a lock-free multi-producer single-consumer ring, the one running the  *
+ * client sends them in order with mqtt_publish_queue_drain. Every slot carries a turn  *
+ * counter: producer owns slot when turn equals its position, consumer when it is one   *
+ * more, after sending it is advanced by slot count for the next round.                 *
+ ****************************************************************************************/
+/* Slot size needed for publish of given topic and payload sizes (below 16 kB) */
+#define MQTT_PUBLISH_QUEUE_SLOT(topic_length, msg_size) (1 + 2 + 2 + (topic_length) + (msg_size))
+
+/* Atomic counters need their natural alignment, queue types are not packed */
+#pragma pack(push)
+#pragma pack()
+
+typedef struct MQTT_publish_slot
+{
+    volatile uint32_t        turn;                    /* Position owning the slot       */
+    uint32_t                 size;                    /* Size of encoded packet         */
+} MQTT_publish_slot_t;
+
+typedef struct MQTT_publish_queue
+{
+    MQTT_publish_slot_t    * slots;                   /* Slot table                     */
+    uint8_t                * data;                    /* slot_cnt * slot_size bytes     */
+    uint32_t                 slot_cnt;                /* Power of two                   */
+    uint32_t                 slot_size;               /* Biggest encoded publish        */
+    volatile uint32_t        head;                    /* Next position of producers     */
+    uint32_t                 tail;                    /* Next position of consumer      */
+    volatile uint32_t        dropped;                 /* Publishes refused, queue full  */
+} MQTT_publish_queue_t;
+
+#pragma pack(pop)
+
+/****************************************************************************************
+ * @section in-flight window.                                                           *
+ * QoS 1 and 2 publishes wait acknowledgement in the in-flight window, which is given   *
+ * by the user. Entries refer to topic and payload of the publish, so they must stay    *
+ * valid until published_fptr is called. Unacknowledged publishes are sent again with  *
+ * DUP flag (PUBREL after PUBREC) when retry time expires and when the window is       *
+ * attached after reconnect. Publish fails with InflightWindowFull when all entries    *
+ * are in use.                                                                          *
+ * Payload of chunked publish (mqtt_publish_begin_qos) is not kept, it can not be sent  *
+ * again: its entry is freed and published_fptr is called with PayloadNotKept instead,  *
+ * so the application publishes it again.                                               *
+ * Received QoS 2 publishes are delivered once: their packet identifiers are kept in   *
+ * the optional received table until PUBREL, repeated PUBLISH is only acknowledged.    *
+ ****************************************************************************************/
+typedef enum MQTTInflightState
+{
+    INFLIGHT_FREE = 0,
+    INFLIGHT_WAIT_PUBACK,                             /* QoS1 sent, waiting PUBACK      */
+    INFLIGHT_WAIT_PUBREC,                             /* QoS2 sent, waiting PUBREC      */
+    INFLIGHT_WAIT_PUBCOMP                             /* PUBREL sent, waiting PUBCOMP   */
+} MQTTInflightState_t;
+
+typedef void (*published_fptr_t)(MQTT_shared_data_t * a_shared_ptr,
+                                 uint16_t             a_packet_id,
+                                 MQTTErrorCodes_t     a_status);
+
+typedef struct MQTT_inflight_entry
+{
+    MQTTInflightState_t      state;
+    uint16_t                 packet_id;
+    MQTTQoSLevel_t           qos;
+    bool                     retain;
+    uint8_t                * topic_ptr;
+    uint16_t                 topic_length;
+    uint8_t                * message_ptr;
+    uint32_t                 message_size;
+    int32_t                  time_to_retry_in_ms;     /* Retransmit timer               */
+#ifdef MQTT_INSTRUMENTATION
+    uint32_t                 sent_in_us;              /* Ack latency start              */
+#endif
+} MQTT_inflight_entry_t;
+
+typedef struct MQTT_inflight_window
+{
+    MQTT_inflight_entry_t  * entries;                 /* Entry table of the user        */
+    uint16_t                 size;                    /* Amount of entries = window     */
+    uint16_t                 used;                    /* Entries waiting for ack        */
+    uint32_t                 retry_in_ms;             /* Retransmit timeout, 0 = never  */
+    published_fptr_t         published_cb_fptr;       /* Ack received callback          */
+    uint16_t               * received_ids;            /* QoS2 ids waiting PUBREL, 0=free*/
+    uint16_t                 received_size;           /* Size of received table         */
+} MQTT_inflight_window_t;
+
+/****************************************************************************************
+ * @section outbound store.                                                             *
+ * Optional queue behind mqtt_publish and mqtt_publish_buf. QoS 0 publish which can not *
+ * be sent (not connected or sending failed) is copied into the store. Publish which    *
+ * does not fit into the transmit buffer (only its header with outv_fptr) is not        *
+ * stored, it fails. Store is flushed in order when it is attached to a connected       *
+ * context, when CONNACK is received and before next publish. Between CONNECT and       *
+ * accepted CONNACK publishes are stored, and refused CONNACK keeps the store. Message  *
+ * is removed only after it was written out, or dropped when it can not be encoded any  *
+ * more. Backend is given with function pointers: RAM ring is portable, file backend    *
+ * (Linux) survives process restarts.                                                   *
+ ****************************************************************************************/
+typedef struct MQTT_store MQTT_store_t;
+
+typedef bool (*store_put_fptr_t)(MQTT_store_t * a_store_ptr,
+                                 uint8_t      * a_topic_ptr,
+                                 uint16_t       a_topic_length,
+                                 uint8_t      * a_message_ptr,
+                                 uint32_t       a_message_size);
+
+/* Give oldest message, pointers are valid until pop */
+typedef bool (*store_peek_fptr_t)(MQTT_store_t  * a_store_ptr,
+                                  uint8_t      ** a_topic_ptr,
+                                  uint16_t      * a_topic_length_ptr,
+                                  uint8_t      ** a_message_ptr,
+                                  uint32_t      * a_message_size_ptr);
+
+typedef bool (*store_pop_fptr_t)(MQTT_store_t * a_store_ptr);
+
+struct MQTT_store
+{
+    store_put_fptr_t         put_fptr;                /* Append message                 */
+    store_peek_fptr_t        peek_fptr;               /* Oldest message                 */
+    store_pop_fptr_t         pop_fptr;                /* Remove oldest message          */
+    uint32_t                 count;                   /* Messages in the store          */
+};
+
+typedef struct MQTT_store_ring
+{
+    MQTT_store_t             store;                   /* Must be the first member       */
+    uint8_t                * buffer;                  /* Ring memory of the user        */
+    uint32_t                 size;                    /* Size of ring memory            */
+    uint32_t                 head;                    /* Write position                 */
+    uint32_t                 tail;                    /* Read position                  */
+} MQTT_store_ring_t;
+
+#ifdef BUILD_DEFAULT_C_LIBS
+typedef struct MQTT_store_file
+{
+    MQTT_store_t             store;                   /* Must be the first member       */
+    FILE                   * file;                    /* Header and appended messages   */
+    uint32_t                 read_offset;             /* Oldest message in the file     */
+    uint8_t                * scratch;                 /* Oldest message is read here    */
+    uint32_t                 scratch_size;            /* Max topic + payload size       */
+} MQTT_store_file_t;
+#endif /* BUILD_DEFAULT_C_LIBS */
+
+/****************************************************************************************
+ * @section topic trie.                                                                 *
+ * Optional per-subscription handlers. Topic filters are kept in a trie, one node per  *
+ * filter level, in the node pool given by the user. Received PUBLISH topic is matched  *
+ * level by level in place (+ and # included) and handler of each matching filter is  *
+ * called. Level names point into registered filters, filter strings must stay valid   *
+ * while registered. subscribe_cb_fptr still gets SUBACKs and unmatched publishes.     *
+ ****************************************************************************************/
+typedef struct MQTT_topic_node
+{
+    const uint8_t          * level_ptr;               /* Level name, NULL = free node   */
+    uint16_t                 level_length;            /* Level name length              */
+    uint16_t                 child;                   /* First child, 0 = none          */
+    uint16_t                 sibling;                 /* Next sibling, 0 = none         */
+    subscrbe_fptr_t          handler_fptr;            /* Filter ends here, NULL = not   */
+} MQTT_topic_node_t;
+
+typedef struct MQTT_topic_trie
+{
+    MQTT_topic_node_t      * nodes;                   /* Node pool, node 0 is the root  */
+    uint16_t                 size;                    /* Size of node pool              */
+    uint16_t                 used;                    /* Nodes in use, root included    */
+} MQTT_topic_trie_t;
+
+/****************************************************************************************
+ * @section pending subscribe.                                                          *
+ * SUBSCRIBE or UNSUBSCRIBE waiting its acknowledgement. One request is pending at a   *
+ * time, it may carry any amount of topic filters.                                      *
+ ****************************************************************************************/
+typedef struct MQTT_subscribe_pending
+{
+    uint16_t                 packet_id;               /* Waiting ack, 0 = none          */
+    uint8_t                * return_codes_ptr;        /* SUBACK codes copied, NULL = no */
+    uint16_t                 return_code_cnt;         /* Room in return code table      */
+    MQTTErrorCodes_t         result;                  /* Successfull = all granted      */
+} MQTT_subscribe_pending_t;
+
+/****************************************************************************************
+ * @section keepalive engine.                                                           *
+ * Sent PINGREQ waits its PINGRESP until the response deadline. When deadline passes    *
+ * connection is dead: context goes to disconnected state, lost callback is called and  *
+ * keepalive fails. Deadline is measured with mqtt_time_ms, 0 timeout = half of the     *
+ * keepalive, so a dead connection is noticed in about 1.5 times the keepalive.         *
+ ****************************************************************************************/
+typedef void (*connection_lost_fptr_t)(MQTT_shared_data_t * a_shared_ptr,
+                                       MQTTErrorCodes_t     a_reason);
+
+typedef struct MQTT_keepalive_engine
+{
+    connection_lost_fptr_t   lost_fptr;               /* Dead connection, NULL = none   */
+    uint32_t                 pingresp_timeout_in_ms;  /* 0 = half of the keepalive      */
+    uint32_t                 ping_sent_in_ms;         /* Time of the outstanding ping   */
+    uint32_t                 clock_in_ms;             /* Previous mqtt_keepalive_poll   */
+    volatile bool            ping_outstanding;        /* PINGRESP not received yet      */
+} MQTT_keepalive_engine_t;
+
+/****************************************************************************************
+ * @section instrumentation                                                             *
+ * Optional latency histograms and packet counters, built in with MQTT_INSTRUMENTATION. *
+ * Without it the context has no instrumentation data and nothing is recorded.          *
+ * Histogram is log-linear: values under 8 us have own buckets, above that each power   *
+ * of two is split into 8 buckets, so a percentile is within 12.5 % of the real value.  *
+ ****************************************************************************************/
+#define MQTT_HISTOGRAM_SUB_BITS 3
+#define MQTT_HISTOGRAM_BUCKETS  200 /* Up to 2^27 us = 134 s, longer go to the last */
+
+typedef enum MQTTHistogram
+{
+    HISTOGRAM_CONNECT = 0,  /* CONNECT sent - CONNACK received                */
+    HISTOGRAM_SUBSCRIBE,    /* SUBSCRIBE or UNSUBSCRIBE sent - ack received   */
+    HISTOGRAM_PING,         /* PINGREQ sent - PINGRESP received               */
+    HISTOGRAM_QOS1_ACK,     /* QoS 1 PUBLISH sent - PUBACK received           */
+    HISTOGRAM_QOS2_ACK,     /* QoS 2 PUBLISH sent - PUBCOMP received          */
+    HISTOGRAM_CALLBACK,     /* Delivery of received PUBLISH to the application */
+    HISTOGRAM_CNT
+} MQTTHistogram_t;
+
+typedef struct MQTT_histogram
+{
+    uint32_t                 count;
+    uint32_t                 min_in_us;
+    uint32_t                 max_in_us;
+    uint64_t                 sum_in_us;
+    uint32_t                 buckets[MQTT_HISTOGRAM_BUCKETS];
+} MQTT_histogram_t;
+
+typedef struct MQTT_packet_counter
+{
+    uint32_t                 packets;
+    uint64_t                 bytes;
+} MQTT_packet_counter_t;
+
+typedef struct MQTT_instrumentation
+{
+    MQTT_histogram_t         histograms[HISTOGRAM_CNT];
+    MQTT_packet_counter_t    in[MAXCMD];              /* Received, by message type      */
+    MQTT_packet_counter_t    out[MAXCMD];             /* Sent, by message type          */
+    uint32_t                 connect_sent_in_us;      /* 0 = not waiting                */
+    uint32_t                 subscribe_sent_in_us;
+    uint32_t                 ping_sent_in_us;
+} MQTT_instrumentation_t;
+
 /****************************************************************************************
  * @section shared data structure.                                                      *
  * MQTT stack uses this shared data sructure to keep its state and needed function      *
- * pointers in safe.                                                                    *
+ * pointers in safe. Context is not packed, its completion lock needs natural alignment. *
  ****************************************************************************************/
-typedef struct MQTT_shared_data
+#pragma pack(push)
+#pragma pack()
+
+struct MQTT_shared_data
 {
     MQTTState_t              state;                   /* Connection state               */
     connected_fptr_t         connected_cb_fptr;       /* Connected callback             */
@@ -210,11 +658,32 @@ typedef struct MQTT_shared_data
     uint8_t                * buffer;                  /* Pointer to transmit buffer     */
     size_t                   buffer_size;             /* Size of transmit buffer        */
     data_stream_out_fptr_t   out_fptr;                /* Sending out MQTT stream fptr   */
+    data_stream_outv_fptr_t  outv_fptr;               /* Vector output, NULL = copy     */
     uint32_t                 mqtt_packet_cntr;        /* MQTT packet indentifer counter */
     int32_t                  keepalive_in_ms;         /* Keepalive timer value          */
     int32_t                  time_to_next_ping_in_ms; /* Keepalive counter              */
-    bool                     subscribe_status;        /* Internal subscribe status flag */
-} MQTT_shared_data_t;
+    MQTT_keepalive_engine_t  ping;                    /* PINGRESP deadline              */
+    volatile bool            connect_status;          /* CONNACK received               */
+    bool                     session_accepted;        /* Accepted CONNACK received      */
+    volatile bool            subscribe_status;        /* SUBACK or UNSUBACK received    */
+    MQTT_subscribe_pending_t subscribe_pending;       /* Request waiting the ack        */
+    MQTT_input_framer_t      framer;                  /* Input stream framer            */
+    MQTT_output_gather_t     gather;                  /* Pipelined connect output       */
+    MQTT_output_coalesce_t   coalesce;                /* Staged small publishes         */
+    MQTT_publish_stream_t    publish_stream;          /* Chunked publish state          */
+    MQTT_receive_stream_t    receive_stream;          /* Streaming receive callbacks    */
+    MQTT_inflight_window_t * inflight;                /* QoS 1/2 window, NULL = none    */
+    MQTT_store_t           * store;                   /* Outbound store, NULL = none    */
+    MQTT_topic_trie_t      * topics;                  /* Filter handlers, NULL = none   */
+    mqtt_completion_t      * completion;              /* Blocking call waiting an ack   */
+    mqtt_completion_lock_t   completion_lock;         /* Guards completion pointer      */
+    void                   * user_ptr;                /* Application data, not touched  */
+#ifdef MQTT_INSTRUMENTATION
+    MQTT_instrumentation_t   instrumentation;         /* Cleared by ACTION_INIT         */
+#endif
+};
+
+#pragma pack(pop)
 
 /****************************************************************************************
  * @section MQTT action structures                                                      *
@@ -224,6 +693,7 @@ typedef struct MQTT_input_stream
 {
     uint8_t  * data;
     uint32_t   size_of_data;
+    uint32_t   size_of_consumed; /* Batch parse: bytes of complete packets parsed */
 } MQTT_input_stream_t;
 
 typedef struct MQTT_publish
@@ -235,6 +705,7 @@ typedef struct MQTT_publish
     uint32_t                  message_buffer_size;
     uint8_t                 * output_buffer_ptr;
     uint32_t                  output_buffer_size;
+    uint16_t                  packet_identifier;   /* [out] packet id of QoS 1 and 2 */
 } MQTT_publish_t;
 
 typedef struct MQTT_subscribe
@@ -244,20 +715,94 @@ typedef struct MQTT_subscribe
     uint16_t         topic_length;
 } MQTT_subscribe_t;
 
+#define MQTT_SUBACK_FAILURE 0x80 /* SUBACK return code of refused topic filter */
+
+typedef struct MQTT_subscribe_list
+{
+    MQTT_subscribe_t * topics_ptr;        /* Topic filters, qos not used in unsubscribe   */
+    uint16_t           topic_cnt;         /* Amount of filters, all in one packet          */
+    uint8_t          * return_codes_ptr;  /* [out] granted QoS or MQTT_SUBACK_FAILURE per  */
+                                          /* filter when SUBACK is received, can be NULL  */
+} MQTT_subscribe_list_t;
+
+/* Requests sent right behind CONNECT, see mqtt_connect_pipelined */
+typedef struct MQTT_connect_pipeline
+{
+    MQTT_connect_t          * connect_ptr;
+    MQTT_subscribe_list_t   * subscribe_ptr;     /* Initial subscriptions, NULL = none */
+    MQTT_publish_t          * publish_ptr;       /* Birth message, NULL = none         */
+} MQTT_connect_pipeline_t;
+
 typedef struct MQTT_action_data
 {
     union {
-        MQTT_shared_data_t  * shared_ptr;
-        MQTT_connect_t      * connect_ptr;
-        uint32_t              epalsed_time_in_ms;
-        MQTT_input_stream_t * input_stream_ptr;
-        MQTT_publish_t      * publish_ptr;
-        MQTT_subscribe_t    * subscribe_ptr;
+        MQTT_connect_t          * connect_ptr;
+        uint32_t                  epalsed_time_in_ms;
+        MQTT_input_stream_t     * input_stream_ptr;
+        MQTT_publish_t          * publish_ptr;
+        MQTT_subscribe_t        * subscribe_ptr;
+        MQTT_subscribe_list_t   * subscribe_list_ptr;
+        MQTT_prepared_publish_t * prepared_ptr;
+        MQTT_connect_pipeline_t * pipeline_ptr;
     } action_argument;
 } MQTT_action_data_t;
 
 /****************************************************************************************
- * @section Debug                                                                         *
+ * @section reconnect manager                                                           *
+ * Keeps a resumed session (clean session = 0) up over transport losses. Subscription   *
+ * table and birth message go right behind every CONNECT, outbound store and in-flight  *
+ * window are attached again, so stored and unacknowledged publishes are sent after     *
+ * CONNACK. Failed attempts are retried after random delay between half and whole of    *
+ * min(max delay, base delay * 2^attempt), so clients do not return in synchronization. *
+ ****************************************************************************************/
+typedef enum MQTTReconnectState
+{
+    RECONNECT_WAIT = 0,   /* Waiting backoff delay, transport closed */
+    RECONNECT_CONNECTING, /* CONNECT sent, waiting CONNACK           */
+    RECONNECT_ONLINE      /* CONNACK received, session resumed       */
+} MQTTReconnectState_t;
+
+typedef enum MQTTReconnectEvent
+{
+    RECONNECT_EVENT_ONLINE = 0, /* Session is up, window and store are attached */
+    RECONNECT_EVENT_LOST,       /* Connection was lost, transport is closed     */
+    RECONNECT_EVENT_FAILED      /* Attempt failed, next one after the delay     */
+} MQTTReconnectEvent_t;
+
+/* Open transport to the broker, true when out_fptr of the context can be used */
+typedef bool (*reconnect_open_fptr_t)(MQTT_shared_data_t * a_shared_ptr);
+
+typedef void (*reconnect_close_fptr_t)(MQTT_shared_data_t * a_shared_ptr);
+
+typedef void (*reconnect_event_fptr_t)(MQTT_shared_data_t   * a_shared_ptr,
+                                       MQTTReconnectEvent_t   a_event);
+
+#define MQTT_RECONNECT_CONNACK_TIMEOUT_MS 10000
+
+typedef struct MQTT_reconnect
+{
+    MQTT_shared_data_t     * shared;                /* Managed client context         */
+    MQTT_connect_t           connect;               /* CONNECT parameters, copied     */
+    reconnect_open_fptr_t    open_fptr;             /* Open transport                 */
+    reconnect_close_fptr_t   close_fptr;            /* Close transport                */
+    reconnect_event_fptr_t   event_fptr;            /* State changes, NULL = none     */
+    MQTT_subscribe_list_t  * subscriptions;         /* Subscribed on every connect    */
+    MQTT_publish_t         * birth;                 /* Published on every connect     */
+    MQTT_inflight_window_t * inflight;              /* Attached after CONNACK         */
+    MQTT_store_t           * store;                 /* Attached before CONNECT        */
+    MQTT_topic_trie_t      * topics;                /* Attached before CONNECT        */
+    uint32_t                 base_delay_in_ms;      /* Delay ceiling of first attempt */
+    uint32_t                 max_delay_in_ms;       /* Delay ceiling limit            */
+    uint32_t                 connack_timeout_in_ms; /* Attempt fails without CONNACK  */
+    uint32_t                 time_left_in_ms;       /* Delay or CONNACK timer         */
+    uint32_t                 attempts;              /* Failed attempts in a row       */
+    uint32_t                 random;                /* Jitter generator state         */
+    volatile bool            lost;                  /* Set by mqtt_reconnect_lost     */
+    MQTTReconnectState_t     state;
+} MQTT_reconnect_t;
+
+/****************************************************************************************
+ * @section Debug                                                                        *
  ****************************************************************************************/
 /**
  * Debug hex print
@@ -281,41 +826,45 @@ void hex_print(uint8_t * a_data_ptr, size_t a_size);
  * It uses data structures together with action parameter to request valid aciton with
  * proper parameters.
  *
+ * @param a_shared_ptr [in] client context @see MQTT_shared_data_t.
  * @param a_action [in] action type see MQTTAction_t.
  * @param a_action_ptr [in] parameters for action see MQTT_action_data_t.
  * @return None
  */
-MQTTErrorCodes_t mqtt(MQTTAction_t         a_action,
+MQTTErrorCodes_t mqtt(MQTT_shared_data_t * a_shared_ptr,
+                      MQTTAction_t         a_action,
                       MQTT_action_data_t * a_action_ptr);
 
 /**
  * mqtt_connect user API
  *
- * Initialize software stack and create connection to requested broker.
+ * Initialize software stack and create connection to requested broker. Returns as soon as
+ * CONNACK is parsed by the task handling input (mqtt_receive), result is also given to
+ * a_connected_fptr.
  *
+ * @param a_shared_ptr [in] client context @see MQTT_shared_data_t.
  * @param a_client_name_ptr [in] name of client which is connecting to broker
  * @param a_keepalive_timeout [in] 0-x keepalive time in seconds (0=disabled).
  * @param a_username_str_ptr [in] username string (must be null ending).
  * @param a_password_str_ptr [in] password string (must be null ending).
  * @param a_last_will_topic_str_ptr [in] last will topic.
  * @param a_last_will_str_ptr [in] last will data string (must be null ending).
- * @param mqtt_shared_data_ptr [in] @see mqtt_shared_data_ptr.
  * @param a_output_buffer_ptr [in] common/shared output buffer.
  * @param a_output_buffer_size [in] maximum size of output buffer.
  * @param a_clean_session [in] is session clean or should broker restore it.
  * @param a_out_write_fptr [in] @see data_stream_out_fptr_t.
  * @param a_connected_fptr [in] @see connected_fptr_t.
  * @param a_subscribe_fptr [in] @see subscrbe_fptr_t.
- * @param a_timeout_in_sec [in] mqtt_connect timeout in seconds.
- * @return true if successfully connected.
+ * @param a_timeout_in_sec [in] mqtt_connect timeout in seconds, 0 = do not wait CONNACK.
+ * @return true if successfully connected, when not waited true if CONNECT was sent.
  */
-bool mqtt_connect(char                   * a_client_name_ptr,
+bool mqtt_connect(MQTT_shared_data_t     * a_shared_ptr,
+                  char                   * a_client_name_ptr,
                   uint16_t                 a_keepalive_timeout,
                   uint8_t                * a_username_str_ptr,
                   uint8_t                * a_password_str_ptr,
                   uint8_t                * a_last_will_topic_str_ptr,
                   uint8_t                * a_last_will_str_ptr,
-                  MQTT_shared_data_t     * mqtt_shared_data_ptr,
                   uint8_t                * a_output_buffer_ptr,
                   size_t                   a_output_buffer_size,
                   bool                     a_clean_session,
@@ -324,89 +873,845 @@ bool mqtt_connect(char                   * a_client_name_ptr,
                   subscrbe_fptr_t          a_subscribe_fptr,
                   uint8_t                  a_timeout_in_sec);
 
+/**
+ * mqtt_connect_pipelined user API
+ *
+ * Same as mqtt_connect, but initial subscriptions and birth message are sent right
+ * behind CONNECT in the same write, without waiting CONNACK in between. First message
+ * is then received one round trip after connecting.
+ *
+ * All packets must fit into the output buffer, vector output is not used for them.
+ * SUBACK is not waited, it is given to a_subscribe_fptr and return codes are written
+ * into a_subscribe_ptr->return_codes_ptr. QoS 1 and 2 birth message is tracked only
+ * when in-flight window is attached later (it is detached by the initialization).
+ *
+ * @param a_subscribe_ptr [in] initial subscriptions, NULL = none.
+ * @param a_birth_ptr [in] message published after subscriptions, NULL = none.
+ * @see mqtt_connect for other parameters.
+ * @return true if successfully connected, when not waited true if packets were sent.
+ */
+bool mqtt_connect_pipelined(MQTT_shared_data_t     * a_shared_ptr,
+                            char                   * a_client_name_ptr,
+                            uint16_t                 a_keepalive_timeout,
+                            uint8_t                * a_username_str_ptr,
+                            uint8_t                * a_password_str_ptr,
+                            uint8_t                * a_last_will_topic_str_ptr,
+                            uint8_t                * a_last_will_str_ptr,
+                            uint8_t                * a_output_buffer_ptr,
+                            size_t                   a_output_buffer_size,
+                            bool                     a_clean_session,
+                            data_stream_out_fptr_t   a_out_write_fptr,
+                            connected_fptr_t         a_connected_fptr,
+                            subscrbe_fptr_t          a_subscribe_fptr,
+                            MQTT_subscribe_list_t  * a_subscribe_ptr,
+                            MQTT_publish_t         * a_birth_ptr,
+                            uint8_t                  a_timeout_in_sec);
+
 /**
  * mqtt_disconnect user API
  *
  * Disconnect from server
  *
+ * @param a_shared_ptr [in] client context.
  * @return true when disconnected was successfully sent.
  */
-bool mqtt_disconnect();
+bool mqtt_disconnect(MQTT_shared_data_t * a_shared_ptr);
 
 /**
  * mqtt_publish user API
  *
  * Publish data to given topic
  *
+ * @param a_shared_ptr [in] client context.
  * @param a_topic_ptr [in] topic (all values alloved = non chars).
  * @param a_topic_size [in] size of topic.
  * @param a_msg_ptr [in] pointer to data which shall be published.
  * @param a_msg_size [in] size of data to be published.
  * @return true when publish successfully formed and sent out.
  */
-bool mqtt_publish(char * a_topic_ptr,
-                  size_t a_topic_size,
-                  char * a_msg_ptr,
-                  size_t a_msg_size);
+bool mqtt_publish(MQTT_shared_data_t * a_shared_ptr,
+                  char               * a_topic_ptr,
+                  size_t               a_topic_size,
+                  char               * a_msg_ptr,
+                  size_t               a_msg_size);
 /**
  * mqtt_publish_buf user API
  *
  * Publish data to given topic, using dedicated transmit buffer.
+ * With outbound store attached, publish which can not be sent is stored and
+ * messages stored earlier are sent first, @see mqtt_outbound_store.
  *
+ * @param a_shared_ptr [in] client context.
  * @param a_topic_ptr [in] topic (all values alloved = non chars).
  * @param a_topic_size [in] size of topic.
  * @param a_msg_ptr [in] pointer to data which shall be published.
  * @param a_msg_size [in] size of data to be published.
  * @param a_output_buffer_ptr [out] ponter to transmit buffer.
  * @param a_output_buffer_size [in] size of transmit buffer.
- * @return true when publish successfully formed and sent out.
+ * @return true when publish successfully formed and sent out, or stored.
+ */
+bool mqtt_publish_buf(MQTT_shared_data_t * a_shared_ptr,
+                      char               * a_topic_ptr,
+                      size_t               a_topic_size,
+                      char               * a_msg_ptr,
+                      size_t               a_msg_size,
+                      uint8_t            * a_output_buffer_ptr,
+                      uint32_t             a_output_buffer_size);
+
+/**
+ * mqtt_publish_qos user API
+ *
+ * Publish with given quality of service. QoS 1 and 2 publishes are kept in the
+ * in-flight window until acknowledged, several can be unacknowledged at the same time.
+ * Topic and payload are referred, not copied: keep them valid until published_fptr.
+ *
+ * @param a_shared_ptr [in] client context.
+ * @param a_topic_ptr [in] topic (all values alloved = non chars).
+ * @param a_topic_size [in] size of topic.
+ * @param a_msg_ptr [in] pointer to data which shall be published.
+ * @param a_msg_size [in] size of data to be published.
+ * @param a_qos [in] quality of service @see MQTTQoSLevel_t.
+ * @param a_packet_id_ptr [out] packet identifier given to published_fptr, can be NULL.
+ * @return true when publish was sent. False also when window is full, @see mqtt_inflight_free.
+ */
+bool mqtt_publish_qos(MQTT_shared_data_t * a_shared_ptr,
+                      char               * a_topic_ptr,
+                      size_t               a_topic_size,
+                      char               * a_msg_ptr,
+                      size_t               a_msg_size,
+                      MQTTQoSLevel_t       a_qos,
+                      uint16_t           * a_packet_id_ptr);
+
+/**
+ * mqtt_inflight_init user API
+ *
+ * Initialize in-flight window on user given entry table.
+ *
+ * @param a_window_ptr [in] window to initialize.
+ * @param a_entries_ptr [in] entry table, one entry for each unacknowledged publish.
+ * @param a_entry_cnt [in] amount of entries = max unacknowledged publishes.
+ * @param a_retry_in_ms [in] retransmit timeout, 0 = only when window is attached again.
+ * @param a_published_fptr [in] @see published_fptr_t, can be NULL.
+ * @return true when window was initialized.
+ */
+bool mqtt_inflight_init(MQTT_inflight_window_t * a_window_ptr,
+                        MQTT_inflight_entry_t  * a_entries_ptr,
+                        uint16_t                 a_entry_cnt,
+                        uint32_t                 a_retry_in_ms,
+                        published_fptr_t         a_published_fptr);
+
+/**
+ * mqtt_inflight_received_init user API
+ *
+ * Give table for packet identifiers of received QoS 2 publishes. Identifier is kept
+ * from PUBLISH until PUBREL, 2 bytes each. Without table received QoS 2 publishes
+ * are delivered at least once. When table is full, new QoS 2 publish is dropped
+ * without PUBREC and broker sends it again.
+ *
+ * @param a_window_ptr [in] initialized window.
+ * @param a_ids_ptr [in] table of packet identifiers.
+ * @param a_id_cnt [in] amount of identifiers = max QoS 2 publishes waiting PUBREL.
+ * @return true when table was set.
+ */
+bool mqtt_inflight_received_init(MQTT_inflight_window_t * a_window_ptr,
+                                 uint16_t               * a_ids_ptr,
+                                 uint16_t                 a_id_cnt);
+
+/**
+ * mqtt_inflight_window user API
+ *
+ * Attach in-flight window into client context. Initialization (mqtt_connect or
+ * ACTION_INIT) detaches it, window keeps its entries. When attached to a connected
+ * context, e.g. after reconnect, entries still waiting ack are sent again with DUP flag.
+ *
+ * @param a_shared_ptr [in] client context.
+ * @param a_window_ptr [in] initialized window, NULL detaches.
+ * @return true when window was attached (and pending entries sent).
+ */
+bool mqtt_inflight_window(MQTT_shared_data_t     * a_shared_ptr,
+                          MQTT_inflight_window_t * a_window_ptr);
+
+/**
+ * mqtt_inflight_free user API
+ *
+ * @param a_shared_ptr [in] client context.
+ * @return amount of free entries in the attached window, 0 without window.
+ */
+uint16_t mqtt_inflight_free(MQTT_shared_data_t * a_shared_ptr);
+
+/**
+ * mqtt_outbound_store user API
+ *
+ * Attach outbound store into client context. Initialization (mqtt_connect or
+ * ACTION_INIT) detaches it, messages stay in the store. When attached to a connected
+ * context stored messages are sent immediately. Stored message must fit into the
+ * shared buffer unless output vector is used.
+ *
+ * @param a_shared_ptr [in] client context.
+ * @param a_store_ptr [in] initialized store, NULL detaches.
+ * @return true when store was attached and, if connected, flushed.
+ */
+bool mqtt_outbound_store(MQTT_shared_data_t * a_shared_ptr,
+                         MQTT_store_t       * a_store_ptr);
+
+/**
+ * mqtt_store_ring_init user API
+ *
+ * Initialize RAM ring backend. Each message takes 6 bytes + topic + payload.
+ *
+ * @param a_ring_ptr [in] ring to initialize.
+ * @param a_buffer_ptr [in] ring memory.
+ * @param a_buffer_size [in] size of ring memory.
+ * @return true when ring was initialized.
  */
-bool mqtt_publish_buf(char    * a_topic_ptr,
-                      size_t    a_topic_size,
-                      char    * a_msg_ptr,
-                      size_t    a_msg_size,
-                      uint8_t * a_output_buffer_ptr,
-                      uint32_t  a_output_buffer_size);
+bool mqtt_store_ring_init(MQTT_store_ring_t * a_ring_ptr,
+                          uint8_t           * a_buffer_ptr,
+                          uint32_t            a_buffer_size);
+
+#ifdef BUILD_DEFAULT_C_LIBS
+/**
+ * mqtt_store_file_open user API
+ *
+ * Open or create file backend. Messages left in the file by previous process are
+ * kept, incomplete last message (crash while writing) is removed.
+ *
+ * @param a_file_store_ptr [in] store to open.
+ * @param a_path [in] file name.
+ * @param a_scratch_ptr [in] buffer where oldest message is read for sending.
+ * @param a_scratch_size [in] size of scratch buffer = max topic + payload size.
+ * @return true when store was opened.
+ */
+bool mqtt_store_file_open(MQTT_store_file_t * a_file_store_ptr,
+                          const char        * a_path,
+                          uint8_t           * a_scratch_ptr,
+                          uint32_t            a_scratch_size);
+
+/**
+ * mqtt_store_file_close user API
+ *
+ * @param a_file_store_ptr [in] store to close, messages stay in the file.
+ */
+void mqtt_store_file_close(MQTT_store_file_t * a_file_store_ptr);
+#endif /* BUILD_DEFAULT_C_LIBS */
+
+/**
+ * mqtt_topic_trie_init user API
+ *
+ * Initialize empty topic trie. Each registered filter level takes one node, levels
+ * shared with other filters are not duplicated.
+ *
+ * @param a_trie_ptr [in] trie to initialize.
+ * @param a_nodes_ptr [in] node pool.
+ * @param a_node_cnt [in] amount of nodes, root takes one.
+ * @return true when trie was initialized.
+ */
+bool mqtt_topic_trie_init(MQTT_topic_trie_t * a_trie_ptr,
+                          MQTT_topic_node_t * a_nodes_ptr,
+                          uint16_t            a_node_cnt);
+
+/**
+ * mqtt_topic_register user API
+ *
+ * Register handler for topic filter. Handler of already registered filter is replaced.
+ *
+ * @param a_trie_ptr [in] topic trie.
+ * @param a_filter_ptr [in] topic filter, + and # wildcards allowed. Not copied.
+ * @param a_filter_size [in] size of filter.
+ * @param a_handler_fptr [in] called for publish matching the filter, @see subscrbe_fptr_t.
+ * @return true when filter was valid and there were enough free nodes.
+ */
+bool mqtt_topic_register(MQTT_topic_trie_t * a_trie_ptr,
+                         const char        * a_filter_ptr,
+                         uint16_t            a_filter_size,
+                         subscrbe_fptr_t     a_handler_fptr);
+
+/**
+ * mqtt_topic_unregister user API
+ *
+ * Remove handler of topic filter. Nodes not needed by other filters are freed.
+ *
+ * @param a_trie_ptr [in] topic trie.
+ * @param a_filter_ptr [in] topic filter.
+ * @param a_filter_size [in] size of filter.
+ * @return true when filter was registered.
+ */
+bool mqtt_topic_unregister(MQTT_topic_trie_t * a_trie_ptr,
+                           const char        * a_filter_ptr,
+                           uint16_t            a_filter_size);
+
+/**
+ * mqtt_topic_dispatch user API
+ *
+ * Call handlers of all filters matching the topic. Used for received PUBLISH when trie
+ * is attached to the client context, can be called directly too.
+ *
+ * @param a_shared_ptr [in] client context given to the handlers.
+ * @param a_trie_ptr [in] topic trie.
+ * @param a_topic_ptr [in] topic name.
+ * @param a_topic_size [in] size of topic name.
+ * @param a_data_ptr [in] payload.
+ * @param a_data_size [in] size of payload.
+ * @return amount of called handlers.
+ */
+uint16_t mqtt_topic_dispatch(MQTT_shared_data_t * a_shared_ptr,
+                             MQTT_topic_trie_t  * a_trie_ptr,
+                             uint8_t            * a_topic_ptr,
+                             uint16_t             a_topic_size,
+                             uint8_t            * a_data_ptr,
+                             uint32_t             a_data_size);
+
+/**
+ * mqtt_topic_trie user API
+ *
+ * Attach topic trie into client context. Initialization (mqtt_connect or ACTION_INIT)
+ * detaches it, registered filters stay in the trie.
+ *
+ * @param a_shared_ptr [in] client context.
+ * @param a_trie_ptr [in] initialized trie, NULL detaches.
+ * @return true when trie was attached.
+ */
+bool mqtt_topic_trie(MQTT_shared_data_t * a_shared_ptr,
+                     MQTT_topic_trie_t  * a_trie_ptr);
+
+/**
+ * mqtt_subscribe_handler user API
+ *
+ * Register handler into attached topic trie and subscribe the filter, @see
+ * mqtt_subscribe. Handler is removed when subscribe fails.
+ *
+ * @param a_shared_ptr [in] client context with topic trie.
+ * @param a_topic [in] topic filter to be subscribed, must stay valid.
+ * @param a_topic_size [in] size of filter.
+ * @param a_handler_fptr [in] handler for publishes matching the filter.
+ * @param a_timeout_in_sec [in] timeout in seconds.
+ * @return true when subscribe succeeded.
+ */
+bool mqtt_subscribe_handler(MQTT_shared_data_t * a_shared_ptr,
+                            char               * a_topic,
+                            uint16_t             a_topic_size,
+                            subscrbe_fptr_t      a_handler_fptr,
+                            uint8_t              a_timeout_in_sec);
+
+/**
+ * mqtt_publish_begin user API
+ *
+ * Start chunked publish. Fixed header, topic and declared payload size are sent, the
+ * payload itself is given with mqtt_publish_append. Only header and topic must fit
+ * into the transmit buffer. Other messages (publish, subscribe, disconnect, ping) are
+ * refused until mqtt_publish_end.
+ *
+ * @param a_shared_ptr [in] client context.
+ * @param a_topic_ptr [in] topic (all values alloved = non chars).
+ * @param a_topic_size [in] size of topic.
+ * @param a_msg_size [in] total size of payload, max MQTT_MAX_MESSAGE_SIZE - topic.
+ * @return true when header was successfully formed and sent out.
+ */
+bool mqtt_publish_begin(MQTT_shared_data_t * a_shared_ptr,
+                        char               * a_topic_ptr,
+                        size_t               a_topic_size,
+                        uint32_t             a_msg_size);
+
+/**
+ * mqtt_publish_begin_qos user API
+ *
+ * Start chunked publish with given quality of service, @see mqtt_publish_begin.
+ * QoS 1 and 2 publishes take an entry of the in-flight window and are acknowledged
+ * like mqtt_publish_qos, but payload is not kept for retransmit: published_fptr is
+ * called with PayloadNotKept when the publish should be sent again.
+ *
+ * @param a_shared_ptr [in] client context.
+ * @param a_topic_ptr [in] topic, must stay valid until published_fptr.
+ * @param a_topic_size [in] size of topic.
+ * @param a_msg_size [in] total size of payload, max MQTT_MAX_MESSAGE_SIZE - topic.
+ * @param a_qos [in] quality of service @see MQTTQoSLevel_t.
+ * @param a_packet_id_ptr [out] packet identifier given to published_fptr, can be NULL.
+ * @return true when header was sent. False also when window is full.
+ */
+bool mqtt_publish_begin_qos(MQTT_shared_data_t * a_shared_ptr,
+                            char               * a_topic_ptr,
+                            size_t               a_topic_size,
+                            uint32_t             a_msg_size,
+                            MQTTQoSLevel_t       a_qos,
+                            uint16_t           * a_packet_id_ptr);
+
+/**
+ * mqtt_publish_append user API
+ *
+ * Send next payload chunk of the started publish. Chunk is given to out_fptr as such,
+ * it is not copied. In case of failure the stream is broken and connection shall be
+ * closed.
+ *
+ * @param a_shared_ptr [in] client context.
+ * @param a_msg_ptr [in] payload chunk.
+ * @param a_msg_size [in] size of the chunk, any size up to the payload left.
+ * @return true when chunk was sent out.
+ */
+bool mqtt_publish_append(MQTT_shared_data_t * a_shared_ptr,
+                         char               * a_msg_ptr,
+                         size_t               a_msg_size);
+
+/**
+ * mqtt_publish_end user API
+ *
+ * End chunked publish. Fails when declared payload is not sent yet, stream is then
+ * kept open so that rest can still be appended.
+ *
+ * @param a_shared_ptr [in] client context.
+ * @return true when all payload was sent and stream was closed.
+ */
+bool mqtt_publish_end(MQTT_shared_data_t * a_shared_ptr);
+
+/**
+ * mqtt_publish_prepare user API
+ *
+ * Encode topic and fixed header flags of a publish once, @see MQTT_prepared_publish_t.
+ * Topic is copied, it does not need to stay valid.
+ *
+ * @param a_prepared_ptr [out] prepared publish.
+ * @param a_buffer_ptr [in] buffer for the encoded header, must stay valid.
+ * @param a_buffer_size [in] size of buffer, MQTT_PREPARED_SIZE(a_topic_size) is enough.
+ * @param a_topic_ptr [in] topic.
+ * @param a_topic_size [in] size of topic.
+ * @param a_qos [in] quality of service @see MQTTQoSLevel_t.
+ * @param a_retain [in] retain bit.
+ * @return true when topic fits into the buffer.
+ */
+bool mqtt_publish_prepare(MQTT_prepared_publish_t * a_prepared_ptr,
+                          uint8_t                 * a_buffer_ptr,
+                          uint32_t                  a_buffer_size,
+                          char                    * a_topic_ptr,
+                          uint16_t                  a_topic_size,
+                          MQTTQoSLevel_t            a_qos,
+                          bool                      a_retain);
+
+/**
+ * mqtt_publish_prepared user API
+ *
+ * Publish message with prepared topic. With output vector (mqtt_output_vector) payload
+ * is not copied, otherwise header and payload are copied into the transmit buffer.
+ * QoS 0 message goes to outbound store like with mqtt_publish, QoS 1 and 2 to the
+ * in-flight window like with mqtt_publish_qos.
+ *
+ * @param a_shared_ptr [in] client context.
+ * @param a_prepared_ptr [in] prepared publish @see mqtt_publish_prepare.
+ * @param a_msg_ptr [in] payload.
+ * @param a_msg_size [in] size of payload.
+ * @param a_packet_id_ptr [out] packet identifier of QoS 1 and 2 publish, can be NULL.
+ * @return true when message was sent or stored.
+ */
+bool mqtt_publish_prepared(MQTT_shared_data_t      * a_shared_ptr,
+                           MQTT_prepared_publish_t * a_prepared_ptr,
+                           char                    * a_msg_ptr,
+                           size_t                    a_msg_size,
+                           uint16_t                * a_packet_id_ptr);
+
+/**
+ * mqtt_publish_queue_init user API
+ *
+ * Initialize publish queue on user given memory.
+ *
+ * @param a_queue_ptr [in] queue to initialize.
+ * @param a_slots_ptr [in] slot table.
+ * @param a_slot_cnt [in] amount of slots, power of two.
+ * @param a_data_ptr [in] packet memory, divided evenly between the slots.
+ * @param a_data_size [in] size of packet memory, @see MQTT_PUBLISH_QUEUE_SLOT.
+ * @return true when queue was initialized.
+ */
+bool mqtt_publish_queue_init(MQTT_publish_queue_t * a_queue_ptr,
+                             MQTT_publish_slot_t  * a_slots_ptr,
+                             uint32_t               a_slot_cnt,
+                             uint8_t              * a_data_ptr,
+                             size_t                 a_data_size);
+
+/**
+ * mqtt_publish_enqueue user API
+ *
+ * Encode QoS 0 publish into the queue. Can be called from many threads or tasks at
+ * the same time, it does not touch the client context and never blocks.
+ *
+ * @param a_queue_ptr [in] initialized queue.
+ * @param a_topic_ptr [in] topic.
+ * @param a_topic_size [in] size of topic.
+ * @param a_msg_ptr [in] payload.
+ * @param a_msg_size [in] size of payload.
+ * @param a_retain [in] retain flag.
+ * @return true when publish was queued, false when queue is full or it does not fit a slot.
+ */
+bool mqtt_publish_enqueue(MQTT_publish_queue_t * a_queue_ptr,
+                          const char           * a_topic_ptr,
+                          uint16_t               a_topic_size,
+                          const void           * a_msg_ptr,
+                          size_t                 a_msg_size,
+                          bool                   a_retain);
+
+/**
+ * mqtt_publish_queue_drain user API
+ *
+ * Send queued publishes in order. Call it only from the thread or task running the
+ * client. Output goes through coalescing when it is set. Nothing is sent while
+ * disconnected, publishes wait in the queue. Publish which could not be sent stays
+ * in the queue.
+ *
+ * @param a_shared_ptr [in] client context.
+ * @param a_queue_ptr [in] queue.
+ * @param a_max_cnt [in] max publishes sent, 0 = all queued.
+ * @return amount of publishes sent.
+ */
+uint32_t mqtt_publish_queue_drain(MQTT_shared_data_t   * a_shared_ptr,
+                                  MQTT_publish_queue_t * a_queue_ptr,
+                                  uint32_t               a_max_cnt);
 
 /**
  * mqtt_subscribe user API
  *
- * Subscribe given topic. Wait SUBACK from broker before returns.
+ * Subscribe given topic. Wait SUBACK from broker before returns, call is woken as soon
+ * as SUBACK is parsed. Without waiting result is given to subscribe callback.
  *
+ * @param a_shared_ptr [in] client context.
  * @param a_topic [in] topic to be subscribed.
  * @param a_topic_size [in] size of topic.
- * @param a_timeout_in_sec [in] timeout in seconds
+ * @param a_timeout_in_sec [in] timeout in seconds, 0 = do not wait SUBACK.
  * @return true when subscirbe succeeded.
  */
-bool mqtt_subscribe(char    * a_topic,
-                    uint16_t  a_topic_size,
-                    uint8_t   a_timeout_in_sec);
+bool mqtt_subscribe(MQTT_shared_data_t * a_shared_ptr,
+                    char               * a_topic,
+                    uint16_t             a_topic_size,
+                    uint8_t              a_timeout_in_sec);
+
+/**
+ * mqtt_subscribe_list user API
+ *
+ * Subscribe all given topic filters with one SUBSCRIBE packet, which must fit into the
+ * transmit buffer. Wait SUBACK from broker before returns. Input must be handled by
+ * another task (mqtt_receive) while waiting.
+ *
+ * @param a_shared_ptr [in] client context.
+ * @param a_topics_ptr [in] topic filters and requested QoS levels.
+ * @param a_topic_cnt [in] amount of filters.
+ * @param a_return_codes_ptr [out] a_topic_cnt return codes from SUBACK: granted QoS or
+ *                           MQTT_SUBACK_FAILURE. Can be NULL. Must stay valid until
+ *                           SUBACK is received when timeout is 0.
+ * @param a_timeout_in_sec [in] timeout in seconds, 0 = do not wait SUBACK.
+ * @return true when SUBSCRIBE was sent and, when waited, all filters were granted.
+ */
+bool mqtt_subscribe_list(MQTT_shared_data_t * a_shared_ptr,
+                         MQTT_subscribe_t   * a_topics_ptr,
+                         uint16_t             a_topic_cnt,
+                         uint8_t            * a_return_codes_ptr,
+                         uint8_t              a_timeout_in_sec);
+
+/**
+ * mqtt_unsubscribe user API
+ *
+ * Unsubscribe given topic. Wait UNSUBACK from broker before returns.
+ *
+ * @param a_shared_ptr [in] client context.
+ * @param a_topic [in] topic filter to be unsubscribed.
+ * @param a_topic_size [in] size of topic.
+ * @param a_timeout_in_sec [in] timeout in seconds, 0 = do not wait UNSUBACK.
+ * @return true when unsubscribe succeeded.
+ */
+bool mqtt_unsubscribe(MQTT_shared_data_t * a_shared_ptr,
+                      char               * a_topic,
+                      uint16_t             a_topic_size,
+                      uint8_t              a_timeout_in_sec);
+
+/**
+ * mqtt_unsubscribe_list user API
+ *
+ * Unsubscribe all given topic filters with one UNSUBSCRIBE packet, @see
+ * mqtt_subscribe_list. QoS of the filters is not used.
+ *
+ * @param a_shared_ptr [in] client context.
+ * @param a_topics_ptr [in] topic filters.
+ * @param a_topic_cnt [in] amount of filters.
+ * @param a_timeout_in_sec [in] timeout in seconds, 0 = do not wait UNSUBACK.
+ * @return true when UNSUBSCRIBE was sent and, when waited, acknowledged.
+ */
+bool mqtt_unsubscribe_list(MQTT_shared_data_t * a_shared_ptr,
+                           MQTT_subscribe_t   * a_topics_ptr,
+                           uint16_t             a_topic_cnt,
+                           uint8_t              a_timeout_in_sec);
 
 /**
  * mqtt_keepalive user API
  *
  * Call reqularly to check if keepalive must be sent.
  * Function will send keepalive to broker based on
- * mqtt_connect keepalive parameters.
+ * mqtt_connect keepalive parameters. Sends also staged
+ * packets older than the coalescing max delay.
  *
- * @param a_topic [in] topic to be subscribed.
- * @param a_topic_size [in] size of topic.
- * @param a_timeout_in_sec [in] timeout in seconds
+ * @param a_shared_ptr [in] client context.
+ * @param a_duration_in_ms [in] time elapsed since the previous call.
+ * @return true when mqtt_keepalive succeeded, false also when PINGRESP
+ *         did not arrive in time and the connection is lost.
+ */
+bool mqtt_keepalive(MQTT_shared_data_t * a_shared_ptr,
+                    uint32_t             a_duration_in_ms);
+
+/**
+ * mqtt_keepalive_poll user API
+ *
+ * Same as mqtt_keepalive, but elapsed time is read from the monotonic
+ * clock (mqtt_time_ms) instead of trusting the caller. Call regularly,
+ * more often than half of the keepalive.
+ *
+ * @param a_shared_ptr [in] client context.
  * @return true when mqtt_keepalive succeeded.
  */
-bool mqtt_keepalive(uint32_t a_duration_in_ms);
+bool mqtt_keepalive_poll(MQTT_shared_data_t * a_shared_ptr);
+
+/**
+ * mqtt_ping_timeout user API
+ *
+ * Set how long a sent PINGREQ waits its PINGRESP and the callback called
+ * when it does not arrive. Settings stay over ACTION_INIT.
+ *
+ * @param a_shared_ptr [in] client context.
+ * @param a_timeout_in_ms [in] response deadline, 0 = half of the keepalive.
+ * @param a_lost_fptr [in] connection lost callback, NULL = none.
+ * @return true when settings were taken in use.
+ */
+bool mqtt_ping_timeout(MQTT_shared_data_t   * a_shared_ptr,
+                       uint32_t               a_timeout_in_ms,
+                       connection_lost_fptr_t a_lost_fptr);
+
+/**
+ * mqtt_packet_view user API
+ *
+ * Decode one received packet without copying. Fixed header flags, remaining
+ * length and the variable header of the packet type are validated, views
+ * point into the given input. Runs in constant time, payload is not touched.
+ *
+ * @param a_input_ptr [in] first byte of the packet.
+ * @param a_input_size [in] bytes available in input, may hold more packets.
+ * @param a_view_ptr [out] decoded packet.
+ * @return Successfull, PacketIncomplete when more bytes are needed or
+ *         InvalidArgument when packet is malformed.
+ */
+MQTTErrorCodes_t mqtt_packet_view(uint8_t            * a_input_ptr,
+                                  uint32_t             a_input_size,
+                                  MQTT_packet_view_t * a_view_ptr);
+
+/**
+ * mqtt_receive_buffer user API
+ *
+ * Set buffer where packets split over several mqtt_receive calls are reassembled.
+ * Without the buffer only complete packets can be received.
+ *
+ * @param a_shared_ptr [in] client context.
+ * @param a_buffer_ptr [in] reassembly buffer (must be valid while connected).
+ * @param a_buffer_size [in] size of the buffer, limits the biggest split packet.
+ * @return true when buffer was taken into use.
+ */
+bool mqtt_receive_buffer(MQTT_shared_data_t * a_shared_ptr,
+                         uint8_t            * a_buffer_ptr,
+                         size_t               a_buffer_size);
+
+/**
+ * mqtt_receive_stream user API
+ *
+ * Receive PUBLISH messages in streaming mode: a_topic_fptr is called once the variable
+ * header is received, a_chunk_fptr for every part of payload as it arrives and
+ * a_complete_fptr when whole payload has been passed. Reassembly buffer needs to hold
+ * only the headers. Initialization (mqtt_connect or ACTION_INIT) clears the mode.
+ *
+ * @param a_shared_ptr [in] client context.
+ * @param a_topic_fptr [in] @see receive_topic_fptr_t, can be NULL.
+ * @param a_chunk_fptr [in] @see receive_chunk_fptr_t, NULL = use subscribe_cb_fptr.
+ * @param a_complete_fptr [in] @see receive_complete_fptr_t, can be NULL.
+ * @return true when mode was set.
+ */
+bool mqtt_receive_stream(MQTT_shared_data_t      * a_shared_ptr,
+                         receive_topic_fptr_t      a_topic_fptr,
+                         receive_chunk_fptr_t      a_chunk_fptr,
+                         receive_complete_fptr_t   a_complete_fptr);
+
+/**
+ * mqtt_output_vector user API
+ *
+ * Set scatter-gather output function. When set, PUBLISH topic and payload are not
+ * copied into the transmit buffer, buffer needs to hold only the header.
+ * Other messages are still sent with out_fptr. Initialization (mqtt_connect or
+ * ACTION_INIT) clears the function, so set it after that.
+ *
+ * @param a_shared_ptr [in] client context.
+ * @param a_outv_fptr [in] @see data_stream_outv_fptr_t, NULL = copy to the buffer.
+ * @return true when output function was set.
+ */
+bool mqtt_output_vector(MQTT_shared_data_t      * a_shared_ptr,
+                        data_stream_outv_fptr_t   a_outv_fptr);
+
+/**
+ * mqtt_output_coalesce user API
+ *
+ * Stage PUBLISH packets into a_buffer_ptr and send them together, @see
+ * MQTT_output_coalesce_t. Packet bigger than the buffer is sent directly after the
+ * staged ones. Staged packets older than the max delay are sent also by mqtt_keepalive,
+ * so call it often enough. Initialization (mqtt_connect or ACTION_INIT) drops staged
+ * packets and clears the buffer, so set it after that.
+ *
+ * @param a_shared_ptr [in] client context.
+ * @param a_buffer_ptr [in] staging buffer, NULL = off (staged packets are sent).
+ * @param a_buffer_size [in] size of the staging buffer.
+ * @param a_threshold [in] bytes sent at once, 0 = size of the buffer.
+ * @param a_max_delay_in_ms [in] max time a packet waits, 0 = send every packet directly.
+ * @return true when coalescing was set.
+ */
+bool mqtt_output_coalesce(MQTT_shared_data_t * a_shared_ptr,
+                          uint8_t            * a_buffer_ptr,
+                          size_t               a_buffer_size,
+                          uint32_t             a_threshold,
+                          uint32_t             a_max_delay_in_ms);
+
+/**
+ * mqtt_flush user API
+ *
+ * Send staged packets now, e.g. after a publish to a control topic.
+ *
+ * @param a_shared_ptr [in] client context.
+ * @return true when nothing was staged or staged packets were sent.
+ */
+bool mqtt_flush(MQTT_shared_data_t * a_shared_ptr);
+
+/**
+ * mqtt_receive_batch user API
+ *
+ * Parse every complete packet from the given buffer in order. Incomplete packet
+ * at the end of the buffer is left untouched, caller shall keep it and give it
+ * again together with the following data.
+ *
+ * @param a_shared_ptr [in] client context.
+ * @param a_data [in] beginning of received data, must start from a packet boundary.
+ * @param a_amount [in] amount received data.
+ * @param a_consumed_ptr [out] amount of bytes parsed = start of the incomplete tail.
+ * @return true when all complete packets were successfully interpreted.
+ */
+bool mqtt_receive_batch(MQTT_shared_data_t * a_shared_ptr,
+                        uint8_t            * a_data,
+                        size_t               a_amount,
+                        size_t             * a_consumed_ptr);
 
 /**
  * mqtt_receive user API
  *
- * Feed received MQTT message to this function.
- * The function will parce it for you.
+ * Feed received data to this function. Data can be any chunk of the input
+ * stream: partial packet, one packet or several packets. Every complete
+ * packet is parsed and dispatched to the callbacks.
  *
- * @param a_data [in] beginning of received MQTT message.
+ * @param a_shared_ptr [in] client context.
+ * @param a_data [in] beginning of received data.
  * @param a_amount [in] amount received data.
- * @return true when message successfully interpreted.
+ * @return true when all complete packets were successfully interpreted.
+ */
+bool mqtt_receive(MQTT_shared_data_t * a_shared_ptr,
+                  uint8_t            * a_data,
+                  size_t               a_amount);
+
+/**
+ * mqtt_instrumentation_snapshot user API
+ *
+ * Copy latency histograms and packet counters of the context. Call it from the thread
+ * running the client, or with the lock of the client held.
+ *
+ * @param a_shared_ptr [in] client context.
+ * @param a_snapshot_ptr [out] copy of the instrumentation data.
+ * @param a_reset [in] clear histograms and counters after copying.
+ * @return false when library is built without MQTT_INSTRUMENTATION.
+ */
+bool mqtt_instrumentation_snapshot(MQTT_shared_data_t     * a_shared_ptr,
+                                   MQTT_instrumentation_t * a_snapshot_ptr,
+                                   bool                     a_reset);
+
+/**
+ * mqtt_histogram_percentile user API
+ *
+ * @param a_histogram_ptr [in] histogram of a snapshot.
+ * @param a_permille [in] percentile in 1/1000, e.g. 990 = p99.
+ * @return upper bound of the bucket holding the percentile in us, 0 when histogram is empty.
+ */
+uint32_t mqtt_histogram_percentile(const MQTT_histogram_t * a_histogram_ptr,
+                                   uint16_t                 a_permille);
+
+/**
+ * mqtt_reconnect_init user API
+ *
+ * Initialize reconnect manager of the context. Transmit buffer, out_fptr and callbacks
+ * of the context are set by the caller, they are kept over the reconnects. So are
+ * outv_fptr, coalescing, framer buffer and streaming receive callbacks, only session
+ * state is reset before CONNECT. Publishes before accepted CONNACK go to the store. Clean
+ * session is cleared from the copied CONNECT parameters, so client id must be set.
+ * First attempt is made on the first mqtt_reconnect_tick call.
+ *
+ * @param a_reconnect_ptr [in] manager, must be valid while in use.
+ * @param a_shared_ptr [in] client context.
+ * @param a_connect_ptr [in] CONNECT parameters, strings must stay valid.
+ * @param a_open_fptr [in] @see reconnect_open_fptr_t.
+ * @param a_close_fptr [in] @see reconnect_close_fptr_t.
+ * @param a_event_fptr [in] @see reconnect_event_fptr_t, can be NULL.
+ * @param a_base_delay_in_ms [in] delay ceiling after the first failure.
+ * @param a_max_delay_in_ms [in] limit of the delay ceiling.
+ * @param a_seed [in] seed of the jitter, 0 = derived from client id and time.
+ * @return true when manager was initialized.
+ */
+bool mqtt_reconnect_init(MQTT_reconnect_t       * a_reconnect_ptr,
+                         MQTT_shared_data_t     * a_shared_ptr,
+                         MQTT_connect_t         * a_connect_ptr,
+                         reconnect_open_fptr_t    a_open_fptr,
+                         reconnect_close_fptr_t   a_close_fptr,
+                         reconnect_event_fptr_t   a_event_fptr,
+                         uint32_t                 a_base_delay_in_ms,
+                         uint32_t                 a_max_delay_in_ms,
+                         uint32_t                 a_seed);
+
+/**
+ * mqtt_reconnect_session user API
+ *
+ * Set session state restored on every connect. Topic trie and outbound store are
+ * attached before CONNECT: retained messages of the subscriptions reach the trie and
+ * publishes made while connecting queue behind the stored ones, which are sent after
+ * CONNACK. In-flight window is attached after CONNACK, unacknowledged publishes are sent
+ * again with DUP flag. Packet identifiers continue over the reconnects.
+ *
+ * @param a_reconnect_ptr [in] manager.
+ * @param a_subscribe_ptr [in] subscription table, NULL = none.
+ * @param a_birth_ptr [in] message published after subscriptions, NULL = none.
+ * @param a_window_ptr [in] in-flight window, NULL = none.
+ * @param a_store_ptr [in] outbound store, NULL = none.
+ * @param a_trie_ptr [in] topic trie, NULL = none.
+ * @return true when state was set.
+ */
+bool mqtt_reconnect_session(MQTT_reconnect_t       * a_reconnect_ptr,
+                            MQTT_subscribe_list_t  * a_subscribe_ptr,
+                            MQTT_publish_t         * a_birth_ptr,
+                            MQTT_inflight_window_t * a_window_ptr,
+                            MQTT_store_t           * a_store_ptr,
+                            MQTT_topic_trie_t      * a_trie_ptr);
+
+/**
+ * mqtt_reconnect_tick user API
+ *
+ * Drive the manager, call it periodically from the task running the client. Runs
+ * keepalive while online, so mqtt_keepalive shall not be called separately. Failed
+ * keepalive, refused or missing CONNACK and mqtt_reconnect_lost close the transport
+ * and schedule the next attempt.
+ *
+ * @param a_reconnect_ptr [in] manager.
+ * @param a_duration_in_ms [in] time elapsed since the previous call.
+ * @return true when session is online.
+ */
+bool mqtt_reconnect_tick(MQTT_reconnect_t * a_reconnect_ptr,
+                         uint32_t           a_duration_in_ms);
+
+/**
+ * mqtt_reconnect_lost user API
+ *
+ * Report lost transport, e.g. end of stream or receive error. Can be called from the
+ * task reading input, connection is closed on the next mqtt_reconnect_tick.
+ *
+ * @param a_reconnect_ptr [in] manager.
+ * @return None
  */
-bool mqtt_receive(uint8_t * a_data,
-                  size_t    a_amount);
+void mqtt_reconnect_lost(MQTT_reconnect_t * a_reconnect_ptr);
 
 #endif /* MQTT_H */
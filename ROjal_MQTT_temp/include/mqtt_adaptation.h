@@ -9,6 +9,10 @@
 #include <unistd.h>  // sleep
 #include <stdio.h>   // printf
 #include <string.h>  // memcpy, strlen
+#include <stdbool.h> // bool
+#include <stdint.h>  // uint32_t
+#include <pthread.h> // pthread_cond_t
+#include <time.h>    // clock_gettime
 
 /**
  * mqtt_printf
@@ -34,10 +38,130 @@
  */
 #define mqtt_memset memset
 
+/**
+ * mqtt_memcmp
+ *
+ * Compare two memory areas = memcmp.
+ *
+ */
+#define mqtt_memcmp memcmp
+
+/**
+ * mqtt_memmove
+ *
+ * Copy between overlapping memory areas = memmove.
+ *
+ */
+#define mqtt_memmove memmove
+
 #define mqtt_sleep sleep
 
+/**
+ * mqtt_sleep_ms
+ *
+ * Sleep given milliseconds.
+ *
+ */
+#define mqtt_sleep_ms(x) usleep((x) * 1000)
+
 #define mqtt_strlen strlen
 
+/**
+ * mqtt_time_us
+ *
+ * Monotonic time in microseconds, used for latency instrumentation. Value wraps
+ * around in 71 minutes, only differences of two values are meaningful.
+ */
+static inline uint32_t mqtt_time_us(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t)((uint64_t)now.tv_sec * 1000000u + (uint64_t)now.tv_nsec / 1000u);
+}
+
+/**
+ * mqtt_time_ms
+ *
+ * Monotonic time in milliseconds, used for keepalive deadlines. Value wraps around
+ * in 49 days, only differences of two values are meaningful.
+ */
+static inline uint32_t mqtt_time_ms(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t)((uint64_t)now.tv_sec * 1000u + (uint64_t)now.tv_nsec / 1000000u);
+}
+
+/**
+ * mqtt_completion_t
+ *
+ * Blocking call (mqtt_connect, mqtt_subscribe...) waits on this object until the reader
+ * parses the ack it waits. Object lives in stack of the waiting call, pointer to it is
+ * read and written only while holding the completion lock of the context.
+ *
+ * mqtt_completion_lock_t is part of every context, sessions do not share it. It is
+ * initialized by ACTION_INIT.
+ * Timeouts use CLOCK_MONOTONIC, changing the wall clock does not move them.
+ */
+typedef pthread_cond_t  mqtt_completion_t;
+typedef pthread_mutex_t mqtt_completion_lock_t;
+typedef struct timespec mqtt_completion_deadline_t;
+
+#define mqtt_completion_lock_init(l) pthread_mutex_init((l), NULL)
+#define mqtt_completion_lock(l)      pthread_mutex_lock(l)
+#define mqtt_completion_unlock(l)    pthread_mutex_unlock(l)
+#define mqtt_completion_init(c)      mqtt_completion_init_(c)
+#define mqtt_completion_destroy(c)   pthread_cond_destroy(c)
+#define mqtt_completion_signal(c)    pthread_cond_signal(c)
+
+static inline void mqtt_completion_init_(pthread_cond_t * a_cond_ptr)
+{
+    pthread_condattr_t attr;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(a_cond_ptr, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+/**
+ * mqtt_completion_deadline
+ *
+ * Absolute end of the wait, taken once before waiting so that wakes do not extend it.
+ */
+static inline void mqtt_completion_deadline(mqtt_completion_deadline_t * a_deadline_ptr,
+                                            uint32_t                     a_timeout_in_ms)
+{
+    clock_gettime(CLOCK_MONOTONIC, a_deadline_ptr);
+    a_deadline_ptr->tv_sec  += a_timeout_in_ms / 1000;
+    a_deadline_ptr->tv_nsec += (long)(a_timeout_in_ms % 1000) * 1000000L;
+    if (1000000000L <= a_deadline_ptr->tv_nsec) {
+        a_deadline_ptr->tv_sec++;
+        a_deadline_ptr->tv_nsec -= 1000000000L;
+    }
+}
+
+/**
+ * mqtt_completion_wait
+ *
+ * Called with the lock held, lock is released while waiting.
+ * Returns false when deadline passed without signal.
+ */
+#define mqtt_completion_wait(c, l, d) (0 == pthread_cond_timedwait((c), (l), (d)))
+
+/**
+ * mqtt_atomic_load, mqtt_atomic_store, mqtt_atomic_cas, mqtt_atomic_inc
+ *
+ * 32-bit atomics of the publish queue. Load acquires and store releases. Compare and
+ * swap sets *p to d when it equals *e, otherwise it copies the current value into *e.
+ */
+#define mqtt_atomic_load(p)      __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define mqtt_atomic_store(p, v)  __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define mqtt_atomic_cas(p, e, d) __atomic_compare_exchange_n((p), (e), (d), false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+#define mqtt_atomic_inc(p)       __atomic_fetch_add((p), 1, __ATOMIC_RELAXED)
+
 #endif /* BUILD_DEFAULT_C_LIBS */
 
 #ifdef BUILD_FREERTOS
@@ -103,11 +227,124 @@
  */
 #define mqtt_memset memset
 
+/**
+ * mqtt_memcmp
+ *
+ * Compare two memory areas = memcmp.
+ *
+ */
+#define mqtt_memcmp memcmp
+
+/**
+ * mqtt_memmove
+ *
+ * Copy between overlapping memory areas = memmove.
+ *
+ */
+#define mqtt_memmove memmove
+
 
 #define mqtt_sleep(x) vTaskDelay(x/portTICK_PERIOD_MS)
 
+#define mqtt_sleep_ms(x) vTaskDelay(pdMS_TO_TICKS(x))
+
 #define mqtt_strlen strlen
 
+/**
+ * mqtt_time_us
+ *
+ * Monotonic time in microseconds, resolution is one tick.
+ */
+#define mqtt_time_us() ((uint32_t)xTaskGetTickCount() * portTICK_PERIOD_MS * 1000u)
+
+/**
+ * mqtt_time_ms
+ *
+ * Monotonic time in milliseconds, resolution is one tick.
+ */
+#define mqtt_time_ms() ((uint32_t)xTaskGetTickCount() * portTICK_PERIOD_MS)
+
+/**
+ * mqtt_completion_t
+ *
+ * Task waiting the ack is woken with direct to task notification, reader task gives it.
+ * Lock is a critical section, mqtt_completion_lock_t only keeps the context layout.
+ */
+typedef TaskHandle_t mqtt_completion_t;
+typedef uint8_t      mqtt_completion_lock_t;
+
+typedef struct mqtt_completion_deadline
+{
+    TimeOut_t  start;                                 /* Time the wait started          */
+    TickType_t ticks_left;                            /* Updated by each check          */
+} mqtt_completion_deadline_t;
+
+#define mqtt_completion_lock_init(l) (void)(l)
+#define mqtt_completion_lock(l)      do { (void)(l); taskENTER_CRITICAL(); } while (0)
+#define mqtt_completion_unlock(l)    do { (void)(l); taskEXIT_CRITICAL(); } while (0)
+#define mqtt_completion_init(c)      do { *(c) = xTaskGetCurrentTaskHandle(); ulTaskNotifyTake(pdTRUE, 0); } while (0)
+#define mqtt_completion_destroy(c)   (void)(c)
+#define mqtt_completion_signal(c)    xTaskNotifyGive(*(c))
+
+static inline void mqtt_completion_deadline(mqtt_completion_deadline_t * a_deadline_ptr,
+                                            uint32_t                     a_timeout_in_ms)
+{
+    vTaskSetTimeOutState(&(a_deadline_ptr->start));
+    a_deadline_ptr->ticks_left = pdMS_TO_TICKS(a_timeout_in_ms);
+}
+
+/* Notification is kept until taken, leaving the critical section before waiting loses nothing */
+static inline bool mqtt_completion_wait(mqtt_completion_t          * a_completion_ptr,
+                                        mqtt_completion_lock_t     * a_lock_ptr,
+                                        mqtt_completion_deadline_t * a_deadline_ptr)
+{
+    uint32_t notified;
+
+    (void)a_completion_ptr;
+    (void)a_lock_ptr;
+    if (pdTRUE == xTaskCheckForTimeOut(&(a_deadline_ptr->start), &(a_deadline_ptr->ticks_left)))
+        return false;
+    taskEXIT_CRITICAL();
+    notified = ulTaskNotifyTake(pdTRUE, a_deadline_ptr->ticks_left);
+    taskENTER_CRITICAL();
+    return (0 != notified);
+}
+
+/**
+ * mqtt_atomic_load, mqtt_atomic_store, mqtt_atomic_cas, mqtt_atomic_inc
+ *
+ * 32-bit atomics of the publish queue. Kernel V9 has no atomic API, on single core
+ * ports a short critical section is the atomic operation and a compiler barrier.
+ */
+static inline uint32_t mqtt_atomic_load(volatile uint32_t * a_ptr)
+{
+    uint32_t value;
+
+    taskENTER_CRITICAL();
+    value = *a_ptr;
+    taskEXIT_CRITICAL();
+    return value;
+}
+
+#define mqtt_atomic_store(p, v) do { taskENTER_CRITICAL(); *(p) = (v); taskEXIT_CRITICAL(); } while (0)
+#define mqtt_atomic_inc(p)      do { taskENTER_CRITICAL(); (*(p))++;   taskEXIT_CRITICAL(); } while (0)
+
+static inline bool mqtt_atomic_cas(volatile uint32_t * a_ptr,
+                                   uint32_t          * a_expected_ptr,
+                                   uint32_t            a_desired)
+{
+    bool swapped;
+
+    taskENTER_CRITICAL();
+    swapped = (*a_ptr == *a_expected_ptr);
+    if (swapped)
+        *a_ptr = a_desired;
+    else
+        *a_expected_ptr = *a_ptr;
+    taskEXIT_CRITICAL();
+    return swapped;
+}
+
 #endif /* BUILD_FREERTOS */
 
 #endif
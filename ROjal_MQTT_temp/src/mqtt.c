@@ -25,8 +25,6 @@
 
 #include "mqtt.h"
 
-static MQTT_shared_data_t * g_shared_data = NULL;
-
 /************************************************************************************************************
  *                                                                                                          *
  * \subsection Internal Declaration of local functions                                                      *
@@ -38,21 +36,34 @@ static MQTT_shared_data_t * g_shared_data = NULL;
  *
  * Parse out connection status from connak message.
  *
+ * @param a_shared_ptr [in] client context, CONNECT is sent with its out_fptr.
  * @param a_message_buffer_ptr [out] allocated working space.
  * @param a_max_buffer_size [in] maximum size of the working space.
  * @param a_in_fptr [in] input stream callback function (receive).
- * @param a_out_fptr [in] output stream callback function (send).
  * @param a_connect_ptr [in] connection parameters @see MQTT_connect_t.
  * @param wait_and_parse_response [in] when true, function will wait connak response from the broker and parse it.
  * @return pointer to input buffer from where next header starts to. NULL in case of failure.
  */
-MQTTErrorCodes_t mqtt_connect_(uint8_t                * a_message_buffer_ptr,
+MQTTErrorCodes_t mqtt_connect_(MQTT_shared_data_t     * a_shared_ptr,
+                               uint8_t                * a_message_buffer_ptr,
                                size_t                   a_max_buffer_size,
                                data_stream_in_fptr_t    a_in_fptr,
-                               data_stream_out_fptr_t   a_out_fptr,
                                MQTT_connect_t         * a_connect_ptr,
                                bool                     wait_and_parse_response);
 
+/**
+ * Connect and send initial requests in one write.
+ *
+ * CONNECT, SUBSCRIBE and PUBLISH are encoded one after another into the transmit buffer
+ * (output gather) and given to out_fptr at once.
+ *
+ * @param a_shared_ptr [in] client context, disconnected.
+ * @param a_pipeline_ptr [in] connect parameters and requests @see MQTT_connect_pipeline_t.
+ * @return Successfull when all packets were sent, BufferOverflow when they do not fit.
+ */
+MQTTErrorCodes_t mqtt_connect_pipelined_(MQTT_shared_data_t      * a_shared_ptr,
+                                         MQTT_connect_pipeline_t * a_pipeline_ptr);
+
 /**
  * Fill connect parameters
  *
@@ -72,33 +83,103 @@ uint8_t * mqtt_connect_fill(uint8_t        * a_message_buffer_ptr,
 /**
  * Send MQTT disconnect.
  *
- * Send out MQTT disconnect message using the given callback.
+ * Send out MQTT disconnect message using the output callback of the context.
  *
- * @param a_out_fptr [in] output stream callback function.
+ * @param a_shared_ptr [in] client context.
  * @return error code @see MQTTErrorCodes_t.
  */
-MQTTErrorCodes_t mqtt_disconnect_(data_stream_out_fptr_t a_out_fptr);
+MQTTErrorCodes_t mqtt_disconnect_(MQTT_shared_data_t * a_shared_ptr);
 
 /**
  * Send PING request.
  *
  * Construct ping request by building fixed header and send data out by calling
- * given funciton pointer.
+ * output callback of the context.
  *
- * @param a_out_fptr [in] output stream callback function.
+ * @param a_shared_ptr [in] client context.
  * @return error code @see MQTTErrorCodes_t.
  */
-MQTTErrorCodes_t mqtt_ping_req(data_stream_out_fptr_t a_out_fptr);
+MQTTErrorCodes_t mqtt_ping_req(MQTT_shared_data_t * a_shared_ptr);
+
+/**
+ * PINGRESP deadline.
+ *
+ * Time a sent PINGREQ may wait its PINGRESP, configured timeout or half of
+ * the keepalive.
+ *
+ * @param a_shared_ptr [in] client context.
+ * @return deadline in milliseconds.
+ */
+uint32_t mqtt_ping_deadline(MQTT_shared_data_t * a_shared_ptr);
+
+/**
+ * Reset session state of the context.
+ *
+ * Connection, keepalive, framer and pending acks are cleared. Transport, callbacks,
+ * buffers and packet identifier counter set by the caller are kept.
+ *
+ * @param a_shared_ptr [in] client context.
+ * @return None
+ */
+void mqtt_session_reset(MQTT_shared_data_t * a_shared_ptr);
+
+/**
+ * Connection is lost.
+ *
+ * Move context to disconnected state and call connection lost callback.
+ *
+ * @param a_shared_ptr [in] client context.
+ * @param a_reason [in] why the connection was lost.
+ * @return a_reason.
+ */
+MQTTErrorCodes_t mqtt_connection_lost(MQTT_shared_data_t * a_shared_ptr,
+                                      MQTTErrorCodes_t     a_reason);
 
 /**
  * Validate connection response.
  *
- * Connect ack message is validated by this funciton.
+ * Connect ack message is validated by this funciton, @see mqtt_packet_view.
  *
  * @param a_message_in_ptr [in] start of MQTT message.
+ * @param a_input_size [in] amount of received bytes.
  * @return error code @see MQTTErrorCodes_t.
  */
-MQTTErrorCodes_t mqtt_connect_parse_ack(uint8_t * a_message_in_ptr);
+MQTTErrorCodes_t mqtt_connect_parse_ack(uint8_t  * a_message_in_ptr,
+                                        uint32_t   a_input_size);
+
+/**
+ * Size of encoded remaining length.
+ *
+ * @param a_value [in] remaining length, at most MQTT_MAX_MESSAGE_SIZE.
+ * @return 1-4 bytes.
+ */
+uint8_t mqtt_varint_size(uint32_t a_value);
+
+/**
+ * Encode remaining length.
+ *
+ * @param a_output_ptr [out] room for 4 bytes.
+ * @param a_value [in] remaining length.
+ * @return amount of bytes written, 0 when value is over MQTT_MAX_MESSAGE_SIZE.
+ */
+uint8_t mqtt_varint_encode(uint8_t  * a_output_ptr,
+                           uint32_t   a_value);
+
+/**
+ * Decode remaining length.
+ *
+ * Never reads over a_input_size, so it can be used on partial input of a framer.
+ *
+ * @param a_input_ptr [in] first byte of remaining length.
+ * @param a_input_size [in] bytes available.
+ * @param a_value_ptr [out] remaining length.
+ * @param a_size_ptr [out] bytes used, or bytes needed when input is incomplete.
+ * @return Successfull, PacketIncomplete or InvalidArgument (more than 4 bytes).
+ */
+MQTTErrorCodes_t mqtt_varint_decode(const uint8_t * a_input_ptr,
+                                    uint32_t        a_input_size,
+                                    uint32_t      * a_value_ptr,
+                                    uint8_t       * a_size_ptr);
 
 /**
  * Set size into fixed header.
@@ -119,6 +200,9 @@ uint32_t set_size(MQTT_fixed_header_t * a_output_ptr,
  * Destruct size based on formula presented in MQTT protocol specification:
  * @see http://docs.oasis-open.org/mqtt/mqtt/v3.1.1/os/mqtt-v3.1.1-os.pdf chapter 2.2.3.
  *
+ * Input is not bounded, whole MQTT_fixed_header_t must be readable. Use get_packet_size
+ * or mqtt_packet_view on received data.
+ *
  * @param a_input_ptr [in] pointer to start of received MQTT message.
  * @param a_message_size_ptr [out] remaining size of MQTT message will be written to here.
  * @return pointer to next header or NULL in case of failure.
@@ -126,6 +210,335 @@ uint32_t set_size(MQTT_fixed_header_t * a_output_ptr,
 uint8_t * get_size(uint8_t  * a_input_ptr,
                    uint32_t * a_message_size_ptr);
 
+/**
+ * Get size of a complete MQTT packet from partial input.
+ *
+ * Size is decoded from the remaining length field without reading over the given
+ * input size. Used by the input framer to find packet boundaries.
+ *
+ * @param a_input_ptr [in] pointer to start of MQTT packet.
+ * @param a_input_size [in] amount of bytes available in input.
+ * @param a_packet_size_ptr [out] size of the whole packet including fixed header.
+ * @return Successfull, PacketIncomplete when more bytes are needed or InvalidArgument.
+ */
+MQTTErrorCodes_t get_packet_size(uint8_t  * a_input_ptr,
+                                 uint32_t   a_input_size,
+                                 uint32_t * a_packet_size_ptr);
+
+/**
+ * Get size of PUBLISH headers collected by the framer in streaming receive.
+ *
+ * Size grows while headers are collected: first fixed header and topic length, then
+ * whole variable header once topic length is known.
+ *
+ * @param a_framer_ptr [in] framer with complete fixed header of a PUBLISH.
+ * @return amount of bytes to collect before payload, 0 in case of failure.
+ */
+uint32_t mqtt_stream_header_size(MQTT_input_framer_t * a_framer_ptr);
+
+/**
+ * Drop partially collected packet, reassembly buffer is kept.
+ *
+ * @param a_framer_ptr [in] framer of the context.
+ * @return None
+ */
+void mqtt_framer_reset(MQTT_input_framer_t * a_framer_ptr);
+
+/**
+ * Give next packet identifier.
+ *
+ * Zero and identifiers still in the in-flight window are skipped.
+ *
+ * @param a_shared_ptr [in] client context.
+ * @return packet identifier 1 - 65535.
+ */
+uint16_t mqtt_next_packet_id(MQTT_shared_data_t * a_shared_ptr);
+
+/**
+ * Encode and send acknowledgement: PUBACK, PUBREC, PUBREL or PUBCOMP.
+ * While payload of chunked publish is still expected the ack is held instead.
+ *
+ * @param a_shared_ptr [in] client context, message is sent out with its out_fptr.
+ * @param a_type [in] message type @see MQTTMessageType_t.
+ * @param a_packet_id [in] packet identifier to acknowledge.
+ * @return Successfull, InvalidArgument, BufferOverflow when too many acks are held or
+ *         ServerUnavailabe when sending failed.
+ */
+MQTTErrorCodes_t encode_ack(MQTT_shared_data_t * a_shared_ptr,
+                            MQTTMessageType_t    a_type,
+                            uint16_t             a_packet_id);
+
+/**
+ * Send acks held while payload of chunked publish was sent, in the order they were
+ * held.
+ *
+ * @param a_shared_ptr [in] client context.
+ */
+void mqtt_publish_stream_acks(MQTT_shared_data_t * a_shared_ptr);
+
+/**
+ * Find entry of the in-flight window.
+ *
+ * @param a_window_ptr [in] window, can be NULL.
+ * @param a_packet_id [in] packet identifier, 0 gives a free entry.
+ * @return entry or NULL when not found.
+ */
+MQTT_inflight_entry_t * mqtt_inflight_find(MQTT_inflight_window_t * a_window_ptr,
+                                           uint16_t                 a_packet_id);
+
+/**
+ * Reserve entry of the in-flight window for QoS 1 or 2 publish.
+ *
+ * Entry is reserved before sending, ack may be parsed before the send returns.
+ *
+ * @param a_shared_ptr [in] client context.
+ * @param a_publish_ptr [in] publish, topic and payload must stay valid until acknowledged.
+ * @param a_packet_id [in] packet identifier of the publish.
+ * @param a_entry_ptr [out] reserved entry, NULL when window is not attached.
+ * @return false when window is full.
+ */
+bool mqtt_inflight_reserve(MQTT_shared_data_t     *  a_shared_ptr,
+                           MQTT_publish_t         *  a_publish_ptr,
+                           uint16_t                  a_packet_id,
+                           MQTT_inflight_entry_t  ** a_entry_ptr);
+
+/**
+ * Send one entry of the in-flight window again, PUBLISH with DUP flag or PUBREL.
+ * Entry of chunked publish is released with PayloadNotKept instead.
+ * Retransmit timer of the entry restarts when it was sent.
+ *
+ * @param a_shared_ptr [in] client context.
+ * @param a_entry_ptr [in] used entry of the window.
+ * @return Successfull or status of the failed send.
+ */
+MQTTErrorCodes_t mqtt_inflight_resend_entry(MQTT_shared_data_t    * a_shared_ptr,
+                                            MQTT_inflight_entry_t * a_entry_ptr);
+
+/**
+ * Send all entries of the in-flight window again, used when window is attached after
+ * reconnect. @see mqtt_inflight_resend_entry.
+ *
+ * @param a_shared_ptr [in] client context.
+ * @return Successfull or status of the first failed send.
+ */
+MQTTErrorCodes_t mqtt_inflight_resend(MQTT_shared_data_t * a_shared_ptr);
+
+/**
+ * Run retransmit timers of the in-flight window, entries whose timer expired are sent
+ * again.
+ *
+ * @param a_shared_ptr [in] client context.
+ * @param a_elapsed_in_ms [in] time since previous call.
+ */
+void mqtt_inflight_tick(MQTT_shared_data_t * a_shared_ptr,
+                        uint32_t             a_elapsed_in_ms);
+
+/**
+ * Handle acknowledgement of sent publish.
+ *
+ * @param a_shared_ptr [in] client context.
+ * @param a_type [in] received message type @see MQTTMessageType_t.
+ * @param a_packet_id [in] acknowledged packet identifier.
+ * @return Successfull, InvalidArgument when packet identifier is unknown.
+ */
+MQTTErrorCodes_t mqtt_inflight_ack(MQTT_shared_data_t * a_shared_ptr,
+                                   MQTTMessageType_t    a_type,
+                                   uint16_t             a_packet_id);
+
+/**
+ * Decide delivery of received publish.
+ *
+ * Packet identifier of new QoS 2 publish is stored into received table of the window.
+ *
+ * @param a_shared_ptr [in] client context.
+ * @param a_qos [in] QoS of received publish.
+ * @param a_packet_id [in] packet identifier of received publish.
+ * @return Successfull = deliver, DuplicatePublish = only acknowledge again,
+ *         InflightWindowFull = drop without acknowledgement.
+ */
+MQTTErrorCodes_t mqtt_publish_accept(MQTT_shared_data_t * a_shared_ptr,
+                                     MQTTQoSLevel_t       a_qos,
+                                     uint16_t             a_packet_id);
+
+/**
+ * Release received QoS 2 publish and send PUBCOMP.
+ *
+ * @param a_shared_ptr [in] client context.
+ * @param a_packet_id [in] packet identifier of PUBREL.
+ * @return Successfull or status of sending PUBCOMP.
+ */
+MQTTErrorCodes_t mqtt_publish_release(MQTT_shared_data_t * a_shared_ptr,
+                                      uint16_t             a_packet_id);
+
+/**
+ * Send stored messages in order, each is removed when sent.
+ *
+ * @param a_shared_ptr [in] client context, accepted by broker and store attached.
+ * @param a_output_ptr [in] transmit buffer.
+ * @param a_output_size [in] size of the transmit buffer.
+ * @return Successfull when store is empty, NoConnection or ServerUnavailabe.
+ */
+MQTTErrorCodes_t mqtt_store_flush(MQTT_shared_data_t * a_shared_ptr,
+                                  uint8_t            * a_output_ptr,
+                                  uint32_t             a_output_size);
+
+/**
+ * RAM ring backend of the outbound store, @see store_put_fptr_t,
+ * store_peek_fptr_t and store_pop_fptr_t.
+ */
+bool mqtt_store_ring_put(MQTT_store_t * a_store_ptr,
+                         uint8_t      * a_topic_ptr,
+                         uint16_t       a_topic_length,
+                         uint8_t      * a_message_ptr,
+                         uint32_t       a_message_size);
+
+bool mqtt_store_ring_peek(MQTT_store_t  * a_store_ptr,
+                          uint8_t      ** a_topic_ptr,
+                          uint16_t      * a_topic_length_ptr,
+                          uint8_t      ** a_message_ptr,
+                          uint32_t      * a_message_size_ptr);
+
+bool mqtt_store_ring_pop(MQTT_store_t * a_store_ptr);
+
+/**
+ * Acknowledge received publish according to its QoS.
+ *
+ * @param a_shared_ptr [in] client context.
+ * @param a_qos [in] QoS of received publish.
+ * @param a_packet_id [in] packet identifier of received publish.
+ * @return Successfull or status of sending the acknowledgement.
+ */
+MQTTErrorCodes_t mqtt_publish_received(MQTT_shared_data_t * a_shared_ptr,
+                                       MQTTQoSLevel_t       a_qos,
+                                       uint16_t             a_packet_id);
+
+/**
+ * Complete awaited ack
+ *
+ * Set the status flag of the ack and wake the blocking call waiting it.
+ *
+ * @param a_shared_ptr [in] client context.
+ * @param a_status_ptr [in] connect_status or subscribe_status of the context.
+ * @return None
+ */
+void mqtt_complete(MQTT_shared_data_t * a_shared_ptr,
+                   volatile bool      * a_status_ptr);
+
+/**
+ * Wait awaited ack
+ *
+ * Blocking call sends its request between mqtt_complete_begin and mqtt_complete_wait.
+ * Waiting ends when the status flag is set by mqtt_complete or timeout expires.
+ *
+ * @param a_shared_ptr [in] client context.
+ * @param a_completion_ptr [in] completion in stack of the caller.
+ * @param a_status_ptr [in] connect_status or subscribe_status of the context.
+ * @param a_timeout_in_sec [in] timeout in seconds.
+ * @return true when the ack was received.
+ */
+void mqtt_complete_begin(MQTT_shared_data_t * a_shared_ptr,
+                         mqtt_completion_t  * a_completion_ptr);
+
+bool mqtt_complete_wait(MQTT_shared_data_t * a_shared_ptr,
+                        mqtt_completion_t  * a_completion_ptr,
+                        volatile bool      * a_status_ptr,
+                        uint8_t              a_timeout_in_sec);
+
+/**
+ * Send data with out_fptr of the context, sent packets are counted by their type.
+ *
+ * @param a_shared_ptr [in] client context.
+ * @param a_data_ptr [in] whole packet or its beginning.
+ * @param a_size [in] size of the data.
+ * @return return value of out_fptr.
+ */
+int mqtt_out(MQTT_shared_data_t * a_shared_ptr,
+             uint8_t            * a_data_ptr,
+             uint32_t             a_size);
+
+/**
+ * Send vector with outv_fptr of the context, first chunk begins with the fixed header.
+ *
+ * @param a_shared_ptr [in] client context.
+ * @param a_iov_ptr [in] chunks of the packet.
+ * @param a_iov_cnt [in] amount of chunks.
+ * @return return value of outv_fptr.
+ */
+int mqtt_outv(MQTT_shared_data_t * a_shared_ptr,
+              MQTT_iovec_t       * a_iov_ptr,
+              uint32_t             a_iov_cnt);
+
+/**
+ * Send staged packets with one out_fptr call. Staged packets are dropped also when
+ * sending fails, connection is broken then.
+ *
+ * @param a_shared_ptr [in] client context.
+ * @return true when nothing was staged or staged packets were sent.
+ */
+bool mqtt_coalesce_flush(MQTT_shared_data_t * a_shared_ptr);
+
+/**
+ * Send staged packets when the oldest one is older than the max delay.
+ *
+ * @param a_shared_ptr [in] client context.
+ * @return false when sending failed.
+ */
+bool mqtt_coalesce_tick(MQTT_shared_data_t * a_shared_ptr);
+
+#ifdef MQTT_INSTRUMENTATION
+/**
+ * Add one latency sample into histogram.
+ *
+ * @param a_histogram_ptr [in] histogram.
+ * @param a_value_in_us [in] latency.
+ */
+void mqtt_histogram_record(MQTT_histogram_t * a_histogram_ptr,
+                           uint32_t           a_value_in_us);
+
+/**
+ * Bucket index of a value, @see MQTT_histogram_t.
+ */
+uint16_t mqtt_histogram_bucket(uint32_t a_value_in_us);
+
+/**
+ * Record time since start into histogram and clear the start, nothing is done when
+ * start is 0 = request was not sent or it is acknowledged already.
+ *
+ * @param a_histogram_ptr [in] histogram.
+ * @param a_start_ptr [in] start time, 0 = not waiting.
+ */
+void mqtt_latency_stop(MQTT_histogram_t * a_histogram_ptr,
+                       uint32_t         * a_start_ptr);
+
+/**
+ * Count one packet, or only bytes when a_packets is 0.
+ */
+void mqtt_packet_count(MQTT_packet_counter_t * a_counters_ptr,
+                       uint8_t                 a_type,
+                       uint32_t                a_bytes,
+                       uint32_t                a_packets);
+
+/* Start time is never 0, it means "not waiting" */
+#define MQTT_LATENCY_START(s, f)   ((s)->instrumentation.f = (mqtt_time_us() | 1u))
+#define MQTT_LATENCY_STOP(s, f, h) mqtt_latency_stop(&((s)->instrumentation.histograms[h]), &((s)->instrumentation.f))
+#define MQTT_COUNT_IN(s, t, n)     mqtt_packet_count((s)->instrumentation.in, (uint8_t)(t), (n), 1)
+#define MQTT_COUNT_OUT(s, t, n, p) mqtt_packet_count((s)->instrumentation.out, (uint8_t)(t), (n), (p))
+#else
+#define MQTT_LATENCY_START(s, f)   do { } while (0)
+#define MQTT_LATENCY_STOP(s, f, h) do { } while (0)
+#define MQTT_COUNT_IN(s, t, n)     do { } while (0)
+#define MQTT_COUNT_OUT(s, t, n, p) do { } while (0)
+#endif
+
+/**
+ * Backoff delay of the next reconnect attempt, between half and whole of the ceiling
+ * min(max delay, base delay * 2^(attempts - 1)). Advances the jitter generator.
+ *
+ * @param a_reconnect_ptr [in] manager, attempts already counts the failed attempt.
+ * @return delay in ms.
+ */
+uint32_t mqtt_reconnect_delay(MQTT_reconnect_t * a_reconnect_ptr);
+
 
 /************************************************************************************************************
  *                                                                                                          *
@@ -138,7 +551,8 @@ uint8_t * get_size(uint8_t  * a_input_ptr,
  *
  * Fixed header flags, message type and size are set by
  * this function. Result is stored to pre-allocated
- * output buffer.
+ * output buffer. Input is not bounded, whole MQTT_fixed_header_t must
+ * be readable, @see get_size.
  *
  * @param a_input_ptr [in] point to first byte of received MQTT message.
  * @param a_dup_ptr [out] duplicate bit.
@@ -170,45 +584,68 @@ uint8_t * decode_variable_header_conack(uint8_t * a_input_ptr,
 /**
  * Decode variable header suback frame.
  *
- * Decode variable header suback frame which is received after subscribe command has been sent to
- * broker. Variable header contains subscribe status information for the subscribe request.
+ * Decode SUBACK or UNSUBACK which is received after subscribe or unsubscribe command has been
+ * sent to broker. Variable header contains packet identifier, SUBACK payload has one return
+ * code per topic filter of the request.
+ *
+ * @param a_input_ptr [in] point to first byte of variable header.
+ * @param a_message_size [in] size of variable header and payload.
+ * @param a_packet_id_ptr [out] packet identifier of acknowledged request.
+ * @param a_code_cnt_ptr [out] amount of return codes.
+ * @return pointer to first return code. NULL in case of failure.
+ */
+uint8_t * decode_variable_header_suback(uint8_t  * a_input_ptr,
+                                        uint32_t   a_message_size,
+                                        uint16_t * a_packet_id_ptr,
+                                        uint16_t * a_code_cnt_ptr);
+
+/**
+ * Handle SUBACK or UNSUBACK of pending request.
+ *
+ * Return codes are copied to the table of the request, result is stored and waiting
+ * mqtt_subscribe_list / mqtt_unsubscribe_list is released.
  *
+ * @param a_shared_ptr [in] client context.
+ * @param a_type [in] SUBACK or UNSUBACK.
  * @param a_input_ptr [in] point to first byte of variable header.
- * @param a_subscribe_state_ptr [out] Result of subscribe will be stored into this variable location.
+ * @param a_message_size [in] size of variable header and payload.
+ * @return Successfull when ack matched the pending request.
  */
-void decode_variable_header_suback(uint8_t          * a_input_ptr,
-                                   MQTTErrorCodes_t * a_subscribe_state_ptr);
+MQTTErrorCodes_t mqtt_subscribe_ack(MQTT_shared_data_t * a_shared_ptr,
+                                    MQTTMessageType_t    a_type,
+                                    uint8_t            * a_input_ptr,
+                                    uint32_t             a_message_size);
 
 /**
  * Decode variable header publish frame.
  *
- * Decode variable header suback frame from given input stream. Varialbe header contains
- * topic name, length and topic quality level, which are parsed out from the given byte stream.
+ * Variable header contains topic length, topic name and packet identifier on QoS 1 and 2.
+ * Topic and payload views point into the given input, they are checked against the size.
  *
  * @param a_input_ptr [in] point to first byte of variable header.
- * @param a_topic_out_ptr [out] this will point to location from where topic start on input stream.
- * @param a_qos [out] not used at this point, would contain QoS information of published message.
- * @param a_topic_length [out] topic length is written to to this parameter.
- * @return pointer to input buffer from where payload starts. NULL in case of failure.
+ * @param a_size [in] size of variable header and payload (remaining length).
+ * @param a_qos [in] QoS of the publish, from the fixed header.
+ * @param a_view_ptr [out] topic, packet_id and payload are written to here.
+ * @return Successfull or InvalidArgument when variable header does not fit into size.
  */
-uint8_t * decode_variable_header_publish(uint8_t        *  a_input_ptr,
-                                         uint8_t        ** a_topic_out_ptr,
-                                         MQTTQoSLevel_t    a_qos,
-                                         uint16_t       *  a_topic_length);
+MQTTErrorCodes_t mqtt_view_publish(uint8_t            * a_input_ptr,
+                                   uint32_t             a_size,
+                                   MQTTQoSLevel_t       a_qos,
+                                   MQTT_packet_view_t * a_view_ptr);
 
 /**
  * Decode complete publish message.
  *
- * Decode publish message using fixed header and variable header functions.
+ * Decode publish message starting from the variable header, @see mqtt_view_publish.
  *
  * @param a_message_in_ptr [in] pointer to variable header part of a MQTT publish message.
  * @param a_size_of_msg [in] size of message.
- * @param a_qos [out] not used at this point, would contain QoS information of published message.
+ * @param a_qos [in] QoS of the publish, from the fixed header.
  * @param a_topic_out_ptr [out] will point to beginning of topic in given input stream.
  * @param a_topic_length_out_ptr [out] topic length is written to to this parameter.
  * @param a_out_message_ptr [out] will point to beginning of payload in given input stream.
  * @param a_out_message_size_ptr [out] payload length is written to to this parameter.
- * @return pointer to input buffer from where payload starts. NULL in case of failure.
+ * @return true when publish was decoded, payload may be empty.
  */
 bool decode_publish(uint8_t        *  a_message_in_ptr,
                     uint32_t          a_size_of_msg,
@@ -260,7 +697,7 @@ uint8_t encode_variable_header_connect(uint8_t        * a_output_ptr,
  * @param a_topic_length [out] topic length is written to to this parameter.
  * @return pointer to input buffer from where payload starts. NULL in case of failure.
  */
-bool encode_publish(data_stream_out_fptr_t   a_out_fptr,
+bool encode_publish(MQTT_shared_data_t     * a_shared_ptr,
                     uint8_t                * a_output_ptr,
                     uint32_t                 a_output_size,
                     bool                     a_retain,
@@ -272,6 +709,60 @@ bool encode_publish(data_stream_out_fptr_t   a_out_fptr,
                     uint8_t                * message_ptr,
                     uint32_t                 message_size);
 
+/**
+ * Encode and send header of chunked publish.
+ *
+ * Fixed header carries the size of the whole message, but only header, topic and
+ * packet identifier are sent. Payload follows with encode_publish_append.
+ *
+ * @param a_shared_ptr [in] client context.
+ * @param a_output_ptr [in] transmit buffer, header and topic must fit into it.
+ * @param a_output_size [in] size of the transmit buffer.
+ * @param a_retain [in] retain bit.
+ * @param a_qos [in] quality of service @see MQTTQoSLevel_t.
+ * @param topic_ptr [in] topic.
+ * @param topic_size [in] size of topic.
+ * @param packet_identifier [in] packet identifier, used with QoS 1 and 2.
+ * @param message_size [in] total size of the payload which will follow.
+ * @return true when header was sent.
+ */
+bool encode_publish_begin(MQTT_shared_data_t     * a_shared_ptr,
+                          uint8_t                * a_output_ptr,
+                          uint32_t                 a_output_size,
+                          bool                     a_retain,
+                          MQTTQoSLevel_t           a_qos,
+                          uint8_t                * topic_ptr,
+                          uint16_t                 topic_size,
+                          uint16_t                 packet_identifier,
+                          uint32_t                 message_size);
+
+/**
+ * Send payload chunk of started publish.
+ *
+ * @param a_shared_ptr [in] client context.
+ * @param message_ptr [in] payload chunk.
+ * @param message_size [in] size of the chunk, at most payload left.
+ * @return Successfull, InvalidArgument or BufferOverflow (chunk over declared size).
+ */
+MQTTErrorCodes_t encode_publish_append(MQTT_shared_data_t * a_shared_ptr,
+                                       uint8_t            * message_ptr,
+                                       uint32_t             message_size);
+
+/**
+ * Send publish with prepared topic.
+ *
+ * Remaining length is written into the header room of the prepared buffer so that
+ * header, topic and packet identifier are one contiguous chunk.
+ *
+ * @param a_shared_ptr [in] client context.
+ * @param a_prepared_ptr [in] prepared publish with payload to send.
+ * @param packet_identifier [in] packet identifier, used with QoS 1 and 2.
+ * @return true when publish was sent.
+ */
+bool encode_publish_prepared(MQTT_shared_data_t      * a_shared_ptr,
+                             MQTT_prepared_publish_t * a_prepared_ptr,
+                             uint16_t                  packet_identifier);
+
  /**
  * Construct fixed header from given parameters.
  *
@@ -295,28 +786,27 @@ uint8_t encode_fixed_header(MQTT_fixed_header_t * a_output_ptr,
                             uint32_t              a_msgSize);
 
  /**
- * Construct fixed header from given parameters.
+ * Encode and send SUBSCRIBE or UNSUBSCRIBE message.
  *
- * Fixed header flags, message type and size are set by
- * this function. Result is stored to pre-allocated
+ * All topic filters are packed into one message. Result is stored to pre-allocated
  * output buffer.
  *
- * @param a_out_fptr [in] function pointer, which is called to send message out.
+ * @param a_shared_ptr [in] client context, message is sent out with its out_fptr.
  * @param a_output_ptr [out] ouptut buffer, where date is stored before sending (caller ensure validity).
  * @param a_output_size [in] maximum size of given output buffer.
- * @param a_topic_qos [in] QoS for the topic.
- * @param a_topic_ptr [in] poitner to topic.
- * @param a_topic_size [in] size of the topic.
+ * @param a_type [in] SUBSCRIBE or UNSUBSCRIBE.
+ * @param a_topics_ptr [in] topic filters, QoS is used only in SUBSCRIBE.
+ * @param a_topic_cnt [in] amount of topic filters.
  * @param a_packet_identifier [in] packet sequence number.
  * @return true or false
  */
-bool encode_subscribe(data_stream_out_fptr_t   a_out_fptr,
-                      uint8_t                * a_output_ptr,
-                      uint32_t                 a_output_size,
-                      MQTTQoSLevel_t           a_topic_qos,
-                      uint8_t                * a_topic_ptr,
-                      uint16_t                 a_topic_size,
-                      uint16_t                 a_packet_identifier);
+bool encode_subscribe_list(MQTT_shared_data_t     * a_shared_ptr,
+                           uint8_t                * a_output_ptr,
+                           uint32_t                 a_output_size,
+                           MQTTMessageType_t        a_type,
+                           MQTT_subscribe_t       * a_topics_ptr,
+                           uint16_t                 a_topic_cnt,
+                           uint16_t                 a_packet_identifier);
 
 
 /************************************************************************************************************
@@ -347,38 +837,110 @@ void hex_print(uint8_t * a_data_ptr, size_t a_size)
  * Get message size and set message size into fixed header                                                  *
  * @see http://docs.oasis-open.org/mqtt/mqtt/v3.1.1/os/mqtt-v3.1.1-os.pdf chapter 2.2.3                     *
  ************************************************************************************************************/
-uint32_t set_size(MQTT_fixed_header_t * a_output_ptr,
-                  size_t                a_message_size)
+/* Smallest value needing 2, 3 and 4 bytes */
+#define MQTT_VARINT_2 128
+#define MQTT_VARINT_3 16384
+#define MQTT_VARINT_4 2097152
+
+uint8_t mqtt_varint_size(uint32_t a_value)
 {
-    uint8_t return_value = 0;
-    if ((MQTT_MAX_MESSAGE_SIZE > a_message_size) && /* Message size in boundaries 0-max */
-        (NULL != a_output_ptr))                     /* Output pointer is not NULL       */
-    {
-        /* Construct size from MQTT message - see the spec.*/
-        do {
-            uint8_t encodedByte = a_message_size % 128;
-            a_message_size      = a_message_size / 128;
+    return (uint8_t)(1 + (MQTT_VARINT_2 <= a_value) + (MQTT_VARINT_3 <= a_value) + (MQTT_VARINT_4 <= a_value));
+}
 
-            if (a_message_size > 0)
-                encodedByte = encodedByte | 128;
+uint8_t mqtt_varint_encode(uint8_t  * a_output_ptr,
+                           uint32_t   a_value)
+{
+    /* Nearly all packets are short */
+    if (MQTT_VARINT_2 > a_value) {
+        a_output_ptr[0] = (uint8_t)a_value;
+        return 1;
+    }
 
-            a_output_ptr->length[return_value] = encodedByte;
-            return_value++;
-        } while (a_message_size > 0);
+    if (MQTT_VARINT_3 > a_value) {
+        a_output_ptr[0] = (uint8_t)(a_value | 0x80);
+        a_output_ptr[1] = (uint8_t)(a_value >> 7);
+        return 2;
+    }
 
-    } else {
+    if (MQTT_MAX_MESSAGE_SIZE < a_value)
         return 0;
+
+    uint8_t size = mqtt_varint_size(a_value);
+
+    a_output_ptr[0] = (uint8_t)(a_value | 0x80);
+    a_output_ptr[1] = (uint8_t)((a_value >> 7) | 0x80);
+    a_output_ptr[2] = (uint8_t)(a_value >> 14);
+    if (4 == size) {
+        a_output_ptr[2] |= 0x80;
+        a_output_ptr[3]  = (uint8_t)(a_value >> 21);
+    }
+    return size;
+}
+
+MQTTErrorCodes_t mqtt_varint_decode(const uint8_t * a_input_ptr,
+                                    uint32_t        a_input_size,
+                                    uint32_t      * a_value_ptr,
+                                    uint8_t       * a_size_ptr)
+{
+    if (1 > a_input_size) {
+        *a_size_ptr = 1;
+        return PacketIncomplete;
+    }
+
+    uint32_t value = a_input_ptr[0];
+    if (0 == (value & 0x80)) {
+        *a_value_ptr = value;
+        *a_size_ptr  = 1;
+        return Successfull;
+    }
+
+    if (2 > a_input_size) {
+        *a_size_ptr = 2;
+        return PacketIncomplete;
+    }
+
+    value = (value & 0x7F) | ((uint32_t)a_input_ptr[1] << 7);
+    if (0 == (a_input_ptr[1] & 0x80)) {
+        *a_value_ptr = value;
+        *a_size_ptr  = 2;
+        return Successfull;
+    }
+
+    /* Continuation bit of the previous byte is cleared by each step */
+    for (uint8_t i = 2; i < 4; i++) {
+        if (i >= a_input_size) {
+            *a_size_ptr = (uint8_t)(i + 1);
+            return PacketIncomplete;
+        }
+
+        value = (value & ~((uint32_t)0x80 << (7 * (i - 1)))) | ((uint32_t)a_input_ptr[i] << (7 * i));
+        if (0 == (a_input_ptr[i] & 0x80)) {
+            *a_value_ptr = value;
+            *a_size_ptr  = (uint8_t)(i + 1);
+            return Successfull;
+        }
     }
-    return return_value;
+
+    #ifdef DEBUG
+        mqtt_printf("%s %u Invalid remaining length\n", __FILE__, __LINE__);
+    #endif
+    return InvalidArgument;
+}
+
+uint32_t set_size(MQTT_fixed_header_t * a_output_ptr,
+                  size_t                a_message_size)
+{
+    if ((MQTT_MAX_MESSAGE_SIZE < a_message_size) || /* Message size in boundaries 0-max */
+        (NULL == a_output_ptr))                      /* Output pointer is not NULL       */
+        return 0;
+
+    return mqtt_varint_encode(a_output_ptr->length, (uint32_t)a_message_size);
 }
 
 uint8_t * get_size(uint8_t  * a_input_ptr,
                    uint32_t * a_message_size_ptr)
 {
-    uint32_t multiplier = 1;
-    uint32_t value      = 0;
-    uint8_t  cnt        = 1;
-    uint8_t  aByte      = 0;
+    uint8_t size;
 
     /* Verify input parameters */
     if ((NULL == a_input_ptr) ||
@@ -394,30 +956,32 @@ uint8_t * get_size(uint8_t  * a_input_ptr,
         return NULL;
     }
 
-    /* Construct size from MQTT message - see the spec link above*/
+    /* Whole fixed header is available, see the spec link above */
     *a_message_size_ptr = 0;
-    do {
-        aByte = a_input_ptr[cnt++];
-        value += ((aByte & 127) * multiplier);
-        if (multiplier > (128*128*128)){
-            #ifdef DEBUG
-                mqtt_printf("Message size is too big %s %i %u\n", __FILE__, __LINE__, value);
-            #endif
-            return NULL;
-        }
-        multiplier *= 128;
-    } while (0 != (aByte & 128));
-
-    /* Verify that size is supported by applicaiton */
-    if (MQTT_MAX_MESSAGE_SIZE < value) {
-        #ifdef DEBUG
-            mqtt_printf("%s %u Size is too big %u\n", __FILE__, __LINE__, value);
-        #endif
+    if (Successfull != mqtt_varint_decode(&(a_input_ptr[1]), 4, a_message_size_ptr, &size))
         return NULL;
-    }
 
-    *a_message_size_ptr = value;
-    return (a_input_ptr + cnt);
+    return (a_input_ptr + 1 + size);
+}
+
+MQTTErrorCodes_t get_packet_size(uint8_t  * a_input_ptr,
+                                 uint32_t   a_input_size,
+                                 uint32_t * a_packet_size_ptr)
+{
+    uint32_t value;
+    uint8_t  size;
+
+    if ((NULL == a_input_ptr) ||
+        (NULL == a_packet_size_ptr))
+        return InvalidArgument;
+
+    if (1 >= a_input_size)
+        return PacketIncomplete;
+
+    MQTTErrorCodes_t status = mqtt_varint_decode(&(a_input_ptr[1]), a_input_size - 1, &value, &size);
+    if (Successfull == status)
+        *a_packet_size_ptr = value + 1 + size;
+    return status;
 }
 
 /************************************************************************************************************
@@ -554,7 +1118,7 @@ uint8_t * decode_fixed_header(uint8_t           * a_input_ptr,
  * See <a href="http://docs.oasis-open.org/mqtt/mqtt/v3.1.1/os/mqtt-v3.1.1-os.pdf">Chapter 3.3 PUBLISH      *
  *                                                                                                          *
  ************************************************************************************************************/
-bool encode_publish(data_stream_out_fptr_t   a_out_fptr,
+bool encode_publish(MQTT_shared_data_t     * a_shared_ptr,
                     uint8_t                * a_output_ptr,
                     uint32_t                 a_output_size,
                     bool                     a_retain,
@@ -568,8 +1132,10 @@ bool encode_publish(data_stream_out_fptr_t   a_out_fptr,
 {
     bool ret = false;
 
-    if ((NULL != a_output_ptr) &&
-        (NULL != topic_ptr)    &&
+    if ((NULL != a_shared_ptr)           &&
+        (NULL != a_shared_ptr->out_fptr) &&
+        (NULL != a_output_ptr)           &&
+        (NULL != topic_ptr)              &&
         (NULL != message_ptr)  &&
         (sizeof(MQTT_fixed_header_t) < a_output_size)) { /* Buffer size is at least big enogh for header */
 
@@ -579,24 +1145,75 @@ bool encode_publish(data_stream_out_fptr_t   a_out_fptr,
             sizeOfMsg += sizeof(uint16_t);
 
         sizeOfMsg = encode_fixed_header((MQTT_fixed_header_t *) a_output_ptr,
-                                                                a_retain,
-                                                                a_qos,
                                                                 a_dup,
+                                                                a_qos,
+                                                                a_retain,
                                                                 PUBLISH,
                                                                 sizeOfMsg);
 
-        if ((0 < sizeOfMsg) &&
-            (sizeOfMsg < a_output_size)) { /* Output buffer is big enough */
+        uint32_t sizeOfHdr = sizeOfMsg + sizeof(uint16_t); /* Fixed header and topic size */
+        if (a_qos > QoS0)
+            sizeOfHdr += sizeof(uint16_t);
 
-            /* First 2 bytes are topic_size */
-            a_output_ptr[sizeOfMsg++] = ((topic_size >> 8) & 0xFF);
-            a_output_ptr[sizeOfMsg++] = ((topic_size >> 0) & 0xFF);
+        if ((0    < sizeOfMsg) &&
+            (NULL != a_shared_ptr->outv_fptr)) {
 
-            /* Copy topic name */
-            mqtt_memcpy((void*)&(a_output_ptr[sizeOfMsg]), topic_ptr, topic_size);
-            sizeOfMsg += topic_size;
+            if (sizeOfHdr <= a_output_size) { /* Only header is stored into the buffer */
+                MQTT_iovec_t iov[MQTT_OUTPUT_VECTOR_MAX];
+                uint32_t     iov_cnt = 0;
 
-            if (a_qos > QoS0) {
+                a_output_ptr[sizeOfMsg++] = ((topic_size >> 8) & 0xFF);
+                a_output_ptr[sizeOfMsg++] = ((topic_size >> 0) & 0xFF);
+
+                iov[iov_cnt].data   = a_output_ptr;
+                iov[iov_cnt++].size = sizeOfMsg;
+                iov[iov_cnt].data   = topic_ptr;
+                iov[iov_cnt++].size = topic_size;
+
+                if (a_qos > QoS0) {
+                    /* Packet identifier follows the topic */
+                    a_output_ptr[sizeOfMsg]     = (uint8_t)((packet_identifier >> 8) & 0xFF);
+                    a_output_ptr[sizeOfMsg + 1] = (uint8_t)((packet_identifier >> 0) & 0xFF);
+
+                    iov[iov_cnt].data   = &(a_output_ptr[sizeOfMsg]);
+                    iov[iov_cnt++].size = sizeof(uint16_t);
+                    sizeOfMsg += sizeof(uint16_t);
+                }
+
+                iov[iov_cnt].data   = message_ptr;
+                iov[iov_cnt++].size = message_size;
+                sizeOfMsg += topic_size + message_size;
+
+                if (mqtt_outv(a_shared_ptr, iov, iov_cnt) == (int)sizeOfMsg)
+                    ret = true;
+                #ifdef DEBUG
+                    else
+                        mqtt_printf("%s %u Sending publish vector failed %u",
+                                    __FILE__,
+                                    __LINE__,
+                                    sizeOfMsg);
+                #endif
+            }
+            #ifdef DEBUG
+                else {
+                    mqtt_printf("%s %u Header does not fit %u\n",
+                                __FILE__,
+                                __LINE__,
+                                sizeOfHdr);
+                }
+            #endif
+        } else if ((0 < sizeOfMsg) &&
+                   ((sizeOfHdr + topic_size + message_size) <= a_output_size)) { /* Output buffer is big enough */
+
+            /* First 2 bytes are topic_size */
+            a_output_ptr[sizeOfMsg++] = ((topic_size >> 8) & 0xFF);
+            a_output_ptr[sizeOfMsg++] = ((topic_size >> 0) & 0xFF);
+
+            /* Copy topic name */
+            mqtt_memcpy((void*)&(a_output_ptr[sizeOfMsg]), topic_ptr, topic_size);
+            sizeOfMsg += topic_size;
+
+            if (a_qos > QoS0) {
                 /* Copy packet identifier - valid only in QoS 1 and 2 levels */
                 a_output_ptr[sizeOfMsg++] = (uint8_t)((packet_identifier >> 8) & 0xFF);
                 a_output_ptr[sizeOfMsg++] = (uint8_t)((packet_identifier >> 0) & 0xFF);
@@ -607,7 +1224,7 @@ bool encode_publish(data_stream_out_fptr_t   a_out_fptr,
             sizeOfMsg +=message_size;
 
             // Send CONNECT message to the broker without flags
-            if (a_out_fptr(a_output_ptr, sizeOfMsg) == (int)sizeOfMsg)
+            if (mqtt_out(a_shared_ptr, a_output_ptr, sizeOfMsg) == (int)sizeOfMsg)
                 ret = true;
             #ifdef DEBUG
                 else
@@ -619,7 +1236,7 @@ bool encode_publish(data_stream_out_fptr_t   a_out_fptr,
         }
         #ifdef DEBUG
             else {
-                mqtt_printf("%s %u Fixed header failed ",
+                mqtt_printf("%s %u Fixed header failed or message does not fit\n",
                             __FILE__,
                             __LINE__);
             }
@@ -637,181 +1254,441 @@ bool encode_publish(data_stream_out_fptr_t   a_out_fptr,
     return ret;
 }
 
-/************************************************************************************************************
- *                                                                                                          *
- * \subsection DecodePublish Decode publish message                                                         *
- *                                                                                                          *
- * Decode publish message from from input stream starting from variable header.                             *
- * See <a href="http://docs.oasis-open.org/mqtt/mqtt/v3.1.1/os/mqtt-v3.1.1-os.pdf">Chapter 3.3 PUBLISH      *
- *                                                                                                          *
- ************************************************************************************************************/
-bool decode_publish(uint8_t         * a_message_in_ptr,
-                    uint32_t          a_size_of_msg,
-                    MQTTQoSLevel_t    a_qos,
-                    uint8_t        ** a_topic_out_ptr,
-                    uint16_t        * a_topic_length_out_ptr,
-                    uint8_t        ** a_out_message_ptr,
-                    uint32_t        * a_out_message_size_ptr)
+bool encode_publish_begin(MQTT_shared_data_t     * a_shared_ptr,
+                          uint8_t                * a_output_ptr,
+                          uint32_t                 a_output_size,
+                          bool                     a_retain,
+                          MQTTQoSLevel_t           a_qos,
+                          uint8_t                * topic_ptr,
+                          uint16_t                 topic_size,
+                          uint16_t                 packet_identifier,
+                          uint32_t                 message_size)
 {
     bool ret = false;
 
-    if ((NULL != a_message_in_ptr)       &&
-        (NULL != a_topic_out_ptr)        &&
-        (NULL != a_topic_length_out_ptr)) {
+    if ((NULL != a_shared_ptr)           &&
+        (NULL != a_shared_ptr->out_fptr) &&
+        (NULL != a_output_ptr)           &&
+        (NULL != topic_ptr)              &&
+        (sizeof(MQTT_fixed_header_t) < a_output_size)) {
+
+        uint32_t sizeOfVarHdr = topic_size + sizeof(uint16_t);
+
+        if (a_qos > QoS0) /* If QoS set, then additional space is required */
+            sizeOfVarHdr += sizeof(uint16_t);
+
+        /* Remaining length must stay in boundaries with the payload */
+        if (message_size > (MQTT_MAX_MESSAGE_SIZE - sizeOfVarHdr))
+            return false;
+
+        uint32_t sizeOfMsg = encode_fixed_header((MQTT_fixed_header_t *) a_output_ptr,
+                                                 false,
+                                                 a_qos,
+                                                 a_retain,
+                                                 PUBLISH,
+                                                 sizeOfVarHdr + message_size);
+
+        if ((0 < sizeOfMsg) &&
+            ((sizeOfMsg + sizeOfVarHdr) <= a_output_size)) { /* Header and topic fit */
 
-        /* Decode variable header = topic name and length - read topic out and get pointer to payload */
-        uint8_t * payload = decode_variable_header_publish(a_message_in_ptr,
-                                                           a_topic_out_ptr,
-                                                           a_qos,
-                                                           a_topic_length_out_ptr);
+            a_output_ptr[sizeOfMsg++] = ((topic_size >> 8) & 0xFF);
+            a_output_ptr[sizeOfMsg++] = ((topic_size >> 0) & 0xFF);
 
-        if ((NULL != payload)                   &&
-            (NULL != *a_topic_out_ptr)          &&
-            (NULL != a_out_message_size_ptr)    &&
-            (0     < (*a_topic_length_out_ptr)) &&
-            (NULL != a_out_message_ptr)) {
+            mqtt_memcpy((void*)&(a_output_ptr[sizeOfMsg]), topic_ptr, topic_size);
+            sizeOfMsg += topic_size;
 
-            /* Count ant store message size */
-            uint32_t header_size = (payload - a_message_in_ptr);
+            if (a_qos > QoS0) {
+                a_output_ptr[sizeOfMsg++] = (uint8_t)((packet_identifier >> 8) & 0xFF);
+                a_output_ptr[sizeOfMsg++] = (uint8_t)((packet_identifier >> 0) & 0xFF);
+            }
 
-            if (header_size < a_size_of_msg) {
-                *a_out_message_size_ptr = a_size_of_msg - header_size;
-                *a_out_message_ptr      = payload;
+            if (mqtt_out(a_shared_ptr, a_output_ptr, sizeOfMsg) == (int)sizeOfMsg) {
+                a_shared_ptr->publish_stream.open = true;
+                a_shared_ptr->publish_stream.left = message_size;
                 ret = true;
             }
             #ifdef DEBUG
-                else {
-                    mqtt_printf("%s %u header size is bigger than reserved message size %u > %u\n",
+                else
+                    mqtt_printf("%s %u Sending publish header failed %u\n",
                                 __FILE__,
                                 __LINE__,
-                                header_size,
-                                a_size_of_msg);
-                }
+                                sizeOfMsg);
             #endif
         }
         #ifdef DEBUG
             else {
-                mqtt_printf("%s %u variable decode failed\n",
+                mqtt_printf("%s %u Fixed header failed or topic does not fit\n",
                             __FILE__,
                             __LINE__);
             }
         #endif
     }
-    #ifdef DEBUG
-        else {
-            mqtt_printf("%s %u Invalid argument given %p, %p, %p, %p\n",
+    return ret;
+}
+
+MQTTErrorCodes_t encode_publish_append(MQTT_shared_data_t * a_shared_ptr,
+                                       uint8_t            * message_ptr,
+                                       uint32_t             message_size)
+{
+    if ((NULL  == a_shared_ptr->out_fptr) ||
+        (false == a_shared_ptr->publish_stream.open) ||
+        ((NULL == message_ptr) && (0 < message_size)))
+        return InvalidArgument;
+
+    if (message_size > a_shared_ptr->publish_stream.left) {
+        #ifdef DEBUG
+            mqtt_printf("%s %u Chunk %u over declared size, left %u\n",
                         __FILE__,
                         __LINE__,
-                        a_message_in_ptr,
-                        a_message_in_ptr,
-                        a_topic_out_ptr,
-                        a_topic_length_out_ptr);
-        }
-    #endif
-    return ret;
+                        message_size,
+                        a_shared_ptr->publish_stream.left);
+        #endif
+        return BufferOverflow;
+    }
+
+    if (0 < message_size) {
+        /* Staged header goes first, chunk goes to the output as such, no copy */
+        if ((false == mqtt_coalesce_flush(a_shared_ptr)) ||
+            (a_shared_ptr->out_fptr(a_shared_ptr, message_ptr, message_size) != (int)message_size))
+            return InvalidArgument;
+
+        /* Packet is counted with its header, chunks add only bytes */
+        MQTT_COUNT_OUT(a_shared_ptr, PUBLISH, message_size, 0);
+
+        a_shared_ptr->publish_stream.left -= message_size;
+
+        /* Publish is complete on the wire, held acks may follow it */
+        if (0 == a_shared_ptr->publish_stream.left)
+            mqtt_publish_stream_acks(a_shared_ptr);
+    }
+    return Successfull;
 }
 
-uint8_t * decode_variable_header_publish(uint8_t         * a_input_ptr,
-                                         uint8_t        ** a_topic_out_ptr,
-                                         MQTTQoSLevel_t    a_qos,
-                                         uint16_t        * a_topic_length_out_ptr)
+bool encode_publish_prepared(MQTT_shared_data_t      * a_shared_ptr,
+                             MQTT_prepared_publish_t * a_prepared_ptr,
+                             uint16_t                  packet_identifier)
 {
-    uint8_t * next_hdr = NULL;
+    if ((NULL == a_shared_ptr->out_fptr)     ||
+        (NULL == a_prepared_ptr->buffer)     ||
+        ((NULL == a_prepared_ptr->message_ptr) && (0 < a_prepared_ptr->message_size)))
+        return false;
+
+    uint8_t  * buffer       = a_prepared_ptr->buffer;
+    uint32_t   sizeOfVarHdr = a_prepared_ptr->topic_length + sizeof(uint16_t);
+
+    if (a_prepared_ptr->qos > QoS0) {
+        buffer[MQTT_PREPARED_HEADER_ROOM + sizeOfVarHdr]     = (uint8_t)((packet_identifier >> 8) & 0xFF);
+        buffer[MQTT_PREPARED_HEADER_ROOM + sizeOfVarHdr + 1] = (uint8_t)((packet_identifier >> 0) & 0xFF);
+        sizeOfVarHdr += sizeof(uint16_t);
+    }
 
-    if ((NULL != a_input_ptr)            &&
-        (NULL != a_topic_length_out_ptr) &&
-        (NULL != a_topic_out_ptr)) {
+    if (a_prepared_ptr->message_size > (MQTT_MAX_MESSAGE_SIZE - sizeOfVarHdr))
+        return false;
 
-        uint32_t index = 0;
-        /* First 2 bytes are topic_size */
-        *a_topic_length_out_ptr  = (((uint16_t)(a_input_ptr[index++]) << 8) & 0xFF00); /* Higer byte */
-        *a_topic_length_out_ptr |= (((uint16_t)(a_input_ptr[index++]) << 0) & 0x00FF); /* Lower byte */
+    /* Remaining length is placed right before the topic length */
+    uint32_t remaining = sizeOfVarHdr + a_prepared_ptr->message_size;
+    uint32_t start     = MQTT_PREPARED_HEADER_ROOM - 1 - mqtt_varint_size(remaining);
 
-        printf("topic length %u\n", *a_topic_length_out_ptr);
+    buffer[start] = a_prepared_ptr->flags;
+    set_size((MQTT_fixed_header_t *) &(buffer[start]), remaining);
 
-        /* Set pointer to point beginning of topic - no copy, reuse existing buffer. */
-        *a_topic_out_ptr = &(a_input_ptr[index++]);
+    uint32_t sizeOfHdr = MQTT_PREPARED_HEADER_ROOM - start + sizeOfVarHdr;
+    uint32_t sizeOfMsg = sizeOfHdr + a_prepared_ptr->message_size;
 
-        index += *a_topic_length_out_ptr;
+    if (NULL != a_shared_ptr->outv_fptr) {
+        MQTT_iovec_t iov[2];
 
-        if (a_qos > QoS0)
-            /* Ignore 2 bytes packet identifiers - valid only in QoS 1 and 2 levels */
-            index += 2;
+        iov[0].data = &(buffer[start]);
+        iov[0].size = sizeOfHdr;
+        iov[1].data = a_prepared_ptr->message_ptr;
+        iov[1].size = a_prepared_ptr->message_size;
 
-        /* Set pointer to beginning of next header */
-        next_hdr = (uint8_t*)&(a_input_ptr[index-1]);
-    } else {
+        if (mqtt_outv(a_shared_ptr, iov, 2) == (int)sizeOfMsg)
+            return true;
+    } else if ((NULL      != a_shared_ptr->buffer) &&
+               (sizeOfMsg <= a_shared_ptr->buffer_size)) {
+
+        mqtt_memcpy(a_shared_ptr->buffer, &(buffer[start]), sizeOfHdr);
+        mqtt_memcpy(&(a_shared_ptr->buffer[sizeOfHdr]), a_prepared_ptr->message_ptr, a_prepared_ptr->message_size);
+
+        if (mqtt_out(a_shared_ptr, a_shared_ptr->buffer, sizeOfMsg) == (int)sizeOfMsg)
+            return true;
+    }
+
+    #ifdef DEBUG
+        mqtt_printf("%s %u Sending prepared publish failed %u\n", __FILE__, __LINE__, sizeOfMsg);
+    #endif
+    return false;
+}
+
+/************************************************************************************************************
+ *                                                                                                          *
+ * \subsection DecodePublish Decode publish message                                                         *
+ *                                                                                                          *
+ * Decode publish message from from input stream starting from variable header.                             *
+ * See <a href="http://docs.oasis-open.org/mqtt/mqtt/v3.1.1/os/mqtt-v3.1.1-os.pdf">Chapter 3.3 PUBLISH      *
+ *                                                                                                          *
+ ************************************************************************************************************/
+bool decode_publish(uint8_t         * a_message_in_ptr,
+                    uint32_t          a_size_of_msg,
+                    MQTTQoSLevel_t    a_qos,
+                    uint8_t        ** a_topic_out_ptr,
+                    uint16_t        * a_topic_length_out_ptr,
+                    uint8_t        ** a_out_message_ptr,
+                    uint32_t        * a_out_message_size_ptr)
+{
+    MQTT_packet_view_t view;
+
+    if ((NULL == a_message_in_ptr)       ||
+        (NULL == a_topic_out_ptr)        ||
+        (NULL == a_topic_length_out_ptr) ||
+        (NULL == a_out_message_ptr)      ||
+        (NULL == a_out_message_size_ptr)) {
         #ifdef DEBUG
-            mqtt_printf("%s %u NULL argument given %p\n",
+            mqtt_printf("%s %u Invalid argument given %p, %p, %p\n",
                         __FILE__,
                         __LINE__,
-                        a_input_ptr);
+                        a_message_in_ptr,
+                        a_topic_out_ptr,
+                        a_topic_length_out_ptr);
         #endif
-        return NULL;
+        return false;
+    }
+
+    if (Successfull != mqtt_view_publish(a_message_in_ptr, a_size_of_msg, a_qos, &view))
+        return false;
+
+    *a_topic_out_ptr        = view.topic.ptr;
+    *a_topic_length_out_ptr = (uint16_t)view.topic.len;
+    *a_out_message_ptr      = view.payload.ptr;
+    *a_out_message_size_ptr = view.payload.len;
+    return true;
+}
+
+/************************************************************************************************************
+ *                                                                                                           *
+ * \subsection PacketView Zero-copy packet view                                                              *
+ *                                                                                                           *
+ * Received packet is decoded into views of the receive buffer. Remaining length is checked against the      *
+ * available input and every field of the variable header against the remaining length, so malformed         *
+ * input from the network is rejected before any pointer to it is given out.                                 *
+ * See <a href="http://docs.oasis-open.org/mqtt/mqtt/v3.1.1/os/mqtt-v3.1.1-os.pdf">Chapter 2 MQTT Control    *
+ * Packet format</a>                                                                                         *
+ *                                                                                                           *
+ ************************************************************************************************************/
+MQTTErrorCodes_t mqtt_view_publish(uint8_t            * a_input_ptr,
+                                   uint32_t             a_size,
+                                   MQTTQoSLevel_t       a_qos,
+                                   MQTT_packet_view_t * a_view_ptr)
+{
+    if ((sizeof(uint16_t) > a_size) ||
+        (QoSInvalid <= a_qos))
+        return InvalidArgument;
+
+    /* First 2 bytes are topic length, topic is at least one character */
+    uint32_t topic_length = ((uint32_t)(a_input_ptr[0]) << 8) | a_input_ptr[1];
+    uint32_t header_size  = sizeof(uint16_t) + topic_length;
+
+    if (QoS0 < a_qos) /* Packet identifier on QoS 1 and 2 */
+        header_size += sizeof(uint16_t);
+
+    if ((0 == topic_length) ||
+        (header_size > a_size)) {
+        #ifdef DEBUG
+            mqtt_printf("%s %u Publish header %u does not fit %u\n", __FILE__, __LINE__, header_size, a_size);
+        #endif
+        return InvalidArgument;
+    }
+
+    a_view_ptr->topic.ptr = &(a_input_ptr[sizeof(uint16_t)]);
+    a_view_ptr->topic.len = topic_length;
+    a_view_ptr->packet_id = 0;
+
+    if (QoS0 < a_qos) {
+        a_view_ptr->packet_id = (uint16_t)((a_input_ptr[header_size - 2] << 8) | a_input_ptr[header_size - 1]);
+        if (0 == a_view_ptr->packet_id)
+            return InvalidArgument;
+    }
+
+    a_view_ptr->payload.ptr = &(a_input_ptr[header_size]);
+    a_view_ptr->payload.len = a_size - header_size;
+    return Successfull;
+}
+
+MQTTErrorCodes_t mqtt_packet_view(uint8_t            * a_input_ptr,
+                                  uint32_t             a_input_size,
+                                  MQTT_packet_view_t * a_view_ptr)
+{
+    uint32_t remaining;
+    uint8_t  size;
+
+    if ((NULL == a_input_ptr) ||
+        (NULL == a_view_ptr))
+        return InvalidArgument;
+
+    if (2 > a_input_size)
+        return PacketIncomplete;
+
+    MQTTErrorCodes_t status = mqtt_varint_decode(&(a_input_ptr[1]), a_input_size - 1, &remaining, &size);
+    if (Successfull != status)
+        return status;
+
+    uint32_t header_size = 1 + size;
+    if (remaining > (a_input_size - header_size))
+        return PacketIncomplete;
+
+    uint8_t flags = a_input_ptr[0] & 0x0F;
+
+    a_view_ptr->type        = (MQTTMessageType_t)(a_input_ptr[0] >> 4);
+    a_view_ptr->qos         = QoS0;
+    a_view_ptr->dup         = false;
+    a_view_ptr->retain      = false;
+    a_view_ptr->packet_id   = 0;
+    a_view_ptr->packet_size = header_size + remaining;
+    a_view_ptr->body.ptr    = &(a_input_ptr[header_size]);
+    a_view_ptr->body.len    = remaining;
+    a_view_ptr->topic.ptr   = NULL;
+    a_view_ptr->topic.len   = 0;
+    a_view_ptr->payload     = a_view_ptr->body;
+
+    /* Flags of other than PUBLISH are fixed, see chapter 2.2.2 */
+    switch (a_view_ptr->type)
+    {
+        case PUBLISH:
+            a_view_ptr->dup    = (0 != (flags & 0x08));
+            a_view_ptr->qos    = (MQTTQoSLevel_t)((flags >> 1) & 0x03);
+            a_view_ptr->retain = (0 != (flags & 0x01));
+            return mqtt_view_publish(a_view_ptr->body.ptr, remaining, a_view_ptr->qos, a_view_ptr);
+
+        case CONNACK:
+            return ((0 == flags) && (2 == remaining)) ? Successfull : InvalidArgument;
+
+        case PUBACK:
+        case PUBREC:
+        case PUBREL:
+        case PUBCOMP:
+        case UNSUBACK:
+            if ((((PUBREL == a_view_ptr->type) ? 0x02 : 0) != flags) ||
+                (sizeof(uint16_t) != remaining))
+                return InvalidArgument;
+            break;
+
+        case SUBSCRIBE:
+        case SUBACK:
+        case UNSUBSCRIBE:
+            if ((((SUBACK == a_view_ptr->type) ? 0 : 0x02) != flags) ||
+                (sizeof(uint16_t) >= remaining)) /* At least one filter or return code */
+                return InvalidArgument;
+            break;
+
+        case PINGREQ:
+        case PINGRESP:
+        case DISCONNECT:
+            return ((0 == flags) && (0 == remaining)) ? Successfull : InvalidArgument;
+
+        case CONNECT:
+            return (0 == flags) ? Successfull : InvalidArgument;
+
+        default:
+            return InvalidArgument;
     }
-    return next_hdr;
+
+    /* Packet identifier starts the variable header */
+    a_view_ptr->packet_id   = (uint16_t)((a_view_ptr->body.ptr[0] << 8) | a_view_ptr->body.ptr[1]);
+    a_view_ptr->payload.ptr = &(a_view_ptr->body.ptr[sizeof(uint16_t)]);
+    a_view_ptr->payload.len = remaining - sizeof(uint16_t);
+    return Successfull;
 }
 
 /************************************************************************************************************
  *                                                                                                          *
  * \subsection EncodeSubscribe Encode subscribe message                                                     *
  *                                                                                                          *
- * Form subscribe message from given input parameters.                                                      *
+ * Form subscribe or unsubscribe message from given input parameters. All topic filters go into one        *
+ * message, so any amount of filters is (un)subscribed with one round trip.                                *
  * See <a href="http://docs.oasis-open.org/mqtt/mqtt/v3.1.1/os/mqtt-v3.1.1-os.pdf">Chapter 3.8 SUBSCRIBE    *
+ * and 3.10 UNSUBSCRIBE</a>                                                                                 *
  *                                                                                                          *
  ************************************************************************************************************/
-bool encode_subscribe(data_stream_out_fptr_t   a_out_fptr,
-                      uint8_t                * a_output_ptr,
-                      uint32_t                 a_output_size,
-                      MQTTQoSLevel_t           a_topic_qos,
-                      uint8_t                * a_topic_ptr,
-                      uint16_t                 a_topic_size,
-                      uint16_t                 a_packet_identifier)
+bool encode_subscribe_list(MQTT_shared_data_t     * a_shared_ptr,
+                           uint8_t                * a_output_ptr,
+                           uint32_t                 a_output_size,
+                           MQTTMessageType_t        a_type,
+                           MQTT_subscribe_t       * a_topics_ptr,
+                           uint16_t                 a_topic_cnt,
+                           uint16_t                 a_packet_identifier)
 {
     bool ret = false;
 
-    if ((NULL != a_out_fptr)   &&
-        (NULL != a_output_ptr) &&
-        (NULL != a_topic_ptr)  &&
-        (a_topic_size < a_output_size)) {
-
-        /* topic string size + topic QoS + topic length + packet identifier. */
-        uint32_t sizeOfMsg =  a_topic_size + sizeof(uint8_t) + sizeof(uint16_t) + sizeof(uint16_t);
+    if ((NULL != a_shared_ptr)           &&
+        (NULL != a_shared_ptr->out_fptr) &&
+        (NULL != a_output_ptr)           &&
+        (NULL != a_topics_ptr)           &&
+        (0     < a_topic_cnt)            &&
+        ((SUBSCRIBE == a_type) || (UNSUBSCRIBE == a_type))) {
+
+        /* packet identifier + topic length and topic string (+ QoS) per topic. */
+        uint32_t sizeOfMsg = sizeof(uint16_t);
+
+        for (uint16_t i = 0; i < a_topic_cnt; i++) {
+            if ((NULL == a_topics_ptr[i].topic_ptr) ||
+                (0    == a_topics_ptr[i].topic_length) ||
+                (QoS2  < a_topics_ptr[i].qos))
+                return false;
+
+            sizeOfMsg += sizeof(uint16_t) + a_topics_ptr[i].topic_length;
+            if (SUBSCRIBE == a_type)
+                sizeOfMsg += sizeof(uint8_t);
+        }
 
-        if (a_topic_qos > QoS0) /* If QoS > 0, then next 2 bytes are packet identifier numbers. */
-            sizeOfMsg += sizeof(uint16_t);
+        /* Whole message must fit into the buffer, check before header is written */
+        if ((sizeOfMsg + sizeof(MQTT_fixed_header_t) + 3) > a_output_size) {
+            #ifdef DEBUG
+                mqtt_printf("%s %u Subscribe does not fit into the buffer %u > %u\n",
+                            __FILE__,
+                            __LINE__,
+                            sizeOfMsg,
+                            a_output_size);
+            #endif
+            return false;
+        }
 
-        /* In subscribe QoS must be 1 and rest remain zero */
+        /* In subscribe and unsubscribe QoS must be 1 and rest remain zero */
         sizeOfMsg = encode_fixed_header((MQTT_fixed_header_t *) a_output_ptr,
-                                        true,
-                                        QoS0,
                                         false,
-                                        SUBSCRIBE,
+                                        QoS1,
+                                        false,
+                                        a_type,
                                         sizeOfMsg);
 
         /* IF fixed header encode succeeded then parse reset of the message. */
-        if ((0 < sizeOfMsg) &&
-            (sizeOfMsg < a_output_size)) {
+        if (0 < sizeOfMsg) {
 
-            if (1 /*a_topic_qos > QoS0*/) {
-                /* Copy packet identifier - valid only in QoS 1 and 2 levels */
-                a_output_ptr[sizeOfMsg++] = (uint8_t)((a_packet_identifier >> 8) & 0xFF);
-                a_output_ptr[sizeOfMsg++] = (uint8_t)((a_packet_identifier >> 0) & 0xFF);
-            }
+            /* Copy packet identifier */
+            a_output_ptr[sizeOfMsg++] = (uint8_t)((a_packet_identifier >> 8) & 0xFF);
+            a_output_ptr[sizeOfMsg++] = (uint8_t)((a_packet_identifier >> 0) & 0xFF);
 
-            /* Copy topic length */
-            a_output_ptr[sizeOfMsg++] = (uint8_t)((a_topic_size >> 8) & 0xFF);
-            a_output_ptr[sizeOfMsg++] = (uint8_t)((a_topic_size >> 0) & 0xFF);
+            for (uint16_t i = 0; i < a_topic_cnt; i++) {
+                uint16_t topic_size = a_topics_ptr[i].topic_length;
 
-            /* Copy topic name */
-            mqtt_memcpy((void*)&(a_output_ptr[sizeOfMsg]), a_topic_ptr, a_topic_size);
-            sizeOfMsg += a_topic_size;
+                /* Copy topic length */
+                a_output_ptr[sizeOfMsg++] = (uint8_t)((topic_size >> 8) & 0xFF);
+                a_output_ptr[sizeOfMsg++] = (uint8_t)((topic_size >> 0) & 0xFF);
+
+                /* Copy topic name */
+                mqtt_memcpy((void*)&(a_output_ptr[sizeOfMsg]), a_topics_ptr[i].topic_ptr, topic_size);
+                sizeOfMsg += topic_size;
+
+                /* QoS for subscribe */
+                if (SUBSCRIBE == a_type)
+                    a_output_ptr[sizeOfMsg++] = a_topics_ptr[i].qos;
+            }
 
-            /* QoS for subscribe */
-            a_output_ptr[sizeOfMsg++] = a_topic_qos;
+            /* Ack may be parsed by other task before out returns */
+            MQTT_LATENCY_START(a_shared_ptr, subscribe_sent_in_us);
 
             /* Send SUBSCRIBE message */
-            if (a_out_fptr(a_output_ptr, sizeOfMsg) == (int)sizeOfMsg)
+            if (mqtt_out(a_shared_ptr, a_output_ptr, sizeOfMsg) == (int)sizeOfMsg)
                 ret = true;
             #ifdef DEBUG
                 else
@@ -831,11 +1708,11 @@ bool encode_subscribe(data_stream_out_fptr_t   a_out_fptr,
     }
     #ifdef DEBUG
         else {
-            mqtt_printf("%s %u Invalid argument given %p %s\n",
+            mqtt_printf("%s %u Invalid argument given %p %p\n",
                         __FILE__,
                         __LINE__,
                         a_output_ptr,
-                        a_topic_ptr);
+                        a_topics_ptr);
         }
     #endif
     return ret;
@@ -849,33 +1726,78 @@ bool encode_subscribe(data_stream_out_fptr_t   a_out_fptr,
  * See <a href="http://docs.oasis-open.org/mqtt/mqtt/v3.1.1/os/mqtt-v3.1.1-os.pdf">Chapter 3.9 SUBACK       *
  *                                                                                                          *
  ************************************************************************************************************/
-void decode_variable_header_suback(uint8_t          * a_input_ptr,
-                                   MQTTErrorCodes_t * a_subscribe_state_ptr)
+uint8_t * decode_variable_header_suback(uint8_t  * a_input_ptr,
+                                        uint32_t   a_message_size,
+                                        uint16_t * a_packet_id_ptr,
+                                        uint16_t * a_code_cnt_ptr)
 {
-    if (NULL != a_subscribe_state_ptr) {
-        *a_subscribe_state_ptr = -1;
-        if (NULL != a_input_ptr)
-        {
-            *a_subscribe_state_ptr = *(a_input_ptr + 4); /*5th byte contains return value  */
-        }
+    if ((NULL == a_input_ptr)     ||
+        (NULL == a_packet_id_ptr) ||
+        (NULL == a_code_cnt_ptr)  ||
+        (sizeof(uint16_t) > a_message_size)) {
         #ifdef DEBUG
-            else {
-                mqtt_printf("%s %u NULL argument given %p\n",
-                            __FILE__,
-                            __LINE__,
-                            a_input_ptr);
-            }
-        #endif
-        *a_subscribe_state_ptr = (*a_subscribe_state_ptr == 0x80); /* 0x80 = successfull */
-    }
-    #ifdef DEBUG
-        else {
-            mqtt_printf("%s %u NULL argument given %p\n",
+            mqtt_printf("%s %u Invalid SUBACK %p %u\n",
                         __FILE__,
                         __LINE__,
-                        a_subscribe_state_ptr);
-        }
-    #endif
+                        a_input_ptr,
+                        a_message_size);
+        #endif
+        return NULL;
+    }
+
+    *a_packet_id_ptr = (uint16_t)((a_input_ptr[0] << 8) | a_input_ptr[1]);
+    *a_code_cnt_ptr  = (uint16_t)(a_message_size - sizeof(uint16_t));
+    return &(a_input_ptr[sizeof(uint16_t)]);
+}
+
+MQTTErrorCodes_t mqtt_subscribe_ack(MQTT_shared_data_t * a_shared_ptr,
+                                    MQTTMessageType_t    a_type,
+                                    uint8_t            * a_input_ptr,
+                                    uint32_t             a_message_size)
+{
+    MQTT_subscribe_pending_t * pending = &(a_shared_ptr->subscribe_pending);
+    uint16_t                   packet_id;
+    uint16_t                   code_cnt;
+    uint8_t                  * codes_ptr = decode_variable_header_suback(a_input_ptr,
+                                                                         a_message_size,
+                                                                         &packet_id,
+                                                                         &code_cnt);
+
+    if ((NULL == codes_ptr) ||
+        ((SUBACK   == a_type) && (0 == code_cnt)) ||
+        ((UNSUBACK == a_type) && (0 != code_cnt)))
+        return InvalidArgument;
+
+    if ((0         == packet_id) ||
+        (packet_id != pending->packet_id)) {
+        #ifdef DEBUG
+            mqtt_printf("%s %u Unexpected ack for packet %u\n", __FILE__, __LINE__, packet_id);
+        #endif
+        return InvalidArgument;
+    }
+
+    MQTTErrorCodes_t result = Successfull;
+    for (uint16_t i = 0; i < code_cnt; i++) {
+        if (MQTT_SUBACK_FAILURE == codes_ptr[i])
+            result = NotAuthorized;
+        if ((NULL != pending->return_codes_ptr) &&
+            (i     < pending->return_code_cnt))
+            pending->return_codes_ptr[i] = codes_ptr[i];
+    }
+
+    pending->packet_id        = 0;
+    pending->return_codes_ptr = NULL;
+    pending->result           = result;
+
+    MQTT_LATENCY_STOP(a_shared_ptr, subscribe_sent_in_us, HISTOGRAM_SUBSCRIBE);
+
+    if ((SUBACK == a_type) &&
+        (NULL   != a_shared_ptr->subscribe_cb_fptr))
+        a_shared_ptr->subscribe_cb_fptr(a_shared_ptr, result, NULL, 0, NULL, 0);
+
+    /* Releases the waiting task, result must be set before */
+    mqtt_complete(a_shared_ptr, &(a_shared_ptr->subscribe_status));
+    return Successfull;
 }
 
 /************************************************************************************************************
@@ -924,15 +1846,16 @@ uint8_t * mqtt_add_payload_parameters(uint8_t * a_output_ptr,
  * See <a href="http://docs.oasis-open.org/mqtt/mqtt/v3.1.1/os/mqtt-v3.1.1-os.pdf">Chapter 3.1 CONNECT      *
  *                                                                                                          *
  ************************************************************************************************************/
-MQTTErrorCodes_t mqtt_connect_(uint8_t                * a_message_buffer_ptr,
+MQTTErrorCodes_t mqtt_connect_(MQTT_shared_data_t     * a_shared_ptr,
+                               uint8_t                * a_message_buffer_ptr,
                                size_t                   a_max_buffer_size,
                                data_stream_in_fptr_t    a_in_fptr,
-                               data_stream_out_fptr_t   a_out_fptr,
                                MQTT_connect_t         * a_connect_ptr,
                                bool                     wait_and_parse_response)
 {
     /* Ensure that pointers are valid */
-    if (NULL != a_out_fptr) {
+    if ((NULL != a_shared_ptr) &&
+        (NULL != a_shared_ptr->out_fptr)) {
 
         if ((NULL != a_message_buffer_ptr) &&
             (NULL != a_connect_ptr)) {
@@ -943,16 +1866,18 @@ MQTTErrorCodes_t mqtt_connect_(uint8_t                * a_message_buffer_ptr,
                                                   a_connect_ptr,
                                                   &msg_size);
             if (NULL != msg_ptr) {
+                MQTT_LATENCY_START(a_shared_ptr, connect_sent_in_us);
+
                 // Send CONNECT message to the broker without flags
-                if (a_out_fptr(msg_ptr, msg_size) == (int)msg_size)
+                if (mqtt_out(a_shared_ptr, msg_ptr, msg_size) == (int)msg_size)
                 {
                     if ((NULL != a_in_fptr) &&
                         (true == wait_and_parse_response))
                     {
                         // Wait response from borker
-                        int rcv = a_in_fptr(a_message_buffer_ptr, a_max_buffer_size);
+                        int rcv = a_in_fptr(a_shared_ptr, a_message_buffer_ptr, a_max_buffer_size);
                         if (0 < rcv) {
-                            return mqtt_connect_parse_ack(a_message_buffer_ptr);
+                            return mqtt_connect_parse_ack(a_message_buffer_ptr, (uint32_t)rcv);
                         } else
                         {
                             return ServerUnavailabe;
@@ -976,6 +1901,64 @@ MQTTErrorCodes_t mqtt_connect_(uint8_t                * a_message_buffer_ptr,
     return InvalidArgument;
 }
 
+MQTTErrorCodes_t mqtt_connect_pipelined_(MQTT_shared_data_t      * a_shared_ptr,
+                                         MQTT_connect_pipeline_t * a_pipeline_ptr)
+{
+    if ((NULL == a_shared_ptr->buffer) ||
+        (NULL == a_pipeline_ptr->connect_ptr))
+        return InvalidArgument;
+
+    uint8_t                 * buffer      = a_shared_ptr->buffer;
+    size_t                    buffer_size = a_shared_ptr->buffer_size;
+    data_stream_outv_fptr_t   outv_fptr   = a_shared_ptr->outv_fptr;
+    MQTT_action_data_t        action;
+
+    /* Vector would refer into the buffer where next packets are encoded */
+    a_shared_ptr->outv_fptr     = NULL;
+    a_shared_ptr->gather.buffer = buffer;
+    a_shared_ptr->gather.size   = (uint32_t)buffer_size;
+    a_shared_ptr->gather.fill   = 0;
+
+    action.action_argument.connect_ptr = a_pipeline_ptr->connect_ptr;
+    MQTTErrorCodes_t status = mqtt(a_shared_ptr, ACTION_CONNECT, &action);
+
+    if ((Successfull == status) &&
+        (NULL        != a_pipeline_ptr->subscribe_ptr)) {
+        action.action_argument.subscribe_list_ptr = a_pipeline_ptr->subscribe_ptr;
+        status = mqtt(a_shared_ptr, ACTION_SUBSCRIBE_LIST, &action);
+    }
+
+    if ((Successfull == status) &&
+        (NULL        != a_pipeline_ptr->publish_ptr)) {
+        action.action_argument.publish_ptr = a_pipeline_ptr->publish_ptr;
+        status = mqtt(a_shared_ptr, ACTION_PUBLISH, &action);
+    }
+
+    uint32_t fill = a_shared_ptr->gather.fill;
+
+    a_shared_ptr->gather.buffer = NULL;
+    a_shared_ptr->buffer        = buffer;
+    a_shared_ptr->buffer_size   = buffer_size;
+    a_shared_ptr->outv_fptr     = outv_fptr;
+
+    if ((Successfull == status) &&
+        (a_shared_ptr->out_fptr(a_shared_ptr, buffer, fill) != (int)fill))
+        status = ServerUnavailabe;
+
+    if (Successfull != status) {
+        #ifdef DEBUG
+            mqtt_printf("%s %u Pipelined connect failed %u, %u bytes collected\n", __FILE__, __LINE__, status, fill);
+        #endif
+        /* Nothing or broken stream was sent, ack of the subscribe will not come */
+        a_shared_ptr->state                              = STATE_DISCONNECTED;
+        a_shared_ptr->subscribe_pending.packet_id        = 0;
+        a_shared_ptr->subscribe_pending.return_codes_ptr = NULL;
+        if (InvalidArgument == status)
+            status = BufferOverflow;
+    }
+    return status;
+}
+
 uint8_t encode_variable_header_connect(uint8_t        * a_output_ptr,
                                        bool             a_clean_session,
                                        bool             a_last_will,
@@ -1281,26 +2264,20 @@ uint8_t * decode_variable_header_conack(uint8_t * a_input_ptr,
     return NULL;
 }
 
-MQTTErrorCodes_t mqtt_connect_parse_ack(uint8_t * a_message_in_ptr)
+MQTTErrorCodes_t mqtt_connect_parse_ack(uint8_t  * a_message_in_ptr,
+                                        uint32_t   a_input_size)
 {
-    uint8_t connection_state = (uint8_t)InvalidArgument;
-    if (NULL != a_message_in_ptr) {
-
-        bool              dup, retain;
-        MQTTQoSLevel_t    qos;
-        MQTTMessageType_t type;
-        uint32_t          size;
+    uint8_t            connection_state;
+    MQTT_packet_view_t view;
 
-        // Decode fixed header
-        uint8_t * nextHdr = decode_fixed_header(a_message_in_ptr, &dup, &qos, &retain, &type, &size);
+    // Decode fixed header, view is bounded by the received bytes
+    if ((Successfull == mqtt_packet_view(a_message_in_ptr, a_input_size, &view)) &&
+        (CONNACK     == view.type)                                              &&
+        // Decode variable header
+        (NULL != decode_variable_header_conack(view.body.ptr, &connection_state)))
+        return (MQTTErrorCodes_t)connection_state;
 
-        if ((NULL != nextHdr) &&
-            (CONNACK == type)) {
-            // Decode variable header
-            decode_variable_header_conack(nextHdr, &connection_state);
-        }
-    }
-    return connection_state;
+    return InvalidArgument;
 }
 
 /************************************************************************************************************
@@ -1311,16 +2288,17 @@ MQTTErrorCodes_t mqtt_connect_parse_ack(uint8_t * a_message_in_ptr)
  * See <a href="http://docs.oasis-open.org/mqtt/mqtt/v3.1.1/os/mqtt-v3.1.1-os.pdf">Chapter 3.1 CONNECT      *
  *                                                                                                          *
  ************************************************************************************************************/
-MQTTErrorCodes_t mqtt_disconnect_(data_stream_out_fptr_t a_out_fptr)
+MQTTErrorCodes_t mqtt_disconnect_(MQTT_shared_data_t * a_shared_ptr)
 {
-    if (NULL != a_out_fptr) {
+    if ((NULL != a_shared_ptr) &&
+        (NULL != a_shared_ptr->out_fptr)) {
         /* Form and send fixed header with DISCONNECT command ID.
            Message is stored into temporary local buffer. */
         MQTT_fixed_header_t temporaryBuffer;
         uint8_t sizeOfFixedHdr = encode_fixed_header(&temporaryBuffer, false, QoS0, false, DISCONNECT, 0);
 
         /* Send disconnect message out */
-        if (a_out_fptr((uint8_t*)&temporaryBuffer, sizeOfFixedHdr) == sizeOfFixedHdr)
+        if (mqtt_out(a_shared_ptr, (uint8_t*)&temporaryBuffer, sizeOfFixedHdr) == sizeOfFixedHdr)
             return Successfull;
         else
             return ServerUnavailabe;
@@ -1336,14 +2314,16 @@ MQTTErrorCodes_t mqtt_disconnect_(data_stream_out_fptr_t a_out_fptr)
  * See <a href="http://docs.oasis-open.org/mqtt/mqtt/v3.1.1/os/mqtt-v3.1.1-os.pdf">Chapter 3.12 PINGREQ     *
  *                                                                                                          *
  ************************************************************************************************************/
-MQTTErrorCodes_t mqtt_ping_req(data_stream_out_fptr_t a_out_fptr)
+MQTTErrorCodes_t mqtt_ping_req(MQTT_shared_data_t * a_shared_ptr)
 {
-    if (NULL != a_out_fptr) {
+    if ((NULL != a_shared_ptr) &&
+        (NULL != a_shared_ptr->out_fptr)) {
         // Form and send fixed header with PINGREQ command ID
         MQTT_fixed_header_t temporaryBuffer;
         uint8_t sizeOfFixedHdr = encode_fixed_header(&temporaryBuffer, false, QoS0, false, PINGREQ, 0);
 
-        if (a_out_fptr((uint8_t*)&temporaryBuffer, sizeOfFixedHdr) == sizeOfFixedHdr)
+        MQTT_LATENCY_START(a_shared_ptr, ping_sent_in_us);
+        if (mqtt_out(a_shared_ptr, (uint8_t*)&temporaryBuffer, sizeOfFixedHdr) == sizeOfFixedHdr)
             return Successfull;
         else
             return ServerUnavailabe;
@@ -1359,76 +2339,1409 @@ MQTTErrorCodes_t mqtt_ping_req(data_stream_out_fptr_t a_out_fptr)
  * See <a href="http://docs.oasis-open.org/mqtt/mqtt/v3.1.1/os/mqtt-v3.1.1-os.pdf">Chapter 3.13 PINGRESP    *
  *                                                                                                          *
  ************************************************************************************************************/
-MQTTErrorCodes_t mqtt_parse_ping_ack(uint8_t * a_message_in_ptr)
+MQTTErrorCodes_t mqtt_parse_ping_ack(uint8_t  * a_message_in_ptr,
+                                     uint32_t   a_input_size)
 {
-    if (NULL != a_message_in_ptr) {
-
-        bool              dup, retain;
-        MQTTQoSLevel_t    qos;
-        MQTTMessageType_t type;
-        uint32_t          size;
+    MQTT_packet_view_t view;
 
-        /* Decode fixed header */
-        uint8_t * nextHdr = decode_fixed_header(a_message_in_ptr, &dup, &qos, &retain, &type, &size);
+    /* Decode fixed header, PINGRESP has no variable header */
+    if ((Successfull == mqtt_packet_view(a_message_in_ptr, a_input_size, &view)) &&
+        (PINGRESP    == view.type))
+        return Successfull;
 
-        /* If decoded successfully ...*/
-        if ((NULL     != nextHdr) &&
-            (PINGRESP == type)) {
-            /* Decode variable header */
-            return Successfull;
-        }
-    }
     return ServerUnavailabe;
 }
 
 /************************************************************************************************************
- *                                                                                                          *
- * \subsection ParsInput Parse input stream                                                                 *
- *                                                                                                          *
- * Function decode fixed header from input stream to find out details of received message.                  *
- * Appropriate funciton is called to decode received message successfully.                                  *
- *                                                                                                          *
+ *                                                                                                           *
+ * \subsection Keepalive PINGRESP deadline                                                                   *
+ *                                                                                                           *
+ * Only one PINGREQ is outstanding at a time. When its PINGRESP does not arrive before the deadline the      *
+ * connection is half-open or the broker is gone, keepalive reports the connection lost.                     *
+ * See <a href="http://docs.oasis-open.org/mqtt/mqtt/v3.1.1/os/mqtt-v3.1.1-os.pdf">Chapter 3.1.2.10          *
+ *                                                                                                           *
  ************************************************************************************************************/
-MQTTErrorCodes_t mqtt_parse_input_stream(uint8_t  * a_input_ptr,
-                                         uint32_t * a_message_size_ptr)
+uint32_t mqtt_ping_deadline(MQTT_shared_data_t * a_shared_ptr)
 {
-    MQTTErrorCodes_t  status = InvalidArgument;
-    bool              dup, retain;
-    MQTTQoSLevel_t    qos;
-    MQTTMessageType_t type;
+    if (0 != a_shared_ptr->ping.pingresp_timeout_in_ms)
+        return a_shared_ptr->ping.pingresp_timeout_in_ms;
 
-    if (NULL == a_input_ptr)
-        return InvalidArgument;
+    /* Ping interval is 500 ms shorter than the keepalive */
+    return ((uint32_t)a_shared_ptr->keepalive_in_ms + 500) / 2;
+}
 
-    /* Decode fixed header */
-    uint8_t * next_header_ptr = decode_fixed_header(a_input_ptr, &dup, &qos, &retain, &type, a_message_size_ptr);
+void mqtt_session_reset(MQTT_shared_data_t * a_shared_ptr)
+{
+    a_shared_ptr->state                   = STATE_DISCONNECTED;
+    a_shared_ptr->keepalive_in_ms         = 0;
+    a_shared_ptr->time_to_next_ping_in_ms = 0;
+    a_shared_ptr->ping.ping_outstanding   = false;
+    a_shared_ptr->ping.clock_in_ms        = 0;
+    a_shared_ptr->publish_stream.open     = false;
+    a_shared_ptr->publish_stream.left     = 0;
+    a_shared_ptr->publish_stream.acks_held           = 0;
+    a_shared_ptr->inflight                = NULL;
+    a_shared_ptr->completion              = NULL;
+    a_shared_ptr->connect_status          = false;
+    a_shared_ptr->session_accepted        = false;
+    a_shared_ptr->subscribe_status        = false;
+    a_shared_ptr->subscribe_pending.packet_id        = 0;
+    a_shared_ptr->subscribe_pending.return_codes_ptr = NULL;
+    a_shared_ptr->subscribe_pending.return_code_cnt  = 0;
+    a_shared_ptr->subscribe_pending.result           = Successfull;
+    a_shared_ptr->gather.buffer                      = NULL;
+    a_shared_ptr->coalesce.fill                      = 0; /* Staged for the old transport */
+    mqtt_framer_reset(&(a_shared_ptr->framer));
+}
 
-    if (NULL == next_header_ptr)
-        return InvalidArgument;
+MQTTErrorCodes_t mqtt_connection_lost(MQTT_shared_data_t * a_shared_ptr,
+                                      MQTTErrorCodes_t     a_reason)
+{
+    #ifdef DEBUG
+        mqtt_printf("%s %u Connection lost %d\n", __FILE__, __LINE__, a_reason);
+    #endif
+    a_shared_ptr->state                 = STATE_DISCONNECTED;
+    a_shared_ptr->session_accepted      = false;
+    a_shared_ptr->ping.ping_outstanding = false;
 
-    /* Check message type to and take appropriate action. */
-    switch (type)
-    {
-        case CONNACK:
+    if (NULL != a_shared_ptr->ping.lost_fptr)
+        a_shared_ptr->ping.lost_fptr(a_shared_ptr, a_reason);
+    return a_reason;
+}
+
+/************************************************************************************************************
+ *                                                                                                          *
+ * \subsection Inflight QoS acknowledgements and in-flight window                                           *
+ *                                                                                                          *
+ * Sent QoS 1 publishes wait PUBACK and QoS 2 publishes PUBREC and PUBCOMP in the in-flight window.         *
+ * Unacknowledged ones are sent again (PUBLISH with DUP flag or PUBREL) when retransmit timer expires.      *
+ * Received QoS 1 publishes are acknowledged with PUBACK, QoS 2 with PUBREC and PUBREL with PUBCOMP.       *
+ * See <a href="http://docs.oasis-open.org/mqtt/mqtt/v3.1.1/os/mqtt-v3.1.1-os.pdf">Chapter 4.3 QoS levels   *
+ *                                                                                                          *
+ ************************************************************************************************************/
+uint16_t mqtt_next_packet_id(MQTT_shared_data_t * a_shared_ptr)
+{
+    uint16_t packet_id;
+
+    do {
+        packet_id = (uint16_t)(++(a_shared_ptr->mqtt_packet_cntr));
+    } while ((0    == packet_id) ||
+             (NULL != mqtt_inflight_find(a_shared_ptr->inflight, packet_id)));
+
+    return packet_id;
+}
+
+MQTTErrorCodes_t encode_ack(MQTT_shared_data_t * a_shared_ptr,
+                            MQTTMessageType_t    a_type,
+                            uint16_t             a_packet_id)
+{
+    if ((NULL == a_shared_ptr) ||
+        (NULL == a_shared_ptr->out_fptr))
+        return InvalidArgument;
+
+    MQTT_publish_stream_t * stream = &(a_shared_ptr->publish_stream);
+
+    /* Ack can not go into the middle of the payload, it waits for the last chunk */
+    if ((true == stream->open) &&
+        (0     < stream->left)) {
+        if (MQTT_PUBLISH_STREAM_ACKS <= stream->acks_held) {
+            #ifdef DEBUG
+                mqtt_printf("%s %u Held acks full, ack %u dropped %u\n", __FILE__, __LINE__, a_type, a_packet_id);
+            #endif
+            return BufferOverflow;
+        }
+        stream->acks[stream->acks_held].type      = (uint8_t)a_type;
+        stream->acks[stream->acks_held].packet_id = a_packet_id;
+        stream->acks_held++;
+        return Successfull;
+    }
+
+    uint8_t ack[sizeof(MQTT_fixed_header_t) + sizeof(uint16_t)];
+
+    /* PUBREL has reserved flags 0010 = QoS1 bits */
+    uint8_t size = encode_fixed_header((MQTT_fixed_header_t *) ack,
+                                       false,
+                                       (PUBREL == a_type) ? QoS1 : QoS0,
+                                       false,
+                                       a_type,
+                                       sizeof(uint16_t));
+    if (0 == size)
+        return InvalidArgument;
+
+    ack[size++] = (uint8_t)((a_packet_id >> 8) & 0xFF);
+    ack[size++] = (uint8_t)((a_packet_id >> 0) & 0xFF);
+
+    if (mqtt_out(a_shared_ptr, ack, size) == size)
+        return Successfull;
+
+    #ifdef DEBUG
+        mqtt_printf("%s %u Sending ack %u failed %u\n", __FILE__, __LINE__, a_type, a_packet_id);
+    #endif
+    return ServerUnavailabe;
+}
+
+void mqtt_publish_stream_acks(MQTT_shared_data_t * a_shared_ptr)
+{
+    MQTT_publish_stream_t * stream = &(a_shared_ptr->publish_stream);
+    uint8_t                 held   = stream->acks_held;
+
+    /* Cleared first, so acks are sent and not held again */
+    stream->acks_held = 0;
+    for (uint8_t i = 0; i < held; i++)
+        encode_ack(a_shared_ptr, (MQTTMessageType_t)stream->acks[i].type, stream->acks[i].packet_id);
+}
+
+MQTT_inflight_entry_t * mqtt_inflight_find(MQTT_inflight_window_t * a_window_ptr,
+                                           uint16_t                 a_packet_id)
+{
+    if (NULL != a_window_ptr) {
+        for (uint16_t i = 0; i < a_window_ptr->size; i++) {
+            MQTT_inflight_entry_t * entry = &(a_window_ptr->entries[i]);
+
+            if (0 == a_packet_id) {
+                if (INFLIGHT_FREE == entry->state)
+                    return entry;
+            } else if ((INFLIGHT_FREE != entry->state) &&
+                       (a_packet_id   == entry->packet_id)) {
+                return entry;
+            }
+        }
+    }
+    return NULL;
+}
+
+bool mqtt_inflight_reserve(MQTT_shared_data_t     *  a_shared_ptr,
+                           MQTT_publish_t         *  a_publish_ptr,
+                           uint16_t                  a_packet_id,
+                           MQTT_inflight_entry_t  ** a_entry_ptr)
+{
+    MQTT_inflight_entry_t * entry = NULL;
+
+    /* Without window publish is sent, but not tracked */
+    if (NULL != a_shared_ptr->inflight) {
+        entry = mqtt_inflight_find(a_shared_ptr->inflight, 0);
+        if (NULL == entry)
+            return false;
+
+        entry->state               = (QoS2 == a_publish_ptr->flags.qos) ? INFLIGHT_WAIT_PUBREC : INFLIGHT_WAIT_PUBACK;
+        entry->packet_id           = a_packet_id;
+        entry->qos                 = a_publish_ptr->flags.qos;
+        entry->retain              = a_publish_ptr->flags.retain;
+        entry->topic_ptr           = a_publish_ptr->topic_ptr;
+        entry->topic_length        = a_publish_ptr->topic_length;
+        entry->message_ptr         = a_publish_ptr->message_buffer_ptr;
+        entry->message_size        = a_publish_ptr->message_buffer_size;
+        entry->time_to_retry_in_ms = (int32_t)a_shared_ptr->inflight->retry_in_ms;
+        #ifdef MQTT_INSTRUMENTATION
+            entry->sent_in_us      = mqtt_time_us(); /* Retransmits do not restart latency */
+        #endif
+        a_shared_ptr->inflight->used++;
+    }
+
+    *a_entry_ptr = entry;
+    return true;
+}
+
+MQTTErrorCodes_t mqtt_inflight_resend_entry(MQTT_shared_data_t    * a_shared_ptr,
+                                            MQTT_inflight_entry_t * a_entry_ptr)
+{
+    MQTT_inflight_window_t * window = a_shared_ptr->inflight;
+
+    if (INFLIGHT_WAIT_PUBCOMP == a_entry_ptr->state) {
+        /* Publish is received by the broker, only release is repeated */
+        MQTTErrorCodes_t ret = encode_ack(a_shared_ptr, PUBREL, a_entry_ptr->packet_id);
+        if (Successfull == ret)
+            a_entry_ptr->time_to_retry_in_ms = (int32_t)window->retry_in_ms;
+        return ret;
+    }
+
+    if ((NULL == a_entry_ptr->message_ptr) &&
+        (0     < a_entry_ptr->message_size)) {
+        /* Chunked publish, payload is with the application */
+        a_entry_ptr->state = INFLIGHT_FREE;
+        window->used--;
+        if (NULL != window->published_cb_fptr)
+            window->published_cb_fptr(a_shared_ptr, a_entry_ptr->packet_id, PayloadNotKept);
+        return Successfull;
+    }
+
+    if (false == encode_publish(a_shared_ptr,
+                                a_shared_ptr->buffer,
+                                a_shared_ptr->buffer_size,
+                                a_entry_ptr->retain,
+                                a_entry_ptr->qos,
+                                true, /* DUP */
+                                a_entry_ptr->topic_ptr,
+                                a_entry_ptr->topic_length,
+                                a_entry_ptr->packet_id,
+                                a_entry_ptr->message_ptr,
+                                a_entry_ptr->message_size)) {
+        #ifdef DEBUG
+            mqtt_printf("%s %u Retransmit failed %u\n", __FILE__, __LINE__, a_entry_ptr->packet_id);
+        #endif
+        return ServerUnavailabe;
+    }
+    a_entry_ptr->time_to_retry_in_ms = (int32_t)window->retry_in_ms;
+    return Successfull;
+}
+
+MQTTErrorCodes_t mqtt_inflight_resend(MQTT_shared_data_t * a_shared_ptr)
+{
+    MQTTErrorCodes_t         status = Successfull;
+    MQTT_inflight_window_t * window = a_shared_ptr->inflight;
+
+    for (uint16_t i = 0; (NULL != window) && (i < window->size); i++) {
+        MQTT_inflight_entry_t * entry = &(window->entries[i]);
+
+        if (INFLIGHT_FREE == entry->state)
+            continue;
+
+        MQTTErrorCodes_t ret = mqtt_inflight_resend_entry(a_shared_ptr, entry);
+        if ((Successfull != ret) &&
+            (Successfull == status))
+            status = ret;
+    }
+    return status;
+}
+
+void mqtt_inflight_tick(MQTT_shared_data_t * a_shared_ptr,
+                        uint32_t             a_elapsed_in_ms)
+{
+    MQTT_inflight_window_t * window = a_shared_ptr->inflight;
+
+    if ((NULL == window) ||
+        (0    == window->retry_in_ms) ||
+        (0    == window->used))
+        return;
+
+    for (uint16_t i = 0; i < window->size; i++) {
+        MQTT_inflight_entry_t * entry = &(window->entries[i]);
+
+        if (INFLIGHT_FREE == entry->state)
+            continue;
+
+        if (entry->time_to_retry_in_ms > (int32_t)a_elapsed_in_ms)
+            entry->time_to_retry_in_ms -= (int32_t)a_elapsed_in_ms;
+        else
+            entry->time_to_retry_in_ms = 0;
+
+        /* Only expired entries, timers of the others keep running. Failed send keeps
+           the timer at zero, it is tried again on the next tick. */
+        if (0 == entry->time_to_retry_in_ms)
+            mqtt_inflight_resend_entry(a_shared_ptr, entry);
+    }
+}
+
+MQTTErrorCodes_t mqtt_inflight_ack(MQTT_shared_data_t * a_shared_ptr,
+                                   MQTTMessageType_t    a_type,
+                                   uint16_t             a_packet_id)
+{
+    MQTT_inflight_entry_t * entry = mqtt_inflight_find(a_shared_ptr->inflight, a_packet_id);
+
+    if ((NULL == entry) ||
+        ((PUBACK  == a_type) && (INFLIGHT_WAIT_PUBACK  != entry->state)) ||
+        ((PUBREC  == a_type) && (INFLIGHT_WAIT_PUBACK  == entry->state)) ||
+        ((PUBCOMP == a_type) && (INFLIGHT_WAIT_PUBCOMP != entry->state))) {
+        #ifdef DEBUG
+            mqtt_printf("%s %u Unexpected ack %u for %u\n", __FILE__, __LINE__, a_type, a_packet_id);
+        #endif
+        return InvalidArgument;
+    }
+
+    if (PUBREC == a_type) {
+        /* Also repeated PUBREC is answered, PUBREL may have been lost */
+        entry->state               = INFLIGHT_WAIT_PUBCOMP;
+        entry->time_to_retry_in_ms = (int32_t)a_shared_ptr->inflight->retry_in_ms;
+        return encode_ack(a_shared_ptr, PUBREL, a_packet_id);
+    }
+
+    entry->state = INFLIGHT_FREE;
+    a_shared_ptr->inflight->used--;
+
+    #ifdef MQTT_INSTRUMENTATION
+        MQTTHistogram_t histogram = (PUBACK == a_type) ? HISTOGRAM_QOS1_ACK : HISTOGRAM_QOS2_ACK;
+        mqtt_histogram_record(&(a_shared_ptr->instrumentation.histograms[histogram]),
+                              mqtt_time_us() - entry->sent_in_us);
+    #endif
+
+    if (NULL != a_shared_ptr->inflight->published_cb_fptr)
+        a_shared_ptr->inflight->published_cb_fptr(a_shared_ptr, a_packet_id, Successfull);
+
+    return Successfull;
+}
+
+MQTTErrorCodes_t mqtt_publish_accept(MQTT_shared_data_t * a_shared_ptr,
+                                     MQTTQoSLevel_t       a_qos,
+                                     uint16_t             a_packet_id)
+{
+    MQTT_inflight_window_t * window = a_shared_ptr->inflight;
+
+    if ((QoS2 != a_qos)   ||
+        (NULL == window)  ||
+        (NULL == window->received_ids))
+        return Successfull;
+
+    uint16_t * free_ptr = NULL;
+
+    for (uint16_t i = 0; i < window->received_size; i++) {
+        if (a_packet_id == window->received_ids[i])
+            return DuplicatePublish;
+
+        if ((NULL == free_ptr) &&
+            (0    == window->received_ids[i]))
+            free_ptr = &(window->received_ids[i]);
+    }
+
+    if (NULL == free_ptr) {
+        #ifdef DEBUG
+            mqtt_printf("%s %u Received table full, publish %u dropped\n", __FILE__, __LINE__, a_packet_id);
+        #endif
+        return InflightWindowFull;
+    }
+
+    *free_ptr = a_packet_id;
+    return Successfull;
+}
+
+MQTTErrorCodes_t mqtt_publish_release(MQTT_shared_data_t * a_shared_ptr,
+                                      uint16_t             a_packet_id)
+{
+    MQTT_inflight_window_t * window = a_shared_ptr->inflight;
+
+    for (uint16_t i = 0; (NULL != window) && (NULL != window->received_ids) && (i < window->received_size); i++) {
+        if (a_packet_id == window->received_ids[i]) {
+            window->received_ids[i] = 0;
+            break;
+        }
+    }
+
+    /* PUBCOMP is sent also for unknown identifier, it may be a repeated PUBREL */
+    return encode_ack(a_shared_ptr, PUBCOMP, a_packet_id);
+}
+
+MQTTErrorCodes_t mqtt_publish_received(MQTT_shared_data_t * a_shared_ptr,
+                                       MQTTQoSLevel_t       a_qos,
+                                       uint16_t             a_packet_id)
+{
+    if (QoS1 == a_qos)
+        return encode_ack(a_shared_ptr, PUBACK, a_packet_id);
+
+    if (QoS2 == a_qos)
+        return encode_ack(a_shared_ptr, PUBREC, a_packet_id);
+
+    return Successfull;
+}
+
+/************************************************************************************************************
+ *                                                                                                          *
+ * \subsection Store Outbound store                                                                         *
+ *                                                                                                          *
+ * QoS 0 publishes which could not be sent wait in the outbound store. RAM ring keeps messages as records   *
+ * of 2 bytes topic length, 4 bytes payload size, topic and payload. Record which does not fit to the end   *
+ * of the ring starts from the beginning, wrap marker (topic length 0xFFFF) is left at the end.             *
+ *                                                                                                          *
+ ************************************************************************************************************/
+#define MQTT_STORE_RECORD_HEADER 6
+#define MQTT_STORE_RECORD_WRAP   0xFFFF
+
+/* QoS 0 publish can be encoded into the output buffer, with vector output only its header */
+static bool mqtt_store_fits(MQTT_shared_data_t * a_shared_ptr,
+                            uint32_t             a_output_size,
+                            uint16_t             a_topic_length,
+                            uint32_t             a_message_size)
+{
+    uint32_t remaining = sizeof(uint16_t) + a_topic_length;
+
+    if ((a_output_size  <= sizeof(MQTT_fixed_header_t)) ||
+        (a_message_size >  (MQTT_MAX_MESSAGE_SIZE - remaining)))
+        return false;
+
+    remaining += a_message_size;
+
+    uint32_t header = 1 + mqtt_varint_size(remaining) + sizeof(uint16_t);
+
+    if (NULL != a_shared_ptr->outv_fptr)
+        return (header <= a_output_size);
+
+    return ((header + a_topic_length + a_message_size) <= a_output_size);
+}
+
+/* Record which can never be flushed through the transmit buffer is refused */
+static bool mqtt_store_put(MQTT_shared_data_t * a_shared_ptr,
+                           uint8_t            * a_topic_ptr,
+                           uint16_t             a_topic_length,
+                           uint8_t            * a_message_ptr,
+                           uint32_t             a_message_size)
+{
+    if (false == mqtt_store_fits(a_shared_ptr, a_shared_ptr->buffer_size, a_topic_length, a_message_size)) {
+        #ifdef DEBUG
+            mqtt_printf("%s %u Message %u does not fit to flush, not stored\n", __FILE__, __LINE__, a_message_size);
+        #endif
+        return false;
+    }
+
+    return a_shared_ptr->store->put_fptr(a_shared_ptr->store,
+                                         a_topic_ptr,
+                                         a_topic_length,
+                                         a_message_ptr,
+                                         a_message_size);
+}
+
+MQTTErrorCodes_t mqtt_store_flush(MQTT_shared_data_t * a_shared_ptr,
+                                  uint8_t            * a_output_ptr,
+                                  uint32_t             a_output_size)
+{
+    MQTT_store_t * store = a_shared_ptr->store;
+
+    /* Refused CONNACK must not cost stored messages, wait for accepted one */
+    if ((STATE_CONNECTED != a_shared_ptr->state)            ||
+        (false           == a_shared_ptr->session_accepted) ||
+        (true            == a_shared_ptr->publish_stream.open))
+        return NoConnection;
+
+    while ((NULL != store) &&
+           (0     < store->count)) {
+
+        uint8_t  * topic_ptr;
+        uint16_t   topic_length;
+        uint8_t  * message_ptr;
+        uint32_t   message_size;
+
+        if (false == store->peek_fptr(store, &topic_ptr, &topic_length, &message_ptr, &message_size))
+            return InvalidArgument;
+
+        uint8_t  * output_ptr  = a_output_ptr;
+        uint32_t   output_size = a_output_size;
+
+        /* Record was checked against the transmit buffer when it was stored */
+        if (false == mqtt_store_fits(a_shared_ptr, output_size, topic_length, message_size)) {
+            output_ptr  = a_shared_ptr->buffer;
+            output_size = a_shared_ptr->buffer_size;
+        }
+
+        /* Undeliverable record (e.g. vector output was removed) must not block the rest */
+        if ((NULL  == output_ptr) ||
+            (false == mqtt_store_fits(a_shared_ptr, output_size, topic_length, message_size))) {
+            #ifdef DEBUG
+                mqtt_printf("%s %u Stored message %u does not fit, dropped\n", __FILE__, __LINE__, message_size);
+            #endif
+            store->pop_fptr(store);
+            continue;
+        }
+
+        if (false == encode_publish(a_shared_ptr,
+                                    output_ptr,
+                                    output_size,
+                                    false,
+                                    QoS0,
+                                    false,
+                                    topic_ptr,
+                                    topic_length,
+                                    0,
+                                    message_ptr,
+                                    message_size)) {
+            #ifdef DEBUG
+                mqtt_printf("%s %u Flush stopped, %u messages stored\n", __FILE__, __LINE__, store->count);
+            #endif
+            return ServerUnavailabe;
+        }
+
+        store->pop_fptr(store);
+        a_shared_ptr->time_to_next_ping_in_ms = a_shared_ptr->keepalive_in_ms;
+    }
+    return Successfull;
+}
+
+/* Position of the oldest record, wrap marker or too short end is skipped */
+static uint32_t mqtt_store_ring_oldest(MQTT_store_ring_t * a_ring_ptr)
+{
+    uint32_t pos = a_ring_ptr->tail;
+
+    if (((a_ring_ptr->size - pos) < MQTT_STORE_RECORD_HEADER) ||
+        (MQTT_STORE_RECORD_WRAP == (((uint16_t)(a_ring_ptr->buffer[pos]) << 8) | a_ring_ptr->buffer[pos + 1])))
+        pos = 0;
+
+    return pos;
+}
+
+bool mqtt_store_ring_put(MQTT_store_t * a_store_ptr,
+                         uint8_t      * a_topic_ptr,
+                         uint16_t       a_topic_length,
+                         uint8_t      * a_message_ptr,
+                         uint32_t       a_message_size)
+{
+    MQTT_store_ring_t * ring   = (MQTT_store_ring_t *) a_store_ptr;
+    uint32_t            record = MQTT_STORE_RECORD_HEADER + a_topic_length + a_message_size;
+    uint32_t            pos;
+
+    if ((MQTT_STORE_RECORD_WRAP == a_topic_length) ||
+        (record < a_message_size)                  || /* Overflow */
+        (record > ring->size))
+        return false;
+
+    if (0 == a_store_ptr->count) {
+        ring->head = 0;
+        ring->tail = 0;
+    }
+
+    if ((0 < a_store_ptr->count) && (ring->head == ring->tail)) {
+        return false; /* Full */
+    } else if (ring->head >= ring->tail) {
+        /* Free space is at the end and before tail */
+        if (record <= (ring->size - ring->head)) {
+            pos = ring->head;
+        } else if (record <= ring->tail) {
+            if (2 <= (ring->size - ring->head)) {
+                ring->buffer[ring->head]     = (uint8_t)(MQTT_STORE_RECORD_WRAP >> 8);
+                ring->buffer[ring->head + 1] = (uint8_t)(MQTT_STORE_RECORD_WRAP);
+            }
+            pos = 0;
+        } else {
+            return false;
+        }
+    } else if (record <= (ring->tail - ring->head)) {
+        pos = ring->head;
+    } else {
+        return false;
+    }
+
+    uint8_t * record_ptr = &(ring->buffer[pos]);
+    record_ptr[0] = (uint8_t)(a_topic_length >> 8);
+    record_ptr[1] = (uint8_t)(a_topic_length);
+    record_ptr[2] = (uint8_t)(a_message_size >> 24);
+    record_ptr[3] = (uint8_t)(a_message_size >> 16);
+    record_ptr[4] = (uint8_t)(a_message_size >> 8);
+    record_ptr[5] = (uint8_t)(a_message_size);
+    mqtt_memcpy(&(record_ptr[MQTT_STORE_RECORD_HEADER]), a_topic_ptr, a_topic_length);
+    mqtt_memcpy(&(record_ptr[MQTT_STORE_RECORD_HEADER + a_topic_length]), a_message_ptr, a_message_size);
+
+    ring->head = pos + record;
+    if (ring->head == ring->size)
+        ring->head = 0;
+
+    a_store_ptr->count++;
+    return true;
+}
+
+bool mqtt_store_ring_peek(MQTT_store_t  * a_store_ptr,
+                          uint8_t      ** a_topic_ptr,
+                          uint16_t      * a_topic_length_ptr,
+                          uint8_t      ** a_message_ptr,
+                          uint32_t      * a_message_size_ptr)
+{
+    MQTT_store_ring_t * ring = (MQTT_store_ring_t *) a_store_ptr;
+
+    if (0 == a_store_ptr->count)
+        return false;
+
+    uint8_t * record_ptr = &(ring->buffer[mqtt_store_ring_oldest(ring)]);
+
+    *a_topic_length_ptr = (uint16_t)(((uint16_t)(record_ptr[0]) << 8) | record_ptr[1]);
+    *a_message_size_ptr = ((uint32_t)(record_ptr[2]) << 24) |
+                          ((uint32_t)(record_ptr[3]) << 16) |
+                          ((uint32_t)(record_ptr[4]) << 8)  |
+                           (uint32_t)(record_ptr[5]);
+    *a_topic_ptr        = &(record_ptr[MQTT_STORE_RECORD_HEADER]);
+    *a_message_ptr      = &(record_ptr[MQTT_STORE_RECORD_HEADER + *a_topic_length_ptr]);
+    return true;
+}
+
+bool mqtt_store_ring_pop(MQTT_store_t * a_store_ptr)
+{
+    MQTT_store_ring_t * ring = (MQTT_store_ring_t *) a_store_ptr;
+    uint8_t           * topic_ptr;
+    uint16_t            topic_length;
+    uint8_t           * message_ptr;
+    uint32_t            message_size;
+
+    if (false == mqtt_store_ring_peek(a_store_ptr, &topic_ptr, &topic_length, &message_ptr, &message_size))
+        return false;
+
+    ring->tail = (uint32_t)(message_ptr - ring->buffer) + message_size;
+    if (ring->tail == ring->size)
+        ring->tail = 0;
+
+    if (0 == --(a_store_ptr->count)) {
+        ring->head = 0;
+        ring->tail = 0;
+    }
+    return true;
+}
+
+/************************************************************************************************************
+ *                                                                                                          *
+ * \subsection PublishQueue Lock-free publish queue                                                         *
+ *                                                                                                          *
+ * Producers reserve a position with compare and swap of head, encode the publish into its slot and        *
+ * release the slot by advancing its turn. Consumer is the only one moving tail, so it needs no atomics    *
+ * for it. Full queue is detected from the turn of the slot, producer never waits the consumer.           *
+ *                                                                                                          *
+ ************************************************************************************************************/
+bool mqtt_publish_queue_init(MQTT_publish_queue_t * a_queue_ptr,
+                             MQTT_publish_slot_t  * a_slots_ptr,
+                             uint32_t               a_slot_cnt,
+                             uint8_t              * a_data_ptr,
+                             size_t                 a_data_size)
+{
+    if ((NULL == a_queue_ptr) ||
+        (NULL == a_slots_ptr) ||
+        (NULL == a_data_ptr)  ||
+        (0    == a_slot_cnt)  ||
+        (0    != (a_slot_cnt & (a_slot_cnt - 1))) ||
+        (a_data_size < a_slot_cnt))
+        return false;
+
+    a_queue_ptr->slots     = a_slots_ptr;
+    a_queue_ptr->data      = a_data_ptr;
+    a_queue_ptr->slot_cnt  = a_slot_cnt;
+    a_queue_ptr->slot_size = (uint32_t)(a_data_size / a_slot_cnt);
+    a_queue_ptr->head      = 0;
+    a_queue_ptr->tail      = 0;
+    a_queue_ptr->dropped   = 0;
+
+    for (uint32_t i = 0; i < a_slot_cnt; i++) {
+        a_slots_ptr[i].turn = i;
+        a_slots_ptr[i].size = 0;
+    }
+    return true;
+}
+
+bool mqtt_publish_enqueue(MQTT_publish_queue_t * a_queue_ptr,
+                          const char           * a_topic_ptr,
+                          uint16_t               a_topic_size,
+                          const void           * a_msg_ptr,
+                          size_t                 a_msg_size,
+                          bool                   a_retain)
+{
+    if ((NULL == a_queue_ptr) ||
+        (NULL == a_topic_ptr) ||
+        (0    == a_topic_size) ||
+        ((NULL == a_msg_ptr) && (0 < a_msg_size)))
+        return false;
+
+    uint32_t remaining = sizeof(uint16_t) + a_topic_size + (uint32_t)a_msg_size;
+
+    if ((a_msg_size > a_queue_ptr->slot_size) ||
+        ((1 + mqtt_varint_size(remaining) + remaining) > a_queue_ptr->slot_size))
+        return false;
+
+    /* Reserve position, slot is free when its turn has come round to it */
+    MQTT_publish_slot_t * slot;
+    uint32_t              pos = mqtt_atomic_load(&(a_queue_ptr->head));
+
+    for (;;) {
+        slot = &(a_queue_ptr->slots[pos & (a_queue_ptr->slot_cnt - 1)]);
+
+        int32_t diff = (int32_t)(mqtt_atomic_load(&(slot->turn)) - pos);
+
+        if (0 == diff) {
+            if (true == mqtt_atomic_cas(&(a_queue_ptr->head), &pos, pos + 1))
+                break;
+        } else if (0 > diff) {
+            /* Consumer has not sent the previous round */
+            mqtt_atomic_inc(&(a_queue_ptr->dropped));
+            return false;
+        } else {
+            pos = mqtt_atomic_load(&(a_queue_ptr->head));
+        }
+    }
+
+    uint8_t  * packet = &(a_queue_ptr->data[(pos & (a_queue_ptr->slot_cnt - 1)) * a_queue_ptr->slot_size]);
+    uint32_t   size   = 0;
+
+    packet[size++] = (uint8_t)((PUBLISH << 4) | ((true == a_retain) ? 0x01 : 0x00));
+    size          += mqtt_varint_encode(&(packet[size]), remaining);
+    packet[size++] = (uint8_t)(a_topic_size >> 8);
+    packet[size++] = (uint8_t)(a_topic_size);
+    mqtt_memcpy(&(packet[size]), a_topic_ptr, a_topic_size);
+    size          += a_topic_size;
+    if (0 < a_msg_size)
+        mqtt_memcpy(&(packet[size]), a_msg_ptr, a_msg_size);
+    size          += (uint32_t)a_msg_size;
+
+    slot->size = size;
+
+    /* Hand the slot over to the consumer */
+    mqtt_atomic_store(&(slot->turn), pos + 1);
+    return true;
+}
+
+uint32_t mqtt_publish_queue_drain(MQTT_shared_data_t   * a_shared_ptr,
+                                  MQTT_publish_queue_t * a_queue_ptr,
+                                  uint32_t               a_max_cnt)
+{
+    uint32_t sent = 0;
+
+    if ((NULL            == a_shared_ptr) ||
+        (NULL            == a_queue_ptr)  ||
+        (STATE_CONNECTED != a_shared_ptr->state) ||
+        (true            == a_shared_ptr->publish_stream.open))
+        return 0;
+
+    while ((0 == a_max_cnt) || (sent < a_max_cnt)) {
+        uint32_t              pos  = a_queue_ptr->tail;
+        MQTT_publish_slot_t * slot = &(a_queue_ptr->slots[pos & (a_queue_ptr->slot_cnt - 1)]);
+
+        if (mqtt_atomic_load(&(slot->turn)) != (pos + 1))
+            break; /* Empty, or producer is still encoding */
+
+        uint8_t * packet = &(a_queue_ptr->data[(pos & (a_queue_ptr->slot_cnt - 1)) * a_queue_ptr->slot_size]);
+
+        if (mqtt_out(a_shared_ptr, packet, slot->size) != (int)slot->size) {
+            #ifdef DEBUG
+                mqtt_printf("%s %u Sending queued publish failed %u\n", __FILE__, __LINE__, slot->size);
+            #endif
+            break;
+        }
+
+        /* Slot is free for the next round */
+        a_queue_ptr->tail = pos + 1;
+        mqtt_atomic_store(&(slot->turn), pos + a_queue_ptr->slot_cnt);
+        sent++;
+    }
+    return sent;
+}
+
+/************************************************************************************************************
+ *                                                                                                          *
+ * \subsection Topics Topic trie                                                                            *
+ *                                                                                                          *
+ * Node 0 is the root, children of a node are a sibling list. Matching walks the topic once level by       *
+ * level, only the branches which match the level ('+', '#' or same name) are followed. Topics starting    *
+ * with '$' do not match wildcards at the first level (MQTT 3.1.1 4.7.2).                                   *
+ *                                                                                                          *
+ ************************************************************************************************************/
+
+/* Length of the level starting from a_ptr */
+static uint16_t mqtt_topic_level(const uint8_t * a_ptr, uint16_t a_size)
+{
+    uint16_t len = 0;
+    while ((len < a_size) && ('/' != a_ptr[len]))
+        len++;
+    return len;
+}
+
+static bool mqtt_topic_is(MQTT_topic_node_t * a_node_ptr, uint8_t a_wildcard)
+{
+    return ((1          == a_node_ptr->level_length) &&
+            (a_wildcard == a_node_ptr->level_ptr[0]));
+}
+
+static uint16_t mqtt_topic_child(MQTT_topic_trie_t * a_trie_ptr,
+                                 uint16_t            a_parent,
+                                 const uint8_t     * a_level_ptr,
+                                 uint16_t            a_level_length)
+{
+    uint16_t idx = a_trie_ptr->nodes[a_parent].child;
+
+    while (0 != idx) {
+        MQTT_topic_node_t * node = &(a_trie_ptr->nodes[idx]);
+        if ((a_level_length == node->level_length) &&
+            (0 == mqtt_memcmp(a_level_ptr, node->level_ptr, a_level_length)))
+            break;
+        idx = node->sibling;
+    }
+    return idx;
+}
+
+/* Filter is valid when wildcards take whole level and # is the last level */
+static bool mqtt_topic_filter_valid(const uint8_t * a_filter_ptr, uint16_t a_filter_size)
+{
+    if (0 == a_filter_size)
+        return false;
+
+    for (uint16_t i = 0; i < a_filter_size; i++) {
+        if (('+' == a_filter_ptr[i]) ||
+            ('#' == a_filter_ptr[i])) {
+            if (((0 < i) && ('/' != a_filter_ptr[i - 1])) ||
+                (((i + 1) < a_filter_size) && ('/' != a_filter_ptr[i + 1])) ||
+                (('#' == a_filter_ptr[i]) && ((i + 1) != a_filter_size)))
+                return false;
+        }
+    }
+    return true;
+}
+
+bool mqtt_topic_trie_init(MQTT_topic_trie_t * a_trie_ptr,
+                          MQTT_topic_node_t * a_nodes_ptr,
+                          uint16_t            a_node_cnt)
+{
+    if ((NULL == a_trie_ptr)  ||
+        (NULL == a_nodes_ptr) ||
+        (2     > a_node_cnt))
+        return false;
+
+    mqtt_memset(a_nodes_ptr, 0, a_node_cnt * sizeof(MQTT_topic_node_t));
+    a_trie_ptr->nodes = a_nodes_ptr;
+    a_trie_ptr->size  = a_node_cnt;
+    a_trie_ptr->used  = 1;
+    return true;
+}
+
+bool mqtt_topic_register(MQTT_topic_trie_t * a_trie_ptr,
+                         const char        * a_filter_ptr,
+                         uint16_t            a_filter_size,
+                         subscrbe_fptr_t     a_handler_fptr)
+{
+    const uint8_t * filter = (const uint8_t *) a_filter_ptr;
+
+    if ((NULL  == a_trie_ptr)     ||
+        (NULL  == a_filter_ptr)   ||
+        (NULL  == a_handler_fptr) ||
+        (false == mqtt_topic_filter_valid(filter, a_filter_size)))
+        return false;
+
+    /* Count levels which do not exist yet, nothing is added when pool is too small */
+    uint16_t parent  = 0;
+    uint16_t missing = 0;
+    uint16_t pos     = 0;
+    for (;;) {
+        uint16_t len = mqtt_topic_level(&(filter[pos]), a_filter_size - pos);
+        if (0 == missing)
+            parent = mqtt_topic_child(a_trie_ptr, parent, &(filter[pos]), len);
+        if (0 == parent)
+            missing++;
+        pos += len + 1;
+        if (pos > a_filter_size)
+            break;
+    }
+
+    if (missing > (a_trie_ptr->size - a_trie_ptr->used))
+        return false;
+
+    uint16_t free_idx = 1;
+    parent = 0;
+    pos    = 0;
+    for (;;) {
+        uint16_t len = mqtt_topic_level(&(filter[pos]), a_filter_size - pos);
+        uint16_t idx = mqtt_topic_child(a_trie_ptr, parent, &(filter[pos]), len);
+
+        if (0 == idx) {
+            while (NULL != a_trie_ptr->nodes[free_idx].level_ptr)
+                free_idx++;
+
+            idx = free_idx;
+            MQTT_topic_node_t * node = &(a_trie_ptr->nodes[idx]);
+            node->level_ptr    = &(filter[pos]);
+            node->level_length = len;
+            node->child        = 0;
+            node->handler_fptr = NULL;
+            node->sibling      = a_trie_ptr->nodes[parent].child;
+            a_trie_ptr->nodes[parent].child = idx;
+            a_trie_ptr->used++;
+        }
+
+        parent = idx;
+        pos   += len + 1;
+        if (pos > a_filter_size)
+            break;
+    }
+
+    a_trie_ptr->nodes[parent].handler_fptr = a_handler_fptr;
+    return true;
+}
+
+/* Remove handler at the end of filter, free nodes left without handler and children */
+static bool mqtt_topic_remove(MQTT_topic_trie_t * a_trie_ptr,
+                              uint16_t            a_parent,
+                              const uint8_t     * a_filter_ptr,
+                              uint16_t            a_filter_size)
+{
+    uint16_t len = mqtt_topic_level(a_filter_ptr, a_filter_size);
+    uint16_t idx = mqtt_topic_child(a_trie_ptr, a_parent, a_filter_ptr, len);
+
+    if (0 == idx)
+        return false;
+
+    MQTT_topic_node_t * node = &(a_trie_ptr->nodes[idx]);
+
+    if (len == a_filter_size) {
+        if (NULL == node->handler_fptr)
+            return false;
+        node->handler_fptr = NULL;
+    } else if (false == mqtt_topic_remove(a_trie_ptr, idx, &(a_filter_ptr[len + 1]), a_filter_size - len - 1)) {
+        return false;
+    }
+
+    if ((NULL == node->handler_fptr) &&
+        (0    == node->child)) {
+        /* Unlink from siblings */
+        uint16_t * link_ptr = &(a_trie_ptr->nodes[a_parent].child);
+        while (idx != *link_ptr)
+            link_ptr = &(a_trie_ptr->nodes[*link_ptr].sibling);
+        *link_ptr = node->sibling;
+
+        node->level_ptr = NULL;
+        a_trie_ptr->used--;
+    }
+    return true;
+}
+
+bool mqtt_topic_unregister(MQTT_topic_trie_t * a_trie_ptr,
+                           const char        * a_filter_ptr,
+                           uint16_t            a_filter_size)
+{
+    if ((NULL == a_trie_ptr)   ||
+        (NULL == a_filter_ptr) ||
+        (0    == a_filter_size))
+        return false;
+
+    return mqtt_topic_remove(a_trie_ptr, 0, (const uint8_t *) a_filter_ptr, a_filter_size);
+}
+
+static uint16_t mqtt_topic_match(MQTT_shared_data_t * a_shared_ptr,
+                                 MQTT_topic_trie_t  * a_trie_ptr,
+                                 uint16_t             a_node,
+                                 uint8_t            * a_topic_ptr,
+                                 uint16_t             a_topic_size,
+                                 uint16_t             a_pos,
+                                 uint8_t            * a_data_ptr,
+                                 uint32_t             a_data_size)
+{
+    uint16_t matches  = 0;
+    bool     wildcard = !((0 == a_pos) && ('$' == a_topic_ptr[0]));
+    uint16_t idx      = a_trie_ptr->nodes[a_node].child;
+
+    if (a_pos > a_topic_size) {
+        /* All levels matched, "a/#" matches "a" as well */
+        MQTT_topic_node_t * node = &(a_trie_ptr->nodes[a_node]);
+        if (NULL != node->handler_fptr) {
+            node->handler_fptr(a_shared_ptr, Successfull, a_data_ptr, a_data_size, a_topic_ptr, a_topic_size);
+            matches++;
+        }
+        for (; 0 != idx; idx = a_trie_ptr->nodes[idx].sibling) {
+            node = &(a_trie_ptr->nodes[idx]);
+            if ((true == mqtt_topic_is(node, '#')) &&
+                (NULL != node->handler_fptr)) {
+                node->handler_fptr(a_shared_ptr, Successfull, a_data_ptr, a_data_size, a_topic_ptr, a_topic_size);
+                matches++;
+            }
+        }
+        return matches;
+    }
+
+    uint16_t len = mqtt_topic_level(&(a_topic_ptr[a_pos]), a_topic_size - a_pos);
+
+    for (; 0 != idx; idx = a_trie_ptr->nodes[idx].sibling) {
+        MQTT_topic_node_t * node = &(a_trie_ptr->nodes[idx]);
+
+        if (true == mqtt_topic_is(node, '#')) {
+            if ((true == wildcard) &&
+                (NULL != node->handler_fptr)) {
+                node->handler_fptr(a_shared_ptr, Successfull, a_data_ptr, a_data_size, a_topic_ptr, a_topic_size);
+                matches++;
+            }
+        } else if (((true == wildcard) && (true == mqtt_topic_is(node, '+'))) ||
+                   ((len == node->level_length) &&
+                    (0   == mqtt_memcmp(&(a_topic_ptr[a_pos]), node->level_ptr, len)))) {
+            matches += mqtt_topic_match(a_shared_ptr,
+                                        a_trie_ptr,
+                                        idx,
+                                        a_topic_ptr,
+                                        a_topic_size,
+                                        a_pos + len + 1,
+                                        a_data_ptr,
+                                        a_data_size);
+        }
+    }
+    return matches;
+}
+
+uint16_t mqtt_topic_dispatch(MQTT_shared_data_t * a_shared_ptr,
+                             MQTT_topic_trie_t  * a_trie_ptr,
+                             uint8_t            * a_topic_ptr,
+                             uint16_t             a_topic_size,
+                             uint8_t            * a_data_ptr,
+                             uint32_t             a_data_size)
+{
+    if ((NULL == a_trie_ptr)  ||
+        (NULL == a_topic_ptr) ||
+        (0    == a_topic_size))
+        return 0;
+
+    return mqtt_topic_match(a_shared_ptr, a_trie_ptr, 0, a_topic_ptr, a_topic_size, 0, a_data_ptr, a_data_size);
+}
+
+/************************************************************************************************************
+ *                                                                                                          *
+ * \subsection Completion Wake blocking calls                                                                *
+ *                                                                                                          *
+ * mqtt_connect and (un)subscribe calls wait in their completion object, the task parsing input signals    *
+ * it right after the ack is handled. Completion lives in stack of the waiting call, so pointer to it is    *
+ * only touched with the completion lock of the context held.                                               *
+ *                                                                                                          *
+ ************************************************************************************************************/
+void mqtt_complete(MQTT_shared_data_t * a_shared_ptr,
+                   volatile bool      * a_status_ptr)
+{
+    mqtt_completion_lock(&(a_shared_ptr->completion_lock));
+    *a_status_ptr = true;
+    if (NULL != a_shared_ptr->completion)
+        mqtt_completion_signal(a_shared_ptr->completion);
+    mqtt_completion_unlock(&(a_shared_ptr->completion_lock));
+}
+
+void mqtt_complete_begin(MQTT_shared_data_t * a_shared_ptr,
+                         mqtt_completion_t  * a_completion_ptr)
+{
+    mqtt_completion_init(a_completion_ptr);
+
+    mqtt_completion_lock(&(a_shared_ptr->completion_lock));
+    a_shared_ptr->completion = a_completion_ptr;
+    mqtt_completion_unlock(&(a_shared_ptr->completion_lock));
+}
+
+bool mqtt_complete_wait(MQTT_shared_data_t * a_shared_ptr,
+                        mqtt_completion_t  * a_completion_ptr,
+                        volatile bool      * a_status_ptr,
+                        uint8_t              a_timeout_in_sec)
+{
+    mqtt_completion_deadline_t deadline;
+    bool                       timeout = false;
+
+    /* Request must be on the wire before waiting its ack */
+    mqtt_coalesce_flush(a_shared_ptr);
+
+    /* Spurious wakes must not restart the timeout */
+    mqtt_completion_deadline(&deadline, (uint32_t)a_timeout_in_sec * 1000);
+
+    mqtt_completion_lock(&(a_shared_ptr->completion_lock));
+    while ((false == *a_status_ptr) &&
+           (false == timeout)) {
+        /* Signal comes only with the status, wake without it is spurious */
+        timeout = !mqtt_completion_wait(a_completion_ptr, &(a_shared_ptr->completion_lock), &deadline);
+    }
+    bool completed = *a_status_ptr;
+    a_shared_ptr->completion = NULL;
+    mqtt_completion_unlock(&(a_shared_ptr->completion_lock));
+
+    mqtt_completion_destroy(a_completion_ptr);
+    return completed;
+}
+
+/************************************************************************************************************
+ *                                                                                                          *
+ * \subsection Instrumentation Latency histograms and packet counters                                       *
+ *                                                                                                          *
+ * All output goes through mqtt_out and mqtt_outv, which count sent packets. Latency of a request is the    *
+ * time from sending it to parsing its ack, start times are kept in the context and in in-flight entries.  *
+ * Without MQTT_INSTRUMENTATION only plain output functions remain.                                         *
+ *                                                                                                          *
+ ************************************************************************************************************/
+/* Append packet to the gathered output, next packet is encoded right after it */
+static int mqtt_gather(MQTT_shared_data_t * a_shared_ptr,
+                       uint8_t            * a_data_ptr,
+                       uint32_t             a_size)
+{
+    MQTT_output_gather_t * gather = &(a_shared_ptr->gather);
+
+    if (a_size > (gather->size - gather->fill))
+        return -1;
+
+    /* Packet was encoded into the free part of the buffer, maybe not to its beginning */
+    mqtt_memmove(&(gather->buffer[gather->fill]), a_data_ptr, a_size);
+    gather->fill += a_size;
+
+    a_shared_ptr->buffer      = &(gather->buffer[gather->fill]);
+    a_shared_ptr->buffer_size = gather->size - gather->fill;
+    return (int)a_size;
+}
+
+bool mqtt_coalesce_flush(MQTT_shared_data_t * a_shared_ptr)
+{
+    MQTT_output_coalesce_t * coalesce = &(a_shared_ptr->coalesce);
+    uint32_t                 fill     = coalesce->fill;
+
+    if (0 == fill)
+        return true;
+
+    coalesce->fill = 0;
+    return (a_shared_ptr->out_fptr(a_shared_ptr, coalesce->buffer, fill) == (int)fill);
+}
+
+bool mqtt_coalesce_tick(MQTT_shared_data_t * a_shared_ptr)
+{
+    MQTT_output_coalesce_t * coalesce = &(a_shared_ptr->coalesce);
+
+    /* Unsigned difference is right also when the clock wrapped around */
+    if ((0 < coalesce->fill) &&
+        ((mqtt_time_us() - coalesce->staged_in_us) >= coalesce->max_delay_in_us))
+        return mqtt_coalesce_flush(a_shared_ptr);
+
+    return true;
+}
+
+/* Stage packet given in chunks, other packets than PUBLISH push the staged ones out with them */
+static int mqtt_coalesce(MQTT_shared_data_t * a_shared_ptr,
+                         MQTT_iovec_t       * a_iov_ptr,
+                         uint32_t             a_iov_cnt,
+                         uint32_t             a_size)
+{
+    MQTT_output_coalesce_t * coalesce = &(a_shared_ptr->coalesce);
+    bool                     publish  = (PUBLISH == (a_iov_ptr[0].data[0] >> 4));
+
+    /* Keep order, staged packets go before this one */
+    if ((a_size > (coalesce->size - coalesce->fill)) &&
+        (false  == mqtt_coalesce_flush(a_shared_ptr)))
+        return -1;
+
+    if (a_size > coalesce->size)
+        return (1 == a_iov_cnt) ? a_shared_ptr->out_fptr(a_shared_ptr, a_iov_ptr[0].data, a_size)
+                                : a_shared_ptr->outv_fptr(a_shared_ptr, a_iov_ptr, a_iov_cnt);
+
+    if (0 == coalesce->fill)
+        coalesce->staged_in_us = mqtt_time_us();
+
+    for (uint32_t i = 0; i < a_iov_cnt; i++) {
+        mqtt_memcpy(&(coalesce->buffer[coalesce->fill]), a_iov_ptr[i].data, a_iov_ptr[i].size);
+        coalesce->fill += (uint32_t)a_iov_ptr[i].size;
+    }
+
+    bool sent = ((false == publish) || (coalesce->fill >= coalesce->threshold)) ? mqtt_coalesce_flush(a_shared_ptr)
+                                                                                  : mqtt_coalesce_tick(a_shared_ptr);
+    return (true == sent) ? (int)a_size : -1;
+}
+
+int mqtt_out(MQTT_shared_data_t * a_shared_ptr,
+             uint8_t            * a_data_ptr,
+             uint32_t             a_size)
+{
+    #ifdef MQTT_INSTRUMENTATION
+        uint8_t type = a_data_ptr[0] >> 4; /* Gathering may move the data */
+    #endif
+
+    int ret;
+
+    if (NULL != a_shared_ptr->gather.buffer) {
+        ret = mqtt_gather(a_shared_ptr, a_data_ptr, a_size);
+    } else if (NULL != a_shared_ptr->coalesce.buffer) {
+        MQTT_iovec_t iov = {a_data_ptr, a_size};
+        ret = mqtt_coalesce(a_shared_ptr, &iov, 1, a_size);
+    } else {
+        ret = a_shared_ptr->out_fptr(a_shared_ptr, a_data_ptr, a_size);
+    }
+
+    #ifdef MQTT_INSTRUMENTATION
+        if (ret == (int)a_size)
+            MQTT_COUNT_OUT(a_shared_ptr, type, a_size, 1);
+    #endif
+    return ret;
+}
+
+int mqtt_outv(MQTT_shared_data_t * a_shared_ptr,
+              MQTT_iovec_t       * a_iov_ptr,
+              uint32_t             a_iov_cnt)
+{
+    int ret;
+
+    if (NULL != a_shared_ptr->coalesce.buffer) {
+        uint32_t size = 0;
+        for (uint32_t i = 0; i < a_iov_cnt; i++)
+            size += (uint32_t)a_iov_ptr[i].size;
+        ret = mqtt_coalesce(a_shared_ptr, a_iov_ptr, a_iov_cnt, size);
+    } else {
+        ret = a_shared_ptr->outv_fptr(a_shared_ptr, a_iov_ptr, a_iov_cnt);
+    }
+
+    #ifdef MQTT_INSTRUMENTATION
+        if (0 < ret)
+            MQTT_COUNT_OUT(a_shared_ptr, a_iov_ptr[0].data[0] >> 4, (uint32_t)ret, 1);
+    #endif
+    return ret;
+}
+
+#ifdef MQTT_INSTRUMENTATION
+uint16_t mqtt_histogram_bucket(uint32_t a_value_in_us)
+{
+    const uint32_t sub_cnt = 1u << MQTT_HISTOGRAM_SUB_BITS;
+
+    if (a_value_in_us < sub_cnt)
+        return (uint16_t)a_value_in_us;
+
+    /* Highest set bit selects the power of two, next 3 bits the sub-bucket */
+    uint32_t msb = 31u - (uint32_t)__builtin_clz(a_value_in_us);
+    uint32_t idx = (msb - MQTT_HISTOGRAM_SUB_BITS + 1) * sub_cnt +
+                   ((a_value_in_us >> (msb - MQTT_HISTOGRAM_SUB_BITS)) & (sub_cnt - 1));
+
+    return (uint16_t)((idx < MQTT_HISTOGRAM_BUCKETS) ? idx : (MQTT_HISTOGRAM_BUCKETS - 1));
+}
+
+void mqtt_histogram_record(MQTT_histogram_t * a_histogram_ptr,
+                           uint32_t           a_value_in_us)
+{
+    if ((0             == a_histogram_ptr->count) ||
+        (a_value_in_us <  a_histogram_ptr->min_in_us))
+        a_histogram_ptr->min_in_us = a_value_in_us;
+
+    if (a_value_in_us > a_histogram_ptr->max_in_us)
+        a_histogram_ptr->max_in_us = a_value_in_us;
+
+    a_histogram_ptr->count++;
+    a_histogram_ptr->sum_in_us += a_value_in_us;
+    a_histogram_ptr->buckets[mqtt_histogram_bucket(a_value_in_us)]++;
+}
+
+void mqtt_latency_stop(MQTT_histogram_t * a_histogram_ptr,
+                       uint32_t         * a_start_ptr)
+{
+    if (0 == *a_start_ptr)
+        return;
+
+    /* Unsigned difference is right also when the clock wrapped around */
+    mqtt_histogram_record(a_histogram_ptr, mqtt_time_us() - *a_start_ptr);
+    *a_start_ptr = 0;
+}
+
+void mqtt_packet_count(MQTT_packet_counter_t * a_counters_ptr,
+                       uint8_t                 a_type,
+                       uint32_t                a_bytes,
+                       uint32_t                a_packets)
+{
+    if (MAXCMD <= a_type)
+        return;
+
+    a_counters_ptr[a_type].packets += a_packets;
+    a_counters_ptr[a_type].bytes   += a_bytes;
+}
+#endif /* MQTT_INSTRUMENTATION */
+
+bool mqtt_instrumentation_snapshot(MQTT_shared_data_t     * a_shared_ptr,
+                                   MQTT_instrumentation_t * a_snapshot_ptr,
+                                   bool                     a_reset)
+{
+    #ifdef MQTT_INSTRUMENTATION
+        if ((NULL == a_shared_ptr) ||
+            (NULL == a_snapshot_ptr))
+            return false;
+
+        mqtt_memcpy(a_snapshot_ptr, &(a_shared_ptr->instrumentation), sizeof(MQTT_instrumentation_t));
+
+        if (true == a_reset) {
+            /* Requests waiting their ack are still measured */
+            mqtt_memset(a_shared_ptr->instrumentation.histograms, 0, sizeof(a_shared_ptr->instrumentation.histograms));
+            mqtt_memset(a_shared_ptr->instrumentation.in,         0, sizeof(a_shared_ptr->instrumentation.in));
+            mqtt_memset(a_shared_ptr->instrumentation.out,        0, sizeof(a_shared_ptr->instrumentation.out));
+        }
+        return true;
+    #else
+        a_shared_ptr   = a_shared_ptr;
+        a_snapshot_ptr = a_snapshot_ptr;
+        a_reset        = a_reset;
+        return false;
+    #endif
+}
+
+uint32_t mqtt_histogram_percentile(const MQTT_histogram_t * a_histogram_ptr,
+                                   uint16_t                 a_permille)
+{
+    if ((NULL == a_histogram_ptr) ||
+        (0    == a_histogram_ptr->count))
+        return 0;
+
+    if (1000 < a_permille)
+        a_permille = 1000;
+
+    /* Rank of the sample, rounded up so that p100 is the last sample */
+    uint64_t rank = ((uint64_t)a_histogram_ptr->count * a_permille + 999) / 1000;
+    uint64_t seen = 0;
+
+    if (0 == rank)
+        rank = 1;
+
+    for (uint32_t i = 0; i < MQTT_HISTOGRAM_BUCKETS; i++) {
+        seen += a_histogram_ptr->buckets[i];
+        if (seen >= rank) {
+            const uint32_t sub_cnt = 1u << MQTT_HISTOGRAM_SUB_BITS;
+            uint32_t       upper;
+
+            if (i < sub_cnt) {
+                upper = i;
+            } else {
+                /* Bucket i covers [base, base + step), see mqtt_histogram_bucket */
+                uint32_t shift = i / sub_cnt - 1;
+                uint32_t base  = (sub_cnt + i % sub_cnt) << shift;
+                upper = base + (1u << shift) - 1;
+            }
+            /* Last bucket is open, max is the only known upper bound */
+            if ((upper > a_histogram_ptr->max_in_us) ||
+                (MQTT_HISTOGRAM_BUCKETS - 1 == i))
+                upper = a_histogram_ptr->max_in_us;
+            return upper;
+        }
+    }
+    return a_histogram_ptr->max_in_us;
+}
+
+/************************************************************************************************************
+ *                                                                                                          *
+ * \subsection ParsInput Parse input stream                                                                 *
+ *                                                                                                          *
+ * Function decode fixed header from input stream to find out details of received message.                  *
+ * Appropriate funciton is called to decode received message successfully.                                  *
+ *                                                                                                          *
+ ************************************************************************************************************/
+MQTTErrorCodes_t mqtt_parse_input_stream(MQTT_shared_data_t * a_shared_ptr,
+                                         uint8_t            * a_input_ptr,
+                                         uint32_t             a_input_size,
+                                         uint32_t           * a_message_size_ptr)
+{
+    MQTTErrorCodes_t   status = InvalidArgument;
+    MQTT_packet_view_t view;
+
+    if ((NULL == a_shared_ptr) ||
+        (NULL == a_input_ptr)  ||
+        (NULL == a_message_size_ptr))
+        return InvalidArgument;
+
+    /* Decode and validate the whole packet, views point into the input */
+    *a_message_size_ptr = 0;
+    status = mqtt_packet_view(a_input_ptr, a_input_size, &view);
+    if (Successfull != status) {
+        /* Subscriber hears about a malformed publish */
+        if ((InvalidArgument == status)                                &&
+            (PUBLISH         == (MQTTMessageType_t)(a_input_ptr[0] >> 4)) &&
+            (NULL            != a_shared_ptr->subscribe_cb_fptr))
+            a_shared_ptr->subscribe_cb_fptr(a_shared_ptr, status, NULL, 0, NULL, 0);
+        return status;
+    }
+    status = InvalidArgument;
+
+    *a_message_size_ptr = view.body.len;
+    MQTT_COUNT_IN(a_shared_ptr, view.type, view.packet_size);
+
+    /* Check message type to and take appropriate action. */
+    switch (view.type)
+    {
+        case CONNACK:
             {
                 uint8_t connection_state;
-                if (NULL != decode_variable_header_conack(next_header_ptr, &connection_state)) {
+                if (NULL != decode_variable_header_conack(view.body.ptr, &connection_state)) {
+
+                    MQTT_LATENCY_STOP(a_shared_ptr, connect_sent_in_us, HISTOGRAM_CONNECT);
 
                     if (Successfull == connection_state) {
-                        g_shared_data->state = STATE_CONNECTED;
+                        a_shared_ptr->state            = STATE_CONNECTED;
+                        a_shared_ptr->session_accepted = true;
                         status = Successfull;
 
+                        /* Messages stored while offline go out in one burst */
+                        if (NULL != a_shared_ptr->store)
+                            mqtt_store_flush(a_shared_ptr, a_shared_ptr->buffer, a_shared_ptr->buffer_size);
+
                     } else {
-                        g_shared_data->state = STATE_DISCONNECTED;
+                        a_shared_ptr->state            = STATE_DISCONNECTED;
+                        a_shared_ptr->session_accepted = false;
                         status = Successfull;
                     }
 
-                    if (NULL != g_shared_data->connected_cb_fptr)
-                        g_shared_data->connected_cb_fptr(connection_state);
+                    if (NULL != a_shared_ptr->connected_cb_fptr)
+                        a_shared_ptr->connected_cb_fptr(a_shared_ptr, connection_state);
                     #ifdef DEBUG
                         else
                             mqtt_printf("%s %u Connection callback is NULL\n", __FILE__, __LINE__);
                     #endif
+
+                    mqtt_complete(a_shared_ptr, &(a_shared_ptr->connect_status));
                 }
                 #ifdef DEBUG
                     else
@@ -1441,61 +3754,87 @@ MQTTErrorCodes_t mqtt_parse_input_stream(uint8_t  * a_input_ptr,
 
         case PUBLISH:
             {
-                uint8_t * topic_ptr    = NULL;
-                uint16_t  topic_length = 0;
-                uint8_t * message_ptr  = NULL;
-                uint32_t  message_size = 0;
-
-                if (decode_publish(next_header_ptr,
-                                   * a_message_size_ptr,
-                                   qos,
-                                   &topic_ptr,
-                                   &topic_length,
-                                   &message_ptr,
-                                   &message_size)){
-
-                    if (NULL != g_shared_data->subscribe_cb_fptr)
-                        g_shared_data->subscribe_cb_fptr(Successfull,
-                                                         message_ptr,
-                                                         message_size,
-                                                         topic_ptr,
-                                                         topic_length);
-                    #ifdef DEBUG
-                        else
-                            mqtt_printf("%s %u Subscribe callback is not set\n",
-                                        __FILE__,
-                                        __LINE__);
-                    #endif
-                    status = Successfull;
-                } else {
-                    if (NULL != g_shared_data->subscribe_cb_fptr)
-                        g_shared_data->subscribe_cb_fptr(status, NULL, 0, NULL, 0);
+                uint8_t        * topic_ptr    = view.topic.ptr;
+                uint16_t         topic_length = (uint16_t)view.topic.len;
+                uint8_t        * message_ptr  = view.payload.ptr;
+                uint32_t         message_size = view.payload.len;
+                MQTTQoSLevel_t   qos          = view.qos;
+                uint16_t         packet_id    = view.packet_id;
+                MQTTErrorCodes_t accept       = mqtt_publish_accept(a_shared_ptr, qos, packet_id);
+
+                if (InflightWindowFull == accept) {
+                    status = accept;
+                    break;
                 }
+
+                #ifdef MQTT_INSTRUMENTATION
+                    uint32_t delivery_in_us = mqtt_time_us() | 1u;
+                #endif
+
+                if (DuplicatePublish == accept) {
+                    /* Delivered already, acknowledge again */
+                } else if (NULL != a_shared_ptr->receive_stream.chunk_fptr) {
+                    /* Streaming mode, whole packet is one chunk */
+                    if (NULL != a_shared_ptr->receive_stream.topic_fptr)
+                        a_shared_ptr->receive_stream.topic_fptr(a_shared_ptr, topic_ptr, topic_length, message_size);
+
+                    a_shared_ptr->receive_stream.chunk_fptr(a_shared_ptr, message_ptr, message_size);
+
+                    if (NULL != a_shared_ptr->receive_stream.complete_fptr)
+                        a_shared_ptr->receive_stream.complete_fptr(a_shared_ptr, Successfull);
+                } else if ((NULL != a_shared_ptr->topics) &&
+                           (0    <  mqtt_topic_dispatch(a_shared_ptr,
+                                                        a_shared_ptr->topics,
+                                                        topic_ptr,
+                                                        topic_length,
+                                                        message_ptr,
+                                                        message_size))) {
+                    /* Delivered to handlers of matching filters */
+                } else if (NULL != a_shared_ptr->subscribe_cb_fptr)
+                    a_shared_ptr->subscribe_cb_fptr(a_shared_ptr,
+                                                    Successfull,
+                                                    message_ptr,
+                                                    message_size,
+                                                    topic_ptr,
+                                                    topic_length);
+                #ifdef DEBUG
+                    else
+                        mqtt_printf("%s %u Subscribe callback is not set\n",
+                                    __FILE__,
+                                    __LINE__);
+                #endif
+
+                #ifdef MQTT_INSTRUMENTATION
+                    if (DuplicatePublish != accept)
+                        mqtt_latency_stop(&(a_shared_ptr->instrumentation.histograms[HISTOGRAM_CALLBACK]),
+                                          &delivery_in_us);
+                #endif
+
+                status = mqtt_publish_received(a_shared_ptr, qos, packet_id);
                 break;
             }
 
         case SUBACK:
-            {
-				decode_variable_header_suback(a_input_ptr, &status);
-				if (NULL != g_shared_data) {
-
-					if (NULL != g_shared_data->subscribe_cb_fptr) {
-						if (true == status) {
-							g_shared_data->subscribe_cb_fptr(Successfull, NULL, 0, NULL, 0);
-							status = Successfull;
-						}
-						else {
-							g_shared_data->subscribe_cb_fptr(PublishDecodeError, NULL, 0, NULL, 0);
-						}
-					}
-				}
-            }
+        case UNSUBACK:
+            status = mqtt_subscribe_ack(a_shared_ptr, view.type, view.body.ptr, view.body.len);
             break;
 
         case PINGRESP:
+            MQTT_LATENCY_STOP(a_shared_ptr, ping_sent_in_us, HISTOGRAM_PING);
+            a_shared_ptr->ping.ping_outstanding = false;
             status = Successfull;
             break;
 
+        case PUBACK:
+        case PUBREC:
+        case PUBCOMP:
+            status = mqtt_inflight_ack(a_shared_ptr, view.type, view.packet_id);
+            break;
+
+        case PUBREL:
+            status = mqtt_publish_release(a_shared_ptr, view.packet_id);
+            break;
+
         default:
             status = InvalidArgument;
             break;
@@ -1503,6 +3842,307 @@ MQTTErrorCodes_t mqtt_parse_input_stream(uint8_t  * a_input_ptr,
     return status;
 }
 
+/************************************************************************************************************
+ *                                                                                                          *
+ * \subsection ParseChunk Parse input chunk                                                                 *
+ *                                                                                                          *
+ * Input framer takes any chunk of the received stream. Complete packets are parsed directly from the       *
+ * given chunk. Packets split over several chunks are collected into the reassembly buffer and parsed when  *
+ * the last byte has been received.                                                                         *
+ *                                                                                                          *
+ ************************************************************************************************************/
+void mqtt_framer_reset(MQTT_input_framer_t * a_framer_ptr)
+{
+    a_framer_ptr->fill           = 0;
+    a_framer_ptr->packet_size    = 0;
+    a_framer_ptr->discard        = 0;
+    a_framer_ptr->stream_payload = false;
+    a_framer_ptr->stream_left    = 0;
+    a_framer_ptr->stream_qos     = QoS0;
+    a_framer_ptr->stream_id      = 0;
+}
+
+uint32_t mqtt_stream_header_size(MQTT_input_framer_t * a_framer_ptr)
+{
+    uint32_t  remaining_size = 0;
+    uint8_t * variable_ptr   = get_size(a_framer_ptr->buffer, &remaining_size);
+
+    if (NULL == variable_ptr)
+        return 0;
+
+    uint32_t header_size = (variable_ptr - a_framer_ptr->buffer) + sizeof(uint16_t);
+
+    if (a_framer_ptr->fill < header_size)
+        return header_size; /* Topic length not yet known */
+
+    header_size += ((uint16_t)(variable_ptr[0]) << 8) | variable_ptr[1];
+
+    if (QoS0 < ((a_framer_ptr->buffer[0] >> 1) & 0x03)) /* Packet identifier */
+        header_size += sizeof(uint16_t);
+
+    return header_size;
+}
+
+MQTTErrorCodes_t mqtt_parse_input_batch(MQTT_shared_data_t * a_shared_ptr,
+                                        uint8_t            * a_input_ptr,
+                                        uint32_t             a_input_size,
+                                        uint32_t           * a_consumed_size_ptr)
+{
+    MQTTErrorCodes_t status   = Successfull;
+    uint32_t         consumed = 0;
+
+    if ((NULL == a_shared_ptr) ||
+        (NULL == a_input_ptr)  ||
+        (NULL == a_consumed_size_ptr))
+        return InvalidArgument;
+
+    while (consumed < a_input_size) {
+        uint32_t packet_size = 0;
+        MQTTErrorCodes_t ret = get_packet_size(&(a_input_ptr[consumed]),
+                                               a_input_size - consumed,
+                                               &packet_size);
+
+        if ((PacketIncomplete == ret) ||
+            ((Successfull == ret) && (packet_size > (a_input_size - consumed))))
+            break; /* Tail is incomplete packet */
+
+        if (Successfull != ret) {
+            status = ret;
+            break;
+        }
+
+        uint32_t message_size = 0;
+        ret = mqtt_parse_input_stream(a_shared_ptr, &(a_input_ptr[consumed]), packet_size, &message_size);
+        if ((Successfull != ret) &&
+            (Successfull == status))
+            status = ret;
+
+        consumed += packet_size;
+    }
+
+    *a_consumed_size_ptr = consumed;
+    return status;
+}
+
+MQTTErrorCodes_t mqtt_parse_input_chunk(MQTT_shared_data_t * a_shared_ptr,
+                                        uint8_t            * a_input_ptr,
+                                        uint32_t             a_input_size)
+{
+    MQTTErrorCodes_t status = Successfull;
+
+    if ((NULL == a_shared_ptr) ||
+        (NULL == a_input_ptr))
+        return InvalidArgument;
+
+    MQTT_input_framer_t * framer = &(a_shared_ptr->framer);
+
+    while (0 < a_input_size) {
+
+        /* Skip rest of a packet which did not fit into reassembly buffer */
+        if (0 < framer->discard) {
+            uint32_t skip = (framer->discard < a_input_size) ? framer->discard : a_input_size;
+            framer->discard -= skip;
+            a_input_ptr     += skip;
+            a_input_size    -= skip;
+            continue;
+        }
+
+        MQTTErrorCodes_t ret;
+
+        if (0 == framer->fill) {
+            /* Nothing collected - parse complete packets directly from input without copying */
+            uint32_t consumed = 0;
+            ret = mqtt_parse_input_batch(a_shared_ptr, a_input_ptr, a_input_size, &consumed);
+            if ((Successfull != ret) &&
+                (Successfull == status))
+                status = ret;
+
+            a_input_ptr  += consumed;
+            a_input_size -= consumed;
+
+            if (0 == a_input_size)
+                break;
+        }
+
+        /* Streamed PUBLISH payload goes straight to the application */
+        if (true == framer->stream_payload) {
+            uint32_t pass = (framer->stream_left < a_input_size) ? framer->stream_left : a_input_size;
+
+            a_shared_ptr->receive_stream.chunk_fptr(a_shared_ptr, a_input_ptr, pass);
+            framer->stream_left -= pass;
+            a_input_ptr         += pass;
+            a_input_size        -= pass;
+
+            if (0 == framer->stream_left) {
+                if (NULL != a_shared_ptr->receive_stream.complete_fptr)
+                    a_shared_ptr->receive_stream.complete_fptr(a_shared_ptr, Successfull);
+                ret = mqtt_publish_received(a_shared_ptr, framer->stream_qos, framer->stream_id);
+                if ((Successfull != ret) &&
+                    (Successfull == status))
+                    status = ret;
+                mqtt_framer_reset(framer);
+            }
+            continue;
+        }
+
+        /* Partial packet - collect it into reassembly buffer */
+        if ((NULL == framer->buffer) ||
+            (sizeof(MQTT_fixed_header_t) > framer->buffer_size)) {
+            #ifdef DEBUG
+                mqtt_printf("%s %u No reassembly buffer for split packet\n", __FILE__, __LINE__);
+            #endif
+            mqtt_framer_reset(framer);
+            return BufferOverflow;
+        }
+
+        if (0 == framer->packet_size) {
+            /* Fixed header is not complete, collect it byte by byte */
+            framer->buffer[framer->fill++] = *a_input_ptr++;
+            a_input_size--;
+
+            /* Framer is packed, size goes through an aligned local */
+            uint32_t packet_size = 0;
+            ret = get_packet_size(framer->buffer, framer->fill, &packet_size);
+            if (InvalidArgument == ret) {
+                mqtt_framer_reset(framer);
+                return InvalidArgument;
+            }
+            framer->packet_size = packet_size;
+
+            /* Streamed PUBLISH needs only its headers in the buffer, checked later */
+            bool stream = ((NULL    != a_shared_ptr->receive_stream.chunk_fptr) &&
+                           (PUBLISH == (framer->buffer[0] >> 4)));
+
+            if ((Successfull == ret) &&
+                (false == stream) &&
+                (framer->packet_size > framer->buffer_size)) {
+                #ifdef DEBUG
+                    mqtt_printf("%s %u Packet too big for reassembly buffer %u\n",
+                                __FILE__,
+                                __LINE__,
+                                framer->packet_size);
+                #endif
+                framer->discard     = framer->packet_size - framer->fill;
+                framer->fill        = 0;
+                framer->packet_size = 0;
+                status              = BufferOverflow;
+                continue;
+            }
+        } else {
+            uint32_t collect = framer->packet_size;
+            bool     stream  = ((NULL    != a_shared_ptr->receive_stream.chunk_fptr) &&
+                                (PUBLISH == (framer->buffer[0] >> 4)));
+
+            if (true == stream) {
+                /* Collect headers only */
+                collect = mqtt_stream_header_size(framer);
+
+                if ((0 == collect) ||
+                    (collect > framer->packet_size)) {
+                    mqtt_framer_reset(framer);
+                    return InvalidArgument;
+                }
+
+                if (collect > framer->buffer_size) {
+                    #ifdef DEBUG
+                        mqtt_printf("%s %u Headers too big for reassembly buffer %u\n",
+                                    __FILE__,
+                                    __LINE__,
+                                    collect);
+                    #endif
+                    framer->discard     = framer->packet_size - framer->fill;
+                    framer->fill        = 0;
+                    framer->packet_size = 0;
+                    status              = BufferOverflow;
+                    continue;
+                }
+            }
+
+            uint32_t copy = collect - framer->fill;
+            if (copy > a_input_size)
+                copy = a_input_size;
+
+            mqtt_memcpy(&(framer->buffer[framer->fill]), a_input_ptr, copy);
+            framer->fill += copy;
+            a_input_ptr  += copy;
+            a_input_size -= copy;
+
+            if ((true == stream) &&
+                (framer->fill == collect) &&
+                (collect == mqtt_stream_header_size(framer))) {
+
+                /* Headers complete - topic is given and rest of packet is payload */
+                MQTT_packet_view_t view;
+                uint32_t           payload_size = framer->packet_size - framer->fill;
+                uint32_t           remaining_size;
+                uint8_t          * variable_ptr = get_size(framer->buffer, &remaining_size);
+
+                framer->stream_qos = (MQTTQoSLevel_t)((framer->buffer[0] >> 1) & 0x03);
+                if (Successfull != mqtt_view_publish(variable_ptr,
+                                                     collect - (uint32_t)(variable_ptr - framer->buffer),
+                                                     framer->stream_qos,
+                                                     &view)) {
+                    if (Successfull == status)
+                        status = InvalidArgument;
+                    mqtt_framer_reset(framer);
+                    framer->discard = payload_size;
+                    continue;
+                }
+
+                uint8_t  * topic_ptr    = view.topic.ptr;
+                uint16_t   topic_length = (uint16_t)view.topic.len;
+                framer->stream_id = view.packet_id;
+
+                MQTT_COUNT_IN(a_shared_ptr, PUBLISH, framer->packet_size);
+
+                ret = mqtt_publish_accept(a_shared_ptr, framer->stream_qos, framer->stream_id);
+                if (Successfull != ret) {
+                    /* Duplicate is acknowledged again, payload is skipped in both cases */
+                    if (DuplicatePublish == ret)
+                        ret = mqtt_publish_received(a_shared_ptr, framer->stream_qos, framer->stream_id);
+                    if ((Successfull != ret) &&
+                        (Successfull == status))
+                        status = ret;
+                    mqtt_framer_reset(framer);
+                    framer->discard = payload_size;
+                    continue;
+                }
+
+                if (NULL != a_shared_ptr->receive_stream.topic_fptr)
+                    a_shared_ptr->receive_stream.topic_fptr(a_shared_ptr, topic_ptr, topic_length, payload_size);
+
+                if (0 < payload_size) {
+                    framer->stream_payload = true;
+                    framer->stream_left    = payload_size;
+                } else {
+                    if (NULL != a_shared_ptr->receive_stream.complete_fptr)
+                        a_shared_ptr->receive_stream.complete_fptr(a_shared_ptr, Successfull);
+                    ret = mqtt_publish_received(a_shared_ptr, framer->stream_qos, framer->stream_id);
+                    if ((Successfull != ret) &&
+                        (Successfull == status))
+                        status = ret;
+                    mqtt_framer_reset(framer);
+                }
+                continue;
+            }
+        }
+
+        if ((0 < framer->packet_size) &&
+            (framer->fill == framer->packet_size)) {
+
+            uint32_t message_size = 0;
+            ret = mqtt_parse_input_stream(a_shared_ptr, framer->buffer, framer->fill, &message_size);
+            if ((Successfull != ret) &&
+                (Successfull == status))
+                status = ret;
+
+            framer->fill        = 0;
+            framer->packet_size = 0;
+        }
+    }
+    return status;
+}
+
 /************************************************************************************************************
  *                                                                                                          *
  * \subsection API MQTT API functions                                                                       *
@@ -1510,56 +4150,88 @@ MQTTErrorCodes_t mqtt_parse_input_stream(uint8_t  * a_input_ptr,
  * External software components uses services of this library through these API functions.                  *
  *                                                                                                          *
  ************************************************************************************************************/
-MQTTErrorCodes_t mqtt(MQTTAction_t         a_action,
+MQTTErrorCodes_t mqtt(MQTT_shared_data_t * a_shared_ptr,
+                      MQTTAction_t         a_action,
                       MQTT_action_data_t * a_action_ptr)
 {
         MQTTErrorCodes_t status = InvalidArgument;
 
+        if (NULL == a_shared_ptr)
+            return InvalidArgument;
+
+        /* Open publish stream owns the output, nothing else may be sent in between */
+        if (true == a_shared_ptr->publish_stream.open) {
+            switch (a_action)
+            {
+                case ACTION_KEEPALIVE:
+                    return PingNotSend;
+                case ACTION_DISCONNECT:
+                case ACTION_CONNECT:
+                case ACTION_CONNECT_PIPELINED:
+                case ACTION_PUBLISH:
+                case ACTION_SUBSCRIBE:
+                case ACTION_SUBSCRIBE_LIST:
+                case ACTION_UNSUBSCRIBE_LIST:
+                case ACTION_PUBLISH_PREPARED:
+                case ACTION_PUBLISH_BEGIN:
+                    return PublishStreamOpen;
+                default:
+                    break;
+            }
+        }
+
         switch (a_action)
         {
             case ACTION_INIT:
-                if (NULL != a_action_ptr) {
-
-                    g_shared_data                          = a_action_ptr->action_argument.shared_ptr;
-                    g_shared_data->state                   = STATE_DISCONNECTED;
-                    g_shared_data->mqtt_packet_cntr        = 0;
-                    g_shared_data->keepalive_in_ms         = 0;
-                    g_shared_data->time_to_next_ping_in_ms = 0;
-                    status = Successfull;
-                }
+                mqtt_session_reset(a_shared_ptr);
+                a_shared_ptr->mqtt_packet_cntr             = 0;
+                a_shared_ptr->outv_fptr                    = NULL;
+                a_shared_ptr->receive_stream.topic_fptr    = NULL;
+                a_shared_ptr->receive_stream.chunk_fptr    = NULL;
+                a_shared_ptr->receive_stream.complete_fptr = NULL;
+                a_shared_ptr->store                        = NULL;
+                a_shared_ptr->topics                       = NULL;
+                a_shared_ptr->coalesce.buffer              = NULL;
+                mqtt_completion_lock_init(&(a_shared_ptr->completion_lock));
+                #ifdef MQTT_INSTRUMENTATION
+                    mqtt_memset(&(a_shared_ptr->instrumentation), 0, sizeof(MQTT_instrumentation_t));
+                #endif
+                status = Successfull;
                 break;
 
             case ACTION_DISCONNECT:
-                if ((NULL               != g_shared_data) &&
-                    (STATE_DISCONNECTED != g_shared_data->state))
-                    status = mqtt_disconnect_(g_shared_data->out_fptr);
+                if (STATE_DISCONNECTED != a_shared_ptr->state)
+                    status = mqtt_disconnect_(a_shared_ptr);
                 else
                     status = NoConnection;
                 break;
 
             case ACTION_CONNECT:
-                if ((NULL != g_shared_data) &&
-                    (NULL != a_action_ptr)) {
-                    if (g_shared_data->state == STATE_DISCONNECTED) {
-                        status = mqtt_connect_(g_shared_data->buffer,
-                                               g_shared_data->buffer_size,
+                if (NULL != a_action_ptr) {
+                    if (a_shared_ptr->state == STATE_DISCONNECTED) {
+                        a_shared_ptr->connect_status   = false;
+                        a_shared_ptr->session_accepted = false;
+                        status = mqtt_connect_(a_shared_ptr,
+                                               a_shared_ptr->buffer,
+                                               a_shared_ptr->buffer_size,
                                                NULL,
-                                               g_shared_data->out_fptr,
                                                a_action_ptr->action_argument.connect_ptr,
                                                false);
 
                         if (Successfull == status) {
 
                             if (0 != a_action_ptr->action_argument.connect_ptr->keepalive) {
-                                g_shared_data->keepalive_in_ms  = (a_action_ptr->action_argument.connect_ptr->keepalive) * 1000;
-                                g_shared_data->keepalive_in_ms -= 500;
+                                a_shared_ptr->keepalive_in_ms  = (a_action_ptr->action_argument.connect_ptr->keepalive) * 1000;
+                                a_shared_ptr->keepalive_in_ms -= 500;
                             } else {
-                                g_shared_data->keepalive_in_ms = INT32_MIN;
+                                a_shared_ptr->keepalive_in_ms = INT32_MIN;
                             }
-                            g_shared_data->time_to_next_ping_in_ms = 0; /* Send Ping immediatelly*/
-                            g_shared_data->state = STATE_CONNECTED;
+                            a_shared_ptr->time_to_next_ping_in_ms = 0; /* Send Ping immediatelly*/
+                            a_shared_ptr->ping.ping_outstanding   = false;
+                            a_shared_ptr->ping.clock_in_ms        = mqtt_time_ms();
+                            a_shared_ptr->state = STATE_CONNECTED;
                         } else {
-                            g_shared_data->state = STATE_DISCONNECTED;
+                            a_shared_ptr->state = STATE_DISCONNECTED;
                         }
                     } else {
                         status = AllreadyConnected;
@@ -1567,13 +4239,35 @@ MQTTErrorCodes_t mqtt(MQTTAction_t         a_action,
                 }
                 break;
 
+            case ACTION_CONNECT_PIPELINED:
+                if (NULL != a_action_ptr) {
+                    a_shared_ptr->session_accepted = false;
+                    if (a_shared_ptr->state == STATE_DISCONNECTED)
+                        status = mqtt_connect_pipelined_(a_shared_ptr, a_action_ptr->action_argument.pipeline_ptr);
+                    else
+                        status = AllreadyConnected;
+                }
+                break;
+
             case ACTION_PUBLISH:
-                if ((NULL            != g_shared_data)        &&
-                    (STATE_CONNECTED == g_shared_data->state) &&
+                if ((STATE_CONNECTED == a_shared_ptr->state) &&
                     (NULL            != a_action_ptr)) {
 
-                        uint8_t * message_buffer      = g_shared_data->buffer;
-                        uint32_t  message_buffer_size = g_shared_data->buffer_size;
+                        uint8_t               * message_buffer      = a_shared_ptr->buffer;
+                        uint32_t                message_buffer_size = a_shared_ptr->buffer_size;
+                        MQTT_publish_t        * publish_ptr         = a_action_ptr->action_argument.publish_ptr;
+                        MQTT_inflight_entry_t * entry               = NULL;
+                        uint16_t                packet_id           = 0;
+
+                        if (QoS0 < publish_ptr->flags.qos) {
+                            packet_id = mqtt_next_packet_id(a_shared_ptr);
+
+                            /* Reserve before sending, PUBACK may arrive before encode returns */
+                            if (false == mqtt_inflight_reserve(a_shared_ptr, publish_ptr, packet_id, &entry)) {
+                                status = InflightWindowFull;
+                                break;
+                            }
+                        }
 
                         /* Use special buffer, not the shared one */
                         if ((NULL != a_action_ptr->action_argument.publish_ptr->output_buffer_ptr) &&
@@ -1582,7 +4276,7 @@ MQTTErrorCodes_t mqtt(MQTTAction_t         a_action,
                                message_buffer = a_action_ptr->action_argument.publish_ptr->output_buffer_ptr;
                                message_buffer_size = a_action_ptr->action_argument.publish_ptr->output_buffer_size;
                            }
-                       if (true == encode_publish(g_shared_data->out_fptr,
+                       if (true == encode_publish(a_shared_ptr,
                                                    message_buffer,
                                                    message_buffer_size,
                                                    a_action_ptr->action_argument.publish_ptr->flags.retain,
@@ -1590,61 +4284,213 @@ MQTTErrorCodes_t mqtt(MQTTAction_t         a_action,
                                                    false, /* a_action_ptr->action_argument.publish_ptr->flags.dup,*/
                                                    a_action_ptr->action_argument.publish_ptr->topic_ptr,
                                                    a_action_ptr->action_argument.publish_ptr->topic_length,
-                                                   g_shared_data->mqtt_packet_cntr++,
+                                                   packet_id,
                                                    a_action_ptr->action_argument.publish_ptr->message_buffer_ptr,
                                                    a_action_ptr->action_argument.publish_ptr->message_buffer_size)) {
 
-                            g_shared_data->time_to_next_ping_in_ms = g_shared_data->keepalive_in_ms;
+                            publish_ptr->packet_identifier = packet_id;
+
+                            a_shared_ptr->time_to_next_ping_in_ms = a_shared_ptr->keepalive_in_ms;
                             status = Successfull;
-                        }
-                        #ifdef DEBUG
-                            else {
-                               mqtt_printf("%s %u Publish encode failed\n", __FILE__, __LINE__);
+                        } else {
+                            if (NULL != entry) {
+                                entry->state = INFLIGHT_FREE;
+                                a_shared_ptr->inflight->used--;
                             }
-                        #endif
+                            #ifdef DEBUG
+                               mqtt_printf("%s %u Publish encode failed\n", __FILE__, __LINE__);
+                            #endif
+                        }
                 }
                 break;
 
-            case ACTION_SUBSCRIBE:
+            case ACTION_PUBLISH_PREPARED:
+                if ((STATE_CONNECTED == a_shared_ptr->state) &&
+                    (NULL            != a_action_ptr)) {
+
+                    MQTT_prepared_publish_t * prepared_ptr = a_action_ptr->action_argument.prepared_ptr;
+                    MQTT_inflight_entry_t   * entry        = NULL;
+                    uint16_t                  packet_id    = 0;
+
+                    if (QoS0 < prepared_ptr->qos) {
+                        /* Window refers the topic inside the prepared buffer */
+                        MQTT_publish_t publish;
+                        publish.flags.qos           = prepared_ptr->qos;
+                        publish.flags.retain        = prepared_ptr->retain;
+                        publish.topic_ptr           = &(prepared_ptr->buffer[MQTT_PREPARED_HEADER_ROOM + sizeof(uint16_t)]);
+                        publish.topic_length        = prepared_ptr->topic_length;
+                        publish.message_buffer_ptr  = prepared_ptr->message_ptr;
+                        publish.message_buffer_size = prepared_ptr->message_size;
+
+                        packet_id = mqtt_next_packet_id(a_shared_ptr);
+                        if (false == mqtt_inflight_reserve(a_shared_ptr, &publish, packet_id, &entry)) {
+                            status = InflightWindowFull;
+                            break;
+                        }
+                    }
+
+                    if (true == encode_publish_prepared(a_shared_ptr, prepared_ptr, packet_id)) {
+                        prepared_ptr->packet_identifier       = packet_id;
+                        a_shared_ptr->time_to_next_ping_in_ms = a_shared_ptr->keepalive_in_ms;
+                        status = Successfull;
+                    } else if (NULL != entry) {
+                        entry->state = INFLIGHT_FREE;
+                        a_shared_ptr->inflight->used--;
+                    }
+                }
+                break;
 
-                if ((NULL            != g_shared_data) &&
-                    (STATE_CONNECTED == g_shared_data->state) &&
+            case ACTION_PUBLISH_BEGIN:
+                if ((STATE_CONNECTED == a_shared_ptr->state) &&
                     (NULL            != a_action_ptr)) {
 
-                        if (true == encode_subscribe(g_shared_data->out_fptr,
-                                                     g_shared_data->buffer,
-                                                     g_shared_data->buffer_size,
-                                                     a_action_ptr->action_argument.subscribe_ptr->qos,
-                                                     a_action_ptr->action_argument.subscribe_ptr->topic_ptr,
-                                                     a_action_ptr->action_argument.subscribe_ptr->topic_length,
-                                                     g_shared_data->mqtt_packet_cntr++)) {
+                    MQTT_publish_t        * publish_ptr = a_action_ptr->action_argument.publish_ptr;
+                    MQTT_inflight_entry_t * entry       = NULL;
+                    uint16_t                packet_id   = 0;
 
-                            g_shared_data->time_to_next_ping_in_ms = g_shared_data->keepalive_in_ms;
-                            status = Successfull;
-                            g_shared_data->subscribe_status = true;
+                    if (QoS0 < publish_ptr->flags.qos) {
+                        packet_id = mqtt_next_packet_id(a_shared_ptr);
+
+                        /* Tracked like ACTION_PUBLISH, entry has no payload to resend */
+                        publish_ptr->message_buffer_ptr = NULL;
+                        if (false == mqtt_inflight_reserve(a_shared_ptr, publish_ptr, packet_id, &entry)) {
+                            status = InflightWindowFull;
+                            break;
                         }
+                    }
+
+                    if (true == encode_publish_begin(a_shared_ptr,
+                                                     a_shared_ptr->buffer,
+                                                     a_shared_ptr->buffer_size,
+                                                     publish_ptr->flags.retain,
+                                                     publish_ptr->flags.qos,
+                                                     publish_ptr->topic_ptr,
+                                                     publish_ptr->topic_length,
+                                                     packet_id,
+                                                     publish_ptr->message_buffer_size)) {
+
+                        publish_ptr->packet_identifier        = packet_id;
+                        a_shared_ptr->time_to_next_ping_in_ms = a_shared_ptr->keepalive_in_ms;
+                        status = Successfull;
+                    } else if (NULL != entry) {
+                        entry->state = INFLIGHT_FREE;
+                        a_shared_ptr->inflight->used--;
+                    }
+                }
+                break;
+
+            case ACTION_PUBLISH_APPEND:
+                if ((STATE_CONNECTED == a_shared_ptr->state) &&
+                    (NULL            != a_action_ptr)) {
+
+                    status = encode_publish_append(a_shared_ptr,
+                                                   a_action_ptr->action_argument.publish_ptr->message_buffer_ptr,
+                                                   a_action_ptr->action_argument.publish_ptr->message_buffer_size);
+
+                    if (Successfull == status)
+                        a_shared_ptr->time_to_next_ping_in_ms = a_shared_ptr->keepalive_in_ms;
+                }
+                break;
+
+            case ACTION_PUBLISH_END:
+                if (false == a_shared_ptr->publish_stream.open) {
+                    status = InvalidArgument;
+                } else if (0 < a_shared_ptr->publish_stream.left) {
+                    status = PacketIncomplete;
+                } else {
+                    mqtt_publish_stream_acks(a_shared_ptr);
+                    a_shared_ptr->publish_stream.open = false;
+                    status = Successfull;
+                }
+                break;
+
+            case ACTION_SUBSCRIBE:
+            case ACTION_SUBSCRIBE_LIST:
+            case ACTION_UNSUBSCRIBE_LIST:
+
+                if ((STATE_CONNECTED == a_shared_ptr->state) &&
+                    (NULL            != a_action_ptr)) {
+
+                    MQTT_subscribe_list_t   single;
+                    MQTT_subscribe_list_t * list      = a_action_ptr->action_argument.subscribe_list_ptr;
+                    uint16_t                packet_id = mqtt_next_packet_id(a_shared_ptr);
+
+                    if (ACTION_SUBSCRIBE == a_action) {
+                        single.topics_ptr       = a_action_ptr->action_argument.subscribe_ptr;
+                        single.topic_cnt        = 1;
+                        single.return_codes_ptr = NULL;
+                        list = &single;
+                    }
+
+                    if (NULL == list)
+                        break;
+
+                    /* Pending before sending, ack can be handled by the reader task before encode returns */
+                    a_shared_ptr->subscribe_status                   = false;
+                    a_shared_ptr->subscribe_pending.packet_id        = packet_id;
+                    a_shared_ptr->subscribe_pending.return_codes_ptr = list->return_codes_ptr;
+                    a_shared_ptr->subscribe_pending.return_code_cnt  = list->topic_cnt;
+                    a_shared_ptr->subscribe_pending.result           = PacketIncomplete;
+
+                    if (true == encode_subscribe_list(a_shared_ptr,
+                                                      a_shared_ptr->buffer,
+                                                      a_shared_ptr->buffer_size,
+                                                      (ACTION_UNSUBSCRIBE_LIST == a_action) ? UNSUBSCRIBE : SUBSCRIBE,
+                                                      list->topics_ptr,
+                                                      list->topic_cnt,
+                                                      packet_id)) {
+
+                        a_shared_ptr->time_to_next_ping_in_ms = a_shared_ptr->keepalive_in_ms;
+                        status = Successfull;
+                    } else {
+                        a_shared_ptr->subscribe_pending.packet_id        = 0;
+                        a_shared_ptr->subscribe_pending.return_codes_ptr = NULL;
+                    }
                 }
                 break;
 
             case ACTION_KEEPALIVE:
                 if (NULL != a_action_ptr) {
-                    if (STATE_CONNECTED == g_shared_data->state) {
+                    if (STATE_CONNECTED == a_shared_ptr->state) {
+
+                        /* Connection is dead when PINGREQ is not answered before the deadline */
+                        if ((true == a_shared_ptr->ping.ping_outstanding) &&
+                            (mqtt_ping_deadline(a_shared_ptr) <= (mqtt_time_ms() - a_shared_ptr->ping.ping_sent_in_ms))) {
+                            status = mqtt_connection_lost(a_shared_ptr, PingTimeout);
+                            break;
+                        }
+
+                        /* Staged publishes do not wait longer than the max delay */
+                        if (false == mqtt_coalesce_tick(a_shared_ptr)) {
+                            status = ServerUnavailabe;
+                            break;
+                        }
+
+                        mqtt_inflight_tick(a_shared_ptr, a_action_ptr->action_argument.epalsed_time_in_ms);
 
-                        if (INT32_MIN != g_shared_data->keepalive_in_ms) {
+                        if (INT32_MIN != a_shared_ptr->keepalive_in_ms) {
 
-                            if (g_shared_data->time_to_next_ping_in_ms  > (int32_t) a_action_ptr->action_argument.epalsed_time_in_ms)
-                                g_shared_data->time_to_next_ping_in_ms -= (int32_t) a_action_ptr->action_argument.epalsed_time_in_ms;
+                            if (a_shared_ptr->time_to_next_ping_in_ms  > (int32_t) a_action_ptr->action_argument.epalsed_time_in_ms)
+                                a_shared_ptr->time_to_next_ping_in_ms -= (int32_t) a_action_ptr->action_argument.epalsed_time_in_ms;
                             else
-                                g_shared_data->time_to_next_ping_in_ms = 0;
-
-                            if ( 0 >= g_shared_data->time_to_next_ping_in_ms) {
-                                status = mqtt_ping_req(g_shared_data->out_fptr);
-                                if (Successfull == status)
-                                    g_shared_data->time_to_next_ping_in_ms = g_shared_data->keepalive_in_ms;
-                                #ifdef DBUG
-                                    else
+                                a_shared_ptr->time_to_next_ping_in_ms = 0;
+
+                            if (true == a_shared_ptr->ping.ping_outstanding) {
+                                status = PingNotSend; /* Previous one is still waiting PINGRESP */
+                            } else if ( 0 >= a_shared_ptr->time_to_next_ping_in_ms) {
+                                /* Mark before sending, PINGRESP may arrive before mqtt_ping_req returns */
+                                a_shared_ptr->ping.ping_sent_in_ms  = mqtt_time_ms();
+                                a_shared_ptr->ping.ping_outstanding = true;
+
+                                status = mqtt_ping_req(a_shared_ptr);
+                                if (Successfull == status) {
+                                    a_shared_ptr->time_to_next_ping_in_ms = a_shared_ptr->keepalive_in_ms;
+                                } else {
+                                    a_shared_ptr->ping.ping_outstanding = false;
+                                    #ifdef DBUG
                                         mqtt_printf("%s %u keep alive failed %u\n", __FILE__, __LINE__, status);
-                                #endif
+                                    #endif
+                                }
                             } else {
                                 status = PingNotSend;
                             }
@@ -1661,10 +4507,32 @@ MQTTErrorCodes_t mqtt(MQTTAction_t         a_action,
                 break;
 
             case ACTION_PARSE_INPUT_STREAM:
-                status = mqtt_parse_input_stream(a_action_ptr->action_argument.input_stream_ptr->data,
-                                                 &(a_action_ptr->action_argument.input_stream_ptr->size_of_data));
-                if (NULL != g_shared_data)
-                     g_shared_data->time_to_next_ping_in_ms = g_shared_data->keepalive_in_ms;
+                if (NULL != a_action_ptr) {
+                    status = mqtt_parse_input_stream(a_shared_ptr,
+                                                     a_action_ptr->action_argument.input_stream_ptr->data,
+                                                     a_action_ptr->action_argument.input_stream_ptr->size_of_data,
+                                                     &(a_action_ptr->action_argument.input_stream_ptr->size_of_data));
+                    a_shared_ptr->time_to_next_ping_in_ms = a_shared_ptr->keepalive_in_ms;
+                }
+                break;
+
+            case ACTION_PARSE_INPUT_BATCH:
+                if (NULL != a_action_ptr) {
+                    status = mqtt_parse_input_batch(a_shared_ptr,
+                                                    a_action_ptr->action_argument.input_stream_ptr->data,
+                                                    a_action_ptr->action_argument.input_stream_ptr->size_of_data,
+                                                    &(a_action_ptr->action_argument.input_stream_ptr->size_of_consumed));
+                    a_shared_ptr->time_to_next_ping_in_ms = a_shared_ptr->keepalive_in_ms;
+                }
+                break;
+
+            case ACTION_PARSE_INPUT_CHUNK:
+                if (NULL != a_action_ptr) {
+                    status = mqtt_parse_input_chunk(a_shared_ptr,
+                                                    a_action_ptr->action_argument.input_stream_ptr->data,
+                                                    a_action_ptr->action_argument.input_stream_ptr->size_of_data);
+                    a_shared_ptr->time_to_next_ping_in_ms = a_shared_ptr->keepalive_in_ms;
+                }
                 break;
 
             default:
@@ -1678,43 +4546,46 @@ MQTTErrorCodes_t mqtt(MQTTAction_t         a_action,
     return status;
 }
 
-bool mqtt_connect(char                   * a_client_name_ptr,
-                  uint16_t                 a_keepalive_timeout,
-                  uint8_t                * a_username_str_ptr,
-                  uint8_t                * a_password_str_ptr,
-                  uint8_t                * a_last_will_topic_str_ptr,
-                  uint8_t                * a_last_will_str_ptr,
-                  MQTT_shared_data_t     * mqtt_shared_data_ptr,
-                  uint8_t                * a_output_buffer_ptr,
-                  size_t                   a_output_buffer_size,
-                  bool                     a_clean_session,
-                  data_stream_out_fptr_t   a_out_write_fptr,
-                  connected_fptr_t         a_connected_fptr,
-                  subscrbe_fptr_t          a_subscribe_fptr,
-                  uint8_t                  a_timeout_in_sec)
+static bool mqtt_connect_request(MQTT_shared_data_t     * a_shared_ptr,
+                                 char                   * a_client_name_ptr,
+                                 uint16_t                 a_keepalive_timeout,
+                                 uint8_t                * a_username_str_ptr,
+                                 uint8_t                * a_password_str_ptr,
+                                 uint8_t                * a_last_will_topic_str_ptr,
+                                 uint8_t                * a_last_will_str_ptr,
+                                 uint8_t                * a_output_buffer_ptr,
+                                 size_t                   a_output_buffer_size,
+                                 bool                     a_clean_session,
+                                 data_stream_out_fptr_t   a_out_write_fptr,
+                                 connected_fptr_t         a_connected_fptr,
+                                 subscrbe_fptr_t          a_subscribe_fptr,
+                                 MQTT_subscribe_list_t  * a_subscribe_ptr,
+                                 MQTT_publish_t         * a_birth_ptr,
+                                 uint8_t                  a_timeout_in_sec)
 {
+    if (NULL == a_shared_ptr)
+        return false;
+
     /* Initialize MQTT */
     if ((NULL != a_client_name_ptr)         &&
         (NULL != a_username_str_ptr)        &&
         (NULL != a_password_str_ptr)        &&
         (NULL != a_last_will_topic_str_ptr) &&
         (NULL != a_last_will_str_ptr)       &&
-        (NULL != mqtt_shared_data_ptr)      &&
         (NULL != a_output_buffer_ptr)) {
 
-        g_shared_data = mqtt_shared_data_ptr;
-        g_shared_data->buffer             = a_output_buffer_ptr;
-        g_shared_data->buffer_size        = a_output_buffer_size;
+        a_shared_ptr->buffer             = a_output_buffer_ptr;
+        a_shared_ptr->buffer_size        = a_output_buffer_size;
 
-        g_shared_data->out_fptr           = a_out_write_fptr;
-        g_shared_data->connected_cb_fptr  = a_connected_fptr;
-        g_shared_data->subscribe_cb_fptr  = a_subscribe_fptr;
+        a_shared_ptr->out_fptr           = a_out_write_fptr;
+        a_shared_ptr->connected_cb_fptr  = a_connected_fptr;
+        a_shared_ptr->subscribe_cb_fptr  = a_subscribe_fptr;
 
         MQTT_action_data_t action;
-        action.action_argument.shared_ptr = g_shared_data;
 
-        MQTTErrorCodes_t state = mqtt(ACTION_INIT,
-                                      &action);
+        MQTTErrorCodes_t state = mqtt(a_shared_ptr,
+                                      ACTION_INIT,
+                                      NULL);
 
         /* Connect to broker */
         if (Successfull == state) {
@@ -1736,37 +4607,148 @@ bool mqtt_connect(char                   * a_client_name_ptr,
 
             action.action_argument.connect_ptr = &connect_params;
 
-            state = mqtt(ACTION_CONNECT,
+            /* Initial requests go in the same write right behind CONNECT */
+            MQTTAction_t            connect_action = ACTION_CONNECT;
+            MQTT_connect_pipeline_t pipeline;
+
+            if ((NULL != a_subscribe_ptr) ||
+                (NULL != a_birth_ptr)) {
+                pipeline.connect_ptr                = &connect_params;
+                pipeline.subscribe_ptr              = a_subscribe_ptr;
+                pipeline.publish_ptr                = a_birth_ptr;
+                action.action_argument.pipeline_ptr = &pipeline;
+                connect_action                      = ACTION_CONNECT_PIPELINED;
+            }
+
+            /* Do not wait CONNACK when timeout is set to zero. */
+            if (0 == a_timeout_in_sec)
+                return (Successfull == mqtt(a_shared_ptr, connect_action, &action));
+
+            /* CONNACK may be parsed before ACTION_CONNECT returns */
+            mqtt_completion_t completion;
+            mqtt_complete_begin(a_shared_ptr, &completion);
+
+            state = mqtt(a_shared_ptr,
+                         connect_action,
                          &action);
 
-            if (Successfull == state) {
+            /* Nothing to wait when CONNECT was not sent */
+            if ((true        == mqtt_complete_wait(a_shared_ptr,
+                                                   &completion,
+                                                   &(a_shared_ptr->connect_status),
+                                                   (Successfull == state) ? a_timeout_in_sec : 0)) &&
+                (Successfull == state))
+                return (a_shared_ptr->state == STATE_CONNECTED);
+        }
+    }
+
+    return false;
+}
+
+bool mqtt_connect(MQTT_shared_data_t     * a_shared_ptr,
+                  char                   * a_client_name_ptr,
+                  uint16_t                 a_keepalive_timeout,
+                  uint8_t                * a_username_str_ptr,
+                  uint8_t                * a_password_str_ptr,
+                  uint8_t                * a_last_will_topic_str_ptr,
+                  uint8_t                * a_last_will_str_ptr,
+                  uint8_t                * a_output_buffer_ptr,
+                  size_t                   a_output_buffer_size,
+                  bool                     a_clean_session,
+                  data_stream_out_fptr_t   a_out_write_fptr,
+                  connected_fptr_t         a_connected_fptr,
+                  subscrbe_fptr_t          a_subscribe_fptr,
+                  uint8_t                  a_timeout_in_sec)
+{
+    return mqtt_connect_request(a_shared_ptr,
+                                a_client_name_ptr,
+                                a_keepalive_timeout,
+                                a_username_str_ptr,
+                                a_password_str_ptr,
+                                a_last_will_topic_str_ptr,
+                                a_last_will_str_ptr,
+                                a_output_buffer_ptr,
+                                a_output_buffer_size,
+                                a_clean_session,
+                                a_out_write_fptr,
+                                a_connected_fptr,
+                                a_subscribe_fptr,
+                                NULL,
+                                NULL,
+                                a_timeout_in_sec);
+}
+
+bool mqtt_connect_pipelined(MQTT_shared_data_t     * a_shared_ptr,
+                            char                   * a_client_name_ptr,
+                            uint16_t                 a_keepalive_timeout,
+                            uint8_t                * a_username_str_ptr,
+                            uint8_t                * a_password_str_ptr,
+                            uint8_t                * a_last_will_topic_str_ptr,
+                            uint8_t                * a_last_will_str_ptr,
+                            uint8_t                * a_output_buffer_ptr,
+                            size_t                   a_output_buffer_size,
+                            bool                     a_clean_session,
+                            data_stream_out_fptr_t   a_out_write_fptr,
+                            connected_fptr_t         a_connected_fptr,
+                            subscrbe_fptr_t          a_subscribe_fptr,
+                            MQTT_subscribe_list_t  * a_subscribe_ptr,
+                            MQTT_publish_t         * a_birth_ptr,
+                            uint8_t                  a_timeout_in_sec)
+{
+    return mqtt_connect_request(a_shared_ptr,
+                                a_client_name_ptr,
+                                a_keepalive_timeout,
+                                a_username_str_ptr,
+                                a_password_str_ptr,
+                                a_last_will_topic_str_ptr,
+                                a_last_will_str_ptr,
+                                a_output_buffer_ptr,
+                                a_output_buffer_size,
+                                a_clean_session,
+                                a_out_write_fptr,
+                                a_connected_fptr,
+                                a_subscribe_fptr,
+                                a_subscribe_ptr,
+                                a_birth_ptr,
+                                a_timeout_in_sec);
+}
+
+bool mqtt_disconnect(MQTT_shared_data_t * a_shared_ptr)
+{
+    return (Successfull == mqtt(a_shared_ptr, ACTION_DISCONNECT, NULL));
+}
 
-                uint8_t timeout = (a_timeout_in_sec * 10);
+/* Keep order - older stored messages first, true when new one must wait behind them */
+static bool mqtt_store_first(MQTT_shared_data_t * a_shared_ptr,
+                             uint8_t            * a_output_buffer_ptr,
+                             uint32_t             a_output_buffer_size)
+{
+    if ((NULL == a_shared_ptr) ||
+        (NULL == a_shared_ptr->store))
+        return false;
 
-                while ((0!= timeout) &&
-                       (STATE_CONNECTED != g_shared_data->state)) {
-                    timeout--;
-                    mqtt_sleep(0.1);
-                }
-            }
-        }
+    if (NULL == a_output_buffer_ptr) {
+        a_output_buffer_ptr  = a_shared_ptr->buffer;
+        a_output_buffer_size = a_shared_ptr->buffer_size;
     }
 
-    return (g_shared_data->state == STATE_CONNECTED);
-}
+    if (0 < a_shared_ptr->store->count)
+        mqtt_store_flush(a_shared_ptr, a_output_buffer_ptr, a_output_buffer_size);
 
-bool mqtt_disconnect()
-{
-    return (Successfull == mqtt(ACTION_DISCONNECT, NULL));
+    return ((0               < a_shared_ptr->store->count) ||
+            (STATE_CONNECTED != a_shared_ptr->state)         ||
+            (false           == a_shared_ptr->session_accepted));
 }
 
-bool mqtt_publish(char * a_topic_ptr,
-                  size_t a_topic_size,
-                  char * a_msg_ptr,
-                  size_t a_msg_size)
+bool mqtt_publish(MQTT_shared_data_t * a_shared_ptr,
+                  char               * a_topic_ptr,
+                  size_t               a_topic_size,
+                  char               * a_msg_ptr,
+                  size_t               a_msg_size)
 {
     /* Use internal shared buffer for sending */
-    return mqtt_publish_buf(a_topic_ptr,
+    return mqtt_publish_buf(a_shared_ptr,
+                            a_topic_ptr,
                             a_topic_size,
                             a_msg_ptr,
                             a_msg_size,
@@ -1774,17 +4756,25 @@ bool mqtt_publish(char * a_topic_ptr,
                             0);
 }
 
-bool mqtt_publish_buf(char    * a_topic_ptr,
-                      size_t    a_topic_size,
-                      char    * a_msg_ptr,
-                      size_t    a_msg_size,
-                      uint8_t * a_output_buffer_ptr,
-                      uint32_t  a_output_buffer_size)
+bool mqtt_publish_buf(MQTT_shared_data_t * a_shared_ptr,
+                      char               * a_topic_ptr,
+                      size_t               a_topic_size,
+                      char               * a_msg_ptr,
+                      size_t               a_msg_size,
+                      uint8_t            * a_output_buffer_ptr,
+                      uint32_t             a_output_buffer_size)
 {
     if ((NULL != a_topic_ptr) &&
         (NULL != a_msg_ptr)) {
         /* a_output_buffer_ptr can be NULL, in that case shared buffer is used */
 
+        if (true == mqtt_store_first(a_shared_ptr, a_output_buffer_ptr, a_output_buffer_size))
+            return mqtt_store_put(a_shared_ptr,
+                                  (uint8_t*)a_topic_ptr,
+                                  (uint16_t)a_topic_size,
+                                  (uint8_t*)a_msg_ptr,
+                                  a_msg_size);
+
         MQTT_publish_t publish;
         publish.flags.dup           = false;
         publish.flags.retain        = false;
@@ -1799,66 +4789,573 @@ bool mqtt_publish_buf(char    * a_topic_ptr,
         MQTT_action_data_t action;
         action.action_argument.publish_ptr = &publish;
 
-        MQTTErrorCodes_t state = mqtt(ACTION_PUBLISH,
-                                    &action);
+        MQTTErrorCodes_t state = mqtt(a_shared_ptr,
+                                      ACTION_PUBLISH,
+                                      &action);
 
         if (Successfull == state)
             return true;
+
+        /* Only transient failures are stored: not connected or sending failed */
+        if ((NULL != a_shared_ptr)        &&
+            (NULL != a_shared_ptr->store) &&
+            (true == mqtt_store_fits(a_shared_ptr,
+                                     ((NULL != a_output_buffer_ptr) && (0 < a_output_buffer_size)) ?
+                                         a_output_buffer_size : a_shared_ptr->buffer_size,
+                                     (uint16_t)a_topic_size,
+                                     a_msg_size)))
+            return mqtt_store_put(a_shared_ptr,
+                                  (uint8_t*)a_topic_ptr,
+                                  (uint16_t)a_topic_size,
+                                  (uint8_t*)a_msg_ptr,
+                                  a_msg_size);
     }
     return false;
 }
 
-bool mqtt_subscribe(char     * a_topic,
-                    uint16_t   a_topic_size,
-                    uint8_t    a_timeout_in_sec)
+bool mqtt_publish_qos(MQTT_shared_data_t * a_shared_ptr,
+                      char               * a_topic_ptr,
+                      size_t               a_topic_size,
+                      char               * a_msg_ptr,
+                      size_t               a_msg_size,
+                      MQTTQoSLevel_t       a_qos,
+                      uint16_t           * a_packet_id_ptr)
 {
-    MQTTErrorCodes_t state = InvalidArgument;
-
-    if ((NULL != g_shared_data) &&
-        (NULL != a_topic)       &&
-        (0     < a_topic_size)) {
+    if ((NULL != a_topic_ptr) &&
+        (NULL != a_msg_ptr)   &&
+        (QoSInvalid > a_qos)) {
 
-        MQTT_subscribe_t subscribe;
-        subscribe.qos          = QoS0;
-        subscribe.topic_ptr    = (uint8_t*) a_topic;
-        subscribe.topic_length = a_topic_size;
+        MQTT_publish_t publish;
+        publish.flags.dup           = false;
+        publish.flags.retain        = false;
+        publish.flags.qos           = a_qos;
+        publish.topic_ptr           = (uint8_t*)a_topic_ptr;
+        publish.topic_length        = (uint16_t)a_topic_size;
+        publish.message_buffer_ptr  = (uint8_t*)a_msg_ptr;
+        publish.message_buffer_size = a_msg_size;
+        publish.output_buffer_ptr   = NULL;
+        publish.output_buffer_size  = 0;
+        publish.packet_identifier   = 0;
 
         MQTT_action_data_t action;
-        action.action_argument.subscribe_ptr = &subscribe;
+        action.action_argument.publish_ptr = &publish;
+
+        if (Successfull == mqtt(a_shared_ptr, ACTION_PUBLISH, &action)) {
+            if (NULL != a_packet_id_ptr)
+                *a_packet_id_ptr = publish.packet_identifier;
+            return true;
+        }
+    }
+    return false;
+}
 
-        state = mqtt(ACTION_SUBSCRIBE, &action);
+bool mqtt_publish_prepare(MQTT_prepared_publish_t * a_prepared_ptr,
+                          uint8_t                 * a_buffer_ptr,
+                          uint32_t                  a_buffer_size,
+                          char                    * a_topic_ptr,
+                          uint16_t                  a_topic_size,
+                          MQTTQoSLevel_t            a_qos,
+                          bool                      a_retain)
+{
+    MQTT_fixed_header_t header;
+    uint32_t            size = MQTT_PREPARED_HEADER_ROOM + sizeof(uint16_t) + a_topic_size;
+
+    if (QoS0 < a_qos)
+        size += sizeof(uint16_t);
+
+    if ((NULL == a_prepared_ptr) ||
+        (NULL == a_buffer_ptr)   ||
+        (NULL == a_topic_ptr)    ||
+        (0    == a_topic_size)   ||
+        (size  > a_buffer_size)  ||
+        (0    == encode_fixed_header(&header, false, a_qos, a_retain, PUBLISH, 0)))
+        return false;
+
+    a_buffer_ptr[MQTT_PREPARED_HEADER_ROOM]     = (uint8_t)((a_topic_size >> 8) & 0xFF);
+    a_buffer_ptr[MQTT_PREPARED_HEADER_ROOM + 1] = (uint8_t)((a_topic_size >> 0) & 0xFF);
+    mqtt_memcpy(&(a_buffer_ptr[MQTT_PREPARED_HEADER_ROOM + sizeof(uint16_t)]), a_topic_ptr, a_topic_size);
+
+    a_prepared_ptr->buffer            = a_buffer_ptr;
+    a_prepared_ptr->flags             = *((uint8_t *) &header);
+    a_prepared_ptr->qos               = a_qos;
+    a_prepared_ptr->retain            = a_retain;
+    a_prepared_ptr->topic_length      = a_topic_size;
+    a_prepared_ptr->message_ptr       = NULL;
+    a_prepared_ptr->message_size      = 0;
+    a_prepared_ptr->packet_identifier = 0;
+    return true;
+}
 
-        if (Successfull == state) {
-            /* Do not perform responce chek when timeout is set to zero. */
-            if (0 < a_timeout_in_sec) {
-
-                uint8_t timeout = (a_timeout_in_sec * 10);
-                while ((0 != timeout) &&
-                       (false == g_shared_data->subscribe_status)) {
-                    timeout--;
-                    mqtt_sleep(0.1);
-                }
+bool mqtt_publish_prepared(MQTT_shared_data_t      * a_shared_ptr,
+                           MQTT_prepared_publish_t * a_prepared_ptr,
+                           char                    * a_msg_ptr,
+                           size_t                    a_msg_size,
+                           uint16_t                * a_packet_id_ptr)
+{
+    if ((NULL == a_prepared_ptr) ||
+        (NULL == a_prepared_ptr->buffer) ||
+        (NULL == a_msg_ptr))
+        return false;
+
+    uint8_t * topic_ptr = &(a_prepared_ptr->buffer[MQTT_PREPARED_HEADER_ROOM + sizeof(uint16_t)]);
+    bool      stored    = ((QoS0 == a_prepared_ptr->qos) && (NULL != a_shared_ptr) && (NULL != a_shared_ptr->store));
+
+    if ((true == stored) &&
+        (true == mqtt_store_first(a_shared_ptr, NULL, 0)))
+        return mqtt_store_put(a_shared_ptr,
+                              topic_ptr,
+                              a_prepared_ptr->topic_length,
+                              (uint8_t*)a_msg_ptr,
+                              a_msg_size);
+
+    a_prepared_ptr->message_ptr  = (uint8_t*)a_msg_ptr;
+    a_prepared_ptr->message_size = a_msg_size;
+
+    MQTT_action_data_t action;
+    action.action_argument.prepared_ptr = a_prepared_ptr;
+
+    if (Successfull == mqtt(a_shared_ptr, ACTION_PUBLISH_PREPARED, &action)) {
+        if (NULL != a_packet_id_ptr)
+            *a_packet_id_ptr = a_prepared_ptr->packet_identifier;
+        return true;
+    }
 
-                if (true == g_shared_data->subscribe_status)
-                    state = Successfull;
-            }
+    /* Only transient failures are stored: not connected or sending failed */
+    if ((true == stored) &&
+        (true == mqtt_store_fits(a_shared_ptr, a_shared_ptr->buffer_size, a_prepared_ptr->topic_length, a_msg_size)))
+        return mqtt_store_put(a_shared_ptr,
+                              topic_ptr,
+                              a_prepared_ptr->topic_length,
+                              (uint8_t*)a_msg_ptr,
+                              a_msg_size);
+    return false;
+}
+
+bool mqtt_inflight_init(MQTT_inflight_window_t * a_window_ptr,
+                        MQTT_inflight_entry_t  * a_entries_ptr,
+                        uint16_t                 a_entry_cnt,
+                        uint32_t                 a_retry_in_ms,
+                        published_fptr_t         a_published_fptr)
+{
+    if ((NULL != a_window_ptr)  &&
+        (NULL != a_entries_ptr) &&
+        (0     < a_entry_cnt)   &&
+        (INT32_MAX >= a_retry_in_ms)) {
+
+        mqtt_memset(a_entries_ptr, 0, a_entry_cnt * sizeof(MQTT_inflight_entry_t));
+
+        a_window_ptr->entries           = a_entries_ptr;
+        a_window_ptr->size              = a_entry_cnt;
+        a_window_ptr->used              = 0;
+        a_window_ptr->retry_in_ms       = a_retry_in_ms;
+        a_window_ptr->published_cb_fptr = a_published_fptr;
+        a_window_ptr->received_ids      = NULL;
+        a_window_ptr->received_size     = 0;
+        return true;
+    }
+    return false;
+}
+
+bool mqtt_inflight_received_init(MQTT_inflight_window_t * a_window_ptr,
+                                 uint16_t               * a_ids_ptr,
+                                 uint16_t                 a_id_cnt)
+{
+    if ((NULL != a_window_ptr) &&
+        (NULL != a_ids_ptr)    &&
+        (0     < a_id_cnt)) {
+
+        mqtt_memset(a_ids_ptr, 0, a_id_cnt * sizeof(uint16_t));
+
+        a_window_ptr->received_ids  = a_ids_ptr;
+        a_window_ptr->received_size = a_id_cnt;
+        return true;
+    }
+    return false;
+}
+
+bool mqtt_inflight_window(MQTT_shared_data_t     * a_shared_ptr,
+                          MQTT_inflight_window_t * a_window_ptr)
+{
+    if (NULL == a_shared_ptr)
+        return false;
+
+    a_shared_ptr->inflight = a_window_ptr;
+
+    if ((NULL            != a_window_ptr)        &&
+        (STATE_CONNECTED == a_shared_ptr->state) &&
+        (false           == a_shared_ptr->publish_stream.open))
+        return (Successfull == mqtt_inflight_resend(a_shared_ptr));
+
+    return true;
+}
+
+uint16_t mqtt_inflight_free(MQTT_shared_data_t * a_shared_ptr)
+{
+    if ((NULL != a_shared_ptr) &&
+        (NULL != a_shared_ptr->inflight))
+        return (a_shared_ptr->inflight->size - a_shared_ptr->inflight->used);
+
+    return 0;
+}
+
+bool mqtt_outbound_store(MQTT_shared_data_t * a_shared_ptr,
+                         MQTT_store_t       * a_store_ptr)
+{
+    if (NULL == a_shared_ptr)
+        return false;
+
+    a_shared_ptr->store = a_store_ptr;
+
+    if ((NULL            != a_store_ptr)         &&
+        (STATE_CONNECTED == a_shared_ptr->state) &&
+        (true            == a_shared_ptr->session_accepted))
+        return (Successfull == mqtt_store_flush(a_shared_ptr, a_shared_ptr->buffer, a_shared_ptr->buffer_size));
+
+    return true;
+}
+
+bool mqtt_topic_trie(MQTT_shared_data_t * a_shared_ptr,
+                     MQTT_topic_trie_t  * a_trie_ptr)
+{
+    if (NULL == a_shared_ptr)
+        return false;
+
+    a_shared_ptr->topics = a_trie_ptr;
+    return true;
+}
+
+bool mqtt_subscribe_handler(MQTT_shared_data_t * a_shared_ptr,
+                            char               * a_topic,
+                            uint16_t             a_topic_size,
+                            subscrbe_fptr_t      a_handler_fptr,
+                            uint8_t              a_timeout_in_sec)
+{
+    if ((NULL  == a_shared_ptr) ||
+        (false == mqtt_topic_register(a_shared_ptr->topics, a_topic, a_topic_size, a_handler_fptr)))
+        return false;
+
+    if (false == mqtt_subscribe(a_shared_ptr, a_topic, a_topic_size, a_timeout_in_sec)) {
+        mqtt_topic_unregister(a_shared_ptr->topics, a_topic, a_topic_size);
+        return false;
+    }
+    return true;
+}
+
+bool mqtt_store_ring_init(MQTT_store_ring_t * a_ring_ptr,
+                          uint8_t           * a_buffer_ptr,
+                          uint32_t            a_buffer_size)
+{
+    if ((NULL != a_ring_ptr)   &&
+        (NULL != a_buffer_ptr) &&
+        (MQTT_STORE_RECORD_HEADER < a_buffer_size)) {
+
+        a_ring_ptr->store.put_fptr  = &mqtt_store_ring_put;
+        a_ring_ptr->store.peek_fptr = &mqtt_store_ring_peek;
+        a_ring_ptr->store.pop_fptr  = &mqtt_store_ring_pop;
+        a_ring_ptr->store.count     = 0;
+        a_ring_ptr->buffer          = a_buffer_ptr;
+        a_ring_ptr->size            = a_buffer_size;
+        a_ring_ptr->head            = 0;
+        a_ring_ptr->tail            = 0;
+        return true;
+    }
+    return false;
+}
+
+bool mqtt_publish_begin(MQTT_shared_data_t * a_shared_ptr,
+                        char               * a_topic_ptr,
+                        size_t               a_topic_size,
+                        uint32_t             a_msg_size)
+{
+    return mqtt_publish_begin_qos(a_shared_ptr, a_topic_ptr, a_topic_size, a_msg_size, QoS0, NULL);
+}
+
+bool mqtt_publish_begin_qos(MQTT_shared_data_t * a_shared_ptr,
+                            char               * a_topic_ptr,
+                            size_t               a_topic_size,
+                            uint32_t             a_msg_size,
+                            MQTTQoSLevel_t       a_qos,
+                            uint16_t           * a_packet_id_ptr)
+{
+    if ((NULL != a_topic_ptr) &&
+        (QoSInvalid > a_qos)) {
+        MQTT_publish_t publish;
+        publish.flags.dup           = false;
+        publish.flags.retain        = false;
+        publish.flags.qos           = a_qos;
+        publish.topic_ptr           = (uint8_t*)a_topic_ptr;
+        publish.topic_length        = (uint16_t)a_topic_size;
+        publish.message_buffer_ptr  = NULL; /* Payload is not kept */
+        publish.message_buffer_size = a_msg_size;
+        publish.output_buffer_ptr   = NULL;
+        publish.output_buffer_size  = 0;
+        publish.packet_identifier   = 0;
+
+        MQTT_action_data_t action;
+        action.action_argument.publish_ptr = &publish;
+
+        if (Successfull == mqtt(a_shared_ptr, ACTION_PUBLISH_BEGIN, &action)) {
+            if (NULL != a_packet_id_ptr)
+                *a_packet_id_ptr = publish.packet_identifier;
+            return true;
         }
-        g_shared_data->subscribe_status = false;
     }
+    return false;
+}
+
+bool mqtt_publish_append(MQTT_shared_data_t * a_shared_ptr,
+                         char               * a_msg_ptr,
+                         size_t               a_msg_size)
+{
+    MQTT_publish_t publish;
+    publish.message_buffer_ptr  = (uint8_t*)a_msg_ptr;
+    publish.message_buffer_size = (uint32_t)a_msg_size;
+
+    MQTT_action_data_t action;
+    action.action_argument.publish_ptr = &publish;
+
+    return (Successfull == mqtt(a_shared_ptr, ACTION_PUBLISH_APPEND, &action));
+}
+
+bool mqtt_publish_end(MQTT_shared_data_t * a_shared_ptr)
+{
+    return (Successfull == mqtt(a_shared_ptr, ACTION_PUBLISH_END, NULL));
+}
+
+/* Send (un)subscribe request and wait its ack */
+static bool mqtt_subscribe_request(MQTT_shared_data_t    * a_shared_ptr,
+                                   MQTTAction_t            a_action,
+                                   MQTT_subscribe_list_t * a_list_ptr,
+                                   uint8_t                 a_timeout_in_sec)
+{
+    MQTT_action_data_t action;
+    action.action_argument.subscribe_list_ptr = a_list_ptr;
+
+    /* Do not perform responce chek when timeout is set to zero. */
+    if (0 == a_timeout_in_sec)
+        return (Successfull == mqtt(a_shared_ptr, a_action, &action));
+
+    /* Ack may be parsed before the action returns */
+    mqtt_completion_t completion;
+    mqtt_complete_begin(a_shared_ptr, &completion);
+
+    MQTTErrorCodes_t state = mqtt(a_shared_ptr, a_action, &action);
+
+    /* Nothing to wait when request was not sent */
+    if (true == mqtt_complete_wait(a_shared_ptr,
+                                   &completion,
+                                   &(a_shared_ptr->subscribe_status),
+                                   (Successfull == state) ? a_timeout_in_sec : 0)) {
+        if (Successfull == state)
+            state = a_shared_ptr->subscribe_pending.result;
+    } else if (Successfull == state) {
+        /* Late ack must not write into return code table of the caller */
+        a_shared_ptr->subscribe_pending.packet_id        = 0;
+        a_shared_ptr->subscribe_pending.return_codes_ptr = NULL;
+        state = ServerUnavailabe;
+    }
+    a_shared_ptr->subscribe_status = false;
     return (Successfull == state);
 }
 
-bool mqtt_keepalive(uint32_t a_duration_in_ms)
+bool mqtt_subscribe(MQTT_shared_data_t * a_shared_ptr,
+                    char               * a_topic,
+                    uint16_t             a_topic_size,
+                    uint8_t              a_timeout_in_sec)
+{
+    MQTT_subscribe_t subscribe;
+    subscribe.qos          = QoS0;
+    subscribe.topic_ptr    = (uint8_t*) a_topic;
+    subscribe.topic_length = a_topic_size;
+
+    return mqtt_subscribe_list(a_shared_ptr, &subscribe, 1, NULL, a_timeout_in_sec);
+}
+
+bool mqtt_subscribe_list(MQTT_shared_data_t * a_shared_ptr,
+                         MQTT_subscribe_t   * a_topics_ptr,
+                         uint16_t             a_topic_cnt,
+                         uint8_t            * a_return_codes_ptr,
+                         uint8_t              a_timeout_in_sec)
+{
+    if ((NULL == a_shared_ptr) ||
+        (NULL == a_topics_ptr) ||
+        (0    == a_topic_cnt))
+        return false;
+
+    MQTT_subscribe_list_t list;
+    list.topics_ptr       = a_topics_ptr;
+    list.topic_cnt        = a_topic_cnt;
+    list.return_codes_ptr = a_return_codes_ptr;
+
+    return mqtt_subscribe_request(a_shared_ptr, ACTION_SUBSCRIBE_LIST, &list, a_timeout_in_sec);
+}
+
+bool mqtt_unsubscribe(MQTT_shared_data_t * a_shared_ptr,
+                      char               * a_topic,
+                      uint16_t             a_topic_size,
+                      uint8_t              a_timeout_in_sec)
+{
+    MQTT_subscribe_t unsubscribe;
+    unsubscribe.qos          = QoS0;
+    unsubscribe.topic_ptr    = (uint8_t*) a_topic;
+    unsubscribe.topic_length = a_topic_size;
+
+    return mqtt_unsubscribe_list(a_shared_ptr, &unsubscribe, 1, a_timeout_in_sec);
+}
+
+bool mqtt_unsubscribe_list(MQTT_shared_data_t * a_shared_ptr,
+                           MQTT_subscribe_t   * a_topics_ptr,
+                           uint16_t             a_topic_cnt,
+                           uint8_t              a_timeout_in_sec)
+{
+    if ((NULL == a_shared_ptr) ||
+        (NULL == a_topics_ptr) ||
+        (0    == a_topic_cnt))
+        return false;
+
+    MQTT_subscribe_list_t list;
+    list.topics_ptr       = a_topics_ptr;
+    list.topic_cnt        = a_topic_cnt;
+    list.return_codes_ptr = NULL;
+
+    return mqtt_subscribe_request(a_shared_ptr, ACTION_UNSUBSCRIBE_LIST, &list, a_timeout_in_sec);
+}
+
+bool mqtt_keepalive(MQTT_shared_data_t * a_shared_ptr,
+                    uint32_t             a_duration_in_ms)
 {
     MQTT_action_data_t ap;
     ap.action_argument.epalsed_time_in_ms = a_duration_in_ms;
 
-    MQTTErrorCodes_t state = mqtt(ACTION_KEEPALIVE, &ap);
+    MQTTErrorCodes_t state = mqtt(a_shared_ptr, ACTION_KEEPALIVE, &ap);
     return ((Successfull == state) ||
             (PingNotSend == state));
 }
 
-bool mqtt_receive(uint8_t * a_data, size_t a_amount)
+bool mqtt_keepalive_poll(MQTT_shared_data_t * a_shared_ptr)
+{
+    if (NULL == a_shared_ptr)
+        return false;
+
+    uint32_t now     = mqtt_time_ms();
+    uint32_t elapsed = now - a_shared_ptr->ping.clock_in_ms;
+
+    a_shared_ptr->ping.clock_in_ms = now;
+    return mqtt_keepalive(a_shared_ptr, elapsed);
+}
+
+bool mqtt_ping_timeout(MQTT_shared_data_t   * a_shared_ptr,
+                       uint32_t               a_timeout_in_ms,
+                       connection_lost_fptr_t a_lost_fptr)
+{
+    if (NULL == a_shared_ptr)
+        return false;
+
+    a_shared_ptr->ping.pingresp_timeout_in_ms = a_timeout_in_ms;
+    a_shared_ptr->ping.lost_fptr              = a_lost_fptr;
+    return true;
+}
+
+bool mqtt_receive_buffer(MQTT_shared_data_t * a_shared_ptr,
+                         uint8_t            * a_buffer_ptr,
+                         size_t               a_buffer_size)
+{
+    if ((NULL != a_shared_ptr) &&
+        (NULL != a_buffer_ptr) &&
+        (sizeof(MQTT_fixed_header_t) <= a_buffer_size)) {
+
+        a_shared_ptr->framer.buffer      = a_buffer_ptr;
+        a_shared_ptr->framer.buffer_size = a_buffer_size;
+        mqtt_framer_reset(&(a_shared_ptr->framer));
+        return true;
+    }
+    return false;
+}
+
+bool mqtt_receive_stream(MQTT_shared_data_t      * a_shared_ptr,
+                         receive_topic_fptr_t      a_topic_fptr,
+                         receive_chunk_fptr_t      a_chunk_fptr,
+                         receive_complete_fptr_t   a_complete_fptr)
+{
+    if (NULL != a_shared_ptr) {
+        a_shared_ptr->receive_stream.topic_fptr    = a_topic_fptr;
+        a_shared_ptr->receive_stream.chunk_fptr    = a_chunk_fptr;
+        a_shared_ptr->receive_stream.complete_fptr = a_complete_fptr;
+        return true;
+    }
+    return false;
+}
+
+bool mqtt_output_vector(MQTT_shared_data_t      * a_shared_ptr,
+                        data_stream_outv_fptr_t   a_outv_fptr)
+{
+    if (NULL != a_shared_ptr) {
+        a_shared_ptr->outv_fptr = a_outv_fptr;
+        return true;
+    }
+    return false;
+}
+
+bool mqtt_output_coalesce(MQTT_shared_data_t * a_shared_ptr,
+                          uint8_t            * a_buffer_ptr,
+                          size_t               a_buffer_size,
+                          uint32_t             a_threshold,
+                          uint32_t             a_max_delay_in_ms)
+{
+    if ((NULL == a_shared_ptr) ||
+        ((NULL != a_buffer_ptr) && (0 == a_buffer_size)) ||
+        (a_max_delay_in_ms > (UINT32_MAX / 2000))) /* Time differences cover half of the clock */
+        return false;
+
+    /* Packets staged into the previous buffer go first */
+    if (NULL != a_shared_ptr->coalesce.buffer)
+        mqtt_coalesce_flush(a_shared_ptr);
+
+    a_shared_ptr->coalesce.buffer          = a_buffer_ptr;
+    a_shared_ptr->coalesce.size            = (uint32_t)a_buffer_size;
+    a_shared_ptr->coalesce.fill            = 0;
+    a_shared_ptr->coalesce.threshold       = ((0 == a_threshold) || (a_threshold > a_buffer_size)) ? (uint32_t)a_buffer_size : a_threshold;
+    a_shared_ptr->coalesce.max_delay_in_us = a_max_delay_in_ms * 1000;
+    return true;
+}
+
+bool mqtt_flush(MQTT_shared_data_t * a_shared_ptr)
+{
+    if (NULL == a_shared_ptr)
+        return false;
+
+    return mqtt_coalesce_flush(a_shared_ptr);
+}
+
+bool mqtt_receive_batch(MQTT_shared_data_t * a_shared_ptr,
+                        uint8_t            * a_data,
+                        size_t               a_amount,
+                        size_t             * a_consumed_ptr)
+{
+    if ((NULL != a_data) &&
+        (NULL != a_consumed_ptr))
+    {
+        MQTT_input_stream_t input;
+
+        input.data             = a_data;
+        input.size_of_data     = (uint32_t)a_amount;
+        input.size_of_consumed = 0;
+
+        MQTT_action_data_t action;
+        action.action_argument.input_stream_ptr = &input;
+
+        MQTTErrorCodes_t state = mqtt(a_shared_ptr, ACTION_PARSE_INPUT_BATCH, &action);
+        *a_consumed_ptr = input.size_of_consumed;
+
+        return (Successfull == state);
+    }
+
+    return false;
+}
+
+bool mqtt_receive(MQTT_shared_data_t * a_shared_ptr,
+                  uint8_t            * a_data,
+                  size_t               a_amount)
 {
     if (NULL != a_data)
     {
@@ -1871,8 +5368,245 @@ bool mqtt_receive(uint8_t * a_data, size_t a_amount)
         MQTT_action_data_t action;
         action.action_argument.input_stream_ptr = &input;
 
-        return (Successfull == mqtt(ACTION_PARSE_INPUT_STREAM, &action));
+        return (Successfull == mqtt(a_shared_ptr, ACTION_PARSE_INPUT_CHUNK, &action));
     }
 
     return false;
 }
+
+/************************************************************************************************************
+ *                                                                                                          *
+ * \subsection Reconnect Reconnect manager                                                                  *
+ *                                                                                                          *
+ * Every attempt starts from ACTION_INIT, which keeps transmit buffer, out_fptr and callbacks of the        *
+ * context but detaches the session state, so it is attached again here. Manager is driven only by          *
+ * mqtt_reconnect_tick, task reading input reports losses with a flag.                                      *
+ *                                                                                                          *
+ ************************************************************************************************************/
+static uint32_t mqtt_reconnect_random(MQTT_reconnect_t * a_reconnect_ptr)
+{
+    /* xorshift32, state never becomes 0 */
+    uint32_t x = a_reconnect_ptr->random;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+
+    a_reconnect_ptr->random = x;
+    return x;
+}
+
+uint32_t mqtt_reconnect_delay(MQTT_reconnect_t * a_reconnect_ptr)
+{
+    uint32_t ceiling = a_reconnect_ptr->base_delay_in_ms;
+
+    for (uint32_t i = 1; (i < a_reconnect_ptr->attempts) && (ceiling < a_reconnect_ptr->max_delay_in_ms); i++)
+        ceiling = (ceiling > (UINT32_MAX / 2)) ? UINT32_MAX : (ceiling * 2);
+
+    if (ceiling > a_reconnect_ptr->max_delay_in_ms)
+        ceiling = a_reconnect_ptr->max_delay_in_ms;
+
+    /* Equal jitter: at least half of the ceiling, so retries still back off */
+    uint32_t half = ceiling / 2;
+    return (ceiling - half) + (mqtt_reconnect_random(a_reconnect_ptr) % (half + 1));
+}
+
+static void mqtt_reconnect_schedule(MQTT_reconnect_t     * a_reconnect_ptr,
+                                    MQTTReconnectEvent_t   a_event)
+{
+    a_reconnect_ptr->shared->state = STATE_DISCONNECTED; /* Publishes go to the store */
+
+    if (UINT32_MAX > a_reconnect_ptr->attempts)
+        a_reconnect_ptr->attempts++;
+
+    a_reconnect_ptr->time_left_in_ms = mqtt_reconnect_delay(a_reconnect_ptr);
+    a_reconnect_ptr->state           = RECONNECT_WAIT;
+
+    #ifdef DEBUG
+        mqtt_printf("%s %u Reconnect attempt %u in %u ms\n", __FILE__, __LINE__, a_reconnect_ptr->attempts, a_reconnect_ptr->time_left_in_ms);
+    #endif
+
+    if (NULL != a_reconnect_ptr->event_fptr)
+        a_reconnect_ptr->event_fptr(a_reconnect_ptr->shared, a_event);
+}
+
+static void mqtt_reconnect_close(MQTT_reconnect_t     * a_reconnect_ptr,
+                                 MQTTReconnectEvent_t   a_event)
+{
+    a_reconnect_ptr->close_fptr(a_reconnect_ptr->shared);
+    mqtt_reconnect_schedule(a_reconnect_ptr, a_event);
+}
+
+static void mqtt_reconnect_attempt(MQTT_reconnect_t * a_reconnect_ptr)
+{
+    MQTT_shared_data_t * shared = a_reconnect_ptr->shared;
+
+    /* Losses reported before this belong to the previous transport */
+    a_reconnect_ptr->lost = false;
+
+    if (false == a_reconnect_ptr->open_fptr(shared)) {
+        mqtt_reconnect_schedule(a_reconnect_ptr, RECONNECT_EVENT_FAILED);
+        return;
+    }
+
+    /* Only the session is reset: transport, callbacks, coalescing, framer buffer and
+       packet identifiers of resumed in-flight messages set by the caller are kept */
+    mqtt_session_reset(shared);
+
+    /* Assigned directly, store is sent by CONNACK handling */
+    shared->topics = a_reconnect_ptr->topics;
+    shared->store  = a_reconnect_ptr->store;
+
+    MQTT_action_data_t      action;
+    MQTT_connect_pipeline_t pipeline;
+    MQTTAction_t            connect_action = ACTION_CONNECT;
+
+    action.action_argument.connect_ptr = &(a_reconnect_ptr->connect);
+
+    if ((NULL != a_reconnect_ptr->subscriptions) ||
+        (NULL != a_reconnect_ptr->birth)) {
+        pipeline.connect_ptr                = &(a_reconnect_ptr->connect);
+        pipeline.subscribe_ptr              = a_reconnect_ptr->subscriptions;
+        pipeline.publish_ptr                = a_reconnect_ptr->birth;
+        action.action_argument.pipeline_ptr = &pipeline;
+        connect_action                      = ACTION_CONNECT_PIPELINED;
+    }
+
+    if (Successfull != mqtt(shared, connect_action, &action)) {
+        mqtt_reconnect_close(a_reconnect_ptr, RECONNECT_EVENT_FAILED);
+        return;
+    }
+
+    a_reconnect_ptr->time_left_in_ms = a_reconnect_ptr->connack_timeout_in_ms;
+    a_reconnect_ptr->state           = RECONNECT_CONNECTING;
+}
+
+bool mqtt_reconnect_init(MQTT_reconnect_t       * a_reconnect_ptr,
+                         MQTT_shared_data_t     * a_shared_ptr,
+                         MQTT_connect_t         * a_connect_ptr,
+                         reconnect_open_fptr_t    a_open_fptr,
+                         reconnect_close_fptr_t   a_close_fptr,
+                         reconnect_event_fptr_t   a_event_fptr,
+                         uint32_t                 a_base_delay_in_ms,
+                         uint32_t                 a_max_delay_in_ms,
+                         uint32_t                 a_seed)
+{
+    if ((NULL == a_reconnect_ptr)            ||
+        (NULL == a_shared_ptr)               ||
+        (NULL == a_connect_ptr)              ||
+        (NULL == a_connect_ptr->client_id)   ||
+        (NULL == a_open_fptr)                ||
+        (NULL == a_close_fptr)               ||
+        (0    == a_base_delay_in_ms)         ||
+        (a_max_delay_in_ms < a_base_delay_in_ms))
+        return false;
+
+    mqtt_memset(a_reconnect_ptr, 0, sizeof(MQTT_reconnect_t));
+
+    a_reconnect_ptr->shared                              = a_shared_ptr;
+    a_reconnect_ptr->connect                             = *a_connect_ptr;
+    a_reconnect_ptr->connect.connect_flags.clean_session = false;
+    a_reconnect_ptr->open_fptr                           = a_open_fptr;
+    a_reconnect_ptr->close_fptr                          = a_close_fptr;
+    a_reconnect_ptr->event_fptr                          = a_event_fptr;
+    a_reconnect_ptr->base_delay_in_ms                    = a_base_delay_in_ms;
+    a_reconnect_ptr->max_delay_in_ms                     = a_max_delay_in_ms;
+    a_reconnect_ptr->connack_timeout_in_ms               = MQTT_RECONNECT_CONNACK_TIMEOUT_MS;
+    a_reconnect_ptr->state                               = RECONNECT_WAIT;
+
+    if (0 == a_seed) {
+        /* FNV-1a of client id separates clients of a fleet, time separates restarts */
+        a_seed = 2166136261u;
+        for (uint8_t * c = a_connect_ptr->client_id; 0 != *c; c++)
+            a_seed = (a_seed ^ *c) * 16777619u;
+        a_seed ^= mqtt_time_us();
+    }
+    a_reconnect_ptr->random = (0 != a_seed) ? a_seed : 0x9E3779B9u;
+    return true;
+}
+
+bool mqtt_reconnect_session(MQTT_reconnect_t       * a_reconnect_ptr,
+                            MQTT_subscribe_list_t  * a_subscribe_ptr,
+                            MQTT_publish_t         * a_birth_ptr,
+                            MQTT_inflight_window_t * a_window_ptr,
+                            MQTT_store_t           * a_store_ptr,
+                            MQTT_topic_trie_t      * a_trie_ptr)
+{
+    if (NULL == a_reconnect_ptr)
+        return false;
+
+    a_reconnect_ptr->subscriptions = a_subscribe_ptr;
+    a_reconnect_ptr->birth         = a_birth_ptr;
+    a_reconnect_ptr->inflight      = a_window_ptr;
+    a_reconnect_ptr->store         = a_store_ptr;
+    a_reconnect_ptr->topics        = a_trie_ptr;
+    return true;
+}
+
+bool mqtt_reconnect_tick(MQTT_reconnect_t * a_reconnect_ptr,
+                         uint32_t           a_duration_in_ms)
+{
+    if ((NULL == a_reconnect_ptr) ||
+        (NULL == a_reconnect_ptr->shared))
+        return false;
+
+    MQTT_shared_data_t * shared = a_reconnect_ptr->shared;
+
+    switch (a_reconnect_ptr->state)
+    {
+        case RECONNECT_WAIT:
+            if (a_reconnect_ptr->time_left_in_ms > a_duration_in_ms) {
+                a_reconnect_ptr->time_left_in_ms -= a_duration_in_ms;
+                break;
+            }
+            a_reconnect_ptr->time_left_in_ms = 0;
+            mqtt_reconnect_attempt(a_reconnect_ptr);
+            break;
+
+        case RECONNECT_CONNECTING:
+            if (true == a_reconnect_ptr->lost) {
+                mqtt_reconnect_close(a_reconnect_ptr, RECONNECT_EVENT_FAILED);
+                break;
+            }
+
+            if (true == shared->connect_status) {
+                if (true == shared->session_accepted) {
+                    a_reconnect_ptr->attempts = 0;
+                    a_reconnect_ptr->state    = RECONNECT_ONLINE;
+
+                    /* Unacknowledged publishes are sent again with DUP flag */
+                    mqtt_inflight_window(shared, a_reconnect_ptr->inflight);
+
+                    if (NULL != a_reconnect_ptr->event_fptr)
+                        a_reconnect_ptr->event_fptr(shared, RECONNECT_EVENT_ONLINE);
+                } else {
+                    /* Refused by the broker */
+                    mqtt_reconnect_close(a_reconnect_ptr, RECONNECT_EVENT_FAILED);
+                }
+                break;
+            }
+
+            if (a_reconnect_ptr->time_left_in_ms > a_duration_in_ms)
+                a_reconnect_ptr->time_left_in_ms -= a_duration_in_ms;
+            else
+                mqtt_reconnect_close(a_reconnect_ptr, RECONNECT_EVENT_FAILED);
+            break;
+
+        case RECONNECT_ONLINE:
+            if ((true  == a_reconnect_ptr->lost) ||
+                (false == mqtt_keepalive(shared, a_duration_in_ms)))
+                mqtt_reconnect_close(a_reconnect_ptr, RECONNECT_EVENT_LOST);
+            break;
+
+        default:
+            break;
+    }
+
+    return (RECONNECT_ONLINE == a_reconnect_ptr->state);
+}
+
+void mqtt_reconnect_lost(MQTT_reconnect_t * a_reconnect_ptr)
+{
+    if (NULL != a_reconnect_ptr)
+        a_reconnect_ptr->lost = true;
+}
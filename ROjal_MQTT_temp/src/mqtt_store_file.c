@@ -0,0 +1,263 @@
+/************************************************************************************************************
+ * Copyright 2017 Rami Ojala / JAMK (K5643)                                                                 *
+ *                                                                                                          *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of                          *
+ * this software and associated documentation files (the "Software"), to deal in the                        *
+ * Software without restriction, including without limitation the rights to use, copy,                      *
+ * modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,                      *
+ * and to permit persons to whom the Software is furnished to do so, subject to the                         *
+ * following conditions:                                                                                    *
+ *                                                                                                          *
+ *  The above copyright notice and this permission notice shall be included                                 *
+ *  in all copies or substantial portions of the Software.                                                  *
+ *                                                                                                          *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,                      *
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A                            *
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT                       *
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION                        *
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE                           *
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                                                   *
+ *                                                                                                          *
+ * https://opensource.org/licenses/MIT                                                                      *
+ ************************************************************************************************************/
+
+#include "mqtt.h"
+
+#ifdef BUILD_DEFAULT_C_LIBS
+
+#include <sys/types.h> // off_t
+#include <unistd.h>    // ftruncate
+
+/************************************************************************************************************
+ *                                                                                                          *
+ * \subsection StoreFile File backend of the outbound store                                                 *
+ *                                                                                                          *
+ * File starts with 8 byte header: magic and offset of the oldest message. Messages are appended as         *
+ * records of 2 bytes topic length, 4 bytes payload size, topic and payload (same as RAM ring). Pop only    *
+ * moves the offset, file is truncated back to the header when it becomes empty.                            *
+ *                                                                                                          *
+ ************************************************************************************************************/
+#define MQTT_STORE_FILE_MAGIC         0x524D5131 /* RMQ1 */
+#define MQTT_STORE_FILE_HEADER        8
+#define MQTT_STORE_FILE_RECORD_HEADER 6
+
+static bool store_file_write_header(MQTT_store_file_t * a_file_store_ptr)
+{
+    uint8_t header[MQTT_STORE_FILE_HEADER];
+    uint32_t magic = MQTT_STORE_FILE_MAGIC;
+
+    for (uint8_t i = 0; i < 4; i++) {
+        header[i]     = (uint8_t)(magic >> (24 - 8 * i));
+        header[4 + i] = (uint8_t)(a_file_store_ptr->read_offset >> (24 - 8 * i));
+    }
+
+    return ((0 == fseek(a_file_store_ptr->file, 0, SEEK_SET)) &&
+            (1 == fwrite(header, sizeof(header), 1, a_file_store_ptr->file)) &&
+            (0 == fflush(a_file_store_ptr->file)));
+}
+
+/* Read record header at a_offset, gives topic length and payload size */
+static bool store_file_read_record(FILE     * a_file,
+                                   uint32_t   a_offset,
+                                   uint16_t * a_topic_length_ptr,
+                                   uint32_t * a_message_size_ptr)
+{
+    uint8_t header[MQTT_STORE_FILE_RECORD_HEADER];
+
+    if ((0 != fseek(a_file, (long)a_offset, SEEK_SET)) ||
+        (1 != fread(header, sizeof(header), 1, a_file)))
+        return false;
+
+    *a_topic_length_ptr = (uint16_t)(((uint16_t)(header[0]) << 8) | header[1]);
+    *a_message_size_ptr = ((uint32_t)(header[2]) << 24) |
+                          ((uint32_t)(header[3]) << 16) |
+                          ((uint32_t)(header[4]) << 8)  |
+                           (uint32_t)(header[5]);
+    return true;
+}
+
+static bool mqtt_store_file_put(MQTT_store_t * a_store_ptr,
+                                uint8_t      * a_topic_ptr,
+                                uint16_t       a_topic_length,
+                                uint8_t      * a_message_ptr,
+                                uint32_t       a_message_size)
+{
+    MQTT_store_file_t * file_store = (MQTT_store_file_t *) a_store_ptr;
+    uint8_t             header[MQTT_STORE_FILE_RECORD_HEADER];
+
+    if ((a_message_size > file_store->scratch_size) ||
+        (a_topic_length > (file_store->scratch_size - a_message_size)) ||
+        (0 != fseek(file_store->file, 0, SEEK_END)))
+        return false;
+
+    long end = ftell(file_store->file);
+
+    header[0] = (uint8_t)(a_topic_length >> 8);
+    header[1] = (uint8_t)(a_topic_length);
+    header[2] = (uint8_t)(a_message_size >> 24);
+    header[3] = (uint8_t)(a_message_size >> 16);
+    header[4] = (uint8_t)(a_message_size >> 8);
+    header[5] = (uint8_t)(a_message_size);
+
+    if ((1 != fwrite(header, sizeof(header), 1, file_store->file))                                    ||
+        (a_topic_length != fwrite(a_topic_ptr, 1, a_topic_length, file_store->file))                  ||
+        (a_message_size != fwrite(a_message_ptr, 1, a_message_size, file_store->file))                ||
+        (0 != fflush(file_store->file))) {
+        /* Do not leave partial record behind */
+        if (0 != ftruncate(fileno(file_store->file), (off_t)end)) {
+            #ifdef DEBUG
+                mqtt_printf("%s %u Store file truncate failed\n", __FILE__, __LINE__);
+            #endif
+        }
+        return false;
+    }
+
+    a_store_ptr->count++;
+    return true;
+}
+
+static bool mqtt_store_file_peek(MQTT_store_t  * a_store_ptr,
+                                 uint8_t      ** a_topic_ptr,
+                                 uint16_t      * a_topic_length_ptr,
+                                 uint8_t      ** a_message_ptr,
+                                 uint32_t      * a_message_size_ptr)
+{
+    MQTT_store_file_t * file_store = (MQTT_store_file_t *) a_store_ptr;
+
+    if ((0     == a_store_ptr->count) ||
+        (false == store_file_read_record(file_store->file,
+                                         file_store->read_offset,
+                                         a_topic_length_ptr,
+                                         a_message_size_ptr)))
+        return false;
+
+    uint32_t size = *a_topic_length_ptr + *a_message_size_ptr;
+
+    if ((size > file_store->scratch_size) ||
+        (size != fread(file_store->scratch, 1, size, file_store->file)))
+        return false;
+
+    *a_topic_ptr   = file_store->scratch;
+    *a_message_ptr = &(file_store->scratch[*a_topic_length_ptr]);
+    return true;
+}
+
+static bool mqtt_store_file_pop(MQTT_store_t * a_store_ptr)
+{
+    MQTT_store_file_t * file_store = (MQTT_store_file_t *) a_store_ptr;
+    uint16_t            topic_length;
+    uint32_t            message_size;
+
+    if ((0     == a_store_ptr->count) ||
+        (false == store_file_read_record(file_store->file,
+                                         file_store->read_offset,
+                                         &topic_length,
+                                         &message_size)))
+        return false;
+
+    file_store->read_offset += MQTT_STORE_FILE_RECORD_HEADER + topic_length + message_size;
+
+    if (0 == --(a_store_ptr->count)) {
+        file_store->read_offset = MQTT_STORE_FILE_HEADER;
+        if (0 != ftruncate(fileno(file_store->file), MQTT_STORE_FILE_HEADER))
+            return false;
+    }
+
+    return store_file_write_header(file_store);
+}
+
+/* Check header and count complete records, partial one is cut from the end */
+static bool store_file_load(MQTT_store_file_t * a_file_store_ptr,
+                            const char        * a_path)
+{
+    FILE    * file = a_file_store_ptr->file;
+    uint8_t   header[MQTT_STORE_FILE_HEADER];
+    uint32_t  magic  = 0;
+    uint32_t  offset = 0;
+
+    a_path = a_path; /* Used only in debug print */
+
+    if (1 == fread(header, sizeof(header), 1, file)) {
+        for (uint8_t i = 0; i < 4; i++) {
+            magic  = (magic << 8)  | header[i];
+            offset = (offset << 8) | header[4 + i];
+        }
+    }
+
+    if (0 != fseek(file, 0, SEEK_END))
+        return false;
+
+    long size = ftell(file);
+
+    if ((MQTT_STORE_FILE_MAGIC  != magic)  ||
+        (MQTT_STORE_FILE_HEADER  > offset) ||
+        ((long)offset            > size)) {
+        /* New or unknown file, start empty */
+        #ifdef DEBUG
+            if (0 < size)
+                mqtt_printf("%s %u Store file %s reset\n", __FILE__, __LINE__, a_path);
+        #endif
+        return ((0 == ftruncate(fileno(file), 0)) &&
+                (true == store_file_write_header(a_file_store_ptr)));
+    }
+
+    a_file_store_ptr->read_offset = offset;
+    while ((long)offset < size) {
+        uint16_t topic_length;
+        uint32_t message_size;
+
+        if ((false == store_file_read_record(file, offset, &topic_length, &message_size)) ||
+            ((size - (long)offset - MQTT_STORE_FILE_RECORD_HEADER) < ((long)topic_length + (long)message_size))) {
+            #ifdef DEBUG
+                mqtt_printf("%s %u Store file %s partial record at %u removed\n", __FILE__, __LINE__, a_path, offset);
+            #endif
+            return (0 == ftruncate(fileno(file), (off_t)offset));
+        }
+        offset += MQTT_STORE_FILE_RECORD_HEADER + topic_length + message_size;
+        a_file_store_ptr->store.count++;
+    }
+    return true;
+}
+
+bool mqtt_store_file_open(MQTT_store_file_t * a_file_store_ptr,
+                          const char        * a_path,
+                          uint8_t           * a_scratch_ptr,
+                          uint32_t            a_scratch_size)
+{
+    if ((NULL == a_file_store_ptr) ||
+        (NULL == a_path)           ||
+        (NULL == a_scratch_ptr))
+        return false;
+
+    mqtt_memset(a_file_store_ptr, 0, sizeof(MQTT_store_file_t));
+    a_file_store_ptr->store.put_fptr  = &mqtt_store_file_put;
+    a_file_store_ptr->store.peek_fptr = &mqtt_store_file_peek;
+    a_file_store_ptr->store.pop_fptr  = &mqtt_store_file_pop;
+    a_file_store_ptr->scratch         = a_scratch_ptr;
+    a_file_store_ptr->scratch_size    = a_scratch_size;
+    a_file_store_ptr->read_offset     = MQTT_STORE_FILE_HEADER;
+
+    a_file_store_ptr->file = fopen(a_path, "r+b");
+    if (NULL == a_file_store_ptr->file)
+        a_file_store_ptr->file = fopen(a_path, "w+b");
+    if (NULL == a_file_store_ptr->file)
+        return false;
+
+    if (false == store_file_load(a_file_store_ptr, a_path)) {
+        fclose(a_file_store_ptr->file);
+        a_file_store_ptr->file = NULL;
+        return false;
+    }
+    return true;
+}
+
+void mqtt_store_file_close(MQTT_store_file_t * a_file_store_ptr)
+{
+    if ((NULL != a_file_store_ptr) &&
+        (NULL != a_file_store_ptr->file)) {
+        fclose(a_file_store_ptr->file);
+        a_file_store_ptr->file = NULL;
+    }
+}
+
+#endif /* BUILD_DEFAULT_C_LIBS */
@@ -0,0 +1,327 @@
+/****************************************************************************************
+ * Encode / decode microbenchmark                                                       *
+ *                                                                                      *
+ * Measures hot paths of the client with payload and topic size sweeps. Result is one   *
+ * CSV row per case to stdout:                                                          *
+ *                                                                                      *
+ *   case,topic_size,payload_size,iterations,ns_per_op,bytes_per_sec                    *
+ *                                                                                      *
+ * bytes_per_sec counts the encoded packet bytes written or read by one operation.      *
+ * Usage: mqtt_benchmark [--quick] [filter], filter selects cases by name prefix.       *
+ ****************************************************************************************/
+#include "mqtt.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/* Functions not declared in mqtt.h - internal functions */
+extern uint8_t mqtt_varint_size(uint32_t a_value);
+extern uint8_t encode_fixed_header(MQTT_fixed_header_t * a_output_ptr,
+                                   bool                  a_dup,
+                                   MQTTQoSLevel_t        a_qos,
+                                   bool                  a_retain,
+                                   MQTTMessageType_t     a_messageType,
+                                   uint32_t              a_msgSize);
+extern uint8_t * decode_fixed_header(uint8_t           * a_input_ptr,
+                                     bool              * a_dup_ptr,
+                                     MQTTQoSLevel_t    * a_qos_ptr,
+                                     bool              * a_retain_ptr,
+                                     MQTTMessageType_t * a_message_type_ptr,
+                                     uint32_t          * a_message_size_ptr);
+extern bool encode_publish(MQTT_shared_data_t * a_shared_ptr,
+                           uint8_t            * a_output_ptr,
+                           uint32_t             a_output_size,
+                           bool                 a_retain,
+                           MQTTQoSLevel_t       a_qos,
+                           bool                 a_dup,
+                           uint8_t            * topic_ptr,
+                           uint16_t             topic_size,
+                           uint16_t             packet_identifier,
+                           uint8_t            * message_ptr,
+                           uint32_t             message_size);
+extern bool decode_publish(uint8_t        *  a_message_in_ptr,
+                           uint32_t          a_size_of_msg,
+                           MQTTQoSLevel_t    a_qos,
+                           uint8_t        ** a_topic_out_ptr,
+                           uint16_t       *  a_topic_length_out_ptr,
+                           uint8_t        ** a_out_message_ptr,
+                           uint32_t       *  a_out_message_size_ptr);
+extern uint8_t * mqtt_connect_fill(uint8_t        * a_message_buffer_ptr,
+                                   size_t           a_max_buffer_size,
+                                   MQTT_connect_t * a_connect_ptr,
+                                   uint16_t       * a_ouput_size_ptr);
+
+#define BENCH_MAX_PAYLOAD 65536
+#define BENCH_BUFFER_SIZE (BENCH_MAX_PAYLOAD + 512)
+#define BENCH_BATCH       256
+
+static const uint32_t g_topic_sizes[]   = {8, 64, 256};
+static const uint32_t g_payload_sizes[] = {16, 256, 4096, BENCH_MAX_PAYLOAD};
+static const uint32_t g_lengths[]       = {0, 127, 16383, 2097151, MQTT_MAX_MESSAGE_SIZE};
+
+static uint8_t  g_topic[256];
+static uint8_t  g_payload[BENCH_MAX_PAYLOAD];
+static uint8_t  g_buffer[BENCH_BUFFER_SIZE];
+static uint8_t  g_packet[BENCH_BUFFER_SIZE];
+static uint32_t g_packet_size = 0;
+
+static MQTT_shared_data_t g_shared;
+static uint32_t           g_min_time_in_ms = 200;
+static const char       * g_filter_ptr     = NULL;
+static uint32_t           g_failures       = 0;
+
+/* Results are summed here, so that the compiler can not drop the measured calls */
+static volatile uint32_t g_sink = 0;
+
+/****************************************************************************************
+ * Output and receive callbacks                                                         *
+ ****************************************************************************************/
+int bench_out_fptr(MQTT_shared_data_t * a_shared_ptr, uint8_t * a_data_ptr, size_t a_amount)
+{
+    a_shared_ptr = a_shared_ptr;
+    g_sink      += a_data_ptr[0];
+    return (int)a_amount;
+}
+
+/* Capture packet into g_packet, used to build input of the decode cases */
+int bench_capture_fptr(MQTT_shared_data_t * a_shared_ptr, uint8_t * a_data_ptr, size_t a_amount)
+{
+    a_shared_ptr = a_shared_ptr;
+    memcpy(&(g_packet[g_packet_size]), a_data_ptr, a_amount);
+    g_packet_size += (uint32_t)a_amount;
+    return (int)a_amount;
+}
+
+void bench_subscribe_cb(MQTT_shared_data_t * a_shared_ptr,
+                        MQTTErrorCodes_t     a_status,
+                        uint8_t            * a_data_ptr,
+                        uint32_t             a_data_len,
+                        uint8_t            * a_topic_ptr,
+                        uint16_t             a_topic_len)
+{
+    a_shared_ptr = a_shared_ptr;
+    a_status     = a_status;
+    a_data_ptr   = a_data_ptr;
+    a_topic_ptr  = a_topic_ptr;
+    g_sink      += a_data_len + a_topic_len;
+}
+
+/****************************************************************************************
+ * Measurement                                                                          *
+ ****************************************************************************************/
+typedef bool (*bench_op_fptr_t)(uint32_t a_topic_size, uint32_t a_payload_size);
+
+static uint64_t now_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+/* Run operation in batches until minimum time is spent, print the result row */
+static void bench_run(const char      * a_name_ptr,
+                      bench_op_fptr_t   a_op_fptr,
+                      uint32_t          a_topic_size,
+                      uint32_t          a_payload_size,
+                      uint32_t          a_bytes_per_op)
+{
+    if ((NULL != g_filter_ptr) &&
+        (0 != strncmp(a_name_ptr, g_filter_ptr, strlen(g_filter_ptr))))
+        return;
+
+    /* One call outside of the measurement validates the case */
+    if (false == a_op_fptr(a_topic_size, a_payload_size)) {
+        fprintf(stderr, "%s topic %u payload %u failed\n", a_name_ptr, a_topic_size, a_payload_size);
+        g_failures++;
+        return;
+    }
+
+    uint64_t iterations = 0;
+    uint64_t start      = now_ns();
+    uint64_t elapsed    = 0;
+
+    do {
+        for (uint32_t i = 0; i < BENCH_BATCH; i++)
+            a_op_fptr(a_topic_size, a_payload_size);
+        iterations += BENCH_BATCH;
+        elapsed     = now_ns() - start;
+    } while (elapsed < (uint64_t)g_min_time_in_ms * 1000000ULL);
+
+    double ns_per_op     = (double)elapsed / (double)iterations;
+    double bytes_per_sec = (double)a_bytes_per_op * 1000000000.0 / ns_per_op;
+
+    printf("%s,%u,%u,%llu,%.2f,%.0f\n",
+           a_name_ptr,
+           a_topic_size,
+           a_payload_size,
+           (unsigned long long)iterations,
+           ns_per_op,
+           bytes_per_sec);
+}
+
+/****************************************************************************************
+ * Cases                                                                                *
+ ****************************************************************************************/
+static bool op_encode_fixed_header(uint32_t a_topic_size, uint32_t a_payload_size)
+{
+    a_topic_size = a_topic_size;
+    uint8_t size = encode_fixed_header((MQTT_fixed_header_t *)g_buffer, false, QoS0, false, PUBLISH, a_payload_size);
+    g_sink += size;
+    return (0 < size);
+}
+
+static bool op_decode_fixed_header(uint32_t a_topic_size, uint32_t a_payload_size)
+{
+    bool              dup;
+    MQTTQoSLevel_t    qos;
+    bool              retain;
+    MQTTMessageType_t type;
+    uint32_t          size;
+
+    a_topic_size = a_topic_size;
+    if (NULL == decode_fixed_header(g_packet, &dup, &qos, &retain, &type, &size))
+        return false;
+    g_sink += size;
+    return (a_payload_size == size);
+}
+
+static bool op_encode_publish(uint32_t a_topic_size, uint32_t a_payload_size)
+{
+    return encode_publish(&g_shared, g_buffer, sizeof(g_buffer), false, QoS0, false,
+                          g_topic, (uint16_t)a_topic_size, 0, g_payload, a_payload_size);
+}
+
+static bool op_decode_publish(uint32_t a_topic_size, uint32_t a_payload_size)
+{
+    uint8_t  * topic_ptr;
+    uint16_t   topic_size;
+    uint8_t  * message_ptr;
+    uint32_t   message_size;
+    uint32_t   header_size = 1 + mqtt_varint_size(2 + a_topic_size + a_payload_size);
+
+    if (false == decode_publish(&(g_packet[header_size]), g_packet_size - header_size, QoS0,
+                                &topic_ptr, &topic_size, &message_ptr, &message_size))
+        return false;
+    g_sink += message_size;
+    return ((a_topic_size == topic_size) && (a_payload_size == message_size));
+}
+
+static bool op_packet_view(uint32_t a_topic_size, uint32_t a_payload_size)
+{
+    MQTT_packet_view_t view;
+
+    if (Successfull != mqtt_packet_view(g_packet, g_packet_size, &view))
+        return false;
+    g_sink += view.payload.len;
+    return ((a_topic_size == view.topic.len) && (a_payload_size == view.payload.len));
+}
+
+static bool op_connect_fill(uint32_t a_topic_size, uint32_t a_payload_size)
+{
+    MQTT_connect_t connect;
+    uint16_t       size = 0;
+
+    /* Topic size selects parameters: client id only or with will and credentials */
+    a_payload_size = a_payload_size;
+    memset(&connect, 0, sizeof(connect));
+    connect.client_id                   = (uint8_t *)"benchmark-client";
+    connect.last_will_topic             = (uint8_t *)((0 < a_topic_size) ? "bench/status"  : "");
+    connect.last_will_message           = (uint8_t *)((0 < a_topic_size) ? "offline"       : "");
+    connect.username                    = (uint8_t *)((0 < a_topic_size) ? "user"          : "");
+    connect.password                    = (uint8_t *)((0 < a_topic_size) ? "secret"        : "");
+    connect.keepalive                   = 60;
+    connect.connect_flags.clean_session = true;
+
+    /* Transmit buffer of a typical client is filled */
+    if (NULL == mqtt_connect_fill(g_buffer, 256, &connect, &size))
+        return false;
+    g_sink += size;
+    return true;
+}
+
+static bool op_parse_dispatch(uint32_t a_topic_size, uint32_t a_payload_size)
+{
+    a_topic_size   = a_topic_size;
+    a_payload_size = a_payload_size;
+    return mqtt_receive(&g_shared, g_packet, g_packet_size);
+}
+
+/* Encode PUBLISH into g_packet */
+static bool capture_publish(uint32_t a_topic_size, uint32_t a_payload_size)
+{
+    g_shared.out_fptr = &bench_capture_fptr;
+    g_packet_size     = 0;
+    bool ret = encode_publish(&g_shared, g_buffer, sizeof(g_buffer), false, QoS0, false,
+                              g_topic, (uint16_t)a_topic_size, 0, g_payload, a_payload_size);
+    g_shared.out_fptr = &bench_out_fptr;
+    return ret;
+}
+
+/****************************************************************************************
+ * Benchmark main                                                                       *
+ ****************************************************************************************/
+int main(int argc, char ** argv)
+{
+    uint8_t connack[] = {0x20, 0x02, 0x00, 0x00};
+
+    for (int i = 1; i < argc; i++) {
+        if (0 == strcmp("--quick", argv[i]))
+            g_min_time_in_ms = 1;
+        else
+            g_filter_ptr = argv[i];
+    }
+
+    memset(g_topic, 't', sizeof(g_topic));
+    memset(g_payload, 'p', sizeof(g_payload));
+
+    /* Connected client, subscribe callback receives all publishes */
+    memset(&g_shared, 0, sizeof(g_shared));
+    g_shared.buffer            = g_buffer;
+    g_shared.buffer_size       = sizeof(g_buffer);
+    g_shared.out_fptr          = &bench_out_fptr;
+    g_shared.subscribe_cb_fptr = &bench_subscribe_cb;
+    if ((Successfull != mqtt(&g_shared, ACTION_INIT, NULL)) ||
+        (false == mqtt_receive(&g_shared, connack, sizeof(connack)))) {
+        fprintf(stderr, "client setup failed\n");
+        return 1;
+    }
+
+    printf("case,topic_size,payload_size,iterations,ns_per_op,bytes_per_sec\n");
+
+    /* Fixed header, payload size is the remaining length */
+    for (uint32_t i = 0; i < sizeof(g_lengths) / sizeof(g_lengths[0]); i++) {
+        uint8_t header_size = (uint8_t)(1 + mqtt_varint_size(g_lengths[i]));
+        bench_run("encode_fixed_header", op_encode_fixed_header, 0, g_lengths[i], header_size);
+
+        encode_fixed_header((MQTT_fixed_header_t *)g_packet, false, QoS0, false, PUBLISH, g_lengths[i]);
+        bench_run("decode_fixed_header", op_decode_fixed_header, 0, g_lengths[i], header_size);
+    }
+
+    /* PUBLISH encode, decode and full receive with dispatch to the callback */
+    for (uint32_t t = 0; t < sizeof(g_topic_sizes) / sizeof(g_topic_sizes[0]); t++) {
+        for (uint32_t p = 0; p < sizeof(g_payload_sizes) / sizeof(g_payload_sizes[0]); p++) {
+            uint32_t topic_size   = g_topic_sizes[t];
+            uint32_t payload_size = g_payload_sizes[p];
+
+            if (false == capture_publish(topic_size, payload_size)) {
+                fprintf(stderr, "publish topic %u payload %u could not be encoded\n", topic_size, payload_size);
+                g_failures++;
+                continue;
+            }
+
+            bench_run("encode_publish", op_encode_publish, topic_size, payload_size, g_packet_size);
+            bench_run("decode_publish", op_decode_publish, topic_size, payload_size, g_packet_size);
+            bench_run("packet_view", op_packet_view, topic_size, payload_size, g_packet_size);
+            bench_run("parse_dispatch", op_parse_dispatch, topic_size, payload_size, g_packet_size);
+        }
+    }
+
+    /* CONNECT with client id only (topic size 0) and with will and credentials */
+    for (uint32_t i = 0; i < 2; i++) {
+        op_connect_fill(i, 0);
+        bench_run("mqtt_connect_fill", op_connect_fill, i, 0, 2 + ((MQTT_fixed_header_t *)g_buffer)->length[0]);
+    }
+
+    return (0 == g_failures) ? 0 : 1;
+}
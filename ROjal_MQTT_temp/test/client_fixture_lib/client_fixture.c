@@ -0,0 +1,81 @@
+#include <string.h>  // memcpy, memset
+#include "unity.h"
+#include "client_fixture.h"
+
+uint8_t  g_out[FIXTURE_OUT_SIZE];
+uint32_t g_out_len     = 0;
+uint32_t g_write_cntr  = 0;
+uint32_t g_write_size[FIXTURE_WRITE_LOG];
+uint32_t g_iov_cnt     = 0;
+bool     g_write_fails = false;
+
+uint8_t  connack[4] = {0x20, 0x02, 0x00, 0x00};
+
+static void fixture_capture(uint8_t * a_data_ptr, size_t a_amount)
+{
+    TEST_ASSERT_TRUE((g_out_len + a_amount) <= sizeof(g_out));
+    memcpy(&(g_out[g_out_len]), a_data_ptr, a_amount);
+    g_out_len += a_amount;
+}
+
+static void fixture_count(size_t a_amount)
+{
+    if (g_write_cntr < FIXTURE_WRITE_LOG)
+        g_write_size[g_write_cntr] = (uint32_t)a_amount;
+    g_write_cntr++;
+}
+
+int fixture_out_fptr(MQTT_shared_data_t * a_shared_ptr, uint8_t * a_data_ptr, size_t a_amount)
+{
+    a_shared_ptr = a_shared_ptr;
+    if (true == g_write_fails)
+        return -1;
+
+    fixture_capture(a_data_ptr, a_amount);
+    fixture_count(a_amount);
+    return (int)a_amount;
+}
+
+int fixture_outv_fptr(MQTT_shared_data_t * a_shared_ptr, MQTT_iovec_t * a_iov_ptr, uint32_t a_iov_cnt)
+{
+    size_t total = 0;
+
+    a_shared_ptr = a_shared_ptr;
+    if (true == g_write_fails)
+        return -1;
+
+    for (uint32_t i = 0; i < a_iov_cnt; i++) {
+        fixture_capture(a_iov_ptr[i].data, a_iov_ptr[i].size);
+        total += a_iov_ptr[i].size;
+    }
+    fixture_count(total);
+    g_iov_cnt = a_iov_cnt;
+    return (int)total;
+}
+
+void fixture_clear(void)
+{
+    g_out_len     = 0;
+    g_write_cntr  = 0;
+    g_iov_cnt     = 0;
+    g_write_fails = false;
+    memset(g_write_size, 0, sizeof(g_write_size));
+}
+
+void fixture_setup(MQTT_shared_data_t * a_shared_ptr,
+                   uint8_t            * a_buffer_ptr,
+                   size_t               a_buffer_size,
+                   bool                 a_connected)
+{
+    memset(a_shared_ptr, 0, sizeof(MQTT_shared_data_t));
+    a_shared_ptr->buffer      = a_buffer_ptr;
+    a_shared_ptr->buffer_size = a_buffer_size;
+    a_shared_ptr->out_fptr    = &fixture_out_fptr;
+
+    TEST_ASSERT_EQUAL_INT(Successfull, mqtt(a_shared_ptr, ACTION_INIT, NULL));
+    if (true == a_connected) {
+        TEST_ASSERT_TRUE(mqtt_receive(a_shared_ptr, connack, sizeof(connack)));
+        TEST_ASSERT_EQUAL_INT(STATE_CONNECTED, a_shared_ptr->state);
+    }
+    fixture_clear();
+}
@@ -0,0 +1,62 @@
+#ifndef CLIENT_FIXTURE_H
+#define CLIENT_FIXTURE_H
+
+#include <stdint.h>  // uint
+#include <stddef.h>  // size_t
+#include <stdbool.h> // bool
+
+#include "mqtt.h"
+
+#define FIXTURE_OUT_SIZE  (20*1024)
+#define FIXTURE_WRITE_LOG 8
+
+/****************************************************************************************
+ * @section client fixture                                                              *
+ * Unit tests drive one client context without a broker. Output of the context is       *
+ * captured into g_out, so tests can check the packets sent. Incoming packets are given *
+ * with mqtt_receive, e.g. connack.                                                     *
+ ****************************************************************************************/
+
+/* Captured output, cleared by fixture_setup and fixture_clear */
+extern uint8_t  g_out[FIXTURE_OUT_SIZE];
+extern uint32_t g_out_len;
+extern uint32_t g_write_cntr;                    /* out_fptr and outv_fptr calls  */
+extern uint32_t g_write_size[FIXTURE_WRITE_LOG]; /* Sizes of the first writes     */
+extern uint32_t g_iov_cnt;                       /* Chunks of the latest vector   */
+extern bool     g_write_fails;                   /* true = writes return -1       */
+
+/* CONNACK - connection accepted */
+extern uint8_t  connack[4];
+
+/**
+ * Capture output of the context into g_out, one write.
+ */
+int fixture_out_fptr(MQTT_shared_data_t * a_shared_ptr, uint8_t * a_data_ptr, size_t a_amount);
+
+/**
+ * Capture output vector of the context into g_out, one write.
+ */
+int fixture_outv_fptr(MQTT_shared_data_t * a_shared_ptr, MQTT_iovec_t * a_iov_ptr, uint32_t a_iov_cnt);
+
+/**
+ * Clear captured output and write failure.
+ */
+void fixture_clear(void);
+
+/**
+ * Initialize context with the transmit buffer and fixture_out_fptr.
+ *
+ * Context is cleared and ACTION_INIT run. Connected context has received connack.
+ * Captured output is cleared after that.
+ *
+ * @param a_shared_ptr [in] client context.
+ * @param a_buffer_ptr [in] transmit buffer, can be NULL.
+ * @param a_buffer_size [in] size of the transmit buffer.
+ * @param a_connected [in] give connack to the context.
+ */
+void fixture_setup(MQTT_shared_data_t * a_shared_ptr,
+                   uint8_t            * a_buffer_ptr,
+                   size_t               a_buffer_size,
+                   bool                 a_connected);
+
+#endif /* CLIENT_FIXTURE_H */
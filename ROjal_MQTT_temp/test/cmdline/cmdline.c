@@ -34,6 +34,7 @@ static struct argp_option options[] = {
     { "sport",     's', "SocketPort", 0, "MQTT's Socket port (if not defined 1883 will be used):", 0},
     { "user",      'u', "Username",   0, "Username (if required by broker):", 0},
     { "password",  'p', "Password",   0, "Password (if required by broker):", 0},
+    { "queue",     'q', "QueueFile",  0, "Queue message into file when broker is not reachable, queued messages are sent first on next run:", 0},
     { "verbose",   'v', 0,            0, "Verbose:", 0},
     { 0 }
 };
@@ -53,11 +54,15 @@ struct arguments {
     uint32_t  hostport;
     uint8_t * filename;
     bool      receive_file;
+    char    * queue_file;
     bool      verbose;
 };
 
 static MQTT_shared_data_t mqtt_shared_data;
 static uint8_t            a_output_buffer[1024]; /* Shared buffer */
+static uint8_t            a_input_buffer[1024*1024]; /* Reassembly buffer for split packets */
+static MQTT_store_file_t  queue;                     /* Outbound store for offline messages */
+static uint8_t            queue_scratch[1024];
 
 static struct arguments arguments; /* Argument prarsing script    */
 
@@ -185,6 +190,11 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
                 arguments->last_will_topic = p;
                 break;
             }
+            case 'q':
+            {
+                arguments->queue_file = arg;
+                break;
+            }
             case ARGP_KEY_ARG:
                 return 0;
             default:
@@ -223,8 +233,10 @@ void sleep_ms(int milliseconds)
     nanosleep(&ts, NULL);
 }
 
-void connected_cb(MQTTErrorCodes_t a_status)
+void connected_cb(MQTT_shared_data_t * a_shared_ptr, MQTTErrorCodes_t a_status)
 {
+    a_shared_ptr = a_shared_ptr;
+
     if (Successfull == a_status) {
         printf("Connected\n");
     } else {
@@ -232,12 +244,15 @@ void connected_cb(MQTTErrorCodes_t a_status)
     }
 }
 
-void subscrbe_cb(MQTTErrorCodes_t   a_status,
-                 uint8_t          * a_data_ptr,
-                 uint32_t           a_data_len,
-                 uint8_t          * a_topic_ptr,
-                 uint16_t           a_topic_len)
+void subscrbe_cb(MQTT_shared_data_t * a_shared_ptr,
+                 MQTTErrorCodes_t     a_status,
+                 uint8_t            * a_data_ptr,
+                 uint32_t             a_data_len,
+                 uint8_t            * a_topic_ptr,
+                 uint16_t             a_topic_len)
 {
+    a_shared_ptr = a_shared_ptr;
+
     if (Successfull == a_status) {
         if (0 < a_data_len) {
             /* Save to file */
@@ -269,7 +284,7 @@ void subscrbe_cb(MQTTErrorCodes_t   a_status,
 
 void data_from_socket(uint8_t * a_data, size_t a_amount)
 {
-    mqtt_receive(a_data, a_amount);
+    mqtt_receive(&mqtt_shared_data, a_data, a_amount);
 }
 
 
@@ -286,25 +301,53 @@ bool rmc_connect(struct arguments * arguments)
 {
     if (false == socket_initialize((char*)(arguments->hostip), arguments->hostport, &data_from_socket))
         return false;
-    return mqtt_connect((char *)arguments->clientID,
+    if (false == mqtt_connect(&mqtt_shared_data,
+                                (char *)arguments->clientID,
                                 arguments->keepalive,
                                 arguments->username,
                                 arguments->password,
                                 arguments->last_will_topic,
                                 arguments->last_will_message,
-                                &mqtt_shared_data,
                                 a_output_buffer,
                                 sizeof(a_output_buffer),
                                 arguments->clean,
                                 &socket_write,
                                 &connected_cb,
                                 &subscrbe_cb,
-                                10);
+                                10))
+        return false;
+    return mqtt_receive_buffer(&mqtt_shared_data, a_input_buffer, sizeof(a_input_buffer));
 }
 
 void rmc_disconnect()
 {
-    mqtt_disconnect();
+    mqtt_disconnect(&mqtt_shared_data);
+}
+
+/* Latencies and packet counts of the session, only when built with MQTT_INSTRUMENTATION */
+void rmc_instrumentation()
+{
+    static const char * histograms[HISTOGRAM_CNT] = {"connect", "subscribe", "ping", "qos1 ack", "qos2 ack", "callback"};
+    static MQTT_instrumentation_t snapshot;
+
+    if (false == mqtt_instrumentation_snapshot(&mqtt_shared_data, &snapshot, false))
+        return;
+
+    trace("\tLatency     count     min     p50     p99     max [us]\n");
+    for (uint32_t i = 0; i < HISTOGRAM_CNT; i++) {
+        MQTT_histogram_t * h = &(snapshot.histograms[i]);
+        if (0 < h->count)
+            trace("\t%-9s %7u %7u %7u %7u %7u\n", histograms[i], h->count, h->min_in_us,
+                  mqtt_histogram_percentile(h, 500), mqtt_histogram_percentile(h, 990), h->max_in_us);
+    }
+
+    trace("\tType   in packets    in bytes out packets   out bytes\n");
+    for (uint32_t i = 0; i < MAXCMD; i++) {
+        if ((0 < snapshot.in[i].packets) || (0 < snapshot.out[i].packets))
+            trace("\t%4u %12u %11llu %11u %11llu\n", i,
+                  snapshot.in[i].packets,  (unsigned long long)snapshot.in[i].bytes,
+                  snapshot.out[i].packets, (unsigned long long)snapshot.out[i].bytes);
+    }
 }
 
 
@@ -334,6 +377,7 @@ int main(int argc, char *argv[])
     arguments.hostport          = 1883;
     arguments.filename          = empty;
     arguments.receive_file      = false;
+    arguments.queue_file        = NULL;
     arguments.verbose           = false;
 
     argp_parse(&argp, argc, argv, 0, 0, &arguments);
@@ -350,6 +394,7 @@ int main(int argc, char *argv[])
     trace("\tTopic     %s\n",    arguments.topic);
     trace("\tLWT       %s\n",    arguments.last_will_message);
     trace("\tLWT topic %s\n",    arguments.last_will_topic);
+    trace("\tQueue     %s\n",    arguments.queue_file ? arguments.queue_file : "");
 
     bool valid_parameters = true;
 
@@ -363,8 +408,22 @@ int main(int argc, char *argv[])
         valid_parameters = false;
     }
 
+    if ((valid_parameters) &&
+        (NULL != arguments.queue_file)) {
+        if (false == mqtt_store_file_open(&queue, arguments.queue_file, queue_scratch, sizeof(queue_scratch))) {
+            printf("Failed to open queue %s\n", arguments.queue_file);
+            valid_parameters = false;
+        } else {
+            trace("\tQueued    %u\n", queue.store.count);
+        }
+    }
+
     if (valid_parameters) {
         if (rmc_connect(&arguments)) {
+            /* Messages queued by earlier runs are sent first */
+            if (NULL != arguments.queue_file)
+                mqtt_outbound_store(&mqtt_shared_data, &(queue.store));
+
             if (((0 == strlen((char*)(arguments.message)))  && // No message & No filename & no receive
                  (0 == strlen((char*)(arguments.filename))) &&
                  (false == arguments.receive_file))         || // or filename and receive
@@ -372,7 +431,7 @@ int main(int argc, char *argv[])
                  (true == arguments.receive_file))) {
 
                 printf("Subscribe\n");
-                if (true == mqtt_subscribe((char *)arguments.topic, strlen((char*)(arguments.topic)), 10)) {
+                if (true == mqtt_subscribe(&mqtt_shared_data, (char *)arguments.topic, strlen((char*)(arguments.topic)), 10)) {
 
                     signal(SIGINT, ctrl_c_exit);
 
@@ -382,7 +441,7 @@ int main(int argc, char *argv[])
                             printf("keepalive...\n");
                             fflush(stdout);
                             if (subscribe_continue)
-                                subscribe_continue = mqtt_keepalive(arguments.keepalive * 1000); // Update in ms
+                                subscribe_continue = mqtt_keepalive(&mqtt_shared_data, arguments.keepalive * 1000); // Update in ms
                         } else {
                             sleep_in_sec(1);
                         }
@@ -395,7 +454,8 @@ int main(int argc, char *argv[])
                 if (0 < strlen((char*)(arguments.message))) {
 
                     printf("Publish MSG\n");
-                    mqtt_publish((char *)arguments.topic,
+                    mqtt_publish(&mqtt_shared_data,
+                                 (char *)arguments.topic,
                                   strlen((char*)(arguments.topic)),
                                  (char *)arguments.message,
                                   strlen((char*)(arguments.message)));
@@ -419,7 +479,8 @@ int main(int argc, char *argv[])
                                 uint8_t * mqttbuf = (uint8_t *)malloc(mqttbuf_size);
 
                                 printf("Sending file %s [%lu Bytes] %p\n", (char*)(arguments.filename), len, a_output_buffer);
-                                printf("Status: %i\n", mqtt_publish_buf((char *)arguments.topic,
+                                printf("Status: %i\n", mqtt_publish_buf(&mqtt_shared_data,
+                                                                        (char *)arguments.topic,
                                                                         strlen((char*)(arguments.topic)),
                                                                         buf,
                                                                         len,
@@ -439,10 +500,24 @@ int main(int argc, char *argv[])
                     }
                 }
             }
+            rmc_instrumentation();
             rmc_disconnect();
+        } else if ((NULL != arguments.queue_file) &&
+                   (0    <  strlen((char*)(arguments.message)))) {
+            if (queue.store.put_fptr(&(queue.store),
+                                     arguments.topic,
+                                     (uint16_t)strlen((char*)(arguments.topic)),
+                                     arguments.message,
+                                     (uint32_t)strlen((char*)(arguments.message))))
+                printf("Broker not reachable, message queued [%u in queue]\n", queue.store.count);
+            else
+                printf("Broker not reachable, queue %s full\n", arguments.queue_file);
         }
     }
 
+    if (NULL != arguments.queue_file)
+        mqtt_store_file_close(&queue);
+
     trace("\n\n--------------------\nCleanUp\n");
     if (arguments.clientid_set)
         clean(arguments.clientID,      "ClientID");
@@ -0,0 +1,157 @@
+#include "mqtt.h"
+#include "unity.h"
+#include "client_fixture.h"
+
+#include <string.h>
+#include <unistd.h>
+
+static MQTT_shared_data_t shared;
+static uint8_t            tx_buffer[64];
+static uint8_t            staging[64];
+
+/* PUBLISH QoS 0 "t" "x" */
+static uint8_t publish_tx[] = {0x30, 0x04, 0x00, 0x01, 't', 'x'};
+
+static void coalesce_setup(uint32_t a_threshold, uint32_t a_max_delay_in_ms)
+{
+    fixture_setup(&shared, tx_buffer, sizeof(tx_buffer), true);
+    shared.keepalive_in_ms = 60000; /* No ping during the test */
+
+    TEST_ASSERT_TRUE(mqtt_output_coalesce(&shared, staging, sizeof(staging), a_threshold, a_max_delay_in_ms));
+    fixture_clear();
+}
+
+/****************************************************************************************
+ * Output coalescing tests                                                              *
+ ****************************************************************************************/
+void test_coalesce_flush()
+{
+    coalesce_setup(0, 1000);
+
+    /* Small publishes wait in the staging buffer */
+    for (uint32_t i = 0; i < 3; i++)
+        TEST_ASSERT_TRUE(mqtt_publish(&shared, "t", 1, "x", 1));
+    TEST_ASSERT_EQUAL_UINT32(0, g_write_cntr);
+    TEST_ASSERT_EQUAL_UINT32(3 * sizeof(publish_tx), shared.coalesce.fill);
+
+    /* All go with one write */
+    TEST_ASSERT_TRUE(mqtt_flush(&shared));
+    TEST_ASSERT_EQUAL_UINT32(1, g_write_cntr);
+    TEST_ASSERT_EQUAL_UINT32(3 * sizeof(publish_tx), g_out_len);
+    for (uint32_t i = 0; i < 3; i++)
+        TEST_ASSERT_EQUAL_MEMORY(publish_tx, &(g_out[i * sizeof(publish_tx)]), sizeof(publish_tx));
+
+    /* Nothing staged */
+    TEST_ASSERT_TRUE(mqtt_flush(&shared));
+    TEST_ASSERT_EQUAL_UINT32(1, g_write_cntr);
+}
+
+void test_coalesce_threshold()
+{
+    coalesce_setup(2 * sizeof(publish_tx), 1000);
+
+    TEST_ASSERT_TRUE(mqtt_publish(&shared, "t", 1, "x", 1));
+    TEST_ASSERT_EQUAL_UINT32(0, g_write_cntr);
+    TEST_ASSERT_TRUE(mqtt_publish(&shared, "t", 1, "x", 1));
+    TEST_ASSERT_EQUAL_UINT32(1, g_write_cntr);
+    TEST_ASSERT_EQUAL_UINT32(2 * sizeof(publish_tx), g_write_size[0]);
+
+    TEST_ASSERT_TRUE(mqtt_publish(&shared, "t", 1, "x", 1));
+    TEST_ASSERT_EQUAL_UINT32(1, g_write_cntr);
+    TEST_ASSERT_EQUAL_UINT32(sizeof(publish_tx), shared.coalesce.fill);
+}
+
+void test_coalesce_control_packet()
+{
+    coalesce_setup(0, 1000);
+
+    /* Other packets push the staged publishes out with them */
+    TEST_ASSERT_TRUE(mqtt_publish(&shared, "t", 1, "x", 1));
+    TEST_ASSERT_TRUE(mqtt_subscribe(&shared, "cmd", 3, 0));
+    TEST_ASSERT_EQUAL_UINT32(1, g_write_cntr);
+    TEST_ASSERT_EQUAL_MEMORY(publish_tx, g_out, sizeof(publish_tx));
+    TEST_ASSERT_EQUAL_HEX8(0x82, g_out[sizeof(publish_tx)]);
+    TEST_ASSERT_EQUAL_UINT32(0, shared.coalesce.fill);
+}
+
+void test_coalesce_big_packet()
+{
+    char payload[80];
+
+    coalesce_setup(0, 1000);
+    memset(payload, 'p', sizeof(payload));
+
+    /* Staged go first, packet bigger than the staging buffer directly after them */
+    TEST_ASSERT_TRUE(mqtt_publish(&shared, "t", 1, "x", 1));
+    TEST_ASSERT_TRUE(mqtt_publish_begin(&shared, "t", 1, sizeof(payload)));
+    TEST_ASSERT_EQUAL_UINT32(0, g_write_cntr);
+    TEST_ASSERT_TRUE(mqtt_publish_append(&shared, payload, sizeof(payload)));
+    TEST_ASSERT_TRUE(mqtt_publish_end(&shared));
+
+    TEST_ASSERT_EQUAL_UINT32(2, g_write_cntr);
+    TEST_ASSERT_EQUAL_UINT32(sizeof(publish_tx) + 5, g_write_size[0]);
+    TEST_ASSERT_EQUAL_UINT32(sizeof(payload), g_write_size[1]);
+    TEST_ASSERT_EQUAL_MEMORY(publish_tx, g_out, sizeof(publish_tx));
+    TEST_ASSERT_EQUAL_HEX8(0x30, g_out[sizeof(publish_tx)]);
+    TEST_ASSERT_EQUAL_HEX8('p',  g_out[sizeof(publish_tx) + 5]);
+}
+
+void test_coalesce_max_delay()
+{
+    coalesce_setup(0, 20);
+
+    TEST_ASSERT_TRUE(mqtt_publish(&shared, "t", 1, "x", 1));
+    TEST_ASSERT_TRUE(mqtt_keepalive(&shared, 0));
+    TEST_ASSERT_EQUAL_UINT32(0, g_write_cntr);
+
+    /* Keepalive sends packets staged longer than the max delay */
+    usleep(30 * 1000);
+    TEST_ASSERT_TRUE(mqtt_keepalive(&shared, 30));
+    TEST_ASSERT_EQUAL_UINT32(1, g_write_cntr);
+    TEST_ASSERT_EQUAL_UINT32(sizeof(publish_tx), g_out_len);
+
+    /* Zero delay sends every packet directly */
+    TEST_ASSERT_TRUE(mqtt_output_coalesce(&shared, staging, sizeof(staging), 0, 0));
+    TEST_ASSERT_TRUE(mqtt_publish(&shared, "t", 1, "x", 1));
+    TEST_ASSERT_EQUAL_UINT32(2, g_write_cntr);
+}
+
+void test_coalesce_off()
+{
+    coalesce_setup(0, 1000);
+
+    /* Turning off sends the staged packets */
+    TEST_ASSERT_TRUE(mqtt_publish(&shared, "t", 1, "x", 1));
+    TEST_ASSERT_TRUE(mqtt_output_coalesce(&shared, NULL, 0, 0, 0));
+    TEST_ASSERT_EQUAL_UINT32(1, g_write_cntr);
+    TEST_ASSERT_TRUE(mqtt_publish(&shared, "t", 1, "x", 1));
+    TEST_ASSERT_EQUAL_UINT32(2, g_write_cntr);
+
+    /* Initialization drops staged packets and turns coalescing off */
+    TEST_ASSERT_TRUE(mqtt_output_coalesce(&shared, staging, sizeof(staging), 0, 1000));
+    TEST_ASSERT_TRUE(mqtt_publish(&shared, "t", 1, "x", 1));
+    TEST_ASSERT_EQUAL_INT(Successfull, mqtt(&shared, ACTION_INIT, NULL));
+    TEST_ASSERT_NULL(shared.coalesce.buffer);
+    TEST_ASSERT_EQUAL_UINT32(0, shared.coalesce.fill);
+    TEST_ASSERT_EQUAL_UINT32(2, g_write_cntr);
+
+    TEST_ASSERT_FALSE(mqtt_output_coalesce(NULL, staging, sizeof(staging), 0, 0));
+    TEST_ASSERT_FALSE(mqtt_output_coalesce(&shared, staging, 0, 0, 0));
+}
+
+/****************************************************************************************
+ * TEST main                                                                            *
+ ****************************************************************************************/
+int main(void)
+{
+    UnityBegin("Output coalescing");
+    unsigned int tCntr = 1;
+
+    RUN_TEST(test_coalesce_flush,          tCntr++);
+    RUN_TEST(test_coalesce_threshold,      tCntr++);
+    RUN_TEST(test_coalesce_control_packet, tCntr++);
+    RUN_TEST(test_coalesce_big_packet,     tCntr++);
+    RUN_TEST(test_coalesce_max_delay,      tCntr++);
+    RUN_TEST(test_coalesce_off,            tCntr++);
+    return (UnityEnd());
+}
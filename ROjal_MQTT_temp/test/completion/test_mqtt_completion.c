@@ -0,0 +1,237 @@
+#include "mqtt.h"
+#include "unity.h"
+
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+static MQTT_shared_data_t shared;
+static uint8_t            tx_buffer[128];
+
+/* Reply given by the "broker" thread to the next packet sent */
+static uint8_t   g_reply[8];
+static size_t    g_reply_len   = 0;
+static uint32_t  g_reply_delay = 0;
+static bool      g_reply_now   = false;
+static pthread_t g_reply_thread;
+static bool      g_reply_thread_started = false;
+
+static uint32_t g_connected_cntr = 0;
+
+static uint32_t now_ms()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t)(now.tv_sec * 1000 + now.tv_nsec / 1000000);
+}
+
+static void * reply_thread(void * a_arg)
+{
+    a_arg = a_arg;
+    mqtt_sleep_ms(g_reply_delay);
+    TEST_ASSERT_TRUE(mqtt_receive(&shared, g_reply, g_reply_len));
+    return NULL;
+}
+
+int completion_out_fptr(MQTT_shared_data_t * a_shared_ptr, uint8_t * a_data_ptr, size_t a_amount)
+{
+    a_shared_ptr = a_shared_ptr;
+
+    if (0 != g_reply_len) {
+        /* SUBACK and UNSUBACK carry packet id of the request */
+        if ((0x90 == g_reply[0]) || (0xB0 == g_reply[0])) {
+            g_reply[2] = a_data_ptr[2];
+            g_reply[3] = a_data_ptr[3];
+        }
+
+        if (g_reply_now) {
+            /* Ack handled before the request returns */
+            TEST_ASSERT_TRUE(mqtt_receive(&shared, g_reply, g_reply_len));
+        } else {
+            TEST_ASSERT_EQUAL_INT(0, pthread_create(&g_reply_thread, NULL, reply_thread, NULL));
+            g_reply_thread_started = true;
+        }
+    }
+    return (int)a_amount;
+}
+
+void completion_connected_cb(MQTT_shared_data_t * a_shared_ptr, MQTTErrorCodes_t a_status)
+{
+    a_shared_ptr = a_shared_ptr;
+    a_status     = a_status;
+    g_connected_cntr++;
+}
+
+static void reply(const uint8_t * a_reply_ptr, size_t a_reply_len, uint32_t a_delay_in_ms, bool a_now)
+{
+    memcpy(g_reply, a_reply_ptr, a_reply_len);
+    g_reply_len   = a_reply_len;
+    g_reply_delay = a_delay_in_ms;
+    g_reply_now   = a_now;
+}
+
+static void join_reply()
+{
+    if (g_reply_thread_started)
+        pthread_join(g_reply_thread, NULL);
+    g_reply_thread_started = false;
+    g_reply_len            = 0;
+}
+
+static bool connect_(uint8_t a_timeout_in_sec)
+{
+    g_connected_cntr = 0;
+    return mqtt_connect(&shared,
+                        "completion",
+                        0,
+                        (uint8_t*)"",
+                        (uint8_t*)"",
+                        (uint8_t*)"",
+                        (uint8_t*)"",
+                        tx_buffer,
+                        sizeof(tx_buffer),
+                        true,
+                        &completion_out_fptr,
+                        &completion_connected_cb,
+                        NULL,
+                        a_timeout_in_sec);
+}
+
+/****************************************************************************************
+ * Completion tests                                                                     *
+ ****************************************************************************************/
+void test_connect_wakes_on_connack()
+{
+    uint8_t connack[] = {0x20, 0x02, 0x00, 0x00};
+
+    reply(connack, sizeof(connack), 50, false);
+    uint32_t start = now_ms();
+    TEST_ASSERT_TRUE(connect_(5));
+    uint32_t elapsed = now_ms() - start;
+    join_reply();
+
+    /* Returns when CONNACK is parsed, callback has been called before */
+    TEST_ASSERT_TRUE(elapsed >= 40);
+    TEST_ASSERT_TRUE(elapsed < 1000);
+    TEST_ASSERT_EQUAL_UINT32(1, g_connected_cntr);
+    TEST_ASSERT_NULL(shared.completion);
+}
+
+void test_connect_connack_before_return()
+{
+    uint8_t connack[] = {0x20, 0x02, 0x00, 0x00};
+
+    reply(connack, sizeof(connack), 0, true);
+    uint32_t start = now_ms();
+    TEST_ASSERT_TRUE(connect_(5));
+    TEST_ASSERT_TRUE((now_ms() - start) < 1000);
+    join_reply();
+}
+
+void test_connect_refused_and_timeout()
+{
+    uint8_t refused[] = {0x20, 0x02, 0x00, 0x05};
+
+    reply(refused, sizeof(refused), 10, false);
+    uint32_t start = now_ms();
+    TEST_ASSERT_FALSE(connect_(5));
+    TEST_ASSERT_TRUE((now_ms() - start) < 1000);
+    join_reply();
+    TEST_ASSERT_EQUAL_UINT32(1, g_connected_cntr);
+
+    /* No CONNACK at all */
+    start = now_ms();
+    TEST_ASSERT_FALSE(connect_(1));
+    uint32_t elapsed = now_ms() - start;
+    TEST_ASSERT_TRUE(elapsed >= 900);
+    TEST_ASSERT_TRUE(elapsed < 2000);
+    TEST_ASSERT_NULL(shared.completion);
+
+    /* Not waited */
+    TEST_ASSERT_TRUE(connect_(0));
+}
+
+void test_subscribe_wakes_on_suback()
+{
+    uint8_t          connack[]  = {0x20, 0x02, 0x00, 0x00};
+    uint8_t          suback[]   = {0x90, 0x04, 0x00, 0x00, 0x01, 0x00};
+    uint8_t          unsuback[] = {0xB0, 0x02, 0x00, 0x00};
+    MQTT_subscribe_t topics[]   = {{QoS1, (uint8_t *)"a", 1},
+                                   {QoS0, (uint8_t *)"b", 1}};
+    uint8_t          codes[2]   = {MQTT_SUBACK_FAILURE, MQTT_SUBACK_FAILURE};
+
+    reply(connack, sizeof(connack), 0, true);
+    TEST_ASSERT_TRUE(connect_(5));
+    join_reply();
+
+    reply(suback, sizeof(suback), 50, false);
+    uint32_t start = now_ms();
+    TEST_ASSERT_TRUE(mqtt_subscribe_list(&shared, topics, 2, codes, 5));
+    TEST_ASSERT_TRUE((now_ms() - start) < 1000);
+    join_reply();
+    TEST_ASSERT_EQUAL_HEX8(0x01, codes[0]);
+    TEST_ASSERT_EQUAL_HEX8(0x00, codes[1]);
+
+    reply(unsuback, sizeof(unsuback), 0, true);
+    start = now_ms();
+    TEST_ASSERT_TRUE(mqtt_unsubscribe_list(&shared, topics, 2, 5));
+    TEST_ASSERT_TRUE((now_ms() - start) < 1000);
+    join_reply();
+
+    /* Ack missing */
+    start = now_ms();
+    TEST_ASSERT_FALSE(mqtt_subscribe(&shared, "c", 1, 1));
+    TEST_ASSERT_TRUE((now_ms() - start) >= 900);
+    TEST_ASSERT_EQUAL_UINT16(0, shared.subscribe_pending.packet_id);
+    TEST_ASSERT_NULL(shared.completion);
+}
+
+static volatile bool g_waking = false;
+
+/* Wakes the waiting call without status every 100 ms, like spurious wakeups do */
+static void * wake_thread(void * a_arg)
+{
+    a_arg = a_arg;
+    for (uint32_t cntr = 0; (true == g_waking) && (cntr < 40); cntr++) {
+        mqtt_sleep_ms(100);
+        mqtt_completion_lock(&(shared.completion_lock));
+        if (NULL != shared.completion)
+            mqtt_completion_signal(shared.completion);
+        mqtt_completion_unlock(&(shared.completion_lock));
+    }
+    return NULL;
+}
+
+void test_spurious_wakes_keep_timeout()
+{
+    pthread_t waker;
+
+    /* No CONNACK, deadline is not restarted by the wakes */
+    g_waking = true;
+    TEST_ASSERT_EQUAL_INT(0, pthread_create(&waker, NULL, wake_thread, NULL));
+    uint32_t start = now_ms();
+    TEST_ASSERT_FALSE(connect_(1));
+    uint32_t elapsed = now_ms() - start;
+    g_waking = false;
+    pthread_join(waker, NULL);
+
+    TEST_ASSERT_TRUE(elapsed >= 900);
+    TEST_ASSERT_TRUE(elapsed < 2000);
+    TEST_ASSERT_NULL(shared.completion);
+}
+
+/****************************************************************************************
+ * TEST main                                                                            *
+ ****************************************************************************************/
+int main(void)
+{
+    UnityBegin("Completion");
+    unsigned int tCntr = 1;
+
+    RUN_TEST(test_connect_wakes_on_connack,      tCntr++);
+    RUN_TEST(test_connect_connack_before_return, tCntr++);
+    RUN_TEST(test_connect_refused_and_timeout,   tCntr++);
+    RUN_TEST(test_subscribe_wakes_on_suback,     tCntr++);
+    RUN_TEST(test_spurious_wakes_keep_timeout,   tCntr++);
+    return (UnityEnd());
+}
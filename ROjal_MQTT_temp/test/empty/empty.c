@@ -4,8 +4,8 @@ int main()
 {
     uint8_t a_buffer[1];
     static MQTT_shared_data_t mqtt_shared_data;
-    mqtt_connect("Empty", 0, '\0','\0','\0','\0',
-                 &mqtt_shared_data,
+    mqtt_connect(&mqtt_shared_data,
+                 "Empty", 0, '\0','\0','\0','\0',
                  a_buffer,
                  sizeof(a_buffer),
                  0,
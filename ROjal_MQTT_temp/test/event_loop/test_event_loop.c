@@ -0,0 +1,209 @@
+#include "mqtt.h"
+#include "unity.h"
+#include "help.h"
+#include "socket_event_loop.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define SESSION_CNT 32
+#define LOOP_CNT    4
+
+typedef struct test_session
+{
+    MQTT_event_session_t session;
+    uint8_t              tx_buffer[256];
+    uint8_t              rx_buffer[256];
+    uint8_t              backlog[1024];
+    char                 client_id[32];
+    char                 topic[32];
+    volatile bool        connected;
+    volatile bool        subscribed;
+    volatile bool        received;
+    volatile bool        closed;
+} test_session_t;
+
+static test_session_t          sessions[SESSION_CNT];
+static MQTT_event_loop_t       loops[LOOP_CNT];
+static MQTT_event_loop_group_t group;
+
+void event_connected_cb(MQTT_shared_data_t * a_shared_ptr, MQTTErrorCodes_t a_status)
+{
+    test_session_t * ts = (test_session_t *) a_shared_ptr->user_ptr;
+    if (Successfull == a_status)
+        ts->connected = true;
+}
+
+void event_subscribe_cb(MQTT_shared_data_t * a_shared_ptr,
+                        MQTTErrorCodes_t     a_status,
+                        uint8_t            * a_data_ptr,
+                        uint32_t             a_data_len,
+                        uint8_t            * a_topic_ptr,
+                        uint16_t             a_topic_len)
+{
+    test_session_t * ts = (test_session_t *) a_shared_ptr->user_ptr;
+
+    if (NULL == a_topic_ptr) {
+        ts->subscribed = true; /* SUBACK */
+    } else if ((Successfull == a_status) &&
+               (strlen(ts->topic) == a_topic_len) &&
+               (0 == memcmp(ts->topic, a_topic_ptr, a_topic_len)) &&
+               (a_data_len == a_topic_len) &&
+               (0 == memcmp(ts->topic, a_data_ptr, a_data_len))) {
+        ts->received = true;
+    }
+}
+
+void event_closed_cb(MQTT_event_session_t * a_session_ptr)
+{
+    ((test_session_t *) a_session_ptr->shared.user_ptr)->closed = true;
+}
+
+static void session_setup(test_session_t * a_ts_ptr, uint32_t a_index, uint16_t a_keepalive)
+{
+    static uint8_t empty[] = "\0";
+    MQTT_connect_t connect_params;
+
+    memset(a_ts_ptr, 0, sizeof(test_session_t));
+    snprintf(a_ts_ptr->client_id, sizeof(a_ts_ptr->client_id), "JAMKtestEvent%u", a_index);
+    snprintf(a_ts_ptr->topic, sizeof(a_ts_ptr->topic), "event/test/%u", a_index);
+
+    connect_params.client_id                    = (uint8_t *)a_ts_ptr->client_id;
+    connect_params.last_will_topic              = empty;
+    connect_params.last_will_message            = empty;
+    connect_params.username                     = empty;
+    connect_params.password                     = empty;
+    connect_params.keepalive                    = a_keepalive;
+    connect_params.connect_flags.clean_session  = true;
+    connect_params.connect_flags.last_will_qos  = 0;
+    connect_params.connect_flags.permanent_will = false;
+
+    a_ts_ptr->session.shared.user_ptr = a_ts_ptr;
+    TEST_ASSERT_TRUE(event_session_init(&(a_ts_ptr->session),
+                                        a_ts_ptr->tx_buffer,
+                                        sizeof(a_ts_ptr->tx_buffer),
+                                        a_ts_ptr->rx_buffer,
+                                        sizeof(a_ts_ptr->rx_buffer),
+                                        a_ts_ptr->backlog,
+                                        sizeof(a_ts_ptr->backlog),
+                                        &connect_params,
+                                        &event_connected_cb,
+                                        &event_subscribe_cb,
+                                        &event_closed_cb));
+}
+
+static bool wait_all(size_t a_flag_offset, uint32_t a_cnt, uint32_t a_timeout_in_ms)
+{
+    for (;;) {
+        uint32_t done = 0;
+        for (uint32_t i = 0; i < a_cnt; i++)
+            if (*(volatile bool *)((uint8_t *)&(sessions[i]) + a_flag_offset))
+                done++;
+
+        if (done == a_cnt)
+            return true;
+
+        if (0 == a_timeout_in_ms)
+            return false;
+
+        asleep(10);
+        a_timeout_in_ms -= (a_timeout_in_ms < 10) ? a_timeout_in_ms : 10;
+    }
+}
+
+/****************************************************************************************
+ * Event loop tests                                                                     *
+ ****************************************************************************************/
+void test_event_loop_single_thread()
+{
+    MQTT_event_loop_t * loop = &(loops[0]);
+    TEST_ASSERT_TRUE(event_loop_init(loop, 100));
+
+    for (uint32_t i = 0; i < 4; i++) {
+        session_setup(&(sessions[i]), i, 0);
+        TEST_ASSERT_TRUE(event_loop_add(loop, &(sessions[i].session), MQTT_SERVER, MQTT_PORT));
+    }
+    TEST_ASSERT_EQUAL_UINT32(4, loop->session_cnt);
+
+    /* Caller drives the loop */
+    for (uint32_t round = 0; (round < 100) && (false == wait_all(offsetof(test_session_t, connected), 4, 0)); round++)
+        TEST_ASSERT_TRUE(0 <= event_loop_poll(loop, 50));
+
+    TEST_ASSERT_TRUE(wait_all(offsetof(test_session_t, connected), 4, 0));
+
+    for (uint32_t i = 0; i < 4; i++)
+        TEST_ASSERT_TRUE(mqtt_disconnect(&(sessions[i].session.shared)));
+
+    event_loop_destroy(loop);
+    TEST_ASSERT_EQUAL_UINT32(0, loop->session_cnt);
+}
+
+void test_event_loop_sharded_pubsub()
+{
+    TEST_ASSERT_TRUE(event_loop_group_init(&group, loops, LOOP_CNT, 100));
+    TEST_ASSERT_TRUE(event_loop_group_start(&group));
+
+    for (uint32_t i = 0; i < SESSION_CNT; i++) {
+        session_setup(&(sessions[i]), i, 2);
+        TEST_ASSERT_TRUE(event_loop_group_add(&group, &(sessions[i].session), MQTT_SERVER, MQTT_PORT));
+    }
+
+    /* Sessions are spread evenly over the loops */
+    for (uint32_t i = 0; i < LOOP_CNT; i++)
+        TEST_ASSERT_EQUAL_UINT32(SESSION_CNT / LOOP_CNT, loops[i].session_cnt);
+
+    TEST_ASSERT_TRUE_MESSAGE(wait_all(offsetof(test_session_t, connected), SESSION_CNT, 5000), "Connect failed");
+
+    for (uint32_t i = 0; i < SESSION_CNT; i++) {
+        MQTT_event_session_t * session = &(sessions[i].session);
+        event_session_lock(session);
+        TEST_ASSERT_TRUE(mqtt_subscribe(&(session->shared), sessions[i].topic, strlen(sessions[i].topic), 0));
+        event_session_unlock(session);
+    }
+    TEST_ASSERT_TRUE_MESSAGE(wait_all(offsetof(test_session_t, subscribed), SESSION_CNT, 5000), "Subscribe failed");
+
+    for (uint32_t i = 0; i < SESSION_CNT; i++) {
+        MQTT_event_session_t * session = &(sessions[i].session);
+        event_session_lock(session);
+        TEST_ASSERT_TRUE(mqtt_publish(&(session->shared),
+                                      sessions[i].topic,
+                                      strlen(sessions[i].topic),
+                                      sessions[i].topic,
+                                      strlen(sessions[i].topic)));
+        event_session_unlock(session);
+    }
+    TEST_ASSERT_TRUE_MESSAGE(wait_all(offsetof(test_session_t, received), SESSION_CNT, 5000), "Publish failed");
+
+    /* Loop threads keep sessions alive over several keepalive periods */
+    asleep(4000);
+    for (uint32_t i = 0; i < SESSION_CNT; i++) {
+        TEST_ASSERT_FALSE(sessions[i].closed);
+        TEST_ASSERT_EQUAL_INT(STATE_CONNECTED, sessions[i].session.shared.state);
+    }
+
+    for (uint32_t i = 0; i < SESSION_CNT; i++) {
+        MQTT_event_session_t * session = &(sessions[i].session);
+        event_session_lock(session);
+        TEST_ASSERT_TRUE(mqtt_disconnect(&(session->shared)));
+        event_session_unlock(session);
+    }
+
+    /* Broker closes the sockets after DISCONNECT */
+    TEST_ASSERT_TRUE_MESSAGE(wait_all(offsetof(test_session_t, closed), SESSION_CNT, 5000), "Close failed");
+
+    event_loop_group_stop(&group);
+    event_loop_group_destroy(&group);
+}
+
+/****************************************************************************************
+ * TEST main                                                                            *
+ ****************************************************************************************/
+int main(void)
+{
+    UnityBegin("Event loop");
+    unsigned int tCntr = 1;
+
+    RUN_TEST(test_event_loop_single_thread,  tCntr++);
+    RUN_TEST(test_event_loop_sharded_pubsub, tCntr++);
+    return (UnityEnd());
+}
@@ -129,26 +129,26 @@ void test_encode_fixed_header_all_zeros()
 
 void test_encode_fixed_header_with_dub_set()
 {
-    /* Dup set and value expcted to be 0x0002 */
+    /* Dup set and value expcted to be 0x0008 */
     MQTT_fixed_header_t fHdr;
     TEST_ASSERT_EQUAL_INT8(2, encode_fixed_header(&fHdr, true, QoS0, false, INVALIDCMD, 0x00));
-    TEST_ASSERT_EQUAL_HEX16(0x0002, TO_HEX_16(fHdr));
+    TEST_ASSERT_EQUAL_HEX16(0x0008, TO_HEX_16(fHdr));
 }
 
 void test_encode_fixed_header_with_qos1()
 {
-    /* QoS1 set and value expected to be 0x0004 */
+    /* QoS1 set and value expected to be 0x0002 */
     MQTT_fixed_header_t fHdr;
     TEST_ASSERT_EQUAL_INT8(2, encode_fixed_header(&fHdr, false, QoS1, false, INVALIDCMD, 0x00));
-    TEST_ASSERT_EQUAL_HEX16(0x0004, TO_HEX_16(fHdr));
+    TEST_ASSERT_EQUAL_HEX16(0x0002, TO_HEX_16(fHdr));
 }
 
 void test_encode_fixed_header_with_qos2()
 {
-    /* QoS2 set and value expected to be 0x0008*/
+    /* QoS2 set and value expected to be 0x0004*/
     MQTT_fixed_header_t fHdr;
     TEST_ASSERT_EQUAL_INT8(2, encode_fixed_header(&fHdr, false, QoS2, false, INVALIDCMD, 0x00));
-    TEST_ASSERT_EQUAL_HEX16(0x0008, TO_HEX_16(fHdr));
+    TEST_ASSERT_EQUAL_HEX16(0x0004, TO_HEX_16(fHdr));
 }
 
 void test_encode_fixed_header_with_invalid_qos()
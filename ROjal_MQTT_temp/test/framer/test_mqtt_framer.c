@@ -0,0 +1,444 @@
+#include "mqtt.h"
+#include "unity.h"
+#include "client_fixture.h"
+
+#include <string.h>
+
+static MQTT_shared_data_t shared;
+static uint8_t            rx_buffer[64];
+
+static uint32_t g_connected_cntr = 0;
+static uint32_t g_publish_cntr   = 0;
+static uint8_t  g_topic[64];
+static uint16_t g_topic_len      = 0;
+static uint8_t  g_payload[64];
+static uint32_t g_payload_len    = 0;
+
+/* PUBLISH QoS0 - topic "a/b", payload "hello" */
+static uint8_t publish1[] = {0x30, 0x0A, 0x00, 0x03, 'a', '/', 'b', 'h', 'e', 'l', 'l', 'o'};
+
+/* PUBLISH QoS0 - topic "c", payload "xy" */
+static uint8_t publish2[] = {0x30, 0x05, 0x00, 0x01, 'c', 'x', 'y'};
+
+void framer_connected_cb(MQTT_shared_data_t * a_shared_ptr, MQTTErrorCodes_t a_status)
+{
+    a_shared_ptr = a_shared_ptr;
+    a_status     = a_status;
+    g_connected_cntr++;
+}
+
+void framer_subscribe_cb(MQTT_shared_data_t * a_shared_ptr,
+                         MQTTErrorCodes_t     a_status,
+                         uint8_t            * a_data_ptr,
+                         uint32_t             a_data_len,
+                         uint8_t            * a_topic_ptr,
+                         uint16_t             a_topic_len)
+{
+    if (NULL != a_shared_ptr->user_ptr)
+        (*(uint32_t *)(a_shared_ptr->user_ptr))++;
+
+    if ((Successfull == a_status) &&
+        (NULL != a_topic_ptr)) {
+        memcpy(g_topic, a_topic_ptr, a_topic_len);
+        memcpy(g_payload, a_data_ptr, a_data_len);
+        g_topic_len   = a_topic_len;
+        g_payload_len = a_data_len;
+        g_publish_cntr++;
+    }
+}
+
+static uint32_t g_stream_topic_cntr    = 0;
+static uint32_t g_stream_complete_cntr = 0;
+static uint32_t g_stream_declared      = 0;
+static uint8_t  g_stream_data[2048];
+static uint32_t g_stream_len           = 0;
+
+void stream_topic_cb(MQTT_shared_data_t * a_shared_ptr,
+                     uint8_t            * a_topic_ptr,
+                     uint16_t             a_topic_len,
+                     uint32_t             a_payload_size)
+{
+    a_shared_ptr = a_shared_ptr;
+    memcpy(g_topic, a_topic_ptr, a_topic_len);
+    g_topic_len       = a_topic_len;
+    g_stream_declared = a_payload_size;
+    g_stream_len      = 0;
+    g_stream_topic_cntr++;
+}
+
+void stream_chunk_cb(MQTT_shared_data_t * a_shared_ptr,
+                     uint8_t            * a_data_ptr,
+                     uint32_t             a_data_len)
+{
+    a_shared_ptr = a_shared_ptr;
+    TEST_ASSERT_TRUE((g_stream_len + a_data_len) <= sizeof(g_stream_data));
+    memcpy(&(g_stream_data[g_stream_len]), a_data_ptr, a_data_len);
+    g_stream_len += a_data_len;
+}
+
+void stream_complete_cb(MQTT_shared_data_t * a_shared_ptr,
+                        MQTTErrorCodes_t     a_status)
+{
+    a_shared_ptr = a_shared_ptr;
+    TEST_ASSERT_EQUAL_INT(Successfull, a_status);
+    TEST_ASSERT_EQUAL_UINT32(g_stream_declared, g_stream_len);
+    g_stream_complete_cntr++;
+}
+
+void framer_setup(uint8_t * a_rx_buffer, size_t a_rx_buffer_size)
+{
+    /* Output carries acknowledgements of received publishes */
+    fixture_setup(&shared, NULL, 0, false);
+    shared.connected_cb_fptr = &framer_connected_cb;
+    shared.subscribe_cb_fptr = &framer_subscribe_cb;
+
+    if (NULL != a_rx_buffer) {
+        TEST_ASSERT_TRUE(mqtt_receive_buffer(&shared, a_rx_buffer, a_rx_buffer_size));
+    }
+
+    g_connected_cntr = 0;
+    g_publish_cntr   = 0;
+    g_topic_len      = 0;
+    g_payload_len    = 0;
+
+    g_stream_topic_cntr    = 0;
+    g_stream_complete_cntr = 0;
+    g_stream_len           = 0;
+}
+
+/* PUBLISH with a_payload_size bytes payload of pattern, returns size of the packet */
+static uint32_t stream_packet(uint8_t * a_out_ptr, MQTTQoSLevel_t a_qos, uint32_t a_payload_size)
+{
+    uint32_t remaining = 2 + 5 + a_payload_size + ((QoS0 < a_qos) ? 2 : 0);
+    uint32_t i = 0;
+
+    a_out_ptr[i++] = 0x30 | (a_qos << 1);
+    a_out_ptr[i++] = (remaining & 0x7F) | 0x80;
+    a_out_ptr[i++] = (remaining >> 7);
+    a_out_ptr[i++] = 0x00;
+    a_out_ptr[i++] = 0x05;
+    memcpy(&(a_out_ptr[i]), "ota/1", 5);
+    i += 5;
+    if (QoS0 < a_qos) {
+        a_out_ptr[i++] = 0x12;
+        a_out_ptr[i++] = 0x34;
+    }
+    for (uint32_t j = 0; j < a_payload_size; j++)
+        a_out_ptr[i++] = (uint8_t)(j * 7);
+    return i;
+}
+
+/****************************************************************************************
+ * Framer tests                                                                         *
+ ****************************************************************************************/
+void test_framer_complete_packet()
+{
+    framer_setup(rx_buffer, sizeof(rx_buffer));
+    TEST_ASSERT_TRUE(mqtt_receive(&shared, connack, sizeof(connack)));
+    TEST_ASSERT_EQUAL_UINT32(1, g_connected_cntr);
+    TEST_ASSERT_EQUAL_INT(STATE_CONNECTED, shared.state);
+}
+
+void test_framer_byte_by_byte()
+{
+    framer_setup(rx_buffer, sizeof(rx_buffer));
+    for (size_t i = 0; i < sizeof(publish1); i++)
+        TEST_ASSERT_TRUE(mqtt_receive(&shared, &(publish1[i]), 1));
+
+    TEST_ASSERT_EQUAL_UINT32(1, g_publish_cntr);
+    TEST_ASSERT_EQUAL_UINT16(3, g_topic_len);
+    TEST_ASSERT_EQUAL_MEMORY("a/b", g_topic, 3);
+    TEST_ASSERT_EQUAL_UINT32(5, g_payload_len);
+    TEST_ASSERT_EQUAL_MEMORY("hello", g_payload, 5);
+}
+
+void test_framer_coalesced_packets()
+{
+    uint8_t stream[sizeof(connack) + sizeof(publish1) + sizeof(publish2)];
+    memcpy(stream, connack, sizeof(connack));
+    memcpy(stream + sizeof(connack), publish1, sizeof(publish1));
+    memcpy(stream + sizeof(connack) + sizeof(publish1), publish2, sizeof(publish2));
+
+    framer_setup(rx_buffer, sizeof(rx_buffer));
+    TEST_ASSERT_TRUE(mqtt_receive(&shared, stream, sizeof(stream)));
+    TEST_ASSERT_EQUAL_UINT32(1, g_connected_cntr);
+    TEST_ASSERT_EQUAL_UINT32(2, g_publish_cntr);
+    TEST_ASSERT_EQUAL_MEMORY("c", g_topic, 1);
+    TEST_ASSERT_EQUAL_MEMORY("xy", g_payload, 2);
+}
+
+void test_framer_split_chunks()
+{
+    uint8_t stream[sizeof(publish1) + sizeof(publish2)];
+    memcpy(stream, publish1, sizeof(publish1));
+    memcpy(stream + sizeof(publish1), publish2, sizeof(publish2));
+
+    /* Split inside of every packet, including the fixed header */
+    for (size_t split = 1; split < sizeof(stream); split++) {
+        framer_setup(rx_buffer, sizeof(rx_buffer));
+        TEST_ASSERT_TRUE(mqtt_receive(&shared, stream, split));
+        TEST_ASSERT_TRUE(mqtt_receive(&shared, stream + split, sizeof(stream) - split));
+        TEST_ASSERT_EQUAL_UINT32(2, g_publish_cntr);
+        TEST_ASSERT_EQUAL_MEMORY("xy", g_payload, 2);
+    }
+}
+
+void test_framer_too_big_packet()
+{
+    uint8_t small_buffer[8];
+    framer_setup(small_buffer, sizeof(small_buffer));
+
+    /* Split publish does not fit into buffer, it is skipped */
+    TEST_ASSERT_FALSE(mqtt_receive(&shared, publish1, 3));
+    TEST_ASSERT_TRUE(mqtt_receive(&shared, publish1 + 3, sizeof(publish1) - 3));
+    TEST_ASSERT_EQUAL_UINT32(0, g_publish_cntr);
+
+    /* Stream is still in sync */
+    TEST_ASSERT_TRUE(mqtt_receive(&shared, publish2, sizeof(publish2)));
+    TEST_ASSERT_EQUAL_UINT32(1, g_publish_cntr);
+}
+
+void test_framer_no_buffer()
+{
+    framer_setup(NULL, 0);
+
+    /* Complete packets are parsed without reassembly buffer */
+    TEST_ASSERT_TRUE(mqtt_receive(&shared, publish2, sizeof(publish2)));
+    TEST_ASSERT_EQUAL_UINT32(1, g_publish_cntr);
+
+    /* Split packet can't be collected */
+    TEST_ASSERT_FALSE(mqtt_receive(&shared, publish1, 4));
+}
+
+void test_framer_invalid_length()
+{
+    uint8_t invalid[] = {0x30, 0xFF, 0xFF, 0xFF, 0xFF, 0x01};
+    framer_setup(rx_buffer, sizeof(rx_buffer));
+    TEST_ASSERT_FALSE(mqtt_receive(&shared, invalid, sizeof(invalid)));
+}
+
+/****************************************************************************************
+ * Batch parse tests                                                                    *
+ ****************************************************************************************/
+void test_batch_many_packets()
+{
+    uint8_t stream[sizeof(connack) + 50 * sizeof(publish2)];
+    size_t  consumed = 0;
+
+    memcpy(stream, connack, sizeof(connack));
+    for (size_t i = 0; i < 50; i++)
+        memcpy(stream + sizeof(connack) + i * sizeof(publish2), publish2, sizeof(publish2));
+
+    framer_setup(NULL, 0);
+    TEST_ASSERT_TRUE(mqtt_receive_batch(&shared, stream, sizeof(stream), &consumed));
+    TEST_ASSERT_EQUAL_UINT32(sizeof(stream), consumed);
+    TEST_ASSERT_EQUAL_UINT32(1, g_connected_cntr);
+    TEST_ASSERT_EQUAL_UINT32(50, g_publish_cntr);
+}
+
+void test_batch_incomplete_tail()
+{
+    uint8_t stream[sizeof(publish1) + sizeof(publish2)];
+    size_t  consumed = 0;
+
+    memcpy(stream, publish2, sizeof(publish2));
+    memcpy(stream + sizeof(publish2), publish1, sizeof(publish1));
+
+    /* Tail is left for the caller, both inside of fixed header and payload */
+    for (size_t size = sizeof(publish2); size < sizeof(stream); size++) {
+        framer_setup(NULL, 0);
+        TEST_ASSERT_TRUE(mqtt_receive_batch(&shared, stream, size, &consumed));
+        TEST_ASSERT_EQUAL_UINT32(sizeof(publish2), consumed);
+        TEST_ASSERT_EQUAL_UINT32(1, g_publish_cntr);
+    }
+
+    framer_setup(NULL, 0);
+    TEST_ASSERT_TRUE(mqtt_receive_batch(&shared, stream, sizeof(publish2) - 1, &consumed));
+    TEST_ASSERT_EQUAL_UINT32(0, consumed);
+    TEST_ASSERT_EQUAL_UINT32(0, g_publish_cntr);
+}
+
+void test_batch_invalid_length()
+{
+    uint8_t stream[sizeof(publish2) + 6];
+    size_t  consumed = 0;
+    uint8_t invalid[] = {0x30, 0xFF, 0xFF, 0xFF, 0xFF, 0x01};
+
+    memcpy(stream, publish2, sizeof(publish2));
+    memcpy(stream + sizeof(publish2), invalid, sizeof(invalid));
+
+    /* Packets before broken length are parsed, parsing stops to broken one */
+    framer_setup(NULL, 0);
+    TEST_ASSERT_FALSE(mqtt_receive_batch(&shared, stream, sizeof(stream), &consumed));
+    TEST_ASSERT_EQUAL_UINT32(sizeof(publish2), consumed);
+    TEST_ASSERT_EQUAL_UINT32(1, g_publish_cntr);
+}
+
+/****************************************************************************************
+ * Streaming receive tests                                                              *
+ ****************************************************************************************/
+void test_stream_split_payload()
+{
+    uint8_t  packet[1100];
+    uint8_t  small_buffer[16];
+    uint32_t packet_size = stream_packet(packet, QoS0, 1000);
+
+    /* Payload is 60 times the reassembly buffer */
+    framer_setup(small_buffer, sizeof(small_buffer));
+    TEST_ASSERT_TRUE(mqtt_receive_stream(&shared, &stream_topic_cb, &stream_chunk_cb, &stream_complete_cb));
+
+    for (uint32_t i = 0; i < packet_size; i += 7) {
+        uint32_t chunk = ((packet_size - i) < 7) ? (packet_size - i) : 7;
+        TEST_ASSERT_TRUE(mqtt_receive(&shared, &(packet[i]), chunk));
+    }
+
+    TEST_ASSERT_EQUAL_UINT32(1, g_stream_topic_cntr);
+    TEST_ASSERT_EQUAL_UINT32(1, g_stream_complete_cntr);
+    TEST_ASSERT_EQUAL_UINT32(0, g_publish_cntr);
+    TEST_ASSERT_EQUAL_UINT16(5, g_topic_len);
+    TEST_ASSERT_EQUAL_MEMORY("ota/1", g_topic, 5);
+    TEST_ASSERT_EQUAL_UINT32(1000, g_stream_len);
+    TEST_ASSERT_EQUAL_MEMORY(&(packet[packet_size - 1000]), g_stream_data, 1000);
+}
+
+void test_stream_qos1_and_following_packet()
+{
+    uint8_t  stream[1200];
+    uint8_t  small_buffer[16];
+    uint8_t  puback[]    = {0x40, 0x02, 0x12, 0x34};
+    uint32_t stream_size = stream_packet(stream, QoS1, 500);
+
+    memcpy(&(stream[stream_size]), connack, sizeof(connack));
+    stream_size += sizeof(connack);
+
+    /* Every split point: packet identifier is not part of payload, CONNACK follows */
+    for (uint32_t split = 1; split < stream_size; split += 13) {
+        framer_setup(small_buffer, sizeof(small_buffer));
+        TEST_ASSERT_TRUE(mqtt_receive_stream(&shared, &stream_topic_cb, &stream_chunk_cb, &stream_complete_cb));
+
+        TEST_ASSERT_TRUE(mqtt_receive(&shared, stream, split));
+        TEST_ASSERT_TRUE(mqtt_receive(&shared, &(stream[split]), stream_size - split));
+
+        TEST_ASSERT_EQUAL_UINT32(1, g_stream_complete_cntr);
+        TEST_ASSERT_EQUAL_UINT32(500, g_stream_len);
+        TEST_ASSERT_EQUAL_MEMORY(&(stream[12]), g_stream_data, 500);
+        TEST_ASSERT_EQUAL_UINT32(1, g_connected_cntr);
+
+        /* Streamed QoS1 publish is acknowledged when complete */
+        TEST_ASSERT_EQUAL_UINT32(sizeof(puback), g_out_len);
+        TEST_ASSERT_EQUAL_MEMORY(puback, g_out, sizeof(puback));
+    }
+}
+
+void test_stream_complete_packet()
+{
+    /* Complete packet in one chunk is passed as one payload chunk */
+    framer_setup(rx_buffer, sizeof(rx_buffer));
+    TEST_ASSERT_TRUE(mqtt_receive_stream(&shared, &stream_topic_cb, &stream_chunk_cb, &stream_complete_cb));
+    TEST_ASSERT_TRUE(mqtt_receive(&shared, publish1, sizeof(publish1)));
+
+    TEST_ASSERT_EQUAL_UINT32(1, g_stream_topic_cntr);
+    TEST_ASSERT_EQUAL_UINT32(1, g_stream_complete_cntr);
+    TEST_ASSERT_EQUAL_MEMORY("a/b", g_topic, 3);
+    TEST_ASSERT_EQUAL_MEMORY("hello", g_stream_data, 5);
+
+    /* Initialization clears streaming mode */
+    TEST_ASSERT_EQUAL_INT(Successfull, mqtt(&shared, ACTION_INIT, NULL));
+    TEST_ASSERT_TRUE(mqtt_receive(&shared, publish1, sizeof(publish1)));
+    TEST_ASSERT_EQUAL_UINT32(1, g_stream_topic_cntr);
+    TEST_ASSERT_EQUAL_UINT32(1, g_publish_cntr);
+}
+
+void test_stream_headers_too_big()
+{
+    uint8_t packet[1100];
+    uint8_t tiny_buffer[8];
+    uint32_t packet_size = stream_packet(packet, QoS0, 100);
+
+    /* Fixed header 3 + topic 7 does not fit, packet is skipped */
+    framer_setup(tiny_buffer, sizeof(tiny_buffer));
+    TEST_ASSERT_TRUE(mqtt_receive_stream(&shared, &stream_topic_cb, &stream_chunk_cb, &stream_complete_cb));
+    TEST_ASSERT_FALSE(mqtt_receive(&shared, packet, 20));
+    TEST_ASSERT_TRUE(mqtt_receive(&shared, &(packet[20]), packet_size - 20));
+    TEST_ASSERT_EQUAL_UINT32(0, g_stream_topic_cntr);
+
+    /* Stream is still in sync */
+    TEST_ASSERT_TRUE(mqtt_receive(&shared, publish2, sizeof(publish2)));
+    TEST_ASSERT_EQUAL_UINT32(1, g_stream_complete_cntr);
+    TEST_ASSERT_EQUAL_MEMORY("xy", g_stream_data, 2);
+}
+
+/****************************************************************************************
+ * Context tests                                                                        *
+ ****************************************************************************************/
+void test_context_two_sessions()
+{
+    MQTT_shared_data_t session_a;
+    MQTT_shared_data_t session_b;
+    uint8_t            rx_buffer_a[64];
+    uint8_t            rx_buffer_b[64];
+    uint32_t           publish_cntr_a = 0;
+    uint32_t           publish_cntr_b = 0;
+
+    framer_setup(NULL, 0);
+
+    memset(&session_a, 0, sizeof(session_a));
+    memset(&session_b, 0, sizeof(session_b));
+    session_a.subscribe_cb_fptr = &framer_subscribe_cb;
+    session_b.subscribe_cb_fptr = &framer_subscribe_cb;
+    session_a.user_ptr          = &publish_cntr_a;
+    session_b.user_ptr          = &publish_cntr_b;
+
+    TEST_ASSERT_EQUAL_INT(Successfull, mqtt(&session_a, ACTION_INIT, NULL));
+    TEST_ASSERT_EQUAL_INT(Successfull, mqtt(&session_b, ACTION_INIT, NULL));
+    TEST_ASSERT_TRUE(mqtt_receive_buffer(&session_a, rx_buffer_a, sizeof(rx_buffer_a)));
+    TEST_ASSERT_TRUE(mqtt_receive_buffer(&session_b, rx_buffer_b, sizeof(rx_buffer_b)));
+
+    /* Interleaved partial packets do not mix between sessions */
+    TEST_ASSERT_TRUE(mqtt_receive(&session_a, publish1, 5));
+    TEST_ASSERT_TRUE(mqtt_receive(&session_b, publish2, 3));
+    TEST_ASSERT_TRUE(mqtt_receive(&session_a, publish1 + 5, sizeof(publish1) - 5));
+    TEST_ASSERT_EQUAL_UINT32(1, publish_cntr_a);
+    TEST_ASSERT_EQUAL_UINT32(0, publish_cntr_b);
+    TEST_ASSERT_EQUAL_MEMORY("hello", g_payload, 5);
+
+    TEST_ASSERT_TRUE(mqtt_receive(&session_b, publish2 + 3, sizeof(publish2) - 3));
+    TEST_ASSERT_EQUAL_UINT32(1, publish_cntr_a);
+    TEST_ASSERT_EQUAL_UINT32(1, publish_cntr_b);
+    TEST_ASSERT_EQUAL_MEMORY("xy", g_payload, 2);
+}
+
+void test_context_null()
+{
+    TEST_ASSERT_EQUAL_INT(InvalidArgument, mqtt(NULL, ACTION_INIT, NULL));
+    TEST_ASSERT_FALSE(mqtt_receive(NULL, publish2, sizeof(publish2)));
+    TEST_ASSERT_FALSE(mqtt_publish(NULL, "a", 1, "b", 1));
+    TEST_ASSERT_FALSE(mqtt_keepalive(NULL, 1000));
+}
+
+/****************************************************************************************
+ * TEST main                                                                            *
+ ****************************************************************************************/
+int main(void)
+{
+    UnityBegin("Input framer");
+    unsigned int tCntr = 1;
+
+    RUN_TEST(test_framer_complete_packet,           tCntr++);
+    RUN_TEST(test_framer_byte_by_byte,              tCntr++);
+    RUN_TEST(test_framer_coalesced_packets,         tCntr++);
+    RUN_TEST(test_framer_split_chunks,              tCntr++);
+    RUN_TEST(test_framer_too_big_packet,            tCntr++);
+    RUN_TEST(test_framer_no_buffer,                 tCntr++);
+    RUN_TEST(test_framer_invalid_length,            tCntr++);
+    RUN_TEST(test_batch_many_packets,               tCntr++);
+    RUN_TEST(test_batch_incomplete_tail,            tCntr++);
+    RUN_TEST(test_batch_invalid_length,             tCntr++);
+    RUN_TEST(test_stream_split_payload,             tCntr++);
+    RUN_TEST(test_stream_qos1_and_following_packet, tCntr++);
+    RUN_TEST(test_stream_complete_packet,           tCntr++);
+    RUN_TEST(test_stream_headers_too_big,           tCntr++);
+    RUN_TEST(test_context_two_sessions,             tCntr++);
+    RUN_TEST(test_context_null,                     tCntr++);
+    return (UnityEnd());
+}
@@ -0,0 +1,32 @@
+#ifndef FUZZ_H
+#define FUZZ_H
+
+#include <stdint.h>  // uint
+#include <stddef.h>  // size_t
+#include <stdlib.h>  // abort
+
+/* Crash on broken invariant, so the fuzzer keeps the input */
+#define FUZZ_CHECK(a_condition) do { if (!(a_condition)) abort(); } while (0)
+
+/* Fuzz target entry point, libFuzzer or fuzz_main.c calls it */
+int LLVMFuzzerTestOneInput(const uint8_t * a_data_ptr, size_t a_size);
+
+/* Read every byte, so the sanitizers see reads outside of the input */
+static inline void fuzz_touch(const uint8_t * a_data_ptr, size_t a_size)
+{
+    static volatile uint8_t sink;
+    for (size_t i = 0; i < a_size; i++)
+        sink ^= a_data_ptr[i];
+}
+
+/* Exact size copy of the input, decoders take non-const data */
+static inline uint8_t * fuzz_copy(const uint8_t * a_data_ptr, size_t a_size)
+{
+    uint8_t * copy = malloc(a_size ? a_size : 1);
+    FUZZ_CHECK(NULL != copy);
+    for (size_t i = 0; i < a_size; i++)
+        copy[i] = a_data_ptr[i];
+    return copy;
+}
+
+#endif /* FUZZ_H */
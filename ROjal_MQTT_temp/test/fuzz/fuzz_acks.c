@@ -0,0 +1,45 @@
+#include "mqtt.h"
+#include "fuzz.h"
+
+extern MQTTErrorCodes_t mqtt_connect_parse_ack(uint8_t  * a_message_in_ptr,
+                                               uint32_t   a_input_size);
+
+extern MQTTErrorCodes_t mqtt_parse_ping_ack(uint8_t  * a_message_in_ptr,
+                                            uint32_t   a_input_size);
+
+extern uint8_t * decode_variable_header_suback(uint8_t  * a_input_ptr,
+                                               uint32_t   a_message_size,
+                                               uint16_t * a_packet_id_ptr,
+                                               uint16_t * a_code_cnt_ptr);
+
+/* Input: response of the broker to CONNECT, PINGREQ or SUBSCRIBE */
+int LLVMFuzzerTestOneInput(const uint8_t * a_data_ptr, size_t a_size)
+{
+    uint8_t * input = fuzz_copy(a_data_ptr, a_size);
+
+    MQTT_packet_view_t view;
+    MQTTErrorCodes_t   status = mqtt_packet_view(input, (uint32_t)a_size, &view);
+
+    /* Connection state comes from a whole CONNACK only */
+    MQTTErrorCodes_t state = mqtt_connect_parse_ack(input, (uint32_t)a_size);
+    if ((Successfull == status) && (CONNACK == view.type))
+        FUZZ_CHECK(state == (MQTTErrorCodes_t)view.body.ptr[1]);
+    else
+        FUZZ_CHECK(InvalidArgument == state);
+
+    if (Successfull == mqtt_parse_ping_ack(input, (uint32_t)a_size))
+        FUZZ_CHECK((Successfull == status) && (PINGRESP == view.type));
+
+    if ((Successfull == status) &&
+        ((SUBACK == view.type) || (UNSUBACK == view.type))) {
+        uint16_t  packet_id, code_cnt;
+        uint8_t * codes_ptr = decode_variable_header_suback(view.body.ptr, view.body.len, &packet_id, &code_cnt);
+
+        FUZZ_CHECK((NULL != codes_ptr) && (packet_id == view.packet_id));
+        FUZZ_CHECK(codes_ptr + code_cnt == view.body.ptr + view.body.len);
+        fuzz_touch(codes_ptr, code_cnt);
+    }
+
+    free(input);
+    return 0;
+}
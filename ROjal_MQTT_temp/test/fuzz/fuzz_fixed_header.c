@@ -0,0 +1,64 @@
+#include "mqtt.h"
+#include "fuzz.h"
+
+#include <string.h>
+
+extern uint8_t * get_size(uint8_t  * a_input_ptr,
+                          uint32_t * a_message_size_ptr);
+
+extern MQTTErrorCodes_t get_packet_size(uint8_t  * a_input_ptr,
+                                        uint32_t   a_input_size,
+                                        uint32_t * a_packet_size_ptr);
+
+extern uint8_t * decode_fixed_header(uint8_t           * a_input_ptr,
+                                     bool              * a_dup_ptr,
+                                     MQTTQoSLevel_t    * a_qos_ptr,
+                                     bool              * a_retain_ptr,
+                                     MQTTMessageType_t * a_message_type_ptr,
+                                     uint32_t          * a_message_size_ptr);
+
+/* Input: start of a received packet. get_packet_size is bounded by the input,
+ * get_size and decode_fixed_header need whole fixed header readable, so they
+ * get the input in a zero padded MQTT_fixed_header_t. */
+int LLVMFuzzerTestOneInput(const uint8_t * a_data_ptr, size_t a_size)
+{
+    uint8_t * input = fuzz_copy(a_data_ptr, a_size);
+    uint32_t  packet_size;
+
+    MQTTErrorCodes_t status = get_packet_size(input, (uint32_t)a_size, &packet_size);
+    FUZZ_CHECK((Successfull == status) || (PacketIncomplete == status) || (InvalidArgument == status));
+    if (Successfull == status)
+        FUZZ_CHECK((2 <= packet_size) && (packet_size <= MQTT_MAX_MESSAGE_SIZE + 5));
+
+    MQTT_fixed_header_t header;
+    uint8_t           * header_ptr = (uint8_t *)&header;
+    uint32_t           remaining;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(&header, input, (sizeof(header) < a_size) ? sizeof(header) : a_size);
+
+    uint8_t * next_ptr = get_size(header_ptr, &remaining);
+    if (NULL != next_ptr) {
+        FUZZ_CHECK((next_ptr >= header_ptr + 2) && (next_ptr <= header_ptr + sizeof(header)));
+        FUZZ_CHECK(remaining <= MQTT_MAX_MESSAGE_SIZE);
+    }
+
+    /* Both agree when whole fixed header was received */
+    if (sizeof(header) <= a_size) {
+        FUZZ_CHECK((NULL != next_ptr) == (Successfull == status));
+        if (NULL != next_ptr)
+            FUZZ_CHECK(packet_size == remaining + (uint32_t)(next_ptr - header_ptr));
+    }
+
+    bool              dup, retain;
+    MQTTQoSLevel_t    qos;
+    MQTTMessageType_t type;
+
+    if (NULL != decode_fixed_header(header_ptr, &dup, &qos, &retain, &type, &remaining)) {
+        FUZZ_CHECK(NULL != next_ptr);
+        FUZZ_CHECK((QoSInvalid > qos) && (MAXCMD > type));
+    }
+
+    free(input);
+    return 0;
+}
@@ -0,0 +1,155 @@
+#include "mqtt.h"
+#include "fuzz.h"
+
+#include <string.h>
+
+/* Options in the first input byte */
+#define FUZZ_REASSEMBLY 0x01 /* Reassembly buffer, packets can be split    */
+#define FUZZ_STREAM     0x02 /* Streaming receive of PUBLISH payload       */
+#define FUZZ_INFLIGHT   0x04 /* In-flight window with QoS 1 and 2 publishes */
+#define FUZZ_TRIE       0x08 /* Topic trie dispatch                        */
+#define FUZZ_BATCH      0x10 /* mqtt_receive_batch instead of mqtt_receive  */
+
+static MQTT_shared_data_t     shared;
+static uint8_t                tx_buffer[64];
+static uint8_t                rx_buffer[64];
+static MQTT_inflight_window_t window;
+static MQTT_inflight_entry_t  entries[4];
+static uint16_t               received_ids[4];
+static MQTT_topic_trie_t      trie;
+static MQTT_topic_node_t      nodes[8];
+
+static uint32_t g_stream_declared = 0;
+static uint32_t g_stream_len      = 0;
+
+/* CONNACK - connection accepted */
+static uint8_t connack[] = {0x20, 0x02, 0x00, 0x00};
+
+int fuzz_out_fptr(MQTT_shared_data_t * a_shared_ptr, uint8_t * a_data_ptr, size_t a_amount)
+{
+    a_shared_ptr = a_shared_ptr;
+    fuzz_touch(a_data_ptr, a_amount);
+    return (int)a_amount;
+}
+
+void fuzz_subscribe_cb(MQTT_shared_data_t * a_shared_ptr,
+                       MQTTErrorCodes_t     a_status,
+                       uint8_t            * a_data_ptr,
+                       uint32_t             a_data_len,
+                       uint8_t            * a_topic_ptr,
+                       uint16_t             a_topic_len)
+{
+    a_shared_ptr = a_shared_ptr;
+    a_status     = a_status;
+    if (NULL != a_topic_ptr)
+        fuzz_touch(a_topic_ptr, a_topic_len);
+    if (NULL != a_data_ptr)
+        fuzz_touch(a_data_ptr, a_data_len);
+}
+
+void fuzz_topic_cb(MQTT_shared_data_t * a_shared_ptr,
+                   uint8_t            * a_topic_ptr,
+                   uint16_t             a_topic_len,
+                   uint32_t             a_payload_size)
+{
+    a_shared_ptr = a_shared_ptr;
+    fuzz_touch(a_topic_ptr, a_topic_len);
+    g_stream_declared = a_payload_size;
+    g_stream_len      = 0;
+}
+
+void fuzz_chunk_cb(MQTT_shared_data_t * a_shared_ptr,
+                   uint8_t            * a_data_ptr,
+                   uint32_t             a_data_len)
+{
+    a_shared_ptr = a_shared_ptr;
+    fuzz_touch(a_data_ptr, a_data_len);
+
+    /* Payload never exceeds the size told with the topic */
+    g_stream_len += a_data_len;
+    FUZZ_CHECK(g_stream_len <= g_stream_declared);
+}
+
+void fuzz_complete_cb(MQTT_shared_data_t * a_shared_ptr,
+                      MQTTErrorCodes_t     a_status)
+{
+    a_shared_ptr = a_shared_ptr;
+    if (Successfull == a_status)
+        FUZZ_CHECK(g_stream_len == g_stream_declared);
+}
+
+static void fuzz_setup(uint8_t a_options)
+{
+    memset(&shared, 0, sizeof(shared));
+    shared.buffer            = tx_buffer;
+    shared.buffer_size       = sizeof(tx_buffer);
+    shared.out_fptr          = &fuzz_out_fptr;
+    shared.subscribe_cb_fptr = &fuzz_subscribe_cb;
+    g_stream_declared        = 0;
+    g_stream_len             = 0;
+
+    FUZZ_CHECK(Successfull == mqtt(&shared, ACTION_INIT, NULL));
+
+    if (a_options & FUZZ_REASSEMBLY)
+        FUZZ_CHECK(mqtt_receive_buffer(&shared, rx_buffer, sizeof(rx_buffer)));
+
+    if (a_options & FUZZ_STREAM)
+        FUZZ_CHECK(mqtt_receive_stream(&shared, &fuzz_topic_cb, &fuzz_chunk_cb, &fuzz_complete_cb));
+
+    if (a_options & FUZZ_INFLIGHT) {
+        /* Packet identifiers 1 and 2 wait PUBACK and PUBREC */
+        FUZZ_CHECK(mqtt_receive(&shared, connack, sizeof(connack)));
+        FUZZ_CHECK(mqtt_inflight_init(&window, entries, sizeof(entries) / sizeof(entries[0]), 0, NULL));
+        FUZZ_CHECK(mqtt_inflight_received_init(&window, received_ids, sizeof(received_ids) / sizeof(received_ids[0])));
+        FUZZ_CHECK(mqtt_inflight_window(&shared, &window));
+        FUZZ_CHECK(mqtt_publish_qos(&shared, "t", 1, "hi", 2, QoS1, NULL));
+        FUZZ_CHECK(mqtt_publish_qos(&shared, "t", 1, "hi", 2, QoS2, NULL));
+    }
+
+    if (a_options & FUZZ_TRIE) {
+        FUZZ_CHECK(mqtt_topic_trie_init(&trie, nodes, sizeof(nodes) / sizeof(nodes[0])));
+        FUZZ_CHECK(mqtt_topic_register(&trie, "a/+/c", 5, &fuzz_subscribe_cb));
+        FUZZ_CHECK(mqtt_topic_register(&trie, "#", 1, &fuzz_subscribe_cb));
+        FUZZ_CHECK(mqtt_topic_trie(&shared, &trie));
+    }
+}
+
+/* Input: options byte, chunk size byte (0 = all at once), then received data */
+int LLVMFuzzerTestOneInput(const uint8_t * a_data_ptr, size_t a_size)
+{
+    if (2 > a_size)
+        return 0;
+
+    uint8_t   options = a_data_ptr[0];
+    size_t    chunk   = a_data_ptr[1];
+    size_t    left    = a_size - 2;
+    uint8_t * input   = fuzz_copy(&(a_data_ptr[2]), left);
+    uint8_t * data    = input;
+
+    fuzz_setup(options);
+
+    if (options & FUZZ_BATCH) {
+        /* Caller keeps the incomplete tail and gives it again with more data */
+        size_t given = 0;
+        while (given < left) {
+            size_t consumed = 0;
+
+            given += ((0 == chunk) || (chunk > left - given)) ? left - given : chunk;
+            if (false == mqtt_receive_batch(&shared, data, given - (size_t)(data - input), &consumed))
+                break;
+            FUZZ_CHECK(consumed <= given - (size_t)(data - input));
+            data += consumed;
+        }
+    } else {
+        while (0 < left) {
+            size_t amount = ((0 == chunk) || (chunk > left)) ? left : chunk;
+
+            mqtt_receive(&shared, data, amount);
+            data += amount;
+            left -= amount;
+        }
+    }
+
+    free(input);
+    return 0;
+}
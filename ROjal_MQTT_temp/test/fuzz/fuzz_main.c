@@ -0,0 +1,57 @@
+#include "fuzz.h"
+
+#include <stdio.h>
+
+/* Standalone driver for compilers without libFuzzer (gcc, afl-gcc).
+ * Each file given as argument is passed once to the fuzz target, without
+ * arguments input is read from stdin as AFL expects. */
+static int fuzz_run(FILE * a_file_ptr)
+{
+    size_t    size = 0;
+    size_t    room = 4096;
+    uint8_t * data = malloc(room);
+
+    if (NULL == data)
+        return 1;
+
+    for (size_t got; 0 < (got = fread(&(data[size]), 1, room - size, a_file_ptr));) {
+        size += got;
+        if (size == room) {
+            uint8_t * more = realloc(data, room * 2);
+            if (NULL == more) {
+                free(data);
+                return 1;
+            }
+            data  = more;
+            room *= 2;
+        }
+    }
+
+    /* Exact size copy, so sanitizers catch reads over the input */
+    uint8_t * input = fuzz_copy(data, size);
+    free(data);
+
+    LLVMFuzzerTestOneInput(input, size);
+    free(input);
+    return 0;
+}
+
+int main(int argc, char ** argv)
+{
+    if (1 == argc)
+        return fuzz_run(stdin);
+
+    for (int i = 1; i < argc; i++) {
+        FILE * file = fopen(argv[i], "rb");
+        if (NULL == file) {
+            fprintf(stderr, "%s: cannot open\n", argv[i]);
+            return 1;
+        }
+        int status = fuzz_run(file);
+        fclose(file);
+        if (0 != status)
+            return status;
+        printf("%s: ok\n", argv[i]);
+    }
+    return 0;
+}
@@ -0,0 +1,38 @@
+#include "mqtt.h"
+#include "fuzz.h"
+
+/* Input: received data, viewed packet by packet as mqtt_receive_batch does */
+int LLVMFuzzerTestOneInput(const uint8_t * a_data_ptr, size_t a_size)
+{
+    uint8_t * input  = fuzz_copy(a_data_ptr, a_size);
+    uint8_t * packet = input;
+    uint32_t  left   = (uint32_t)a_size;
+
+    while (0 < left) {
+        MQTT_packet_view_t view;
+
+        if (Successfull != mqtt_packet_view(packet, left, &view))
+            break;
+
+        /* Views stay inside of the packet, packet inside of the input */
+        uint8_t * end = packet + view.packet_size;
+        FUZZ_CHECK((2 <= view.packet_size) && (view.packet_size <= left));
+        FUZZ_CHECK((view.body.ptr > packet) && (view.body.ptr + view.body.len == end));
+        FUZZ_CHECK((view.payload.ptr >= view.body.ptr) && (view.payload.ptr + view.payload.len == end));
+        if (NULL != view.topic.ptr) {
+            FUZZ_CHECK((0 < view.topic.len) && (view.topic.ptr >= view.body.ptr));
+            FUZZ_CHECK(view.topic.ptr + view.topic.len <= view.payload.ptr);
+        }
+        if (PUBLISH == view.type) {
+            FUZZ_CHECK(QoSInvalid > view.qos);
+            FUZZ_CHECK((QoS0 == view.qos) == (0 == view.packet_id));
+        }
+        fuzz_touch(view.body.ptr, view.body.len);
+
+        packet += view.packet_size;
+        left   -= view.packet_size;
+    }
+
+    free(input);
+    return 0;
+}
@@ -0,0 +1,37 @@
+#include "mqtt.h"
+#include "fuzz.h"
+
+extern bool decode_publish(uint8_t        *  a_message_in_ptr,
+                           uint32_t          a_size_of_msg,
+                           MQTTQoSLevel_t    a_qos,
+                           uint8_t        ** a_topic_out_ptr,
+                           uint16_t       *  a_topic_length_out_ptr,
+                           uint8_t        ** a_out_message_ptr,
+                           uint32_t       *  a_out_message_size_ptr);
+
+/* Input: QoS from the fixed header in the first byte, then variable header and
+ * payload of PUBLISH */
+int LLVMFuzzerTestOneInput(const uint8_t * a_data_ptr, size_t a_size)
+{
+    if (1 > a_size)
+        return 0;
+
+    uint8_t      * input = fuzz_copy(&(a_data_ptr[1]), a_size - 1);
+    uint32_t       size  = (uint32_t)(a_size - 1);
+    MQTTQoSLevel_t qos   = (MQTTQoSLevel_t)(a_data_ptr[0] & 0x03);
+    uint8_t      * topic_ptr;
+    uint16_t       topic_len;
+    uint8_t      * payload_ptr;
+    uint32_t       payload_len;
+
+    if (true == decode_publish(input, size, qos, &topic_ptr, &topic_len, &payload_ptr, &payload_len)) {
+        FUZZ_CHECK(QoSInvalid > qos);
+        FUZZ_CHECK((0 < topic_len) && (topic_ptr == input + sizeof(uint16_t)));
+        FUZZ_CHECK((topic_ptr + topic_len <= payload_ptr) && (payload_ptr + payload_len == input + size));
+        fuzz_touch(topic_ptr, topic_len);
+        fuzz_touch(payload_ptr, payload_len);
+    }
+
+    free(input);
+    return 0;
+}
@@ -86,8 +86,10 @@ void close_mqtt_socket_()
     socket_OK_ = false;
 }
 
-int data_stream_in_fptr_(uint8_t * a_data_ptr, size_t a_amount)
+int data_stream_in_fptr_(MQTT_shared_data_t * a_shared_ptr, uint8_t * a_data_ptr, size_t a_amount)
 {
+    a_shared_ptr = a_shared_ptr;
+
     if (g_socket_desc <= 0)
         g_socket_desc = open_mqtt_socket_(&g_socket_desc);
 
@@ -100,8 +102,10 @@ int data_stream_in_fptr_(uint8_t * a_data_ptr, size_t a_amount)
     }
 }
 
-int data_stream_out_fptr_(uint8_t * a_data_ptr, size_t a_amount)
+int data_stream_out_fptr_(MQTT_shared_data_t * a_shared_ptr, uint8_t * a_data_ptr, size_t a_amount)
 {
+    a_shared_ptr = a_shared_ptr;
+
     if (g_socket_desc <= 0)
         g_socket_desc = open_mqtt_socket_(&g_socket_desc);
 
@@ -114,8 +118,10 @@ int data_stream_out_fptr_(uint8_t * a_data_ptr, size_t a_amount)
     }
 }
 
-void connected_cb_(MQTTErrorCodes_t a_status)
+void connected_cb_(MQTT_shared_data_t * a_shared_ptr, MQTTErrorCodes_t a_status)
 {
+    a_shared_ptr = a_shared_ptr;
+
     if (Successfull == a_status)
         printf("Connected CB SUCCESSFULL\n");
     else
@@ -123,12 +129,15 @@ void connected_cb_(MQTTErrorCodes_t a_status)
     g_auto_state_connection_completed_ = true;
 }
 
-void subscrbe_cb_(MQTTErrorCodes_t a_status,
+void subscrbe_cb_(MQTT_shared_data_t * a_shared_ptr,
+                 MQTTErrorCodes_t a_status,
                  uint8_t * a_data_ptr,
                  uint32_t a_data_len,
                  uint8_t * a_topic_ptr,
                  uint16_t a_topic_len)
 {
+    a_shared_ptr = a_shared_ptr;
+
     if (Successfull == a_status) {
         printf("Subscribed CB SUCCESSFULL\n");
 
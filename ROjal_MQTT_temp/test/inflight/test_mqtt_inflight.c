@@ -0,0 +1,471 @@
+#include "mqtt.h"
+#include "unity.h"
+#include "client_fixture.h"
+
+#include <string.h>
+
+#define WINDOW_SIZE 4
+
+static MQTT_shared_data_t     shared;
+static uint8_t                tx_buffer[64];
+static MQTT_inflight_entry_t  entries[WINDOW_SIZE];
+static MQTT_inflight_window_t window;
+
+static uint32_t g_published_cntr  = 0;
+static uint16_t g_published_id    = 0;
+static uint32_t g_received_cntr   = 0;
+static uint16_t received_ids[2];
+
+void inflight_published_cb(MQTT_shared_data_t * a_shared_ptr, uint16_t a_packet_id, MQTTErrorCodes_t a_status)
+{
+    TEST_ASSERT_EQUAL_PTR(&shared, a_shared_ptr);
+    TEST_ASSERT_EQUAL_INT(Successfull, a_status);
+    g_published_id = a_packet_id;
+    g_published_cntr++;
+}
+
+void inflight_subscribe_cb(MQTT_shared_data_t * a_shared_ptr,
+                           MQTTErrorCodes_t     a_status,
+                           uint8_t            * a_data_ptr,
+                           uint32_t             a_data_len,
+                           uint8_t            * a_topic_ptr,
+                           uint16_t             a_topic_len)
+{
+    a_shared_ptr = a_shared_ptr;
+    a_data_ptr   = a_data_ptr;
+    a_data_len   = a_data_len;
+    a_topic_len  = a_topic_len;
+    if ((Successfull == a_status) &&
+        (NULL != a_topic_ptr))
+        g_received_cntr++;
+}
+
+void inflight_setup(uint32_t a_retry_in_ms)
+{
+    fixture_setup(&shared, tx_buffer, sizeof(tx_buffer), true);
+    shared.subscribe_cb_fptr = &inflight_subscribe_cb;
+
+    TEST_ASSERT_TRUE(mqtt_inflight_init(&window, entries, WINDOW_SIZE, a_retry_in_ms, &inflight_published_cb));
+    TEST_ASSERT_TRUE(mqtt_inflight_window(&shared, &window));
+
+    fixture_clear();
+    g_published_cntr = 0;
+    g_published_id   = 0;
+    g_received_cntr  = 0;
+}
+
+static void send_ack(uint8_t a_type, uint16_t a_packet_id)
+{
+    uint8_t ack[] = {a_type, 0x02, (uint8_t)(a_packet_id >> 8), (uint8_t)a_packet_id};
+    TEST_ASSERT_TRUE(mqtt_receive(&shared, ack, sizeof(ack)));
+}
+
+static void send_puback(uint16_t a_packet_id)
+{
+    uint8_t puback[] = {0x40, 0x02, (uint8_t)(a_packet_id >> 8), (uint8_t)a_packet_id};
+    TEST_ASSERT_TRUE(mqtt_receive(&shared, puback, sizeof(puback)));
+}
+
+/****************************************************************************************
+ * In-flight window tests                                                               *
+ ****************************************************************************************/
+void test_inflight_publish_and_puback()
+{
+    /* PUBLISH QoS1 - topic "t", packet id, payload "hi" */
+    uint8_t  expected[] = {0x32, 0x07, 0x00, 0x01, 't', 0x00, 0x00, 'h', 'i'};
+    uint16_t packet_id  = 0;
+
+    inflight_setup(0);
+
+    TEST_ASSERT_TRUE(mqtt_publish_qos(&shared, "t", 1, "hi", 2, QoS1, &packet_id));
+    TEST_ASSERT_NOT_EQUAL(0, packet_id);
+    expected[5] = (uint8_t)(packet_id >> 8);
+    expected[6] = (uint8_t)(packet_id);
+
+    TEST_ASSERT_EQUAL_UINT32(sizeof(expected), g_out_len);
+    TEST_ASSERT_EQUAL_MEMORY(expected, g_out, sizeof(expected));
+    TEST_ASSERT_EQUAL_UINT16(WINDOW_SIZE - 1, mqtt_inflight_free(&shared));
+
+    /* Unknown packet identifier does not free anything */
+    uint8_t unknown[] = {0x40, 0x02, (uint8_t)((packet_id + 1) >> 8), (uint8_t)(packet_id + 1)};
+    TEST_ASSERT_FALSE(mqtt_receive(&shared, unknown, sizeof(unknown)));
+    TEST_ASSERT_EQUAL_UINT32(0, g_published_cntr);
+
+    send_puback(packet_id);
+    TEST_ASSERT_EQUAL_UINT32(1, g_published_cntr);
+    TEST_ASSERT_EQUAL_UINT16(packet_id, g_published_id);
+    TEST_ASSERT_EQUAL_UINT16(WINDOW_SIZE, mqtt_inflight_free(&shared));
+}
+
+void test_inflight_window_full()
+{
+    uint16_t ids[WINDOW_SIZE];
+
+    inflight_setup(0);
+
+    /* Several publishes are unacknowledged at the same time */
+    for (uint32_t i = 0; i < WINDOW_SIZE; i++)
+        TEST_ASSERT_TRUE(mqtt_publish_qos(&shared, "t", 1, "hi", 2, QoS1, &(ids[i])));
+
+    TEST_ASSERT_EQUAL_UINT16(0, mqtt_inflight_free(&shared));
+
+    /* Backpressure - nothing is sent when window is full */
+    uint32_t out_len = g_out_len;
+    MQTT_publish_t publish;
+    memset(&publish, 0, sizeof(publish));
+    publish.flags.qos           = QoS1;
+    publish.topic_ptr           = (uint8_t *)"t";
+    publish.topic_length        = 1;
+    publish.message_buffer_ptr  = (uint8_t *)"hi";
+    publish.message_buffer_size = 2;
+
+    MQTT_action_data_t action;
+    action.action_argument.publish_ptr = &publish;
+    TEST_ASSERT_EQUAL_INT(InflightWindowFull, mqtt(&shared, ACTION_PUBLISH, &action));
+    TEST_ASSERT_EQUAL_UINT32(out_len, g_out_len);
+
+    /* QoS0 does not use the window */
+    TEST_ASSERT_TRUE(mqtt_publish(&shared, "t", 1, "hi", 2));
+
+    /* Acks in any order */
+    send_puback(ids[2]);
+    TEST_ASSERT_EQUAL_UINT16(1, mqtt_inflight_free(&shared));
+    TEST_ASSERT_TRUE(mqtt_publish_qos(&shared, "t", 1, "hi", 2, QoS1, &(ids[2])));
+
+    /* Identifiers in flight are not reused */
+    for (uint32_t i = 0; i < WINDOW_SIZE; i++)
+        for (uint32_t j = i + 1; j < WINDOW_SIZE; j++)
+            TEST_ASSERT_NOT_EQUAL(ids[i], ids[j]);
+
+    for (uint32_t i = 0; i < WINDOW_SIZE; i++)
+        send_puback(ids[i]);
+    TEST_ASSERT_EQUAL_UINT32(WINDOW_SIZE + 1, g_published_cntr);
+    TEST_ASSERT_EQUAL_UINT16(WINDOW_SIZE, mqtt_inflight_free(&shared));
+}
+
+void test_inflight_retransmit_timeout()
+{
+    uint16_t packet_id = 0;
+
+    inflight_setup(1000);
+
+    TEST_ASSERT_TRUE(mqtt_publish_qos(&shared, "t", 1, "hi", 2, QoS1, &packet_id));
+    uint32_t first_len = g_out_len;
+    g_out_len = 0;
+
+    /* Retransmit timer runs with keepalive, retransmit goes out before ping */
+    TEST_ASSERT_TRUE(mqtt_keepalive(&shared, 500));
+    g_out_len = 0;
+    TEST_ASSERT_TRUE(mqtt_keepalive(&shared, 600));
+
+    /* Same packet again, DUP flag set (0x3A = PUBLISH, DUP, QoS1) */
+    TEST_ASSERT_TRUE(first_len <= g_out_len);
+    TEST_ASSERT_EQUAL_HEX8(0x3A, g_out[0]);
+    TEST_ASSERT_EQUAL_UINT8((uint8_t)(packet_id >> 8), g_out[5]);
+    TEST_ASSERT_EQUAL_UINT8((uint8_t)(packet_id),      g_out[6]);
+
+    send_puback(packet_id);
+    g_out_len = 0;
+    TEST_ASSERT_TRUE(mqtt_keepalive(&shared, 2000));
+    for (uint32_t i = 0; i < g_out_len; i++)
+        TEST_ASSERT_NOT_EQUAL(0x3A, g_out[i]); /* Only ping, no retransmit */
+}
+
+/* Count retransmitted QoS1 PUBLISH packets of given id in the output, topic length 1 */
+static uint32_t dup_count(uint16_t a_packet_id)
+{
+    uint32_t cntr = 0;
+
+    for (uint32_t pos = 0; pos + 1 < g_out_len; pos += 2 + g_out[pos + 1]) {
+        if ((0x3A == g_out[pos]) &&
+            ((uint8_t)(a_packet_id >> 8) == g_out[pos + 5]) &&
+            ((uint8_t)(a_packet_id)      == g_out[pos + 6]))
+            cntr++;
+    }
+    return cntr;
+}
+
+void test_inflight_retransmit_only_expired()
+{
+    uint16_t first_id  = 0;
+    uint16_t second_id = 0;
+
+    inflight_setup(1000);
+
+    TEST_ASSERT_TRUE(mqtt_publish_qos(&shared, "t", 1, "hi", 2, QoS1, &first_id));
+    TEST_ASSERT_TRUE(mqtt_keepalive(&shared, 600));
+    TEST_ASSERT_TRUE(mqtt_publish_qos(&shared, "t", 1, "hi", 2, QoS1, &second_id));
+    g_out_len = 0;
+
+    /* Timer of the first one expires, the one sent later is not repeated yet */
+    TEST_ASSERT_TRUE(mqtt_keepalive(&shared, 500));
+    TEST_ASSERT_EQUAL_UINT32(1, dup_count(first_id));
+    TEST_ASSERT_EQUAL_UINT32(0, dup_count(second_id));
+
+    /* Second one expires on its own time, timer of the first was restarted */
+    g_out_len = 0;
+    TEST_ASSERT_TRUE(mqtt_keepalive(&shared, 600));
+    TEST_ASSERT_EQUAL_UINT32(0, dup_count(first_id));
+    TEST_ASSERT_EQUAL_UINT32(1, dup_count(second_id));
+}
+
+void test_inflight_resend_after_reconnect()
+{
+    uint16_t packet_id = 0;
+
+    inflight_setup(0);
+    TEST_ASSERT_TRUE(mqtt_publish_qos(&shared, "t", 1, "hi", 2, QoS1, &packet_id));
+
+    /* Reconnect detaches the window, unacknowledged entries are kept */
+    TEST_ASSERT_EQUAL_INT(Successfull, mqtt(&shared, ACTION_INIT, NULL));
+    TEST_ASSERT_EQUAL_UINT16(0, mqtt_inflight_free(&shared));
+    TEST_ASSERT_TRUE(mqtt_receive(&shared, connack, sizeof(connack)));
+
+    g_out_len = 0;
+    TEST_ASSERT_TRUE(mqtt_inflight_window(&shared, &window));
+    TEST_ASSERT_EQUAL_UINT32(9, g_out_len);
+    TEST_ASSERT_EQUAL_HEX8(0x3A, g_out[0]);
+
+    send_puback(packet_id);
+    TEST_ASSERT_EQUAL_UINT32(1, g_published_cntr);
+}
+
+void test_inflight_packet_id_not_zero()
+{
+    uint16_t packet_id = 0;
+
+    inflight_setup(0);
+    shared.mqtt_packet_cntr = 0xFFFE;
+
+    for (uint32_t i = 0; i < 3; i++) {
+        TEST_ASSERT_TRUE(mqtt_publish_qos(&shared, "t", 1, "hi", 2, QoS1, &packet_id));
+        TEST_ASSERT_NOT_EQUAL(0, packet_id);
+        send_puback(packet_id);
+    }
+    TEST_ASSERT_EQUAL_UINT16(2, packet_id); /* 0xFFFF, 1, 2 */
+}
+
+void test_inflight_receive_qos1()
+{
+    /* PUBLISH QoS1 - topic "a", packet id 0x1234, payload "x" */
+    uint8_t publish[] = {0x32, 0x06, 0x00, 0x01, 'a', 0x12, 0x34, 'x'};
+    uint8_t puback[]  = {0x40, 0x02, 0x12, 0x34};
+
+    inflight_setup(0);
+    TEST_ASSERT_TRUE(mqtt_receive(&shared, publish, sizeof(publish)));
+    TEST_ASSERT_EQUAL_UINT32(sizeof(puback), g_out_len);
+    TEST_ASSERT_EQUAL_MEMORY(puback, g_out, sizeof(puback));
+}
+
+void test_inflight_no_window()
+{
+    uint16_t packet_id = 0;
+
+    inflight_setup(0);
+    TEST_ASSERT_TRUE(mqtt_inflight_window(&shared, NULL));
+
+    /* Sent, but not tracked */
+    TEST_ASSERT_TRUE(mqtt_publish_qos(&shared, "t", 1, "hi", 2, QoS1, &packet_id));
+    TEST_ASSERT_NOT_EQUAL(0, packet_id);
+    TEST_ASSERT_EQUAL_UINT16(0, mqtt_inflight_free(&shared));
+    TEST_ASSERT_FALSE(mqtt_inflight_init(&window, NULL, WINDOW_SIZE, 0, NULL));
+    TEST_ASSERT_FALSE(mqtt_inflight_init(&window, entries, 0, 0, NULL));
+}
+
+void test_inflight_qos2_publish()
+{
+    uint16_t packet_id = 0;
+    uint8_t  pubrel[]  = {0x62, 0x02, 0x00, 0x00};
+
+    inflight_setup(1000);
+
+    TEST_ASSERT_TRUE(mqtt_publish_qos(&shared, "t", 1, "hi", 2, QoS2, &packet_id));
+    TEST_ASSERT_EQUAL_HEX8(0x34, g_out[0]);
+    pubrel[2] = (uint8_t)(packet_id >> 8);
+    pubrel[3] = (uint8_t)(packet_id);
+
+    /* PUBACK is not valid for QoS2 */
+    uint8_t puback[] = {0x40, 0x02, pubrel[2], pubrel[3]};
+    TEST_ASSERT_FALSE(mqtt_receive(&shared, puback, sizeof(puback)));
+
+    /* PUBREC - PUBREL is sent, publish is not yet complete */
+    g_out_len = 0;
+    send_ack(0x50, packet_id);
+    TEST_ASSERT_EQUAL_UINT32(sizeof(pubrel), g_out_len);
+    TEST_ASSERT_EQUAL_MEMORY(pubrel, g_out, sizeof(pubrel));
+    TEST_ASSERT_EQUAL_UINT32(0, g_published_cntr);
+    TEST_ASSERT_EQUAL_UINT16(WINDOW_SIZE - 1, mqtt_inflight_free(&shared));
+
+    /* Lost PUBCOMP - PUBREL is repeated, not PUBLISH */
+    g_out_len = 0;
+    TEST_ASSERT_TRUE(mqtt_keepalive(&shared, 1000));
+    TEST_ASSERT_EQUAL_MEMORY(pubrel, g_out, sizeof(pubrel));
+
+    /* Identifier is not reused before PUBCOMP */
+    uint16_t other_id = 0;
+    TEST_ASSERT_TRUE(mqtt_publish_qos(&shared, "t", 1, "hi", 2, QoS1, &other_id));
+    TEST_ASSERT_NOT_EQUAL(packet_id, other_id);
+    send_ack(0x40, other_id);
+
+    send_ack(0x70, packet_id);
+    TEST_ASSERT_EQUAL_UINT32(2, g_published_cntr);
+    TEST_ASSERT_EQUAL_UINT16(packet_id, g_published_id);
+    TEST_ASSERT_EQUAL_UINT16(WINDOW_SIZE, mqtt_inflight_free(&shared));
+
+    /* Repeated PUBCOMP is not matched */
+    uint8_t pubcomp[] = {0x70, 0x02, pubrel[2], pubrel[3]};
+    TEST_ASSERT_FALSE(mqtt_receive(&shared, pubcomp, sizeof(pubcomp)));
+}
+
+void test_inflight_qos2_resend_after_reconnect()
+{
+    uint16_t ids[2];
+
+    inflight_setup(0);
+    TEST_ASSERT_TRUE(mqtt_publish_qos(&shared, "t", 1, "hi", 2, QoS2, &(ids[0])));
+    TEST_ASSERT_TRUE(mqtt_publish_qos(&shared, "t", 1, "hi", 2, QoS2, &(ids[1])));
+    send_ack(0x50, ids[1]);
+
+    TEST_ASSERT_EQUAL_INT(Successfull, mqtt(&shared, ACTION_INIT, NULL));
+    TEST_ASSERT_TRUE(mqtt_receive(&shared, connack, sizeof(connack)));
+
+    /* First is published again with DUP, second only released */
+    g_out_len = 0;
+    TEST_ASSERT_TRUE(mqtt_inflight_window(&shared, &window));
+    TEST_ASSERT_EQUAL_UINT32(9 + 4, g_out_len);
+    TEST_ASSERT_EQUAL_HEX8(0x3C, g_out[0]);
+    TEST_ASSERT_EQUAL_HEX8(0x62, g_out[9]);
+    TEST_ASSERT_EQUAL_UINT8((uint8_t)(ids[1]), g_out[12]);
+}
+
+void test_inflight_qos2_receive_once()
+{
+    /* PUBLISH QoS2 - topic "a", packet id 0x0102, payload "x" */
+    uint8_t publish[] = {0x34, 0x06, 0x00, 0x01, 'a', 0x01, 0x02, 'x'};
+    uint8_t dup[]     = {0x3C, 0x06, 0x00, 0x01, 'a', 0x01, 0x02, 'x'};
+    uint8_t pubrec[]  = {0x50, 0x02, 0x01, 0x02};
+    uint8_t pubcomp[] = {0x70, 0x02, 0x01, 0x02};
+
+    inflight_setup(0);
+    TEST_ASSERT_TRUE(mqtt_inflight_received_init(&window, received_ids, 2));
+
+    TEST_ASSERT_TRUE(mqtt_receive(&shared, publish, sizeof(publish)));
+    TEST_ASSERT_EQUAL_UINT32(1, g_received_cntr);
+    TEST_ASSERT_EQUAL_MEMORY(pubrec, g_out, sizeof(pubrec));
+
+    /* Lost PUBREC - repeated publish is acknowledged, not delivered */
+    g_out_len = 0;
+    TEST_ASSERT_TRUE(mqtt_receive(&shared, dup, sizeof(dup)));
+    TEST_ASSERT_EQUAL_UINT32(1, g_received_cntr);
+    TEST_ASSERT_EQUAL_UINT32(sizeof(pubrec), g_out_len);
+    TEST_ASSERT_EQUAL_MEMORY(pubrec, g_out, sizeof(pubrec));
+
+    /* PUBREL releases the identifier */
+    g_out_len = 0;
+    send_ack(0x62, 0x0102);
+    TEST_ASSERT_EQUAL_MEMORY(pubcomp, g_out, sizeof(pubcomp));
+    TEST_ASSERT_EQUAL_UINT16(0, received_ids[0]);
+
+    /* Repeated PUBREL is completed again */
+    g_out_len = 0;
+    send_ack(0x62, 0x0102);
+    TEST_ASSERT_EQUAL_MEMORY(pubcomp, g_out, sizeof(pubcomp));
+
+    /* Same identifier is a new message after release */
+    TEST_ASSERT_TRUE(mqtt_receive(&shared, publish, sizeof(publish)));
+    TEST_ASSERT_EQUAL_UINT32(2, g_received_cntr);
+}
+
+void test_inflight_qos2_received_table_full()
+{
+    uint8_t publish[] = {0x34, 0x06, 0x00, 0x01, 'a', 0x00, 0x01, 'x'};
+
+    inflight_setup(0);
+    TEST_ASSERT_TRUE(mqtt_inflight_received_init(&window, received_ids, 2));
+
+    for (uint8_t id = 1; id <= 2; id++) {
+        publish[6] = id;
+        TEST_ASSERT_TRUE(mqtt_receive(&shared, publish, sizeof(publish)));
+    }
+
+    /* No room to remember third - dropped without PUBREC, broker sends it again */
+    g_out_len  = 0;
+    publish[6] = 3;
+    TEST_ASSERT_FALSE(mqtt_receive(&shared, publish, sizeof(publish)));
+    TEST_ASSERT_EQUAL_UINT32(2, g_received_cntr);
+    TEST_ASSERT_EQUAL_UINT32(0, g_out_len);
+
+    send_ack(0x62, 1);
+    TEST_ASSERT_TRUE(mqtt_receive(&shared, publish, sizeof(publish)));
+    TEST_ASSERT_EQUAL_UINT32(3, g_received_cntr);
+}
+
+static uint32_t g_chunk_len = 0;
+
+void inflight_chunk_cb(MQTT_shared_data_t * a_shared_ptr, uint8_t * a_data_ptr, uint32_t a_data_len)
+{
+    a_shared_ptr = a_shared_ptr;
+    a_data_ptr   = a_data_ptr;
+    g_chunk_len += a_data_len;
+}
+
+void test_inflight_qos2_stream_duplicate()
+{
+    /* PUBLISH QoS2 - topic "a", packet id 0x0005, 100 bytes payload */
+    uint8_t publish[2 + 5 + 100];
+    uint8_t rx_buffer[16];
+
+    memset(publish, 'p', sizeof(publish));
+    publish[0] = 0x34;
+    publish[1] = 5 + 100;
+    publish[2] = 0x00;
+    publish[3] = 0x01;
+    publish[4] = 'a';
+    publish[5] = 0x00;
+    publish[6] = 0x05;
+
+    inflight_setup(0);
+    TEST_ASSERT_TRUE(mqtt_inflight_received_init(&window, received_ids, 2));
+    TEST_ASSERT_TRUE(mqtt_receive_buffer(&shared, rx_buffer, sizeof(rx_buffer)));
+    TEST_ASSERT_TRUE(mqtt_receive_stream(&shared, NULL, &inflight_chunk_cb, NULL));
+
+    /* Split packets - headers are collected, payload streamed once */
+    g_chunk_len = 0;
+    for (uint32_t round = 0; round < 2; round++) {
+        g_out_len = 0;
+        TEST_ASSERT_TRUE(mqtt_receive(&shared, publish, 4));
+        TEST_ASSERT_TRUE(mqtt_receive(&shared, &(publish[4]), sizeof(publish) - 4));
+        TEST_ASSERT_EQUAL_UINT32(100, g_chunk_len);
+        TEST_ASSERT_EQUAL_UINT32(4, g_out_len);
+        TEST_ASSERT_EQUAL_HEX8(0x50, g_out[0]);
+        publish[0] = 0x3C; /* DUP */
+    }
+
+    /* Framer is in sync after skipped payload */
+    send_ack(0x62, 0x0005);
+    TEST_ASSERT_EQUAL_HEX8(0x70, g_out[4]);
+}
+
+/****************************************************************************************
+ * TEST main                                                                            *
+ ****************************************************************************************/
+int main(void)
+{
+    UnityBegin("In-flight window");
+    unsigned int tCntr = 1;
+
+    RUN_TEST(test_inflight_publish_and_puback,          tCntr++);
+    RUN_TEST(test_inflight_window_full,                 tCntr++);
+    RUN_TEST(test_inflight_retransmit_timeout,          tCntr++);
+    RUN_TEST(test_inflight_retransmit_only_expired,     tCntr++);
+    RUN_TEST(test_inflight_resend_after_reconnect,      tCntr++);
+    RUN_TEST(test_inflight_packet_id_not_zero,          tCntr++);
+    RUN_TEST(test_inflight_receive_qos1,                tCntr++);
+    RUN_TEST(test_inflight_no_window,                   tCntr++);
+    RUN_TEST(test_inflight_qos2_publish,                tCntr++);
+    RUN_TEST(test_inflight_qos2_resend_after_reconnect, tCntr++);
+    RUN_TEST(test_inflight_qos2_receive_once,           tCntr++);
+    RUN_TEST(test_inflight_qos2_received_table_full,    tCntr++);
+    RUN_TEST(test_inflight_qos2_stream_duplicate,       tCntr++);
+    return (UnityEnd());
+}
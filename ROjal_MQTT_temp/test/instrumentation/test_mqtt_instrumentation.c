@@ -0,0 +1,235 @@
+#include "mqtt.h"
+#include "unity.h"
+#include "client_fixture.h"
+
+#include <string.h>
+#include <unistd.h>
+
+#define WINDOW_SIZE 2
+#define DELAY_IN_US 2000
+
+/* Functions not declared in mqtt.h - internal functions */
+extern uint16_t mqtt_histogram_bucket(uint32_t a_value_in_us);
+extern void     mqtt_histogram_record(MQTT_histogram_t * a_histogram_ptr,
+                                      uint32_t           a_value_in_us);
+
+static MQTT_shared_data_t     shared;
+static MQTT_instrumentation_t snapshot;
+static uint8_t                tx_buffer[128];
+static MQTT_inflight_entry_t  entries[WINDOW_SIZE];
+static MQTT_inflight_window_t window;
+
+static uint32_t g_received_cntr = 0;
+
+void instrumentation_subscribe_cb(MQTT_shared_data_t * a_shared_ptr,
+                                  MQTTErrorCodes_t     a_status,
+                                  uint8_t            * a_data_ptr,
+                                  uint32_t             a_data_len,
+                                  uint8_t            * a_topic_ptr,
+                                  uint16_t             a_topic_len)
+{
+    a_shared_ptr = a_shared_ptr;
+    a_data_ptr   = a_data_ptr;
+    a_data_len   = a_data_len;
+    a_topic_len  = a_topic_len;
+    if ((Successfull == a_status) &&
+        (NULL != a_topic_ptr)) {
+        /* Slow application */
+        usleep(DELAY_IN_US);
+        g_received_cntr++;
+    }
+}
+
+static void instrumentation_setup()
+{
+    memset(&shared, 0, sizeof(shared));
+    fixture_clear();
+    g_received_cntr = 0;
+
+    /* CONNECT is sent, CONNACK is not waited */
+    TEST_ASSERT_TRUE(mqtt_connect(&shared, "instr", 10,
+                                  (uint8_t*)"", (uint8_t*)"", (uint8_t*)"", (uint8_t*)"",
+                                  tx_buffer, sizeof(tx_buffer), true,
+                                  &fixture_out_fptr, NULL, &instrumentation_subscribe_cb, 0));
+}
+
+static void assert_latency(MQTTHistogram_t a_histogram, uint32_t a_count)
+{
+    MQTT_histogram_t * histogram = &(snapshot.histograms[a_histogram]);
+
+    TEST_ASSERT_EQUAL_UINT32(a_count, histogram->count);
+    TEST_ASSERT_TRUE(DELAY_IN_US <= histogram->min_in_us);
+    TEST_ASSERT_TRUE(histogram->min_in_us <= histogram->max_in_us);
+    TEST_ASSERT_TRUE(DELAY_IN_US <= mqtt_histogram_percentile(histogram, 500));
+}
+
+static void assert_counter(MQTT_packet_counter_t * a_counter_ptr, uint32_t a_packets, uint64_t a_bytes)
+{
+    TEST_ASSERT_EQUAL_UINT32(a_packets, a_counter_ptr->packets);
+    TEST_ASSERT_TRUE(a_bytes == a_counter_ptr->bytes);
+}
+
+/****************************************************************************************
+ * Instrumentation tests                                                                *
+ ****************************************************************************************/
+void test_histogram_buckets()
+{
+    /* Small values have own buckets, bucket grows with the value */
+    for (uint32_t value = 0; value < 8; value++)
+        TEST_ASSERT_EQUAL_UINT16(value, mqtt_histogram_bucket(value));
+
+    TEST_ASSERT_EQUAL_UINT16(8,  mqtt_histogram_bucket(8));
+    TEST_ASSERT_EQUAL_UINT16(15, mqtt_histogram_bucket(15));
+    TEST_ASSERT_EQUAL_UINT16(16, mqtt_histogram_bucket(16));
+    TEST_ASSERT_EQUAL_UINT16(16, mqtt_histogram_bucket(17));
+    TEST_ASSERT_EQUAL_UINT16(17, mqtt_histogram_bucket(18));
+    TEST_ASSERT_EQUAL_UINT16(MQTT_HISTOGRAM_BUCKETS - 1, mqtt_histogram_bucket(UINT32_MAX));
+
+    uint16_t previous = 0;
+    for (uint32_t value = 1; value < 100000000; value += value / 16 + 1) {
+        uint16_t bucket = mqtt_histogram_bucket(value);
+        TEST_ASSERT_TRUE(previous <= bucket);
+        previous = bucket;
+    }
+}
+
+void test_histogram_percentile()
+{
+    MQTT_histogram_t histogram;
+
+    memset(&histogram, 0, sizeof(histogram));
+    TEST_ASSERT_EQUAL_UINT32(0, mqtt_histogram_percentile(&histogram, 500));
+
+    /* 1..1000 us */
+    for (uint32_t value = 1; value <= 1000; value++)
+        mqtt_histogram_record(&histogram, value);
+
+    TEST_ASSERT_EQUAL_UINT32(1000, histogram.count);
+    TEST_ASSERT_EQUAL_UINT32(1,    histogram.min_in_us);
+    TEST_ASSERT_EQUAL_UINT32(1000, histogram.max_in_us);
+    TEST_ASSERT_TRUE(500500 == histogram.sum_in_us);
+
+    /* Within one bucket = 12.5 % from the real value */
+    uint32_t p50 = mqtt_histogram_percentile(&histogram, 500);
+    uint32_t p99 = mqtt_histogram_percentile(&histogram, 990);
+    TEST_ASSERT_TRUE((500 <= p50) && (p50 <= 500 + 500 / 8));
+    TEST_ASSERT_TRUE((990 <= p99) && (p99 <= 1000));
+    TEST_ASSERT_EQUAL_UINT32(1000, mqtt_histogram_percentile(&histogram, 1000));
+    TEST_ASSERT_EQUAL_UINT32(1,    mqtt_histogram_percentile(&histogram, 0));
+}
+
+void test_request_latencies()
+{
+    uint8_t pingresp[] = {0xD0, 0x00};
+
+    instrumentation_setup();
+    usleep(DELAY_IN_US);
+    TEST_ASSERT_TRUE(mqtt_receive(&shared, connack, sizeof(connack)));
+    TEST_ASSERT_EQUAL_INT(STATE_CONNECTED, shared.state);
+
+    /* SUBSCRIBE is sent, SUBACK is not waited */
+    g_out_len = 0;
+    TEST_ASSERT_TRUE(mqtt_subscribe(&shared, "a/b", 3, 0));
+    uint8_t suback[] = {0x90, 0x03, g_out[2], g_out[3], 0x00};
+    usleep(DELAY_IN_US);
+    TEST_ASSERT_TRUE(mqtt_receive(&shared, suback, sizeof(suback)));
+
+    /* Whole keepalive period elapsed, PINGREQ is sent */
+    g_out_len = 0;
+    TEST_ASSERT_TRUE(mqtt_keepalive(&shared, 10000));
+    TEST_ASSERT_EQUAL_HEX8(0xC0, g_out[0]);
+    usleep(DELAY_IN_US);
+    TEST_ASSERT_TRUE(mqtt_receive(&shared, pingresp, sizeof(pingresp)));
+
+    /* Unexpected PINGRESP is counted, but has no latency */
+    TEST_ASSERT_TRUE(mqtt_receive(&shared, pingresp, sizeof(pingresp)));
+
+    TEST_ASSERT_TRUE(mqtt_instrumentation_snapshot(&shared, &snapshot, false));
+    assert_latency(HISTOGRAM_CONNECT,   1);
+    assert_latency(HISTOGRAM_SUBSCRIBE, 1);
+    assert_latency(HISTOGRAM_PING,      1);
+
+    assert_counter(&(snapshot.out[CONNECT]),   1, 19);
+    assert_counter(&(snapshot.out[SUBSCRIBE]), 1, 10);
+    assert_counter(&(snapshot.out[PINGREQ]),   1, 2);
+    assert_counter(&(snapshot.in[CONNACK]),    1, sizeof(connack));
+    assert_counter(&(snapshot.in[SUBACK]),     1, sizeof(suback));
+    assert_counter(&(snapshot.in[PINGRESP]),   2, 2 * sizeof(pingresp));
+}
+
+void test_publish_latencies()
+{
+    uint8_t  publish[] = {0x30, 0x05, 0x00, 0x01, 't', 'h', 'i'};
+    uint16_t packet_id = 0;
+
+    instrumentation_setup();
+    TEST_ASSERT_TRUE(mqtt_receive(&shared, connack, sizeof(connack)));
+    TEST_ASSERT_TRUE(mqtt_inflight_init(&window, entries, WINDOW_SIZE, 0, NULL));
+    TEST_ASSERT_TRUE(mqtt_inflight_window(&shared, &window));
+
+    /* QoS 1 and QoS 2 publish */
+    TEST_ASSERT_TRUE(mqtt_publish_qos(&shared, "t", 1, "hi", 2, QoS1, &packet_id));
+    uint8_t puback[] = {0x40, 0x02, (uint8_t)(packet_id >> 8), (uint8_t)packet_id};
+    usleep(DELAY_IN_US);
+    TEST_ASSERT_TRUE(mqtt_receive(&shared, puback, sizeof(puback)));
+
+    TEST_ASSERT_TRUE(mqtt_publish_qos(&shared, "t", 1, "hi", 2, QoS2, &packet_id));
+    uint8_t pubrec[]  = {0x50, 0x02, (uint8_t)(packet_id >> 8), (uint8_t)packet_id};
+    uint8_t pubcomp[] = {0x70, 0x02, (uint8_t)(packet_id >> 8), (uint8_t)packet_id};
+    TEST_ASSERT_TRUE(mqtt_receive(&shared, pubrec, sizeof(pubrec)));
+    usleep(DELAY_IN_US);
+    TEST_ASSERT_TRUE(mqtt_receive(&shared, pubcomp, sizeof(pubcomp)));
+
+    /* Delivery to the application */
+    TEST_ASSERT_TRUE(mqtt_receive(&shared, publish, sizeof(publish)));
+    TEST_ASSERT_EQUAL_UINT32(1, g_received_cntr);
+
+    TEST_ASSERT_TRUE(mqtt_instrumentation_snapshot(&shared, &snapshot, true));
+    assert_latency(HISTOGRAM_QOS1_ACK, 1);
+    assert_latency(HISTOGRAM_QOS2_ACK, 1);
+    assert_latency(HISTOGRAM_CALLBACK, 1);
+
+    assert_counter(&(snapshot.out[PUBLISH]), 2, 2 * 9);
+    assert_counter(&(snapshot.out[PUBREL]),  1, 4);
+    assert_counter(&(snapshot.in[PUBACK]),   1, sizeof(puback));
+    assert_counter(&(snapshot.in[PUBLISH]),  1, sizeof(publish));
+
+    /* Reset cleared everything */
+    TEST_ASSERT_TRUE(mqtt_instrumentation_snapshot(&shared, &snapshot, false));
+    for (uint32_t i = 0; i < HISTOGRAM_CNT; i++)
+        TEST_ASSERT_EQUAL_UINT32(0, snapshot.histograms[i].count);
+    for (uint32_t i = 0; i < MAXCMD; i++) {
+        assert_counter(&(snapshot.in[i]),  0, 0);
+        assert_counter(&(snapshot.out[i]), 0, 0);
+    }
+}
+
+void test_streamed_publish_counted()
+{
+    instrumentation_setup();
+    TEST_ASSERT_TRUE(mqtt_receive(&shared, connack, sizeof(connack)));
+
+    TEST_ASSERT_TRUE(mqtt_publish_begin(&shared, "t", 1, 6));
+    TEST_ASSERT_TRUE(mqtt_publish_append(&shared, "abc", 3));
+    TEST_ASSERT_TRUE(mqtt_publish_append(&shared, "def", 3));
+    TEST_ASSERT_TRUE(mqtt_publish_end(&shared));
+
+    TEST_ASSERT_TRUE(mqtt_instrumentation_snapshot(&shared, &snapshot, false));
+    assert_counter(&(snapshot.out[PUBLISH]), 1, g_out_len - 19);
+}
+
+/****************************************************************************************
+ * TEST main                                                                            *
+ ****************************************************************************************/
+int main(void)
+{
+    UnityBegin("Instrumentation");
+    unsigned int tCntr = 1;
+
+    RUN_TEST(test_histogram_buckets,        tCntr++);
+    RUN_TEST(test_histogram_percentile,     tCntr++);
+    RUN_TEST(test_request_latencies,        tCntr++);
+    RUN_TEST(test_publish_latencies,        tCntr++);
+    RUN_TEST(test_streamed_publish_counted, tCntr++);
+    return (UnityEnd());
+}
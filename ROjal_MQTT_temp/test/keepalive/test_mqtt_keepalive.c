@@ -0,0 +1,165 @@
+#include "mqtt.h"
+#include "unity.h"
+
+#include <string.h>
+#include <unistd.h>
+
+extern uint32_t mqtt_ping_deadline(MQTT_shared_data_t * a_shared_ptr);
+
+static MQTT_shared_data_t shared;
+static MQTT_connect_t     connect_params;
+static uint8_t            tx_buffer[64];
+
+static uint32_t         g_ping_cntr = 0;
+static uint32_t         g_lost_cntr = 0;
+static MQTTErrorCodes_t g_lost_reason;
+
+/* CONNACK - connection accepted */
+static uint8_t connack[]  = {0x20, 0x02, 0x00, 0x00};
+static uint8_t pingresp[] = {0xD0, 0x00};
+
+int keepalive_out_fptr(MQTT_shared_data_t * a_shared_ptr, uint8_t * a_data_ptr, size_t a_amount)
+{
+    a_shared_ptr = a_shared_ptr;
+    if ((2 == a_amount) && (0xC0 == a_data_ptr[0]))
+        g_ping_cntr++;
+    return (int)a_amount;
+}
+
+void keepalive_lost_cb(MQTT_shared_data_t * a_shared_ptr, MQTTErrorCodes_t a_reason)
+{
+    TEST_ASSERT_EQUAL_PTR(&shared, a_shared_ptr);
+    TEST_ASSERT_EQUAL_INT(STATE_DISCONNECTED, a_shared_ptr->state);
+    g_lost_reason = a_reason;
+    g_lost_cntr++;
+}
+
+static void keepalive_setup(uint16_t a_keepalive, uint32_t a_timeout_in_ms)
+{
+    MQTT_action_data_t action;
+
+    memset(&shared, 0, sizeof(shared));
+    shared.buffer      = tx_buffer;
+    shared.buffer_size = sizeof(tx_buffer);
+    shared.out_fptr    = &keepalive_out_fptr;
+
+    memset(&connect_params, 0, sizeof(connect_params));
+    connect_params.client_id                   = (uint8_t*)"alive";
+    connect_params.username                    = (uint8_t*)"";
+    connect_params.password                    = (uint8_t*)"";
+    connect_params.last_will_topic             = (uint8_t*)"";
+    connect_params.last_will_message           = (uint8_t*)"";
+    connect_params.keepalive                   = a_keepalive;
+    connect_params.connect_flags.clean_session = true;
+
+    TEST_ASSERT_EQUAL_INT(Successfull, mqtt(&shared, ACTION_INIT, NULL));
+    TEST_ASSERT_TRUE(mqtt_ping_timeout(&shared, a_timeout_in_ms, &keepalive_lost_cb));
+
+    action.action_argument.connect_ptr = &connect_params;
+    TEST_ASSERT_EQUAL_INT(Successfull, mqtt(&shared, ACTION_CONNECT, &action));
+    TEST_ASSERT_TRUE(mqtt_receive(&shared, connack, sizeof(connack)));
+    TEST_ASSERT_EQUAL_INT(STATE_CONNECTED, shared.state);
+
+    g_ping_cntr = 0;
+    g_lost_cntr = 0;
+}
+
+/****************************************************************************************
+ * Keepalive engine tests                                                               *
+ ****************************************************************************************/
+void test_keepalive_pingresp()
+{
+    keepalive_setup(1, 0);
+
+    /* Ping interval is keepalive - 500 ms */
+    TEST_ASSERT_TRUE(mqtt_keepalive(&shared, 400));
+    TEST_ASSERT_EQUAL_UINT32(0, g_ping_cntr);
+    TEST_ASSERT_TRUE(mqtt_keepalive(&shared, 100));
+    TEST_ASSERT_EQUAL_UINT32(1, g_ping_cntr);
+    TEST_ASSERT_TRUE(shared.ping.ping_outstanding);
+
+    /* One ping waits its response at a time */
+    TEST_ASSERT_TRUE(mqtt_keepalive(&shared, 500));
+    TEST_ASSERT_EQUAL_UINT32(1, g_ping_cntr);
+
+    TEST_ASSERT_TRUE(mqtt_receive(&shared, pingresp, sizeof(pingresp)));
+    TEST_ASSERT_FALSE(shared.ping.ping_outstanding);
+    TEST_ASSERT_TRUE(mqtt_keepalive(&shared, 500));
+    TEST_ASSERT_EQUAL_UINT32(2, g_ping_cntr);
+    TEST_ASSERT_EQUAL_UINT32(0, g_lost_cntr);
+}
+
+void test_keepalive_dead_connection()
+{
+    keepalive_setup(1, 20);
+
+    TEST_ASSERT_TRUE(mqtt_keepalive(&shared, 500));
+    TEST_ASSERT_EQUAL_UINT32(1, g_ping_cntr);
+    TEST_ASSERT_TRUE(mqtt_keepalive(&shared, 0));
+
+    /* PINGRESP missed its deadline */
+    usleep(30 * 1000);
+    TEST_ASSERT_FALSE(mqtt_keepalive(&shared, 0));
+    TEST_ASSERT_EQUAL_INT(STATE_DISCONNECTED, shared.state);
+    TEST_ASSERT_FALSE(shared.ping.ping_outstanding);
+    TEST_ASSERT_EQUAL_UINT32(1, g_lost_cntr);
+    TEST_ASSERT_EQUAL_INT(PingTimeout, g_lost_reason);
+
+    /* Lost is reported once */
+    TEST_ASSERT_FALSE(mqtt_keepalive(&shared, 500));
+    TEST_ASSERT_EQUAL_UINT32(1, g_lost_cntr);
+    TEST_ASSERT_EQUAL_UINT32(1, g_ping_cntr);
+}
+
+void test_keepalive_deadline()
+{
+    /* Half of the keepalive by default */
+    keepalive_setup(10, 0);
+    TEST_ASSERT_EQUAL_UINT32(5000, mqtt_ping_deadline(&shared));
+
+    TEST_ASSERT_TRUE(mqtt_ping_timeout(&shared, 123, NULL));
+    TEST_ASSERT_EQUAL_UINT32(123, mqtt_ping_deadline(&shared));
+
+    /* Settings stay over initialization, outstanding ping does not */
+    TEST_ASSERT_TRUE(mqtt_keepalive(&shared, 10000));
+    TEST_ASSERT_TRUE(shared.ping.ping_outstanding);
+    TEST_ASSERT_EQUAL_INT(Successfull, mqtt(&shared, ACTION_INIT, NULL));
+    TEST_ASSERT_FALSE(shared.ping.ping_outstanding);
+    TEST_ASSERT_EQUAL_UINT32(123, shared.ping.pingresp_timeout_in_ms);
+
+    TEST_ASSERT_FALSE(mqtt_ping_timeout(NULL, 0, NULL));
+    TEST_ASSERT_FALSE(mqtt_keepalive_poll(NULL));
+}
+
+void test_keepalive_poll()
+{
+    keepalive_setup(1, 0);
+
+    /* Elapsed time comes from the monotonic clock */
+    TEST_ASSERT_TRUE(mqtt_keepalive_poll(&shared));
+    TEST_ASSERT_EQUAL_UINT32(0, g_ping_cntr);
+
+    usleep(520 * 1000);
+    TEST_ASSERT_TRUE(mqtt_keepalive_poll(&shared));
+    TEST_ASSERT_EQUAL_UINT32(1, g_ping_cntr);
+
+    TEST_ASSERT_TRUE(mqtt_receive(&shared, pingresp, sizeof(pingresp)));
+    TEST_ASSERT_TRUE(mqtt_keepalive_poll(&shared));
+    TEST_ASSERT_EQUAL_UINT32(1, g_ping_cntr);
+    TEST_ASSERT_EQUAL_UINT32(0, g_lost_cntr);
+}
+
+/****************************************************************************************
+ * TEST main                                                                            *
+ ****************************************************************************************/
+int main(void)
+{
+    UnityBegin("Keepalive engine");
+    unsigned int tCntr = 1;
+
+    RUN_TEST(test_keepalive_pingresp,        tCntr++);
+    RUN_TEST(test_keepalive_dead_connection, tCntr++);
+    RUN_TEST(test_keepalive_deadline,        tCntr++);
+    RUN_TEST(test_keepalive_poll,            tCntr++);
+    return (UnityEnd());
+}
@@ -0,0 +1,352 @@
+#include "mqtt.h"
+#include "unity.h"
+#include "loopback_broker.h"
+#include "socket_event_loop.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define SESSION_CNT     3
+#define THROUGHPUT_CNT  20000
+#define THROUGHPUT_SIZE 64
+#define LATENCY_CNT     1000
+#define WINDOW          256
+
+typedef struct test_session
+{
+    MQTT_event_session_t   session;
+    uint8_t                tx_buffer[512];
+    uint8_t                rx_buffer[512];
+    uint8_t                backlog[4096];
+    char                   client_id[32];
+    MQTT_inflight_window_t window;
+    MQTT_inflight_entry_t  entries[8];
+    volatile bool          connected;
+    volatile bool          subscribed;
+    volatile bool          closed;
+    volatile uint32_t      received;
+    volatile uint32_t      published;
+    volatile uint64_t      latency_sum_in_ns;
+} test_session_t;
+
+static loopback_broker_t  broker;
+static test_session_t     sessions[SESSION_CNT];
+static MQTT_event_loop_t  loop;
+
+static uint64_t now_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+void loopback_connected_cb(MQTT_shared_data_t * a_shared_ptr, MQTTErrorCodes_t a_status)
+{
+    test_session_t * ts = (test_session_t *) a_shared_ptr->user_ptr;
+    if (Successfull == a_status)
+        ts->connected = true;
+}
+
+void loopback_published_cb(MQTT_shared_data_t * a_shared_ptr, uint16_t a_packet_id, MQTTErrorCodes_t a_status)
+{
+    test_session_t * ts = (test_session_t *) a_shared_ptr->user_ptr;
+    a_packet_id = a_packet_id;
+    if (Successfull == a_status)
+        ts->published++;
+}
+
+void loopback_subscribe_cb(MQTT_shared_data_t * a_shared_ptr,
+                           MQTTErrorCodes_t     a_status,
+                           uint8_t            * a_data_ptr,
+                           uint32_t             a_data_len,
+                           uint8_t            * a_topic_ptr,
+                           uint16_t             a_topic_len)
+{
+    test_session_t * ts = (test_session_t *) a_shared_ptr->user_ptr;
+    a_topic_len = a_topic_len;
+
+    if (NULL == a_topic_ptr) {
+        ts->subscribed = (Successfull == a_status); /* SUBACK */
+        return;
+    }
+
+    /* Latency messages carry their send time */
+    if ((sizeof(uint64_t) == a_data_len) &&
+        (0 == memcmp("lb/latency", a_topic_ptr, 10))) {
+        uint64_t sent;
+        memcpy(&sent, a_data_ptr, sizeof(sent));
+        ts->latency_sum_in_ns += now_ns() - sent;
+    }
+    ts->received++;
+}
+
+void loopback_closed_cb(MQTT_event_session_t * a_session_ptr)
+{
+    ((test_session_t *) a_session_ptr->shared.user_ptr)->closed = true;
+}
+
+static void session_setup(test_session_t * a_ts_ptr, uint32_t a_index, uint16_t a_keepalive)
+{
+    static uint8_t empty[] = "\0";
+    MQTT_connect_t connect_params;
+
+    memset(a_ts_ptr, 0, sizeof(test_session_t));
+    snprintf(a_ts_ptr->client_id, sizeof(a_ts_ptr->client_id), "loopback%u", a_index);
+
+    connect_params.client_id                    = (uint8_t *)a_ts_ptr->client_id;
+    connect_params.last_will_topic              = empty;
+    connect_params.last_will_message            = empty;
+    connect_params.username                     = empty;
+    connect_params.password                     = empty;
+    connect_params.keepalive                    = a_keepalive;
+    connect_params.connect_flags.clean_session  = true;
+    connect_params.connect_flags.last_will_qos  = 0;
+    connect_params.connect_flags.permanent_will = false;
+
+    a_ts_ptr->session.shared.user_ptr = a_ts_ptr;
+    TEST_ASSERT_TRUE(event_session_init(&(a_ts_ptr->session),
+                                        a_ts_ptr->tx_buffer,
+                                        sizeof(a_ts_ptr->tx_buffer),
+                                        a_ts_ptr->rx_buffer,
+                                        sizeof(a_ts_ptr->rx_buffer),
+                                        a_ts_ptr->backlog,
+                                        sizeof(a_ts_ptr->backlog),
+                                        &connect_params,
+                                        &loopback_connected_cb,
+                                        &loopback_subscribe_cb,
+                                        &loopback_closed_cb));
+}
+
+/* Wait until counter reaches the value */
+static bool wait_for(volatile uint32_t * a_value_ptr, uint32_t a_expected, uint32_t a_timeout_in_ms)
+{
+    uint64_t deadline = now_ns() + (uint64_t)a_timeout_in_ms * 1000000ULL;
+
+    while (*a_value_ptr < a_expected) {
+        if (now_ns() > deadline)
+            return false;
+        mqtt_sleep_ms(1);
+    }
+    return true;
+}
+
+static bool wait_flag(volatile bool * a_flag_ptr, uint32_t a_timeout_in_ms)
+{
+    uint64_t deadline = now_ns() + (uint64_t)a_timeout_in_ms * 1000000ULL;
+
+    while (false == *a_flag_ptr) {
+        if (now_ns() > deadline)
+            return false;
+        mqtt_sleep_ms(1);
+    }
+    return true;
+}
+
+static void subscribe(test_session_t * a_ts_ptr, char * a_filter_ptr, MQTTQoSLevel_t a_qos)
+{
+    MQTT_subscribe_t topic = {a_qos, (uint8_t *)a_filter_ptr, (uint16_t)strlen(a_filter_ptr)};
+
+    a_ts_ptr->subscribed = false;
+    event_session_lock(&(a_ts_ptr->session));
+    TEST_ASSERT_TRUE(mqtt_subscribe_list(&(a_ts_ptr->session.shared), &topic, 1, NULL, 0));
+    event_session_unlock(&(a_ts_ptr->session));
+    TEST_ASSERT_TRUE_MESSAGE(wait_flag(&(a_ts_ptr->subscribed), 2000), "Subscribe failed");
+}
+
+static void publish(test_session_t * a_ts_ptr, char * a_topic_ptr, char * a_msg_ptr, size_t a_msg_size, MQTTQoSLevel_t a_qos)
+{
+    event_session_lock(&(a_ts_ptr->session));
+    TEST_ASSERT_TRUE(mqtt_publish_qos(&(a_ts_ptr->session.shared), a_topic_ptr, strlen(a_topic_ptr), a_msg_ptr, a_msg_size, a_qos, NULL));
+    event_session_unlock(&(a_ts_ptr->session));
+}
+
+static void setup_all(uint16_t a_keepalive)
+{
+    TEST_ASSERT_TRUE(loopback_broker_start(&broker, 0));
+    TEST_ASSERT_TRUE(event_loop_init(&loop, 10));
+
+    for (uint32_t i = 0; i < SESSION_CNT; i++) {
+        session_setup(&(sessions[i]), i, a_keepalive);
+        TEST_ASSERT_TRUE(event_loop_add(&loop, &(sessions[i].session), "127.0.0.1", broker.port));
+    }
+    TEST_ASSERT_TRUE(event_loop_start(&loop));
+
+    for (uint32_t i = 0; i < SESSION_CNT; i++) {
+        TEST_ASSERT_TRUE_MESSAGE(wait_flag(&(sessions[i].connected), 2000), "Connect failed");
+
+        /* Window is attached to the connected context */
+        event_session_lock(&(sessions[i].session));
+        TEST_ASSERT_TRUE(mqtt_inflight_init(&(sessions[i].window), sessions[i].entries, 8, 0, &loopback_published_cb));
+        TEST_ASSERT_TRUE(mqtt_inflight_window(&(sessions[i].session.shared), &(sessions[i].window)));
+        event_session_unlock(&(sessions[i].session));
+    }
+    TEST_ASSERT_EQUAL_UINT32(SESSION_CNT, broker.stats.connects);
+}
+
+static void teardown_all()
+{
+    for (uint32_t i = 0; i < SESSION_CNT; i++) {
+        event_session_lock(&(sessions[i].session));
+        mqtt_disconnect(&(sessions[i].session.shared));
+        event_session_unlock(&(sessions[i].session));
+    }
+    TEST_ASSERT_TRUE(wait_for(&(broker.stats.disconnects), SESSION_CNT, 2000));
+
+    event_loop_stop(&loop);
+    event_loop_destroy(&loop);
+    loopback_broker_stop(&broker);
+    TEST_ASSERT_EQUAL_UINT32(0, broker.stats.protocol_errors);
+}
+
+/****************************************************************************************
+ * Loopback broker tests                                                                *
+ ****************************************************************************************/
+void test_loopback_match()
+{
+    TEST_ASSERT_TRUE(loopback_broker_match("a/b",   "a/b", 3));
+    TEST_ASSERT_FALSE(loopback_broker_match("a/b",  "a/bc", 4));
+    TEST_ASSERT_TRUE(loopback_broker_match("a/+",   "a/b", 3));
+    TEST_ASSERT_FALSE(loopback_broker_match("a/+",  "a/b/c", 5));
+    TEST_ASSERT_TRUE(loopback_broker_match("+/+/c", "a/b/c", 5));
+    TEST_ASSERT_TRUE(loopback_broker_match("a/#",   "a/b/c", 5));
+    TEST_ASSERT_TRUE(loopback_broker_match("a/#",   "a", 1));
+    TEST_ASSERT_FALSE(loopback_broker_match("a/#",  "ab", 2));
+    TEST_ASSERT_TRUE(loopback_broker_match("#",     "a/b", 3));
+    TEST_ASSERT_FALSE(loopback_broker_match("#",    "$SYS/x", 6));
+}
+
+void test_loopback_fan_out()
+{
+    setup_all(0);
+
+    subscribe(&(sessions[1]), "lb/#",   QoS0);
+    subscribe(&(sessions[2]), "lb/a/+", QoS0);
+
+    /* Both match, only the first one matches the second topic */
+    publish(&(sessions[0]), "lb/a/x", "1", 1, QoS0);
+    publish(&(sessions[0]), "lb/b",   "2", 1, QoS0);
+
+    TEST_ASSERT_TRUE(wait_for(&(sessions[1].received), 2, 2000));
+    TEST_ASSERT_TRUE(wait_for(&(sessions[2].received), 1, 2000));
+    mqtt_sleep_ms(50);
+    TEST_ASSERT_EQUAL_UINT32(2, sessions[1].received);
+    TEST_ASSERT_EQUAL_UINT32(1, sessions[2].received);
+    TEST_ASSERT_EQUAL_UINT32(0, sessions[0].received);
+    TEST_ASSERT_EQUAL_UINT32(2, broker.stats.publishes);
+    TEST_ASSERT_EQUAL_UINT32(3, broker.stats.deliveries);
+
+    teardown_all();
+}
+
+void test_loopback_qos_flows()
+{
+    setup_all(0);
+
+    subscribe(&(sessions[1]), "lb/qos", QoS2);
+
+    /* Publisher window is released by PUBACK and PUBCOMP, subscriber acks deliveries */
+    publish(&(sessions[0]), "lb/qos", "q1", 2, QoS1);
+    publish(&(sessions[0]), "lb/qos", "q2", 2, QoS2);
+
+    TEST_ASSERT_TRUE(wait_for(&(sessions[0].published), 2, 2000));
+    TEST_ASSERT_TRUE(wait_for(&(sessions[1].received), 2, 2000));
+    event_session_lock(&(sessions[0].session));
+    TEST_ASSERT_EQUAL_UINT16(8, mqtt_inflight_free(&(sessions[0].session.shared)));
+    event_session_unlock(&(sessions[0].session));
+
+    teardown_all();
+}
+
+void test_loopback_keepalive()
+{
+    setup_all(1);
+
+    /* Keepalive of 1 s sends PINGREQ and connection stays up */
+    TEST_ASSERT_TRUE(wait_for(&(broker.stats.pings), SESSION_CNT * 2, 5000));
+    for (uint32_t i = 0; i < SESSION_CNT; i++)
+        TEST_ASSERT_FALSE(sessions[i].closed);
+
+    teardown_all();
+}
+
+void test_loopback_dead_connection()
+{
+    broker.ignore_ping = true;
+    setup_all(1);
+
+    /* Unanswered PINGREQ closes every session in about 1.5 times the keepalive */
+    for (uint32_t i = 0; i < SESSION_CNT; i++)
+        TEST_ASSERT_TRUE_MESSAGE(wait_flag(&(sessions[i].closed), 3000), "Dead connection not noticed");
+    TEST_ASSERT_EQUAL_UINT32(SESSION_CNT, broker.stats.pings);
+
+    event_loop_stop(&loop);
+    event_loop_destroy(&loop);
+    loopback_broker_stop(&broker);
+    broker.ignore_ping = false;
+}
+
+/* Deterministic load: results are printed as rows of the benchmark output */
+void test_loopback_throughput_latency()
+{
+    static char payload[THROUGHPUT_SIZE];
+
+    setup_all(0);
+    memset(payload, 'x', sizeof(payload));
+    subscribe(&(sessions[1]), "lb/throughput", QoS0);
+    subscribe(&(sessions[1]), "lb/latency",    QoS0);
+
+    /* At most WINDOW messages on the way, socket buffers never fill */
+    uint64_t start = now_ns();
+    for (uint32_t i = 0; i < THROUGHPUT_CNT; i++) {
+        if (WINDOW <= (i - sessions[1].received)) {
+            TEST_ASSERT_TRUE(wait_for(&(sessions[1].received), i - WINDOW + 1, 2000));
+        }
+        publish(&(sessions[0]), "lb/throughput", payload, sizeof(payload), QoS0);
+    }
+    TEST_ASSERT_TRUE(wait_for(&(sessions[1].received), THROUGHPUT_CNT, 5000));
+    uint64_t elapsed = now_ns() - start;
+
+    printf("case,topic_size,payload_size,iterations,ns_per_op,bytes_per_sec\n");
+    printf("loopback_throughput,%u,%u,%u,%.2f,%.0f\n",
+           (uint32_t)strlen("lb/throughput"),
+           THROUGHPUT_SIZE,
+           THROUGHPUT_CNT,
+           (double)elapsed / THROUGHPUT_CNT,
+           (double)THROUGHPUT_CNT * THROUGHPUT_SIZE * 1000000000.0 / (double)elapsed);
+
+    /* One message at a time, publish to callback of the subscriber */
+    uint32_t base = sessions[1].received;
+    for (uint32_t i = 0; i < LATENCY_CNT; i++) {
+        uint64_t sent = now_ns();
+        publish(&(sessions[0]), "lb/latency", (char *)&sent, sizeof(sent), QoS0);
+        TEST_ASSERT_TRUE(wait_for(&(sessions[1].received), base + i + 1, 2000));
+    }
+
+    double latency_in_ns = (double)sessions[1].latency_sum_in_ns / LATENCY_CNT;
+    printf("loopback_latency,%u,%u,%u,%.2f,%.0f\n",
+           (uint32_t)strlen("lb/latency"),
+           (uint32_t)sizeof(uint64_t),
+           LATENCY_CNT,
+           latency_in_ns,
+           sizeof(uint64_t) * 1000000000.0 / latency_in_ns);
+
+    teardown_all();
+}
+
+/****************************************************************************************
+ * TEST main                                                                            *
+ ****************************************************************************************/
+int main(void)
+{
+    UnityBegin("Loopback broker");
+    unsigned int tCntr = 1;
+
+    RUN_TEST(test_loopback_match,              tCntr++);
+    RUN_TEST(test_loopback_fan_out,            tCntr++);
+    RUN_TEST(test_loopback_qos_flows,          tCntr++);
+    RUN_TEST(test_loopback_keepalive,          tCntr++);
+    RUN_TEST(test_loopback_dead_connection,    tCntr++);
+    RUN_TEST(test_loopback_throughput_latency, tCntr++);
+    return (UnityEnd());
+}
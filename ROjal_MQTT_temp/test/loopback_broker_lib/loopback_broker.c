@@ -0,0 +1,549 @@
+#include <stdio.h>       // printf
+#include <string.h>      // memcpy
+#include <sys/socket.h>  // socket
+#include <netinet/in.h>  // sockaddr_in
+#include <netinet/tcp.h> // TCP_NODELAY
+#include <arpa/inet.h>   // htonl
+#include <unistd.h>      // close
+#include <poll.h>        // poll
+#include "loopback_broker.h"
+
+/* Broker has own packet coding, so a bug in the client codec is not mirrored here */
+#define BROKER_CONNECT     0x10
+#define BROKER_CONNACK     0x20
+#define BROKER_PUBLISH     0x30
+#define BROKER_PUBACK      0x40
+#define BROKER_PUBREC      0x50
+#define BROKER_PUBREL      0x62
+#define BROKER_PUBCOMP     0x70
+#define BROKER_SUBSCRIBE   0x82
+#define BROKER_SUBACK      0x90
+#define BROKER_UNSUBSCRIBE 0xA2
+#define BROKER_UNSUBACK    0xB0
+#define BROKER_PINGREQ     0xC0
+#define BROKER_PINGRESP    0xD0
+#define BROKER_DISCONNECT  0xE0
+
+#define BROKER_SUBACK_FAILURE 0x80
+#define BROKER_POLL_IN_MS     20
+
+/****************************************************************************************
+ * Output                                                                               *
+ ****************************************************************************************/
+static bool broker_send(loopback_broker_client_t * a_client_ptr,
+                        const uint8_t            * a_data_ptr,
+                        size_t                     a_amount,
+                        bool                       a_more)
+{
+    while (0 < a_amount) {
+        ssize_t sent = send(a_client_ptr->fd, a_data_ptr, a_amount, MSG_NOSIGNAL | (a_more ? MSG_MORE : 0));
+        if (0 >= sent)
+            return false;
+        a_data_ptr += sent;
+        a_amount   -= (size_t)sent;
+    }
+    return true;
+}
+
+/* Fixed header with remaining length, returns header size */
+static uint8_t broker_header(uint8_t * a_output_ptr, uint8_t a_type, uint32_t a_remaining)
+{
+    uint8_t size = 0;
+
+    a_output_ptr[size++] = a_type;
+    do {
+        uint8_t encoded = a_remaining & 0x7F;
+        a_remaining >>= 7;
+        a_output_ptr[size++] = encoded | ((0 < a_remaining) ? 0x80 : 0);
+    } while (0 < a_remaining);
+    return size;
+}
+
+static bool broker_send_ack(loopback_broker_client_t * a_client_ptr, uint8_t a_type, uint16_t a_packet_id)
+{
+    uint8_t ack[] = {a_type, 0x02, (uint8_t)(a_packet_id >> 8), (uint8_t)a_packet_id};
+    return broker_send(a_client_ptr, ack, sizeof(ack), false);
+}
+
+static void broker_close(loopback_broker_t * a_broker_ptr, loopback_broker_client_t * a_client_ptr, bool a_error)
+{
+    if (a_error)
+        a_broker_ptr->stats.protocol_errors++;
+
+    close(a_client_ptr->fd);
+    memset(a_client_ptr->filters, 0, sizeof(a_client_ptr->filters));
+    a_client_ptr->fd        = -1;
+    a_client_ptr->connected = false;
+    a_client_ptr->fill      = 0;
+}
+
+/****************************************************************************************
+ * Topic filters                                                                        *
+ ****************************************************************************************/
+bool loopback_broker_match(const char * a_filter_ptr,
+                           const char * a_topic_ptr,
+                           uint16_t     a_topic_length)
+{
+    uint16_t pos = 0;
+
+    /* Wildcards do not match topics starting with $ */
+    if ((0 < a_topic_length) &&
+        ('$' == a_topic_ptr[0]) &&
+        (('+' == a_filter_ptr[0]) || ('#' == a_filter_ptr[0])))
+        return false;
+
+    while ('\0' != *a_filter_ptr) {
+        if ('#' == *a_filter_ptr)
+            return true;
+
+        if ('+' == *a_filter_ptr) {
+            while ((pos < a_topic_length) && ('/' != a_topic_ptr[pos]))
+                pos++;
+            a_filter_ptr++;
+        } else {
+            if ((pos >= a_topic_length) || (*a_filter_ptr != a_topic_ptr[pos])) {
+                /* "a/#" matches also "a" */
+                return ((pos == a_topic_length) &&
+                        (0 == strcmp(a_filter_ptr, "/#")));
+            }
+            a_filter_ptr++;
+            pos++;
+        }
+    }
+    return (pos == a_topic_length);
+}
+
+/* Highest QoS of the filters of the client matching the topic, -1 = no match */
+static int broker_subscribed_qos(loopback_broker_client_t * a_client_ptr,
+                                 const char               * a_topic_ptr,
+                                 uint16_t                   a_topic_length)
+{
+    int qos = -1;
+
+    for (uint32_t i = 0; i < LOOPBACK_BROKER_MAX_FILTERS; i++) {
+        loopback_broker_filter_t * filter = &(a_client_ptr->filters[i]);
+        if ((filter->used) &&
+            ((int)filter->qos > qos) &&
+            (loopback_broker_match(filter->filter, a_topic_ptr, a_topic_length)))
+            qos = filter->qos;
+    }
+    return qos;
+}
+
+/* Add or replace filter, returns SUBACK return code */
+static uint8_t broker_subscribe_filter(loopback_broker_client_t * a_client_ptr,
+                                       const uint8_t            * a_filter_ptr,
+                                       uint16_t                   a_filter_length,
+                                       uint8_t                    a_qos)
+{
+    loopback_broker_filter_t * free_ptr = NULL;
+
+    if ((0 == a_filter_length) ||
+        (LOOPBACK_BROKER_MAX_FILTER_LENGTH <= a_filter_length) ||
+        (2 < a_qos))
+        return BROKER_SUBACK_FAILURE;
+
+    for (uint32_t i = 0; i < LOOPBACK_BROKER_MAX_FILTERS; i++) {
+        loopback_broker_filter_t * filter = &(a_client_ptr->filters[i]);
+        if ((filter->used) &&
+            (a_filter_length == strlen(filter->filter)) &&
+            (0 == memcmp(filter->filter, a_filter_ptr, a_filter_length))) {
+            filter->qos = a_qos;
+            return a_qos;
+        }
+        if ((false == filter->used) && (NULL == free_ptr))
+            free_ptr = filter;
+    }
+
+    if (NULL == free_ptr)
+        return BROKER_SUBACK_FAILURE;
+
+    memcpy(free_ptr->filter, a_filter_ptr, a_filter_length);
+    free_ptr->filter[a_filter_length] = '\0';
+    free_ptr->qos                     = a_qos;
+    free_ptr->used                    = true;
+    return a_qos;
+}
+
+static void broker_unsubscribe_filter(loopback_broker_client_t * a_client_ptr,
+                                      const uint8_t            * a_filter_ptr,
+                                      uint16_t                   a_filter_length)
+{
+    for (uint32_t i = 0; i < LOOPBACK_BROKER_MAX_FILTERS; i++) {
+        loopback_broker_filter_t * filter = &(a_client_ptr->filters[i]);
+        if ((filter->used) &&
+            (a_filter_length == strlen(filter->filter)) &&
+            (0 == memcmp(filter->filter, a_filter_ptr, a_filter_length)))
+            filter->used = false;
+    }
+}
+
+/****************************************************************************************
+ * Packet handlers                                                                      *
+ ****************************************************************************************/
+static bool broker_subscribe(loopback_broker_t        * a_broker_ptr,
+                             loopback_broker_client_t * a_client_ptr,
+                             uint8_t                  * a_data_ptr,
+                             uint32_t                   a_size,
+                             bool                       a_subscribe)
+{
+    uint8_t  codes[LOOPBACK_BROKER_MAX_FILTERS * 4];
+    uint16_t code_cnt = 0;
+    uint32_t pos      = 2;
+
+    if (2 > a_size)
+        return false;
+
+    uint16_t packet_id = (uint16_t)((a_data_ptr[0] << 8) | a_data_ptr[1]);
+
+    while (pos < a_size) {
+        if ((pos + 2) > a_size)
+            return false;
+
+        uint16_t length = (uint16_t)((a_data_ptr[pos] << 8) | a_data_ptr[pos + 1]);
+        pos += 2;
+        if ((pos + length + (a_subscribe ? 1 : 0)) > a_size)
+            return false;
+
+        if (a_subscribe) {
+            if (code_cnt >= sizeof(codes))
+                return false;
+            codes[code_cnt++] = broker_subscribe_filter(a_client_ptr, &(a_data_ptr[pos]), length, a_data_ptr[pos + length]);
+            pos += length + 1;
+        } else {
+            broker_unsubscribe_filter(a_client_ptr, &(a_data_ptr[pos]), length);
+            pos += length;
+        }
+    }
+
+    if (a_subscribe) {
+        uint8_t header[8];
+        uint8_t size = broker_header(header, BROKER_SUBACK, 2 + code_cnt);
+
+        header[size++] = (uint8_t)(packet_id >> 8);
+        header[size++] = (uint8_t)packet_id;
+        a_broker_ptr->stats.subscribes++;
+        return (broker_send(a_client_ptr, header, size, true) &&
+                broker_send(a_client_ptr, codes, code_cnt, false));
+    }
+
+    a_broker_ptr->stats.unsubscribes++;
+    return broker_send_ack(a_client_ptr, BROKER_UNSUBACK, packet_id);
+}
+
+static bool broker_publish(loopback_broker_t        * a_broker_ptr,
+                           loopback_broker_client_t * a_client_ptr,
+                           uint8_t                    a_flags,
+                           uint8_t                  * a_data_ptr,
+                           uint32_t                   a_size)
+{
+    uint8_t  qos       = (a_flags >> 1) & 0x03;
+    uint16_t packet_id = 0;
+
+    if ((3 == qos) || (2 > a_size))
+        return false;
+
+    uint16_t   topic_length = (uint16_t)((a_data_ptr[0] << 8) | a_data_ptr[1]);
+    uint32_t   header_size  = 2 + topic_length + ((0 < qos) ? 2 : 0);
+    const char * topic_ptr  = (const char *)&(a_data_ptr[2]);
+
+    if ((0 == topic_length) || (header_size > a_size))
+        return false;
+
+    if (0 < qos)
+        packet_id = (uint16_t)((a_data_ptr[2 + topic_length] << 8) | a_data_ptr[3 + topic_length]);
+
+    a_broker_ptr->stats.publishes++;
+
+    /* QoS 2 is delivered at once and released with PUBREL, duplicates are not filtered */
+    if ((1 == qos) && (false == broker_send_ack(a_client_ptr, BROKER_PUBACK, packet_id)))
+        return false;
+    if ((2 == qos) && (false == broker_send_ack(a_client_ptr, BROKER_PUBREC, packet_id)))
+        return false;
+
+    uint8_t  * payload_ptr  = &(a_data_ptr[header_size]);
+    uint32_t   payload_size = a_size - header_size;
+
+    for (uint32_t i = 0; i < LOOPBACK_BROKER_MAX_CLIENTS; i++) {
+        loopback_broker_client_t * client = &(a_broker_ptr->clients[i]);
+
+        if ((-1 == client->fd) || (false == client->connected))
+            continue;
+
+        int sub_qos = broker_subscribed_qos(client, topic_ptr, topic_length);
+        if (0 > sub_qos)
+            continue;
+
+        uint8_t out_qos = ((uint8_t)sub_qos < qos) ? (uint8_t)sub_qos : qos;
+        uint8_t header[16];
+        uint8_t size = broker_header(header,
+                                     BROKER_PUBLISH | (uint8_t)(out_qos << 1),
+                                     2 + topic_length + ((0 < out_qos) ? 2 : 0) + payload_size);
+
+        header[size++] = a_data_ptr[0];
+        header[size++] = a_data_ptr[1];
+
+        bool sent = broker_send(client, header, size, true) &&
+                    broker_send(client, (const uint8_t *)topic_ptr, topic_length, true);
+
+        if (sent && (0 < out_qos)) {
+            if (0 == ++(client->next_packet_id))
+                client->next_packet_id = 1;
+            uint8_t id[] = {(uint8_t)(client->next_packet_id >> 8), (uint8_t)client->next_packet_id};
+            sent = broker_send(client, id, sizeof(id), true);
+        }
+
+        if (sent)
+            sent = broker_send(client, payload_ptr, payload_size, false);
+
+        if (sent)
+            a_broker_ptr->stats.deliveries++;
+        else
+            broker_close(a_broker_ptr, client, true);
+    }
+    return (-1 != a_client_ptr->fd);
+}
+
+/* Handle one complete packet, false closes the connection */
+static bool broker_packet(loopback_broker_t        * a_broker_ptr,
+                          loopback_broker_client_t * a_client_ptr,
+                          uint8_t                    a_first,
+                          uint8_t                  * a_data_ptr,
+                          uint32_t                   a_size)
+{
+    uint8_t type = a_first & 0xF0;
+
+    /* First packet must be CONNECT */
+    if ((false == a_client_ptr->connected) && (BROKER_CONNECT != type))
+        return false;
+
+    switch (type) {
+        case BROKER_CONNECT:
+            {
+                uint8_t connack[] = {BROKER_CONNACK, 0x02, 0x00, 0x00};
+
+                if ((a_client_ptr->connected) ||
+                    (10 > a_size) ||
+                    (0 != memcmp(a_data_ptr, "\x00\x04MQTT", 6)))
+                    return false;
+
+                a_client_ptr->connected = true;
+                a_broker_ptr->stats.connects++;
+                return broker_send(a_client_ptr, connack, sizeof(connack), false);
+            }
+        case BROKER_PUBLISH:
+            return broker_publish(a_broker_ptr, a_client_ptr, a_first, a_data_ptr, a_size);
+        case BROKER_PUBACK:
+        case BROKER_PUBCOMP:
+            return (2 == a_size);
+        case BROKER_PUBREC:
+            return ((2 == a_size) &&
+                    broker_send_ack(a_client_ptr, BROKER_PUBREL, (uint16_t)((a_data_ptr[0] << 8) | a_data_ptr[1])));
+        case (BROKER_PUBREL & 0xF0):
+            return ((BROKER_PUBREL == a_first) &&
+                    (2 == a_size) &&
+                    broker_send_ack(a_client_ptr, BROKER_PUBCOMP, (uint16_t)((a_data_ptr[0] << 8) | a_data_ptr[1])));
+        case (BROKER_SUBSCRIBE & 0xF0):
+            return ((BROKER_SUBSCRIBE == a_first) &&
+                    broker_subscribe(a_broker_ptr, a_client_ptr, a_data_ptr, a_size, true));
+        case (BROKER_UNSUBSCRIBE & 0xF0):
+            return ((BROKER_UNSUBSCRIBE == a_first) &&
+                    broker_subscribe(a_broker_ptr, a_client_ptr, a_data_ptr, a_size, false));
+        case BROKER_PINGREQ:
+            {
+                uint8_t pingresp[] = {BROKER_PINGRESP, 0x00};
+
+                a_broker_ptr->stats.pings++;
+                if (a_broker_ptr->ignore_ping)
+                    return true;
+                return broker_send(a_client_ptr, pingresp, sizeof(pingresp), false);
+            }
+        default:
+            return false;
+    }
+}
+
+/* Read from socket and handle complete packets */
+static void broker_read(loopback_broker_t * a_broker_ptr, loopback_broker_client_t * a_client_ptr)
+{
+    ssize_t bytes_read = recv(a_client_ptr->fd,
+                              &(a_client_ptr->rx_buffer[a_client_ptr->fill]),
+                              sizeof(a_client_ptr->rx_buffer) - a_client_ptr->fill,
+                              0);
+    if (0 >= bytes_read) {
+        broker_close(a_broker_ptr, a_client_ptr, false);
+        return;
+    }
+    a_client_ptr->fill += (uint32_t)bytes_read;
+
+    uint32_t pos = 0;
+    while (pos < a_client_ptr->fill) {
+        uint8_t  * packet    = &(a_client_ptr->rx_buffer[pos]);
+        uint32_t   available = a_client_ptr->fill - pos;
+        uint32_t   remaining = 0;
+        uint32_t   cnt       = 1;
+        bool       complete  = false;
+
+        /* Remaining length */
+        while ((cnt < available) && (5 > cnt)) {
+            remaining |= (uint32_t)(packet[cnt] & 0x7F) << (7 * (cnt - 1));
+            if (0 == (packet[cnt++] & 0x80)) {
+                complete = true;
+                break;
+            }
+        }
+
+        if ((false == complete) && (5 <= cnt)) {
+            broker_close(a_broker_ptr, a_client_ptr, true);
+            return;
+        }
+
+        if ((cnt + remaining) > sizeof(a_client_ptr->rx_buffer)) {
+            broker_close(a_broker_ptr, a_client_ptr, true);
+            return;
+        }
+
+        if ((false == complete) || ((cnt + remaining) > available))
+            break;
+
+        if (BROKER_DISCONNECT == packet[0]) {
+            a_broker_ptr->stats.disconnects++;
+            broker_close(a_broker_ptr, a_client_ptr, false);
+            return;
+        }
+
+        if (false == broker_packet(a_broker_ptr, a_client_ptr, packet[0], &(packet[cnt]), remaining)) {
+            if (-1 != a_client_ptr->fd)
+                broker_close(a_broker_ptr, a_client_ptr, true);
+            return;
+        }
+        pos += cnt + remaining;
+    }
+
+    /* Keep start of the next packet */
+    if (0 < pos) {
+        memmove(a_client_ptr->rx_buffer, &(a_client_ptr->rx_buffer[pos]), a_client_ptr->fill - pos);
+        a_client_ptr->fill -= pos;
+    }
+}
+
+static void broker_accept(loopback_broker_t * a_broker_ptr)
+{
+    int fd = accept(a_broker_ptr->listen_fd, NULL, NULL);
+    if (0 > fd)
+        return;
+
+    for (uint32_t i = 0; i < LOOPBACK_BROKER_MAX_CLIENTS; i++) {
+        loopback_broker_client_t * client = &(a_broker_ptr->clients[i]);
+        if (-1 == client->fd) {
+            int value = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &value, sizeof(value));
+
+            memset(client->filters, 0, sizeof(client->filters));
+            client->fd             = fd;
+            client->connected      = false;
+            client->fill           = 0;
+            client->next_packet_id = 0;
+            return;
+        }
+    }
+
+    /* No room */
+    close(fd);
+}
+
+static void * broker_thread(void * a_arg)
+{
+    loopback_broker_t * broker = (loopback_broker_t *)a_arg;
+    struct pollfd       fds[LOOPBACK_BROKER_MAX_CLIENTS + 1];
+    uint32_t            index[LOOPBACK_BROKER_MAX_CLIENTS + 1];
+
+    while (broker->running) {
+        uint32_t cnt = 0;
+
+        fds[cnt].fd       = broker->listen_fd;
+        fds[cnt++].events = POLLIN;
+        for (uint32_t i = 0; i < LOOPBACK_BROKER_MAX_CLIENTS; i++) {
+            if (-1 != broker->clients[i].fd) {
+                index[cnt]        = i;
+                fds[cnt].fd       = broker->clients[i].fd;
+                fds[cnt++].events = POLLIN;
+            }
+        }
+
+        if (0 >= poll(fds, cnt, BROKER_POLL_IN_MS))
+            continue;
+
+        for (uint32_t i = 1; i < cnt; i++) {
+            loopback_broker_client_t * client = &(broker->clients[index[i]]);
+            /* Client may have been closed while delivering to it */
+            if ((0 != (fds[i].revents & (POLLIN | POLLHUP | POLLERR))) &&
+                (fds[i].fd == client->fd))
+                broker_read(broker, client);
+        }
+
+        if (0 != (fds[0].revents & POLLIN))
+            broker_accept(broker);
+    }
+    return NULL;
+}
+
+/****************************************************************************************
+ * Start and stop                                                                       *
+ ****************************************************************************************/
+bool loopback_broker_start(loopback_broker_t * a_broker_ptr, uint16_t a_port)
+{
+    struct sockaddr_in address;
+    socklen_t          address_size = sizeof(address);
+    int                value        = 1;
+
+    if (NULL == a_broker_ptr)
+        return false;
+
+    memset(&(a_broker_ptr->stats), 0, sizeof(a_broker_ptr->stats));
+    for (uint32_t i = 0; i < LOOPBACK_BROKER_MAX_CLIENTS; i++)
+        a_broker_ptr->clients[i].fd = -1;
+
+    a_broker_ptr->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (0 > a_broker_ptr->listen_fd)
+        return false;
+
+    setsockopt(a_broker_ptr->listen_fd, SOL_SOCKET, SO_REUSEADDR, &value, sizeof(value));
+
+    memset(&address, 0, sizeof(address));
+    address.sin_family      = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port        = htons(a_port);
+
+    if ((0 != bind(a_broker_ptr->listen_fd, (struct sockaddr *)&address, sizeof(address))) ||
+        (0 != listen(a_broker_ptr->listen_fd, LOOPBACK_BROKER_MAX_CLIENTS)) ||
+        (0 != getsockname(a_broker_ptr->listen_fd, (struct sockaddr *)&address, &address_size))) {
+        printf("Loopback broker: port %u not available\n", a_port);
+        close(a_broker_ptr->listen_fd);
+        return false;
+    }
+    a_broker_ptr->port    = ntohs(address.sin_port);
+    a_broker_ptr->running = true;
+
+    if (0 != pthread_create(&(a_broker_ptr->thread), NULL, broker_thread, a_broker_ptr)) {
+        a_broker_ptr->running = false;
+        close(a_broker_ptr->listen_fd);
+        return false;
+    }
+    return true;
+}
+
+void loopback_broker_stop(loopback_broker_t * a_broker_ptr)
+{
+    if ((NULL == a_broker_ptr) ||
+        (false == a_broker_ptr->running))
+        return;
+
+    a_broker_ptr->running = false;
+    pthread_join(a_broker_ptr->thread, NULL);
+
+    for (uint32_t i = 0; i < LOOPBACK_BROKER_MAX_CLIENTS; i++)
+        if (-1 != a_broker_ptr->clients[i].fd)
+            broker_close(a_broker_ptr, &(a_broker_ptr->clients[i]), false);
+    close(a_broker_ptr->listen_fd);
+}
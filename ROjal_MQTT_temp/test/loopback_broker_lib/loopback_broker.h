@@ -0,0 +1,90 @@
+#ifndef LOOPBACK_BROKER_H
+#define LOOPBACK_BROKER_H
+
+#include <stdint.h>  // uint
+#include <stdbool.h> // bool
+#include <pthread.h> // pthread_t
+
+/* mqtt.h packs structures, pthread types need their natural alignment */
+#pragma pack(push)
+#pragma pack()
+
+#define LOOPBACK_BROKER_MAX_CLIENTS       32
+#define LOOPBACK_BROKER_MAX_FILTERS       8
+#define LOOPBACK_BROKER_MAX_FILTER_LENGTH 64
+#define LOOPBACK_BROKER_BUFFER_SIZE       (64*1024 + 512)
+
+/****************************************************************************************
+ * @section loopback broker                                                             *
+ * Minimal MQTT 3.1.1 broker stand-in for tests which must run without network. It      *
+ * listens on 127.0.0.1 in own thread and handles CONNECT, SUBSCRIBE, UNSUBSCRIBE,      *
+ * PUBLISH fan-out with + and # filters, QoS 1 and 2 acks both ways, PINGREQ and        *
+ * DISCONNECT. Sessions, retained messages and will are not supported.                  *
+ ****************************************************************************************/
+typedef struct loopback_broker_filter
+{
+    char     filter[LOOPBACK_BROKER_MAX_FILTER_LENGTH];
+    uint8_t  qos;
+    bool     used;
+} loopback_broker_filter_t;
+
+typedef struct loopback_broker_client
+{
+    int                      fd;                 /* -1 = free slot                           */
+    bool                     connected;          /* CONNECT received                         */
+    uint16_t                 next_packet_id;     /* Packet id of publishes sent to client    */
+    uint32_t                 fill;               /* Bytes collected into rx_buffer           */
+    loopback_broker_filter_t filters[LOOPBACK_BROKER_MAX_FILTERS];
+    uint8_t                  rx_buffer[LOOPBACK_BROKER_BUFFER_SIZE];
+} loopback_broker_client_t;
+
+/* Counters of handled packets, read them after loopback_broker_stop or poll them */
+typedef struct loopback_broker_stats
+{
+    volatile uint32_t connects;
+    volatile uint32_t subscribes;
+    volatile uint32_t unsubscribes;
+    volatile uint32_t publishes;         /* PUBLISH received from clients     */
+    volatile uint32_t deliveries;        /* PUBLISH sent to subscribers       */
+    volatile uint32_t pings;
+    volatile uint32_t disconnects;
+    volatile uint32_t protocol_errors;   /* Connection closed by the broker   */
+} loopback_broker_stats_t;
+
+typedef struct loopback_broker
+{
+    int                      listen_fd;
+    uint16_t                 port;               /* Bound port, valid after start            */
+    pthread_t                thread;
+    volatile bool            running;
+    bool                     ignore_ping;        /* Do not answer PINGREQ, for timeout tests */
+    loopback_broker_stats_t  stats;
+    loopback_broker_client_t clients[LOOPBACK_BROKER_MAX_CLIENTS];
+} loopback_broker_t;
+
+/**
+ * Start broker thread.
+ *
+ * Broker structure is big (receive buffer per client), allocate it statically.
+ *
+ * @param a_broker_ptr [in] broker.
+ * @param a_port [in] TCP port on 127.0.0.1, 0 = any free port, see a_broker_ptr->port.
+ * @return true when broker is listening.
+ */
+bool loopback_broker_start(loopback_broker_t * a_broker_ptr, uint16_t a_port);
+
+/**
+ * Stop broker thread and close all connections.
+ */
+void loopback_broker_stop(loopback_broker_t * a_broker_ptr);
+
+/**
+ * Match topic name against topic filter with + and # wildcards.
+ */
+bool loopback_broker_match(const char * a_filter_ptr,
+                           const char * a_topic_ptr,
+                           uint16_t     a_topic_length);
+
+#pragma pack(pop)
+
+#endif
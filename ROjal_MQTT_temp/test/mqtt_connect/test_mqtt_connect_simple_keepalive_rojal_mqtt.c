@@ -7,6 +7,7 @@
 #include <string.h>
 #include <sys/socket.h>
 
+static MQTT_shared_data_t shared = { .out_fptr = &data_stream_out_fptr_ };
 char buffer[1024*256];
 
 void test_mqtt_connect_simple_keepalive()
@@ -31,10 +32,10 @@ void test_mqtt_connect_simple_keepalive()
     connect_params.connect_flags.last_will_qos  = 0;
     connect_params.connect_flags.permanent_will = false;
 
-    MQTTErrorCodes_t ret = mqtt_connect_(mqtt_raw_buffer,
+    MQTTErrorCodes_t ret = mqtt_connect_(&shared,
+                                        mqtt_raw_buffer,
                                         sizeof(mqtt_raw_buffer),
                                         &data_stream_in_fptr_,
-                                        &data_stream_out_fptr_,
                                         &connect_params,
                                         true);
 
@@ -44,18 +45,18 @@ void test_mqtt_connect_simple_keepalive()
         uint8_t mqtt_raw_buffer[64];
         asleep(1000);
         // MQTT PING REQ
-        TEST_ASSERT_TRUE(mqtt_ping_req(&data_stream_out_fptr_) == Successfull);
+        TEST_ASSERT_TRUE(mqtt_ping_req(&shared) == Successfull);
 
         // Wait PINGRESP from borker
         int rcv = recv(g_socket_desc, mqtt_raw_buffer , sizeof(mqtt_raw_buffer) , 0);
 
         TEST_ASSERT_FALSE_MESSAGE(rcv < 0,  "Receive failed with error");
         TEST_ASSERT_FALSE_MESSAGE(rcv == 0, "No data received");
-        TEST_ASSERT_EQUAL(Successfull, mqtt_parse_ping_ack(mqtt_raw_buffer));
+        TEST_ASSERT_EQUAL(Successfull, mqtt_parse_ping_ack(mqtt_raw_buffer, (uint32_t)rcv));
     }
 
     // MQTT disconnect
-    TEST_ASSERT_TRUE(mqtt_disconnect(&data_stream_out_fptr_) == Successfull);
+    TEST_ASSERT_TRUE(mqtt_disconnect_(&shared) == Successfull);
 
     // Close socket
     close_mqtt_socket_();
@@ -84,10 +85,10 @@ void test_mqtt_connect_simple_keepalive_timeout()
     connect_params.connect_flags.last_will_qos  = 0;
     connect_params.connect_flags.permanent_will = false;
 
-    MQTTErrorCodes_t ret = mqtt_connect_(mqtt_raw_buffer,
+    MQTTErrorCodes_t ret = mqtt_connect_(&shared,
+                                        mqtt_raw_buffer,
                                         sizeof(mqtt_raw_buffer),
                                         &data_stream_in_fptr_,
-                                        &data_stream_out_fptr_,
                                         &connect_params,
                                         true);
 
@@ -98,7 +99,7 @@ void test_mqtt_connect_simple_keepalive_timeout()
         uint8_t mqtt_raw_buffer[64];
         asleep((1+(i*2))*1000);
         // MQTT PING REQ
-        TEST_ASSERT_TRUE(mqtt_ping_req(&data_stream_out_fptr_) == Successfull);
+        TEST_ASSERT_TRUE(mqtt_ping_req(&shared) == Successfull);
 
         // Wait PINGRESP from borker
         int rcv = recv(g_socket_desc, mqtt_raw_buffer , sizeof(mqtt_raw_buffer), 0);
@@ -106,7 +107,7 @@ void test_mqtt_connect_simple_keepalive_timeout()
 
         if (i == 0) {
             TEST_ASSERT_FALSE_MESSAGE(rcv == 0, "No data received");
-            TEST_ASSERT_EQUAL(Successfull, mqtt_parse_ping_ack(mqtt_raw_buffer));
+            TEST_ASSERT_EQUAL(Successfull, mqtt_parse_ping_ack(mqtt_raw_buffer, (uint32_t)rcv));
         } /* else {
             TEST_ASSERT_TRUE_MESSAGE(rcv == 0, "Data received??");
         } */
@@ -7,6 +7,7 @@
 #include <string.h>
 #include <sys/socket.h>
 
+static MQTT_shared_data_t shared = { .out_fptr = &data_stream_out_fptr_ };
 char buffer[1024*256];
 
 void test_mqtt_socket()
@@ -89,10 +90,10 @@ void test_mqtt_connect_simple()
     connect_params.connect_flags.clean_session  = true;
     connect_params.connect_flags.permanent_will = false;
     connect_params.connect_flags.last_will_qos  = 0;
-    MQTTErrorCodes_t ret = mqtt_connect_(mqtt_raw_buffer,
+    MQTTErrorCodes_t ret = mqtt_connect_(&shared,
+                                        mqtt_raw_buffer,
                                         sizeof(mqtt_raw_buffer),
                                         &data_stream_in_fptr_,
-                                        &data_stream_out_fptr_,
                                         &connect_params,
                                         true);
 
@@ -7,6 +7,7 @@
 #include <string.h>
 #include <sys/socket.h>
 
+static MQTT_shared_data_t shared = { .out_fptr = &data_stream_out_fptr_ };
 char buffer[1024*256];
 
 void test_mqtt_connect_simple()
@@ -30,10 +31,10 @@ void test_mqtt_connect_simple()
     connect_params.connect_flags.clean_session  = true;
     connect_params.connect_flags.permanent_will = false;
     connect_params.connect_flags.last_will_qos  = 0;
-    MQTTErrorCodes_t ret = mqtt_connect_(mqtt_raw_buffer,
+    MQTTErrorCodes_t ret = mqtt_connect_(&shared,
+                                        mqtt_raw_buffer,
                                         sizeof(mqtt_raw_buffer),
                                         &data_stream_in_fptr_,
-                                        &data_stream_out_fptr_,
                                         &connect_params,
                                         true);
 
@@ -70,10 +71,10 @@ void test_mqtt_connect_simple_username_and_password()
     connect_params.connect_flags.clean_session  = true;
     connect_params.connect_flags.permanent_will = false;
     connect_params.connect_flags.last_will_qos  = 0;
-    MQTTErrorCodes_t ret = mqtt_connect_(mqtt_raw_buffer,
+    MQTTErrorCodes_t ret = mqtt_connect_(&shared,
+                                        mqtt_raw_buffer,
                                         sizeof(mqtt_raw_buffer),
                                         &data_stream_in_fptr_,
-                                        &data_stream_out_fptr_,
                                         &connect_params,
                                         true);
 
@@ -113,17 +114,17 @@ void test_mqtt_connect_simple_all_details()
     connect_params.connect_flags.clean_session  = true;
     connect_params.connect_flags.permanent_will = false;
     connect_params.connect_flags.last_will_qos  = 0;
-    MQTTErrorCodes_t ret = mqtt_connect_(mqtt_raw_buffer,
+    MQTTErrorCodes_t ret = mqtt_connect_(&shared,
+                                        mqtt_raw_buffer,
                                         sizeof(mqtt_raw_buffer),
                                         &data_stream_in_fptr_,
-                                        &data_stream_out_fptr_,
                                         &connect_params,
                                         true);
 
     TEST_ASSERT_FALSE_MESSAGE(ret != 0, "MQTT Connect failed");
 
     // MQTT disconnect
-    TEST_ASSERT_TRUE(mqtt_disconnect(&data_stream_out_fptr_) == Successfull);
+    TEST_ASSERT_TRUE(mqtt_disconnect_(&shared) == Successfull);
 
     // Close socket
     close_mqtt_socket_();
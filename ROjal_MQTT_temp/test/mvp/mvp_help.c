@@ -10,6 +10,7 @@
 #include <string.h>
 
 static uint8_t            mqtt_send_buffer[1024*10];
+static uint8_t            mqtt_receive_buffer_[1024*10];
 static MQTT_shared_data_t mqtt_shared_data;
 
 static bool g_mqtt_connected  = false;
@@ -20,12 +21,14 @@ bool mvp_keepalive_(uint32_t a_duration_in_ms)
 {
     MQTT_action_data_t ap;
     ap.action_argument.epalsed_time_in_ms = a_duration_in_ms;
-    mqtt(ACTION_KEEPALIVE, &ap);
+    mqtt(&mqtt_shared_data, ACTION_KEEPALIVE, &ap);
     return true;
 }
 
-void mvp_connected_cb_(MQTTErrorCodes_t a_status)
+void mvp_connected_cb_(MQTT_shared_data_t * a_shared_ptr, MQTTErrorCodes_t a_status)
 {
+    a_shared_ptr = a_shared_ptr;
+
     if (Successfull == a_status) {
         printf("Connected CB SUCCESSFULL\n");
     } else {
@@ -34,12 +37,15 @@ void mvp_connected_cb_(MQTTErrorCodes_t a_status)
     g_mqtt_connected = true;
 }
 
-void mvp_subscribe_cb_(MQTTErrorCodes_t   a_status,
-                       uint8_t          * a_data_ptr,
-                       uint32_t           a_data_len,
-                       uint8_t          * a_topic_ptr,
-                       uint16_t           a_topic_len)
+void mvp_subscribe_cb_(MQTT_shared_data_t * a_shared_ptr,
+                       MQTTErrorCodes_t     a_status,
+                       uint8_t            * a_data_ptr,
+                       uint32_t             a_data_len,
+                       uint8_t            * a_topic_ptr,
+                       uint16_t             a_topic_len)
 {
+    a_shared_ptr = a_shared_ptr;
+
     if (Successfull == a_status) {
         printf("Subscribed CB SUCCESSFULL\n");
         for (uint16_t i = 0; i < a_topic_len; i++)
@@ -73,12 +79,14 @@ bool mvp_enable_(uint16_t a_keepalive_timeout, char * clientName)
         mqtt_shared_data.out_fptr          = &socket_write;
         mqtt_shared_data.connected_cb_fptr = &mvp_connected_cb_;
         mqtt_shared_data.subscribe_cb_fptr = &mvp_subscribe_cb_;
+        mqtt_shared_data.framer.buffer      = mqtt_receive_buffer_;
+        mqtt_shared_data.framer.buffer_size = sizeof(mqtt_receive_buffer_);
 
         MQTT_action_data_t action;
-        action.action_argument.shared_ptr  = &mqtt_shared_data;
 
-        MQTTErrorCodes_t state = mqtt(ACTION_INIT,
-                                      &action);
+        MQTTErrorCodes_t state = mqtt(&mqtt_shared_data,
+                                      ACTION_INIT,
+                                      NULL);
 
         TEST_ASSERT_EQUAL_INT(Successfull, state);
         printf("MQTT Initialized\n");
@@ -99,7 +107,8 @@ bool mvp_enable_(uint16_t a_keepalive_timeout, char * clientName)
 
         action.action_argument.connect_ptr = &connect_params;
 
-        state = mqtt(ACTION_CONNECT,
+        state = mqtt(&mqtt_shared_data,
+                     ACTION_CONNECT,
                      &action);
 
         TEST_ASSERT_EQUAL_INT(Successfull, state);
@@ -124,7 +133,8 @@ bool mvp_enable_(uint16_t a_keepalive_timeout, char * clientName)
 
 bool mvp_disable_()
 {
-    MQTTErrorCodes_t state = mqtt(ACTION_DISCONNECT,
+    MQTTErrorCodes_t state = mqtt(&mqtt_shared_data,
+                                  ACTION_DISCONNECT,
                                   NULL);
 
     TEST_ASSERT_EQUAL_INT(Successfull, state);
@@ -145,7 +155,8 @@ void mvp_data_from_socket_(uint8_t * a_data, size_t a_amount)
     MQTT_action_data_t action;
     action.action_argument.input_stream_ptr = &input;
 
-    MQTTErrorCodes_t state = mqtt(ACTION_PARSE_INPUT_STREAM,
+    MQTTErrorCodes_t state = mqtt(&mqtt_shared_data,
+                                  ACTION_PARSE_INPUT_CHUNK,
                                   &action);
 
     TEST_ASSERT_EQUAL_INT(Successfull, state);
@@ -168,7 +179,8 @@ bool mvp_publish_(char * a_topic, char * a_msg)
     MQTT_action_data_t action;
     action.action_argument.publish_ptr = &publish;
 
-    MQTTErrorCodes_t state = mqtt(ACTION_PUBLISH,
+    MQTTErrorCodes_t state = mqtt(&mqtt_shared_data,
+                                  ACTION_PUBLISH,
                                   &action);
 
     TEST_ASSERT_EQUAL_INT(Successfull, state);
@@ -188,7 +200,8 @@ bool mvp_subscribe_(char * a_topic)
     MQTT_action_data_t action;
     action.action_argument.subscribe_ptr = &subscribe;
 
-    MQTTErrorCodes_t state = mqtt(ACTION_SUBSCRIBE,
+    MQTTErrorCodes_t state = mqtt(&mqtt_shared_data,
+                                  ACTION_SUBSCRIBE,
                                   &action);
 
     TEST_ASSERT_EQUAL_INT(Successfull, state);
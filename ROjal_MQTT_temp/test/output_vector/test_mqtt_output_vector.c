@@ -0,0 +1,165 @@
+#include "mqtt.h"
+#include "unity.h"
+
+#include <string.h>
+
+static MQTT_shared_data_t shared;
+static uint8_t            tx_buffer[16];
+
+static uint8_t  g_copy[256];
+static uint32_t g_copy_len   = 0;
+static uint8_t  g_vector[256];
+static uint32_t g_vector_len = 0;
+static uint32_t g_iov_cnt    = 0;
+
+/* CONNACK - connection accepted */
+static uint8_t connack[] = {0x20, 0x02, 0x00, 0x00};
+
+int vector_out_fptr(MQTT_shared_data_t * a_shared_ptr, uint8_t * a_data_ptr, size_t a_amount)
+{
+    a_shared_ptr = a_shared_ptr;
+    memcpy(&(g_copy[g_copy_len]), a_data_ptr, a_amount);
+    g_copy_len += a_amount;
+    return (int)a_amount;
+}
+
+int vector_outv_fptr(MQTT_shared_data_t * a_shared_ptr, MQTT_iovec_t * a_iov_ptr, uint32_t a_iov_cnt)
+{
+    int total = 0;
+    a_shared_ptr = a_shared_ptr;
+
+    for (uint32_t i = 0; i < a_iov_cnt; i++) {
+        /* Header chunks are in the transmit buffer, others are referenced */
+        memcpy(&(g_vector[g_vector_len]), a_iov_ptr[i].data, a_iov_ptr[i].size);
+        g_vector_len += a_iov_ptr[i].size;
+        total        += (int)a_iov_ptr[i].size;
+    }
+    g_iov_cnt = a_iov_cnt;
+    return total;
+}
+
+void vector_setup(data_stream_outv_fptr_t a_outv_fptr)
+{
+    memset(&shared, 0, sizeof(shared));
+    shared.buffer      = tx_buffer;
+    shared.buffer_size = sizeof(tx_buffer);
+    shared.out_fptr    = &vector_out_fptr;
+
+    TEST_ASSERT_EQUAL_INT(Successfull, mqtt(&shared, ACTION_INIT, NULL));
+    TEST_ASSERT_TRUE(mqtt_output_vector(&shared, a_outv_fptr));
+    TEST_ASSERT_TRUE(mqtt_receive(&shared, connack, sizeof(connack)));
+    TEST_ASSERT_EQUAL_INT(STATE_CONNECTED, shared.state);
+
+    g_copy_len   = 0;
+    g_vector_len = 0;
+    g_iov_cnt    = 0;
+}
+
+static MQTTErrorCodes_t vector_publish(MQTTQoSLevel_t a_qos,
+                                       char         * a_topic_ptr,
+                                       uint8_t      * a_msg_ptr,
+                                       uint32_t       a_msg_size,
+                                       uint8_t      * a_output_ptr,
+                                       uint32_t       a_output_size)
+{
+    MQTT_publish_t publish;
+    memset(&publish, 0, sizeof(publish));
+    publish.flags.qos           = a_qos;
+    publish.topic_ptr           = (uint8_t *)a_topic_ptr;
+    publish.topic_length        = strlen(a_topic_ptr);
+    publish.message_buffer_ptr  = a_msg_ptr;
+    publish.message_buffer_size = a_msg_size;
+    publish.output_buffer_ptr   = a_output_ptr;
+    publish.output_buffer_size  = a_output_size;
+
+    MQTT_action_data_t action;
+    action.action_argument.publish_ptr = &publish;
+    return mqtt(&shared, ACTION_PUBLISH, &action);
+}
+
+/****************************************************************************************
+ * Output vector tests                                                                  *
+ ****************************************************************************************/
+void test_vector_same_as_copy()
+{
+    uint8_t big_buffer[64];
+    uint8_t reference[64];
+
+    /* Reference from copying path, dedicated buffer is big enough */
+    vector_setup(NULL);
+    TEST_ASSERT_EQUAL_INT(Successfull, vector_publish(QoS0, "a/b", (uint8_t *)"hello", 5, big_buffer, sizeof(big_buffer)));
+    TEST_ASSERT_EQUAL_UINT32(12, g_copy_len);
+    memcpy(reference, g_copy, g_copy_len);
+
+    vector_setup(&vector_outv_fptr);
+    TEST_ASSERT_EQUAL_INT(Successfull, vector_publish(QoS0, "a/b", (uint8_t *)"hello", 5, NULL, 0));
+    TEST_ASSERT_EQUAL_UINT32(0, g_copy_len);
+    TEST_ASSERT_EQUAL_UINT32(3, g_iov_cnt);
+    TEST_ASSERT_EQUAL_UINT32(12, g_vector_len);
+    TEST_ASSERT_EQUAL_MEMORY(reference, g_vector, 12);
+}
+
+void test_vector_qos1_identifier()
+{
+    uint8_t big_buffer[64];
+    uint8_t reference[64];
+
+    vector_setup(NULL);
+    TEST_ASSERT_EQUAL_INT(Successfull, vector_publish(QoS1, "a/b", (uint8_t *)"hello", 5, big_buffer, sizeof(big_buffer)));
+    uint32_t reference_len = g_copy_len;
+    memcpy(reference, g_copy, g_copy_len);
+
+    vector_setup(&vector_outv_fptr);
+    TEST_ASSERT_EQUAL_INT(Successfull, vector_publish(QoS1, "a/b", (uint8_t *)"hello", 5, NULL, 0));
+
+    /* Packet identifier is own chunk between topic and payload */
+    TEST_ASSERT_EQUAL_UINT32(4, g_iov_cnt);
+    TEST_ASSERT_EQUAL_UINT32(reference_len, g_vector_len);
+    TEST_ASSERT_EQUAL_MEMORY(reference, g_vector, reference_len);
+}
+
+void test_vector_payload_bigger_than_buffer()
+{
+    uint8_t payload[200];
+    memset(payload, 0xA5, sizeof(payload));
+
+    /* Copying path can not fit the message into the transmit buffer */
+    vector_setup(NULL);
+    TEST_ASSERT_NOT_EQUAL(Successfull, vector_publish(QoS0, "a/b", payload, sizeof(payload), NULL, 0));
+    TEST_ASSERT_EQUAL_UINT32(0, g_copy_len);
+
+    /* Vector path needs only the header: 3 + 2 bytes */
+    vector_setup(&vector_outv_fptr);
+    TEST_ASSERT_EQUAL_INT(Successfull, vector_publish(QoS0, "a/b", payload, sizeof(payload), NULL, 0));
+    TEST_ASSERT_EQUAL_UINT32(3 + 2 + 3 + sizeof(payload), g_vector_len);
+    TEST_ASSERT_EQUAL_HEX8(0x30, g_vector[0]);
+    TEST_ASSERT_EQUAL_HEX8(0xCD, g_vector[1]); /* 205 = 0x4D | continuation */
+    TEST_ASSERT_EQUAL_HEX8(0x01, g_vector[2]);
+    TEST_ASSERT_EQUAL_MEMORY(payload, &(g_vector[8]), sizeof(payload));
+}
+
+void test_vector_header_does_not_fit()
+{
+    uint8_t small_buffer[6];
+
+    /* Fixed header (3) + topic size (2) + packet identifier (2) does not fit */
+    vector_setup(&vector_outv_fptr);
+    uint8_t payload[200] = {0};
+    TEST_ASSERT_NOT_EQUAL(Successfull, vector_publish(QoS1, "a/b", payload, sizeof(payload), small_buffer, sizeof(small_buffer)));
+    TEST_ASSERT_EQUAL_UINT32(0, g_vector_len);
+}
+
+/****************************************************************************************
+ * TEST main                                                                            *
+ ****************************************************************************************/
+int main(void)
+{
+    UnityBegin("Output vector");
+    unsigned int tCntr = 1;
+
+    RUN_TEST(test_vector_same_as_copy,               tCntr++);
+    RUN_TEST(test_vector_qos1_identifier,            tCntr++);
+    RUN_TEST(test_vector_payload_bigger_than_buffer, tCntr++);
+    RUN_TEST(test_vector_header_does_not_fit,        tCntr++);
+    return (UnityEnd());
+}
@@ -0,0 +1,204 @@
+#include "mqtt.h"
+#include "unity.h"
+
+#include <string.h>
+
+/* PUBLISH QoS 1, retain, topic "a/b", packet id 0x1234, payload "hi" */
+static uint8_t publish_qos1[] = {0x33, 0x09, 0x00, 0x03, 'a', '/', 'b', 0x12, 0x34, 'h', 'i'};
+
+/* Every packet type a client receives */
+static uint8_t connack[]  = {0x20, 0x02, 0x00, 0x00};
+static uint8_t puback[]   = {0x40, 0x02, 0x00, 0x07};
+static uint8_t pubrel[]   = {0x62, 0x02, 0x00, 0x08};
+static uint8_t suback[]   = {0x90, 0x04, 0x00, 0x09, 0x01, 0x80};
+static uint8_t unsuback[] = {0xB0, 0x02, 0x00, 0x0A};
+static uint8_t pingresp[] = {0xD0, 0x00};
+
+/* Views of a successfully decoded packet stay inside the packet */
+static void assert_inside(uint8_t * a_input_ptr, uint32_t a_input_size, MQTT_packet_view_t * a_view_ptr)
+{
+    uint8_t * end = a_input_ptr + a_view_ptr->packet_size;
+
+    TEST_ASSERT_TRUE(a_view_ptr->packet_size <= a_input_size);
+    TEST_ASSERT_TRUE(a_view_ptr->body.ptr >= a_input_ptr);
+    TEST_ASSERT_TRUE(a_view_ptr->body.ptr + a_view_ptr->body.len == end);
+    TEST_ASSERT_TRUE(a_view_ptr->payload.ptr >= a_view_ptr->body.ptr);
+    TEST_ASSERT_TRUE(a_view_ptr->payload.ptr + a_view_ptr->payload.len == end);
+    if (NULL != a_view_ptr->topic.ptr) {
+        TEST_ASSERT_TRUE(a_view_ptr->topic.ptr + a_view_ptr->topic.len <= a_view_ptr->payload.ptr);
+    }
+}
+
+/****************************************************************************************
+ * Packet view tests                                                                    *
+ ****************************************************************************************/
+void test_view_publish()
+{
+    MQTT_packet_view_t view;
+    uint8_t            qos0[] = {0x30, 0x05, 0x00, 0x01, 't', 'x', 'y'};
+
+    TEST_ASSERT_EQUAL_INT(Successfull, mqtt_packet_view(publish_qos1, sizeof(publish_qos1), &view));
+    TEST_ASSERT_EQUAL_INT(PUBLISH, view.type);
+    TEST_ASSERT_EQUAL_INT(QoS1, view.qos);
+    TEST_ASSERT_TRUE(view.retain);
+    TEST_ASSERT_FALSE(view.dup);
+    TEST_ASSERT_EQUAL_UINT16(0x1234, view.packet_id);
+    TEST_ASSERT_EQUAL_UINT32(sizeof(publish_qos1), view.packet_size);
+    TEST_ASSERT_EQUAL_PTR(&(publish_qos1[4]), view.topic.ptr);
+    TEST_ASSERT_EQUAL_UINT32(3, view.topic.len);
+    TEST_ASSERT_EQUAL_PTR(&(publish_qos1[9]), view.payload.ptr);
+    TEST_ASSERT_EQUAL_UINT32(2, view.payload.len);
+
+    TEST_ASSERT_EQUAL_INT(Successfull, mqtt_packet_view(qos0, sizeof(qos0), &view));
+    TEST_ASSERT_EQUAL_UINT16(0, view.packet_id);
+    TEST_ASSERT_EQUAL_UINT32(1, view.topic.len);
+    TEST_ASSERT_EQUAL_UINT32(2, view.payload.len);
+
+    /* Empty payload, e.g. clearing a retained message */
+    qos0[1] = 0x03;
+    TEST_ASSERT_EQUAL_INT(Successfull, mqtt_packet_view(qos0, 5, &view));
+    TEST_ASSERT_EQUAL_UINT32(0, view.payload.len);
+}
+
+void test_view_publish_malformed()
+{
+    MQTT_packet_view_t view;
+    uint8_t            packet[sizeof(publish_qos1)];
+
+    /* Topic length over the remaining length */
+    memcpy(packet, publish_qos1, sizeof(packet));
+    packet[3] = 0x08;
+    TEST_ASSERT_EQUAL_INT(InvalidArgument, mqtt_packet_view(packet, sizeof(packet), &view));
+
+    /* Packet identifier does not fit */
+    memcpy(packet, publish_qos1, sizeof(packet));
+    packet[1] = 0x06;
+    TEST_ASSERT_EQUAL_INT(InvalidArgument, mqtt_packet_view(packet, sizeof(packet), &view));
+
+    /* Empty topic, QoS 3 and zero packet identifier */
+    memcpy(packet, publish_qos1, sizeof(packet));
+    packet[3] = 0x00;
+    TEST_ASSERT_EQUAL_INT(InvalidArgument, mqtt_packet_view(packet, sizeof(packet), &view));
+    memcpy(packet, publish_qos1, sizeof(packet));
+    packet[0] = 0x36;
+    TEST_ASSERT_EQUAL_INT(InvalidArgument, mqtt_packet_view(packet, sizeof(packet), &view));
+    memcpy(packet, publish_qos1, sizeof(packet));
+    packet[7] = 0x00;
+    packet[8] = 0x00;
+    TEST_ASSERT_EQUAL_INT(InvalidArgument, mqtt_packet_view(packet, sizeof(packet), &view));
+}
+
+void test_view_acks()
+{
+    MQTT_packet_view_t view;
+
+    TEST_ASSERT_EQUAL_INT(Successfull, mqtt_packet_view(connack, sizeof(connack), &view));
+    TEST_ASSERT_EQUAL_INT(CONNACK, view.type);
+    TEST_ASSERT_EQUAL_UINT32(2, view.payload.len);
+
+    TEST_ASSERT_EQUAL_INT(Successfull, mqtt_packet_view(puback, sizeof(puback), &view));
+    TEST_ASSERT_EQUAL_UINT16(7, view.packet_id);
+    TEST_ASSERT_EQUAL_UINT32(0, view.payload.len);
+
+    TEST_ASSERT_EQUAL_INT(Successfull, mqtt_packet_view(pubrel, sizeof(pubrel), &view));
+    TEST_ASSERT_EQUAL_UINT16(8, view.packet_id);
+
+    TEST_ASSERT_EQUAL_INT(Successfull, mqtt_packet_view(suback, sizeof(suback), &view));
+    TEST_ASSERT_EQUAL_UINT16(9, view.packet_id);
+    TEST_ASSERT_EQUAL_UINT32(2, view.payload.len);
+    TEST_ASSERT_EQUAL_HEX8(0x80, view.payload.ptr[1]);
+
+    TEST_ASSERT_EQUAL_INT(Successfull, mqtt_packet_view(unsuback, sizeof(unsuback), &view));
+    TEST_ASSERT_EQUAL_UINT16(10, view.packet_id);
+
+    TEST_ASSERT_EQUAL_INT(Successfull, mqtt_packet_view(pingresp, sizeof(pingresp), &view));
+    TEST_ASSERT_EQUAL_INT(PINGRESP, view.type);
+}
+
+void test_view_acks_malformed()
+{
+    MQTT_packet_view_t view;
+    uint8_t            long_puback[]  = {0x40, 0x03, 0x00, 0x07, 0x00};
+    uint8_t            bad_flags[]    = {0x60, 0x02, 0x00, 0x08};
+    uint8_t            no_codes[]     = {0x90, 0x02, 0x00, 0x09};
+    uint8_t            long_ping[]    = {0xD0, 0x01, 0x00};
+    uint8_t            reserved[]     = {0xF0, 0x00};
+
+    TEST_ASSERT_EQUAL_INT(InvalidArgument, mqtt_packet_view(long_puback, sizeof(long_puback), &view));
+    TEST_ASSERT_EQUAL_INT(InvalidArgument, mqtt_packet_view(bad_flags,   sizeof(bad_flags),   &view));
+    TEST_ASSERT_EQUAL_INT(InvalidArgument, mqtt_packet_view(no_codes,    sizeof(no_codes),    &view));
+    TEST_ASSERT_EQUAL_INT(InvalidArgument, mqtt_packet_view(long_ping,   sizeof(long_ping),   &view));
+    TEST_ASSERT_EQUAL_INT(InvalidArgument, mqtt_packet_view(reserved,    sizeof(reserved),    &view));
+}
+
+void test_view_incomplete()
+{
+    MQTT_packet_view_t view;
+    uint8_t            long_length[] = {0x30, 0x80, 0x80, 0x80, 0x80, 0x01};
+    uint8_t            two[sizeof(connack) + sizeof(pingresp)];
+
+    /* Every prefix of a packet needs more bytes */
+    for (uint32_t i = 0; i < sizeof(publish_qos1); i++)
+        TEST_ASSERT_EQUAL_INT(PacketIncomplete, mqtt_packet_view(publish_qos1, i, &view));
+
+    /* Remaining length over four bytes */
+    TEST_ASSERT_EQUAL_INT(InvalidArgument, mqtt_packet_view(long_length, sizeof(long_length), &view));
+
+    /* Input may continue with the next packet */
+    memcpy(two, connack, sizeof(connack));
+    memcpy(&(two[sizeof(connack)]), pingresp, sizeof(pingresp));
+    TEST_ASSERT_EQUAL_INT(Successfull, mqtt_packet_view(two, sizeof(two), &view));
+    TEST_ASSERT_EQUAL_UINT32(sizeof(connack), view.packet_size);
+
+    TEST_ASSERT_EQUAL_INT(InvalidArgument, mqtt_packet_view(NULL, 4, &view));
+    TEST_ASSERT_EQUAL_INT(InvalidArgument, mqtt_packet_view(connack, sizeof(connack), NULL));
+}
+
+void test_view_mutated()
+{
+    uint8_t * seeds[]      = {publish_qos1, connack, puback, pubrel, suback, unsuback, pingresp};
+    uint32_t  seed_sizes[] = {sizeof(publish_qos1), sizeof(connack), sizeof(puback), sizeof(pubrel),
+                              sizeof(suback), sizeof(unsuback), sizeof(pingresp)};
+    uint32_t  random       = 0x2545F491;
+    uint32_t  valid        = 0;
+
+    /* Random byte flips and truncations never give views outside of the input */
+    for (uint32_t i = 0; i < 200000; i++) {
+        uint8_t            packet[16];
+        MQTT_packet_view_t view;
+        uint32_t           seed = i % (sizeof(seeds) / sizeof(seeds[0]));
+        uint32_t           size = seed_sizes[seed];
+
+        memcpy(packet, seeds[seed], size);
+        for (uint32_t flips = 0; flips < 2; flips++) {
+            random ^= random << 13;
+            random ^= random >> 17;
+            random ^= random << 5;
+            packet[random % size] ^= (uint8_t)(random >> 8);
+        }
+        size -= (random >> 24) % 2;
+
+        if (Successfull == mqtt_packet_view(packet, size, &view)) {
+            assert_inside(packet, size, &view);
+            valid++;
+        }
+    }
+    TEST_ASSERT_TRUE(0 < valid);
+}
+
+/****************************************************************************************
+ * TEST main                                                                            *
+ ****************************************************************************************/
+int main(void)
+{
+    UnityBegin("Packet view");
+    unsigned int tCntr = 1;
+
+    RUN_TEST(test_view_publish,           tCntr++);
+    RUN_TEST(test_view_publish_malformed, tCntr++);
+    RUN_TEST(test_view_acks,              tCntr++);
+    RUN_TEST(test_view_acks_malformed,    tCntr++);
+    RUN_TEST(test_view_incomplete,        tCntr++);
+    RUN_TEST(test_view_mutated,           tCntr++);
+    return (UnityEnd());
+}
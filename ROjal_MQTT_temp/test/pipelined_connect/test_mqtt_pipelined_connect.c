@@ -0,0 +1,194 @@
+#include "mqtt.h"
+#include "unity.h"
+#include "client_fixture.h"
+
+#include <string.h>
+
+static MQTT_shared_data_t shared;
+static uint8_t            tx_buffer[64];
+
+static uint32_t         g_connected_cntr = 0;
+static uint32_t         g_suback_cntr    = 0;
+static uint32_t         g_received_cntr  = 0;
+static MQTTErrorCodes_t g_suback_status;
+
+void pipelined_connected_cb(MQTT_shared_data_t * a_shared_ptr, MQTTErrorCodes_t a_status)
+{
+    a_shared_ptr = a_shared_ptr;
+    TEST_ASSERT_EQUAL_INT(Successfull, a_status);
+    g_connected_cntr++;
+}
+
+void pipelined_subscribe_cb(MQTT_shared_data_t * a_shared_ptr,
+                            MQTTErrorCodes_t     a_status,
+                            uint8_t            * a_data_ptr,
+                            uint32_t             a_data_len,
+                            uint8_t            * a_topic_ptr,
+                            uint16_t             a_topic_len)
+{
+    a_shared_ptr = a_shared_ptr;
+    if (NULL == a_topic_ptr) {
+        g_suback_status = a_status;
+        g_suback_cntr++;
+    } else {
+        TEST_ASSERT_EQUAL_UINT16(5, a_topic_len);
+        TEST_ASSERT_EQUAL_MEMORY("state", a_topic_ptr, 5);
+        TEST_ASSERT_EQUAL_UINT32(6, a_data_len);
+        TEST_ASSERT_EQUAL_MEMORY("online", a_data_ptr, 6);
+        g_received_cntr++;
+    }
+}
+
+static bool pipelined_connect(uint8_t               * a_buffer_ptr,
+                              size_t                  a_buffer_size,
+                              MQTT_subscribe_list_t * a_subscribe_ptr,
+                              MQTT_publish_t        * a_birth_ptr)
+{
+    memset(&shared, 0, sizeof(shared));
+    fixture_clear();
+    g_connected_cntr = 0;
+    g_suback_cntr    = 0;
+    g_received_cntr  = 0;
+
+    return mqtt_connect_pipelined(&shared,
+                                  "pipe",
+                                  10,
+                                  (uint8_t*)"",
+                                  (uint8_t*)"",
+                                  (uint8_t*)"",
+                                  (uint8_t*)"",
+                                  a_buffer_ptr,
+                                  a_buffer_size,
+                                  true,
+                                  &fixture_out_fptr,
+                                  &pipelined_connected_cb,
+                                  &pipelined_subscribe_cb,
+                                  a_subscribe_ptr,
+                                  a_birth_ptr,
+                                  0);
+}
+
+static void birth(MQTT_publish_t * a_publish_ptr)
+{
+    memset(a_publish_ptr, 0, sizeof(MQTT_publish_t));
+    a_publish_ptr->flags.qos           = QoS0;
+    a_publish_ptr->flags.retain        = true;
+    a_publish_ptr->topic_ptr           = (uint8_t*)"state";
+    a_publish_ptr->topic_length        = 5;
+    a_publish_ptr->message_buffer_ptr  = (uint8_t*)"online";
+    a_publish_ptr->message_buffer_size = 6;
+}
+
+/****************************************************************************************
+ * Pipelined connect tests                                                              *
+ ****************************************************************************************/
+void test_pipelined_one_write()
+{
+    MQTT_subscribe_t      topics[2] = {{QoS1, (uint8_t*)"state", 5}, {QoS0, (uint8_t*)"c", 1}};
+    uint8_t               codes[2]  = {0xFF, 0xFF};
+    MQTT_subscribe_list_t list      = {topics, 2, codes};
+    MQTT_publish_t        publish;
+
+    birth(&publish);
+    TEST_ASSERT_TRUE(pipelined_connect(tx_buffer, sizeof(tx_buffer), &list, &publish));
+
+    /* CONNECT, SUBSCRIBE and PUBLISH in one write */
+    uint8_t subscribe[] = {0x82, 0x0E, 0x00, 0x01, 0x00, 0x05, 's', 't', 'a', 't', 'e', 0x01, 0x00, 0x01, 'c', 0x00};
+    uint8_t birth_msg[] = {0x31, 0x0D, 0x00, 0x05, 's', 't', 'a', 't', 'e', 'o', 'n', 'l', 'i', 'n', 'e'};
+
+    TEST_ASSERT_EQUAL_UINT32(1, g_write_cntr);
+    TEST_ASSERT_EQUAL_UINT32(18 + sizeof(subscribe) + sizeof(birth_msg), g_out_len);
+    TEST_ASSERT_EQUAL_HEX8(0x10, g_out[0]);
+    TEST_ASSERT_EQUAL_HEX8(16,   g_out[1]);
+    subscribe[2] = g_out[18 + 2]; /* Packet id is not fixed */
+    subscribe[3] = g_out[18 + 3];
+    TEST_ASSERT_EQUAL_MEMORY(subscribe, &(g_out[18]), sizeof(subscribe));
+    TEST_ASSERT_EQUAL_MEMORY(birth_msg, &(g_out[18 + sizeof(subscribe)]), sizeof(birth_msg));
+
+    /* Transmit buffer is restored */
+    TEST_ASSERT_EQUAL_PTR(tx_buffer, shared.buffer);
+    TEST_ASSERT_EQUAL_UINT32(sizeof(tx_buffer), shared.buffer_size);
+    TEST_ASSERT_NULL(shared.gather.buffer);
+
+    /* Broker answers all in one round trip, retained birth message comes back */
+    uint8_t answer[] = {0x20, 0x02, 0x00, 0x00,
+                        0x90, 0x04, subscribe[2], subscribe[3], 0x01, 0x00,
+                        0x31, 0x0D, 0x00, 0x05, 's', 't', 'a', 't', 'e', 'o', 'n', 'l', 'i', 'n', 'e'};
+    TEST_ASSERT_TRUE(mqtt_receive(&shared, answer, sizeof(answer)));
+    TEST_ASSERT_EQUAL_INT(STATE_CONNECTED, shared.state);
+    TEST_ASSERT_EQUAL_UINT32(1, g_connected_cntr);
+    TEST_ASSERT_EQUAL_UINT32(1, g_suback_cntr);
+    TEST_ASSERT_EQUAL_INT(Successfull, g_suback_status);
+    TEST_ASSERT_EQUAL_HEX8(0x01, codes[0]);
+    TEST_ASSERT_EQUAL_HEX8(0x00, codes[1]);
+    TEST_ASSERT_EQUAL_UINT32(1, g_received_cntr);
+
+    /* Output goes directly again */
+    g_write_cntr = 0;
+    TEST_ASSERT_TRUE(mqtt_publish(&shared, "t", 1, "x", 1));
+    TEST_ASSERT_EQUAL_UINT32(1, g_write_cntr);
+}
+
+void test_pipelined_only_birth()
+{
+    MQTT_publish_t publish;
+
+    birth(&publish);
+    TEST_ASSERT_TRUE(pipelined_connect(tx_buffer, sizeof(tx_buffer), NULL, &publish));
+    TEST_ASSERT_EQUAL_UINT32(1, g_write_cntr);
+    TEST_ASSERT_EQUAL_UINT32(18 + 15, g_out_len);
+    TEST_ASSERT_EQUAL_HEX8(0x31, g_out[18]);
+}
+
+void test_pipelined_does_not_fit()
+{
+    MQTT_subscribe_t      topics[1] = {{QoS0, (uint8_t*)"state", 5}};
+    MQTT_subscribe_list_t list      = {topics, 1, NULL};
+    MQTT_publish_t        publish;
+    uint8_t               small[40];
+
+    /* CONNECT and SUBSCRIBE fit, birth message does not - nothing is sent */
+    birth(&publish);
+    TEST_ASSERT_FALSE(pipelined_connect(small, sizeof(small), &list, &publish));
+    TEST_ASSERT_EQUAL_UINT32(0, g_write_cntr);
+    TEST_ASSERT_EQUAL_INT(STATE_DISCONNECTED, shared.state);
+    TEST_ASSERT_EQUAL_UINT16(0, shared.subscribe_pending.packet_id);
+    TEST_ASSERT_EQUAL_PTR(small, shared.buffer);
+    TEST_ASSERT_NULL(shared.gather.buffer);
+
+    /* Without pipelined requests same buffer is enough */
+    TEST_ASSERT_TRUE(pipelined_connect(small, sizeof(small), &list, NULL));
+    TEST_ASSERT_EQUAL_UINT32(1, g_write_cntr);
+    TEST_ASSERT_EQUAL_HEX8(0x82, g_out[18]);
+}
+
+void test_pipelined_refused_while_stream_open()
+{
+    MQTT_action_data_t action;
+
+    /* Open publish stream owns the output, pipelined CONNECT must not be written into it */
+    memset(&shared, 0, sizeof(shared));
+    memset(&action, 0, sizeof(action));
+    fixture_clear();
+    shared.buffer              = tx_buffer;
+    shared.buffer_size         = sizeof(tx_buffer);
+    shared.out_fptr            = &fixture_out_fptr;
+    shared.publish_stream.open = true;
+    TEST_ASSERT_EQUAL_INT(PublishStreamOpen, mqtt(&shared, ACTION_CONNECT_PIPELINED, &action));
+    TEST_ASSERT_EQUAL_UINT32(0, g_write_cntr);
+}
+
+/****************************************************************************************
+ * TEST main                                                                            *
+ ****************************************************************************************/
+int main(void)
+{
+    UnityBegin("Pipelined connect");
+    unsigned int tCntr = 1;
+
+    RUN_TEST(test_pipelined_one_write,    tCntr++);
+    RUN_TEST(test_pipelined_only_birth,   tCntr++);
+    RUN_TEST(test_pipelined_does_not_fit, tCntr++);
+    RUN_TEST(test_pipelined_refused_while_stream_open, tCntr++);
+    return (UnityEnd());
+}
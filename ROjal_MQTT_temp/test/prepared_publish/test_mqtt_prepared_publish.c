@@ -0,0 +1,173 @@
+#include "mqtt.h"
+#include "unity.h"
+#include "client_fixture.h"
+
+#include <string.h>
+
+static MQTT_shared_data_t shared;
+static uint8_t            tx_buffer[512];
+
+static void prepared_setup(bool a_connected, data_stream_outv_fptr_t a_outv_fptr)
+{
+    fixture_setup(&shared, tx_buffer, sizeof(tx_buffer), a_connected);
+    TEST_ASSERT_TRUE(mqtt_output_vector(&shared, a_outv_fptr));
+}
+
+/* Prepared publish must give the same bytes as mqtt_publish */
+static void assert_same_as_publish(MQTT_prepared_publish_t * a_prepared_ptr,
+                                   char                    * a_topic_ptr,
+                                   char                    * a_msg_ptr,
+                                   uint32_t                  a_msg_size)
+{
+    uint8_t  expected[sizeof(g_out)];
+    uint32_t expected_len;
+
+    TEST_ASSERT_TRUE(mqtt_publish(&shared, a_topic_ptr, strlen(a_topic_ptr), a_msg_ptr, a_msg_size));
+    expected_len = g_out_len;
+    memcpy(expected, g_out, expected_len);
+
+    g_out_len = 0;
+    TEST_ASSERT_TRUE(mqtt_publish_prepared(&shared, a_prepared_ptr, a_msg_ptr, a_msg_size, NULL));
+    TEST_ASSERT_EQUAL_UINT32(expected_len, g_out_len);
+    TEST_ASSERT_EQUAL_MEMORY(expected, g_out, expected_len);
+    g_out_len = 0;
+}
+
+/****************************************************************************************
+ * Prepared publish tests                                                               *
+ ****************************************************************************************/
+void test_prepared_publish_copy()
+{
+    MQTT_prepared_publish_t prepared;
+    uint8_t                 buffer[MQTT_PREPARED_SIZE(9)];
+    char                    payload[300];
+
+    memset(payload, 'x', sizeof(payload));
+    prepared_setup(true, NULL);
+
+    TEST_ASSERT_TRUE(mqtt_publish_prepare(&prepared, buffer, sizeof(buffer), "telemetry", 9, QoS0, false));
+
+    /* Remaining length of one and two bytes */
+    assert_same_as_publish(&prepared, "telemetry", "21.5", 4);
+    assert_same_as_publish(&prepared, "telemetry", payload, 116);
+    assert_same_as_publish(&prepared, "telemetry", payload, 117);
+    assert_same_as_publish(&prepared, "telemetry", payload, sizeof(payload));
+    assert_same_as_publish(&prepared, "telemetry", payload, 0);
+
+    /* Does not fit into the transmit buffer */
+    shared.buffer_size = 20;
+    TEST_ASSERT_FALSE(mqtt_publish_prepared(&shared, &prepared, payload, 10, NULL));
+    TEST_ASSERT_EQUAL_UINT32(0, g_out_len);
+}
+
+void test_prepared_publish_vector()
+{
+    MQTT_prepared_publish_t prepared;
+    uint8_t                 buffer[MQTT_PREPARED_SIZE(5)];
+    static char             payload[20000];
+
+    memset(payload, 'y', sizeof(payload));
+    prepared_setup(true, &fixture_outv_fptr);
+
+    TEST_ASSERT_TRUE(mqtt_publish_prepare(&prepared, buffer, sizeof(buffer), "a/b/c", 5, QoS0, true));
+
+    /* Header with topic is one chunk, payload other, three bytes of remaining length */
+    TEST_ASSERT_TRUE(mqtt_publish_prepared(&shared, &prepared, payload, sizeof(payload), NULL));
+    TEST_ASSERT_EQUAL_UINT32(2, g_iov_cnt);
+    TEST_ASSERT_EQUAL_UINT32(1 + 3 + 2 + 5 + sizeof(payload), g_out_len);
+    TEST_ASSERT_EQUAL_HEX8(0x31, g_out[0]);
+    TEST_ASSERT_EQUAL_HEX8(0xA7, g_out[1]);
+    TEST_ASSERT_EQUAL_HEX8(0x9C, g_out[2]);
+    TEST_ASSERT_EQUAL_HEX8(0x01, g_out[3]);
+    TEST_ASSERT_EQUAL_MEMORY("\x00\x05" "a/b/c", &(g_out[4]), 7);
+
+    /* Shorter message after longer one */
+    g_out_len = 0;
+    TEST_ASSERT_TRUE(mqtt_publish_prepared(&shared, &prepared, "1", 1, NULL));
+    uint8_t expected[] = {0x31, 0x08, 0x00, 0x05, 'a', '/', 'b', '/', 'c', '1'};
+    TEST_ASSERT_EQUAL_UINT32(sizeof(expected), g_out_len);
+    TEST_ASSERT_EQUAL_MEMORY(expected, g_out, sizeof(expected));
+}
+
+void test_prepared_publish_qos1()
+{
+    MQTT_prepared_publish_t prepared;
+    MQTT_inflight_window_t  window;
+    MQTT_inflight_entry_t   entries[2];
+    uint8_t                 buffer[MQTT_PREPARED_SIZE(1)];
+    uint16_t                packet_id[3];
+
+    prepared_setup(true, NULL);
+    TEST_ASSERT_TRUE(mqtt_inflight_init(&window, entries, 2, 0, NULL));
+    TEST_ASSERT_TRUE(mqtt_inflight_window(&shared, &window));
+
+    /* Room for packet identifier is needed */
+    TEST_ASSERT_FALSE(mqtt_publish_prepare(&prepared, buffer, sizeof(buffer) - 2, "t", 1, QoS1, false));
+    TEST_ASSERT_TRUE(mqtt_publish_prepare(&prepared, buffer, sizeof(buffer), "t", 1, QoS1, false));
+
+    TEST_ASSERT_TRUE(mqtt_publish_prepared(&shared, &prepared, "a", 1, &(packet_id[0])));
+    uint8_t expected[] = {0x32, 0x06, 0x00, 0x01, 't', (uint8_t)(packet_id[0] >> 8), (uint8_t)packet_id[0], 'a'};
+    TEST_ASSERT_EQUAL_UINT32(sizeof(expected), g_out_len);
+    TEST_ASSERT_EQUAL_MEMORY(expected, g_out, sizeof(expected));
+
+    TEST_ASSERT_TRUE(mqtt_publish_prepared(&shared, &prepared, "b", 1, &(packet_id[1])));
+    TEST_ASSERT_NOT_EQUAL(packet_id[0], packet_id[1]);
+    TEST_ASSERT_FALSE(mqtt_publish_prepared(&shared, &prepared, "c", 1, &(packet_id[2])));
+    TEST_ASSERT_EQUAL_UINT16(0, mqtt_inflight_free(&shared));
+
+    /* Window refers the topic in the prepared buffer */
+    MQTT_inflight_entry_t * entry = &(entries[0]);
+    TEST_ASSERT_EQUAL_UINT16(1, entry->topic_length);
+    TEST_ASSERT_EQUAL_MEMORY("t", entry->topic_ptr, 1);
+
+    uint8_t puback[] = {0x40, 0x02, (uint8_t)(packet_id[0] >> 8), (uint8_t)packet_id[0]};
+    TEST_ASSERT_TRUE(mqtt_receive(&shared, puback, sizeof(puback)));
+    TEST_ASSERT_EQUAL_UINT16(1, mqtt_inflight_free(&shared));
+}
+
+void test_prepared_publish_store()
+{
+    MQTT_prepared_publish_t prepared;
+    MQTT_store_ring_t       ring;
+    uint8_t                 ring_buffer[64];
+    uint8_t                 buffer[MQTT_PREPARED_SIZE(1)];
+
+    TEST_ASSERT_FALSE(mqtt_publish_prepare(&prepared, buffer, sizeof(buffer), "t", 1, QoSInvalid, false));
+    TEST_ASSERT_FALSE(mqtt_publish_prepare(&prepared, buffer, sizeof(buffer), "t", 0, QoS0, false));
+    TEST_ASSERT_TRUE(mqtt_publish_prepare(&prepared, buffer, sizeof(buffer), "t", 1, QoS0, false));
+
+    /* Not connected, no store */
+    prepared_setup(false, NULL);
+    TEST_ASSERT_FALSE(mqtt_publish_prepared(&shared, &prepared, "a", 1, NULL));
+
+    /* Stored while offline, sent when connected */
+    TEST_ASSERT_TRUE(mqtt_store_ring_init(&ring, ring_buffer, sizeof(ring_buffer)));
+    TEST_ASSERT_TRUE(mqtt_outbound_store(&shared, &(ring.store)));
+    TEST_ASSERT_TRUE(mqtt_publish_prepared(&shared, &prepared, "a", 1, NULL));
+    TEST_ASSERT_EQUAL_UINT32(1, ring.store.count);
+    TEST_ASSERT_EQUAL_UINT32(0, g_out_len);
+
+    TEST_ASSERT_TRUE(mqtt_receive(&shared, connack, sizeof(connack)));
+    TEST_ASSERT_EQUAL_UINT32(0, ring.store.count);
+    TEST_ASSERT_TRUE(mqtt_publish_prepared(&shared, &prepared, "b", 1, NULL));
+
+    uint8_t expected[] = {0x30, 0x04, 0x00, 0x01, 't', 'a',
+                          0x30, 0x04, 0x00, 0x01, 't', 'b'};
+    TEST_ASSERT_EQUAL_UINT32(sizeof(expected), g_out_len);
+    TEST_ASSERT_EQUAL_MEMORY(expected, g_out, sizeof(expected));
+}
+
+/****************************************************************************************
+ * TEST main                                                                            *
+ ****************************************************************************************/
+int main(void)
+{
+    UnityBegin("Prepared publish");
+    unsigned int tCntr = 1;
+
+    RUN_TEST(test_prepared_publish_copy,   tCntr++);
+    RUN_TEST(test_prepared_publish_vector, tCntr++);
+    RUN_TEST(test_prepared_publish_qos1,   tCntr++);
+    RUN_TEST(test_prepared_publish_store,  tCntr++);
+    return (UnityEnd());
+}
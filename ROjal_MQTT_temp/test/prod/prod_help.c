@@ -3,7 +3,8 @@
 #include "help.h"
 
 static uint8_t mqtt_send_buffer[1024];
-static MQTT_shared_data_t mqtt_shared_data;
+static uint8_t mqtt_receive_buffer_[1024];
+MQTT_shared_data_t mqtt_shared_data;
 
 #include "socket_read_write.h"
 
@@ -14,27 +15,29 @@ bool enable_(uint16_t a_keepalive_timeout, char * clientName)
 
     if (ret) {
         /* Initialize MQTT */
-        return mqtt_connect(clientName,
-                            a_keepalive_timeout,
-                            (uint8_t*)"\0",
-                            (uint8_t*)"\0",
-                            (uint8_t*)"\0",
-                            (uint8_t*)"\0",
-                            &mqtt_shared_data,
-                            mqtt_send_buffer,
-                            sizeof(mqtt_send_buffer),
-                            false,
-                            &socket_write,
-                            &connected_cb_,
-                            &subscrbe_cb_,
-                            10);
+        ret = mqtt_connect(&mqtt_shared_data,
+                           clientName,
+                           a_keepalive_timeout,
+                           (uint8_t*)"\0",
+                           (uint8_t*)"\0",
+                           (uint8_t*)"\0",
+                           (uint8_t*)"\0",
+                           mqtt_send_buffer,
+                           sizeof(mqtt_send_buffer),
+                           false,
+                           &socket_write,
+                           &connected_cb_,
+                           &subscrbe_cb_,
+                           10);
+        if (ret)
+            ret = mqtt_receive_buffer(&mqtt_shared_data, mqtt_receive_buffer_, sizeof(mqtt_receive_buffer_));
     }
-    return false;
+    return ret;
 }
 
 bool disable_()
 {
-    TEST_ASSERT_TRUE_MESSAGE(mqtt_disconnect(), "MQTT Disconnect failed");
+    TEST_ASSERT_TRUE_MESSAGE(mqtt_disconnect(&mqtt_shared_data), "MQTT Disconnect failed");
     printf("MQTT Disconnected\n");
 
     printf("Close socket\n");
@@ -45,5 +48,5 @@ bool disable_()
 
 void data_from_socket(uint8_t * a_data, size_t a_amount)
 {
-    TEST_ASSERT_TRUE_MESSAGE(mqtt_receive(a_data, a_amount), "Receive failed (socket -> mqtt)");
+    TEST_ASSERT_TRUE_MESSAGE(mqtt_receive(&mqtt_shared_data, a_data, a_amount), "Receive failed (socket -> mqtt)");
 }
\ No newline at end of file
@@ -4,6 +4,8 @@
 #include "mqtt.h"
 #include "unity.h"
 
+extern MQTT_shared_data_t mqtt_shared_data;
+
 bool enable_(uint16_t a_keepalive_timeout, char * clientName);
 bool disable_();
 void data_from_socket(uint8_t * a_data, size_t a_amount);
@@ -2,20 +2,101 @@
 #include "mqtt.h"
 #include "unity.h"
 #include <stdio.h>
+#include <string.h>
 
 #include "help.h"
 #include "prod_help.h"
+#include "socket_read_write.h"
 
 void prod_test_publish()
 {
     TEST_ASSERT_TRUE_MESSAGE(enable_(0, "prod_test_b"), "Connect failed");
 
-    TEST_ASSERT_TRUE_MESSAGE(mqtt_publish("prod/test1", 10, "PROD testing", 12), "Publish failed");
+    TEST_ASSERT_TRUE_MESSAGE(mqtt_publish(&mqtt_shared_data, "prod/test1", 10, "PROD testing", 12), "Publish failed");
     asleep(500);
 
     TEST_ASSERT_TRUE_MESSAGE(disable_(), "Disconnect failed");
 }
 
+void prod_test_publish_vector()
+{
+    static char payload[100 * 1024];
+    memset(payload, 'V', sizeof(payload));
+
+    TEST_ASSERT_TRUE_MESSAGE(enable_(0, "prod_test_v"), "Connect failed");
+
+    /* Payload is much bigger than the 1 kB transmit buffer, only header is copied */
+    TEST_ASSERT_TRUE(mqtt_output_vector(&mqtt_shared_data, &socket_writev));
+    TEST_ASSERT_TRUE_MESSAGE(mqtt_publish(&mqtt_shared_data, "prod/vector", 11, payload, sizeof(payload)), "Publish failed");
+    asleep(500);
+
+    TEST_ASSERT_TRUE(mqtt_output_vector(&mqtt_shared_data, NULL));
+    TEST_ASSERT_TRUE_MESSAGE(disable_(), "Disconnect failed");
+}
+
+void prod_test_publish_stream()
+{
+    char chunk[1000];
+    memset(chunk, 'S', sizeof(chunk));
+
+    TEST_ASSERT_TRUE_MESSAGE(enable_(0, "prod_test_s"), "Connect failed");
+
+    /* 2 MB log bundle through the 1 kB transmit buffer */
+    TEST_ASSERT_TRUE_MESSAGE(mqtt_publish_begin(&mqtt_shared_data, "prod/stream", 11, 2000 * sizeof(chunk)), "Publish begin failed");
+    for (uint32_t i = 0; i < 2000; i++)
+        TEST_ASSERT_TRUE_MESSAGE(mqtt_publish_append(&mqtt_shared_data, chunk, sizeof(chunk)), "Publish append failed");
+    TEST_ASSERT_TRUE_MESSAGE(mqtt_publish_end(&mqtt_shared_data), "Publish end failed");
+    asleep(500);
+
+    TEST_ASSERT_TRUE_MESSAGE(disable_(), "Disconnect failed");
+}
+
+static volatile uint32_t g_published_cntr = 0;
+
+void prod_published_cb(MQTT_shared_data_t * a_shared_ptr, uint16_t a_packet_id, MQTTErrorCodes_t a_status)
+{
+    a_shared_ptr = a_shared_ptr;
+    a_packet_id  = a_packet_id;
+    if (Successfull == a_status)
+        g_published_cntr++;
+}
+
+static void publish_qos_(MQTTQoSLevel_t a_qos, char * a_client_name)
+{
+    MQTT_inflight_entry_t  entries[4];
+    MQTT_inflight_window_t window;
+
+    TEST_ASSERT_TRUE_MESSAGE(enable_(0, a_client_name), "Connect failed");
+    TEST_ASSERT_TRUE(mqtt_inflight_init(&window, entries, 4, 1000, &prod_published_cb));
+    TEST_ASSERT_TRUE(mqtt_inflight_window(&mqtt_shared_data, &window));
+
+    g_published_cntr = 0;
+    for (uint32_t i = 0; i < 10; i++) {
+        uint16_t packet_id = 0;
+        TEST_ASSERT_TRUE_MESSAGE(mqtt_publish_qos(&mqtt_shared_data, "prod/qos", 8, "PROD QoS", 8, a_qos, &packet_id), "Publish failed");
+        TEST_ASSERT_NOT_EQUAL(0, packet_id);
+
+        /* Wait PUBACK or PUBCOMP of the broker */
+        for (uint32_t timeout = 0; (timeout < 100) && (g_published_cntr <= i); timeout++)
+            asleep(10);
+        TEST_ASSERT_EQUAL_UINT32_MESSAGE(i + 1, g_published_cntr, "Acknowledgement not received");
+    }
+    TEST_ASSERT_EQUAL_UINT16(4, mqtt_inflight_free(&mqtt_shared_data));
+
+    TEST_ASSERT_TRUE(mqtt_inflight_window(&mqtt_shared_data, NULL));
+    TEST_ASSERT_TRUE_MESSAGE(disable_(), "Disconnect failed");
+}
+
+void prod_test_publish_qos1()
+{
+    publish_qos_(QoS1, "prod_test_q1");
+}
+
+void prod_test_publish_qos2()
+{
+    publish_qos_(QoS2, "prod_test_q2");
+}
+
 /****************************************************************************************
  * TEST main                                                                            *
  ****************************************************************************************/
@@ -24,5 +105,9 @@ int main(void)
     UnityBegin("Production tests publish");
     unsigned int tCntr = 1;
     RUN_TEST(prod_test_publish,                tCntr++);
+    RUN_TEST(prod_test_publish_vector,         tCntr++);
+    RUN_TEST(prod_test_publish_stream,         tCntr++);
+    RUN_TEST(prod_test_publish_qos1,           tCntr++);
+    RUN_TEST(prod_test_publish_qos2,           tCntr++);
     return (UnityEnd());
 }
@@ -11,18 +11,18 @@ void prod_test_pubsub()
     TEST_ASSERT_TRUE_MESSAGE(enable_(4, "prod_test_d"), "Connect failed");
 
     char sub[] = "prod/test2";
-    TEST_ASSERT_TRUE_MESSAGE(mqtt_subscribe(sub, strlen(sub), 10), "Subscribe failed");
+    TEST_ASSERT_TRUE_MESSAGE(mqtt_subscribe(&mqtt_shared_data, sub, strlen(sub), 10), "Subscribe failed");
     for (int i = 0; i < 35 ; i++) {
         if ( i % 10 == 0) {
             printf("\n");
-            TEST_ASSERT_TRUE_MESSAGE(mqtt_publish("prod/test2", 10, "PROD testing", 12), "Publish failed");
+            TEST_ASSERT_TRUE_MESSAGE(mqtt_publish(&mqtt_shared_data, "prod/test2", 10, "PROD testing", 12), "Publish failed");
             asleep(1000);
         } else {
             asleep(1000);
         }
         printf(".");
         fflush(stdout);
-        TEST_ASSERT_TRUE_MESSAGE(mqtt_keepalive(1000), "keepalive failed")
+        TEST_ASSERT_TRUE_MESSAGE(mqtt_keepalive(&mqtt_shared_data, 1000), "keepalive failed")
     }
     printf("\n");
     TEST_ASSERT_TRUE_MESSAGE(disable_(), "Disconnect failed");
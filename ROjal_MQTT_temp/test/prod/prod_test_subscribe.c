@@ -11,13 +11,30 @@ void prod_test_subscribe()
     TEST_ASSERT_TRUE_MESSAGE(enable_(0, "prod_test_c"), "Connect failed");
 
     char sub[] = "prod/test2";
-    TEST_ASSERT_TRUE_MESSAGE(mqtt_subscribe(sub, strlen(sub), 10), "Subscribe failed");
+    TEST_ASSERT_TRUE_MESSAGE(mqtt_subscribe(&mqtt_shared_data, sub, strlen(sub), 10), "Subscribe failed");
 
-    TEST_ASSERT_TRUE_MESSAGE(mqtt_publish("prod/test2", 10, "PROD testing", 12), "Publish failed");
+    TEST_ASSERT_TRUE_MESSAGE(mqtt_publish(&mqtt_shared_data, "prod/test2", 10, "PROD testing", 12), "Publish failed");
     asleep(500);
     TEST_ASSERT_TRUE_MESSAGE(disable_(), "Disconnect failed");
 }
 
+void prod_test_subscribe_list()
+{
+    TEST_ASSERT_TRUE_MESSAGE(enable_(0, "prod_test_l"), "Connect failed");
+
+    MQTT_subscribe_t topics[] = {{QoS0, (uint8_t *)"prod/list/a", 11},
+                                 {QoS1, (uint8_t *)"prod/list/b", 11},
+                                 {QoS0, (uint8_t *)"prod/list/#", 11}};
+    uint8_t          codes[3] = {MQTT_SUBACK_FAILURE, MQTT_SUBACK_FAILURE, MQTT_SUBACK_FAILURE};
+
+    TEST_ASSERT_TRUE_MESSAGE(mqtt_subscribe_list(&mqtt_shared_data, topics, 3, codes, 10), "Subscribe failed");
+    for (uint8_t i = 0; i < 3; i++)
+        TEST_ASSERT_NOT_EQUAL(MQTT_SUBACK_FAILURE, codes[i]);
+
+    TEST_ASSERT_TRUE_MESSAGE(mqtt_unsubscribe_list(&mqtt_shared_data, topics, 3, 10), "Unsubscribe failed");
+    TEST_ASSERT_TRUE_MESSAGE(disable_(), "Disconnect failed");
+}
+
 /****************************************************************************************
  * TEST main                                                                            *
  ****************************************************************************************/
@@ -26,5 +43,6 @@ int main(void)
     UnityBegin("Production subscribe tests");
     unsigned int tCntr = 1;
     RUN_TEST(prod_test_subscribe,              tCntr++);
+    RUN_TEST(prod_test_subscribe_list,         tCntr++);
     return (UnityEnd());
 }
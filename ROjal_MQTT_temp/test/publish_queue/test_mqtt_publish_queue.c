@@ -0,0 +1,188 @@
+#include "mqtt.h"
+#include "unity.h"
+#include "client_fixture.h"
+
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+
+#define SLOT_CNT      16
+#define SLOT_SIZE     MQTT_PUBLISH_QUEUE_SLOT(1, 8)
+#define PRODUCERS     4
+#define PER_PRODUCER  20000
+
+static MQTT_shared_data_t   shared;
+static uint8_t              tx_buffer[64];
+static MQTT_publish_queue_t queue;
+static MQTT_publish_slot_t  slots[SLOT_CNT];
+static uint8_t              data[SLOT_CNT * SLOT_SIZE];
+
+static bool     g_check       = false;
+static uint32_t g_next[PRODUCERS];
+static uint32_t g_received    = 0;
+
+int queue_out_fptr(MQTT_shared_data_t * a_shared_ptr, uint8_t * a_data_ptr, size_t a_amount)
+{
+    if ((true  == g_write_fails) ||
+        (false == g_check))
+        return fixture_out_fptr(a_shared_ptr, a_data_ptr, a_amount);
+
+    /* Every packet is whole and publishes of one producer come in order */
+    uint32_t seq;
+    TEST_ASSERT_EQUAL_UINT32(13, a_amount);
+    TEST_ASSERT_EQUAL_HEX8(0x30, a_data_ptr[0]);
+    TEST_ASSERT_EQUAL_HEX8(11,   a_data_ptr[1]);
+    TEST_ASSERT_EQUAL_HEX8(1,    a_data_ptr[3]);
+    TEST_ASSERT_TRUE(a_data_ptr[4] < PRODUCERS);
+    memcpy(&seq, &(a_data_ptr[5]), sizeof(seq));
+    TEST_ASSERT_EQUAL_UINT32(g_next[a_data_ptr[4]], seq);
+    g_next[a_data_ptr[4]]++;
+    g_received++;
+    g_write_cntr++;
+    return (int)a_amount;
+}
+
+static void queue_setup(void)
+{
+    fixture_setup(&shared, tx_buffer, sizeof(tx_buffer), true);
+    shared.out_fptr = &queue_out_fptr;
+    TEST_ASSERT_TRUE(mqtt_publish_queue_init(&queue, slots, SLOT_CNT, data, sizeof(data)));
+
+    g_check       = false;
+    g_received    = 0;
+    memset(g_next, 0, sizeof(g_next));
+}
+
+static void * producer(void * a_arg_ptr)
+{
+    uint8_t id = (uint8_t)(uintptr_t)a_arg_ptr;
+    char    topic[1] = {(char)id};
+
+    for (uint32_t seq = 0; seq < PER_PRODUCER; seq++) {
+        uint8_t msg[8];
+        memcpy(msg, &seq, sizeof(seq));
+        memset(&(msg[4]), id, 4);
+
+        /* Full queue refuses, producer retries */
+        while (false == mqtt_publish_enqueue(&queue, topic, 1, msg, sizeof(msg), false))
+            sched_yield();
+    }
+    return NULL;
+}
+
+/****************************************************************************************
+ * Publish queue tests                                                                  *
+ ****************************************************************************************/
+void test_queue_init()
+{
+    TEST_ASSERT_FALSE(mqtt_publish_queue_init(&queue, slots, 3,        data, sizeof(data)));
+    TEST_ASSERT_FALSE(mqtt_publish_queue_init(&queue, slots, 0,        data, sizeof(data)));
+    TEST_ASSERT_FALSE(mqtt_publish_queue_init(&queue, NULL,  SLOT_CNT, data, sizeof(data)));
+    TEST_ASSERT_FALSE(mqtt_publish_queue_init(&queue, slots, SLOT_CNT, data, SLOT_CNT - 1));
+    TEST_ASSERT_TRUE(mqtt_publish_queue_init(&queue, slots, SLOT_CNT, data, sizeof(data)));
+    TEST_ASSERT_EQUAL_UINT32(SLOT_SIZE, queue.slot_size);
+}
+
+void test_queue_atomic_alignment()
+{
+    /* Atomic counters keep natural alignment although mqtt.h packs its structures */
+    TEST_ASSERT_EQUAL_UINT32(__alignof__(uint32_t), __alignof__(MQTT_publish_slot_t));
+    TEST_ASSERT_TRUE(__alignof__(uint32_t) <= __alignof__(MQTT_publish_queue_t));
+}
+
+void test_queue_encode_and_drain()
+{
+    queue_setup();
+
+    TEST_ASSERT_TRUE(mqtt_publish_enqueue(&queue, "t", 1, "x", 1, false));
+    TEST_ASSERT_TRUE(mqtt_publish_enqueue(&queue, "t", 1, "y", 1, true));
+    TEST_ASSERT_EQUAL_UINT32(0, g_write_cntr);
+
+    TEST_ASSERT_EQUAL_UINT32(2, mqtt_publish_queue_drain(&shared, &queue, 0));
+    uint8_t expected[] = {0x30, 0x04, 0x00, 0x01, 't', 'x',
+                          0x31, 0x04, 0x00, 0x01, 't', 'y'};
+    TEST_ASSERT_EQUAL_UINT32(sizeof(expected), g_out_len);
+    TEST_ASSERT_EQUAL_MEMORY(expected, g_out, sizeof(expected));
+
+    /* Empty */
+    TEST_ASSERT_EQUAL_UINT32(0, mqtt_publish_queue_drain(&shared, &queue, 0));
+
+    /* Does not fit a slot */
+    TEST_ASSERT_FALSE(mqtt_publish_enqueue(&queue, "tt", 2, "123456789", 9, false));
+    TEST_ASSERT_TRUE(mqtt_publish_enqueue(&queue, "t", 1, "12345678", 8, false));
+}
+
+void test_queue_full()
+{
+    queue_setup();
+
+    for (uint32_t i = 0; i < SLOT_CNT; i++)
+        TEST_ASSERT_TRUE(mqtt_publish_enqueue(&queue, "t", 1, "x", 1, false));
+    TEST_ASSERT_FALSE(mqtt_publish_enqueue(&queue, "t", 1, "x", 1, false));
+    TEST_ASSERT_EQUAL_UINT32(1, queue.dropped);
+
+    /* Drained slots are used again */
+    TEST_ASSERT_EQUAL_UINT32(2, mqtt_publish_queue_drain(&shared, &queue, 2));
+    TEST_ASSERT_TRUE(mqtt_publish_enqueue(&queue, "t", 1, "x", 1, false));
+    TEST_ASSERT_TRUE(mqtt_publish_enqueue(&queue, "t", 1, "x", 1, false));
+    TEST_ASSERT_FALSE(mqtt_publish_enqueue(&queue, "t", 1, "x", 1, false));
+    TEST_ASSERT_EQUAL_UINT32(SLOT_CNT, mqtt_publish_queue_drain(&shared, &queue, 0));
+}
+
+void test_queue_offline()
+{
+    queue_setup();
+    TEST_ASSERT_TRUE(mqtt_publish_enqueue(&queue, "t", 1, "x", 1, false));
+
+    /* Failed write keeps the publish */
+    g_write_fails = true;
+    TEST_ASSERT_EQUAL_UINT32(0, mqtt_publish_queue_drain(&shared, &queue, 0));
+    g_write_fails = false;
+
+    /* Nothing is sent while disconnected */
+    shared.state = STATE_DISCONNECTED;
+    TEST_ASSERT_EQUAL_UINT32(0, mqtt_publish_queue_drain(&shared, &queue, 0));
+    shared.state = STATE_CONNECTED;
+    TEST_ASSERT_EQUAL_UINT32(1, mqtt_publish_queue_drain(&shared, &queue, 0));
+    TEST_ASSERT_EQUAL_UINT32(6, g_out_len);
+}
+
+void test_queue_concurrent_producers()
+{
+    pthread_t threads[PRODUCERS];
+
+    queue_setup();
+    g_check = true;
+
+    for (uintptr_t i = 0; i < PRODUCERS; i++)
+        TEST_ASSERT_EQUAL_INT(0, pthread_create(&(threads[i]), NULL, &producer, (void *)i));
+
+    /* This thread runs the client */
+    while (g_received < (PRODUCERS * PER_PRODUCER)) {
+        if (0 == mqtt_publish_queue_drain(&shared, &queue, 0))
+            sched_yield();
+    }
+
+    for (uint32_t i = 0; i < PRODUCERS; i++) {
+        TEST_ASSERT_EQUAL_INT(0, pthread_join(threads[i], NULL));
+        TEST_ASSERT_EQUAL_UINT32(PER_PRODUCER, g_next[i]);
+    }
+    TEST_ASSERT_EQUAL_UINT32(0, mqtt_publish_queue_drain(&shared, &queue, 0));
+}
+
+/****************************************************************************************
+ * TEST main                                                                            *
+ ****************************************************************************************/
+int main(void)
+{
+    UnityBegin("Publish queue");
+    unsigned int tCntr = 1;
+
+    RUN_TEST(test_queue_init,                 tCntr++);
+    RUN_TEST(test_queue_atomic_alignment,     tCntr++);
+    RUN_TEST(test_queue_encode_and_drain,     tCntr++);
+    RUN_TEST(test_queue_full,                 tCntr++);
+    RUN_TEST(test_queue_offline,              tCntr++);
+    RUN_TEST(test_queue_concurrent_producers, tCntr++);
+    return (UnityEnd());
+}
@@ -0,0 +1,252 @@
+#include "mqtt.h"
+#include "unity.h"
+
+#include <string.h>
+
+static MQTT_shared_data_t shared;
+static uint8_t            tx_buffer[32];
+
+static uint8_t  g_output[4096];
+static uint32_t g_output_len = 0;
+static uint32_t g_write_cntr = 0;
+
+static MQTT_inflight_entry_t  entries[2];
+static MQTT_inflight_window_t window;
+
+static uint32_t         g_published_cntr = 0;
+static uint16_t         g_published_id   = 0;
+static MQTTErrorCodes_t g_published_status;
+
+/* CONNACK - connection accepted */
+static uint8_t connack[] = {0x20, 0x02, 0x00, 0x00};
+
+int stream_out_fptr(MQTT_shared_data_t * a_shared_ptr, uint8_t * a_data_ptr, size_t a_amount)
+{
+    a_shared_ptr = a_shared_ptr;
+    if ((g_output_len + a_amount) > sizeof(g_output))
+        return -1;
+
+    memcpy(&(g_output[g_output_len]), a_data_ptr, a_amount);
+    g_output_len += a_amount;
+    g_write_cntr++;
+    return (int)a_amount;
+}
+
+void stream_published_cb(MQTT_shared_data_t * a_shared_ptr, uint16_t a_packet_id, MQTTErrorCodes_t a_status)
+{
+    a_shared_ptr = a_shared_ptr;
+    g_published_id     = a_packet_id;
+    g_published_status = a_status;
+    g_published_cntr++;
+}
+
+void stream_setup()
+{
+    memset(&shared, 0, sizeof(shared));
+    shared.buffer      = tx_buffer;
+    shared.buffer_size = sizeof(tx_buffer);
+    shared.out_fptr    = &stream_out_fptr;
+
+    TEST_ASSERT_EQUAL_INT(Successfull, mqtt(&shared, ACTION_INIT, NULL));
+    TEST_ASSERT_TRUE(mqtt_receive(&shared, connack, sizeof(connack)));
+    TEST_ASSERT_EQUAL_INT(STATE_CONNECTED, shared.state);
+
+    g_output_len     = 0;
+    g_write_cntr     = 0;
+    g_published_cntr = 0;
+    g_published_id   = 0;
+}
+
+/****************************************************************************************
+ * Publish stream tests                                                                 *
+ ****************************************************************************************/
+void test_stream_same_as_publish()
+{
+    uint8_t reference[32];
+
+    /* Reference from normal publish */
+    stream_setup();
+    TEST_ASSERT_TRUE(mqtt_publish(&shared, "a/b", 3, "hello", 5));
+    TEST_ASSERT_EQUAL_UINT32(12, g_output_len);
+    memcpy(reference, g_output, g_output_len);
+
+    stream_setup();
+    TEST_ASSERT_TRUE(mqtt_publish_begin(&shared, "a/b", 3, 5));
+    TEST_ASSERT_TRUE(mqtt_publish_append(&shared, "he", 2));
+    TEST_ASSERT_TRUE(mqtt_publish_append(&shared, "", 0));
+    TEST_ASSERT_TRUE(mqtt_publish_append(&shared, "llo", 3));
+    TEST_ASSERT_TRUE(mqtt_publish_end(&shared));
+
+    TEST_ASSERT_EQUAL_UINT32(3, g_write_cntr); /* Header, 2 non-empty chunks */
+    TEST_ASSERT_EQUAL_UINT32(12, g_output_len);
+    TEST_ASSERT_EQUAL_MEMORY(reference, g_output, 12);
+}
+
+void test_stream_bigger_than_buffer()
+{
+    char chunk[100];
+    memset(chunk, 'L', sizeof(chunk));
+
+    /* 3000 bytes through 32 byte transmit buffer */
+    stream_setup();
+    TEST_ASSERT_FALSE(mqtt_publish(&shared, "log", 3, chunk, sizeof(chunk)));
+    TEST_ASSERT_TRUE(mqtt_publish_begin(&shared, "log", 3, 3000));
+    for (uint32_t i = 0; i < 30; i++)
+        TEST_ASSERT_TRUE(mqtt_publish_append(&shared, chunk, sizeof(chunk)));
+    TEST_ASSERT_TRUE(mqtt_publish_end(&shared));
+
+    /* Remaining length 3005 = 0xBD 0x17 */
+    TEST_ASSERT_EQUAL_UINT32(1 + 2 + 2 + 3 + 3000, g_output_len);
+    TEST_ASSERT_EQUAL_HEX8(0x30, g_output[0]);
+    TEST_ASSERT_EQUAL_HEX8(0xBD, g_output[1]);
+    TEST_ASSERT_EQUAL_HEX8(0x17, g_output[2]);
+    TEST_ASSERT_EQUAL_MEMORY("log", &(g_output[5]), 3);
+    TEST_ASSERT_EQUAL_HEX8('L', g_output[g_output_len - 1]);
+}
+
+void test_stream_owns_output()
+{
+    stream_setup();
+    TEST_ASSERT_TRUE(mqtt_publish_begin(&shared, "a", 1, 4));
+    uint32_t header_len = g_output_len;
+
+    /* Nothing may be sent in the middle of the payload */
+    TEST_ASSERT_FALSE(mqtt_publish(&shared, "a", 1, "x", 1));
+    TEST_ASSERT_FALSE(mqtt_publish_begin(&shared, "a", 1, 1));
+    TEST_ASSERT_FALSE(mqtt_disconnect(&shared));
+    TEST_ASSERT_EQUAL_INT(PingNotSend, mqtt(&shared, ACTION_KEEPALIVE, &(MQTT_action_data_t){ .action_argument.epalsed_time_in_ms = 100000 }));
+    TEST_ASSERT_EQUAL_UINT32(header_len, g_output_len);
+
+    /* End before all payload is sent, stream is still usable */
+    TEST_ASSERT_TRUE(mqtt_publish_append(&shared, "ab", 2));
+    TEST_ASSERT_EQUAL_INT(PacketIncomplete, mqtt(&shared, ACTION_PUBLISH_END, NULL));
+
+    /* Chunk over the declared size is refused */
+    TEST_ASSERT_EQUAL_INT(BufferOverflow, mqtt(&shared, ACTION_PUBLISH_APPEND, &(MQTT_action_data_t){ .action_argument.publish_ptr = &(MQTT_publish_t){ .message_buffer_ptr = (uint8_t *)"cde", .message_buffer_size = 3 } }));
+    TEST_ASSERT_TRUE(mqtt_publish_append(&shared, "cd", 2));
+    TEST_ASSERT_TRUE(mqtt_publish_end(&shared));
+
+    TEST_ASSERT_FALSE(mqtt_publish_end(&shared));
+    TEST_ASSERT_TRUE(mqtt_publish(&shared, "a", 1, "x", 1));
+    TEST_ASSERT_TRUE(mqtt_disconnect(&shared));
+}
+
+void test_stream_topic_does_not_fit()
+{
+    char topic[40];
+    memset(topic, 't', sizeof(topic));
+
+    stream_setup();
+    TEST_ASSERT_FALSE(mqtt_publish_begin(&shared, topic, sizeof(topic), 10));
+    TEST_ASSERT_FALSE(shared.publish_stream.open);
+    TEST_ASSERT_EQUAL_UINT32(0, g_output_len);
+
+    /* Declared size over the remaining length limit */
+    TEST_ASSERT_FALSE(mqtt_publish_begin(&shared, "a", 1, MQTT_MAX_MESSAGE_SIZE));
+    TEST_ASSERT_FALSE(shared.publish_stream.open);
+}
+
+void test_stream_qos1_acknowledged()
+{
+    uint16_t packet_id = 0;
+
+    stream_setup();
+    TEST_ASSERT_TRUE(mqtt_inflight_init(&window, entries, 2, 0, &stream_published_cb));
+    TEST_ASSERT_TRUE(mqtt_inflight_window(&shared, &window));
+
+    TEST_ASSERT_TRUE(mqtt_publish_begin_qos(&shared, "a/b", 3, 5, QoS1, &packet_id));
+    TEST_ASSERT_NOT_EQUAL(0, packet_id);
+    TEST_ASSERT_EQUAL_UINT16(1, mqtt_inflight_free(&shared));
+    TEST_ASSERT_TRUE(mqtt_publish_append(&shared, "hel", 3));
+    TEST_ASSERT_TRUE(mqtt_publish_append(&shared, "lo", 2));
+    TEST_ASSERT_TRUE(mqtt_publish_end(&shared));
+
+    /* Header with packet identifier */
+    TEST_ASSERT_EQUAL_UINT32(14, g_output_len);
+    TEST_ASSERT_EQUAL_HEX8(0x32, g_output[0]);
+    TEST_ASSERT_EQUAL_HEX8(12,   g_output[1]);
+    TEST_ASSERT_EQUAL_HEX8((uint8_t)(packet_id >> 8), g_output[7]);
+    TEST_ASSERT_EQUAL_HEX8((uint8_t)packet_id,        g_output[8]);
+    TEST_ASSERT_EQUAL_MEMORY("hello", &(g_output[9]), 5);
+
+    uint8_t puback[] = {0x40, 0x02, (uint8_t)(packet_id >> 8), (uint8_t)packet_id};
+    TEST_ASSERT_TRUE(mqtt_receive(&shared, puback, sizeof(puback)));
+    TEST_ASSERT_EQUAL_UINT32(1, g_published_cntr);
+    TEST_ASSERT_EQUAL_UINT16(packet_id, g_published_id);
+    TEST_ASSERT_EQUAL_INT(Successfull, g_published_status);
+    TEST_ASSERT_EQUAL_UINT16(2, mqtt_inflight_free(&shared));
+}
+
+void test_stream_qos1_not_resent()
+{
+    uint16_t packet_id = 0;
+
+    stream_setup();
+    TEST_ASSERT_TRUE(mqtt_inflight_init(&window, entries, 2, 0, &stream_published_cb));
+    TEST_ASSERT_TRUE(mqtt_inflight_window(&shared, &window));
+
+    TEST_ASSERT_TRUE(mqtt_publish_begin_qos(&shared, "a", 1, 2, QoS1, &packet_id));
+    TEST_ASSERT_TRUE(mqtt_publish_append(&shared, "hi", 2));
+    TEST_ASSERT_TRUE(mqtt_publish_end(&shared));
+
+    /* Payload is not kept, application is told to publish again */
+    TEST_ASSERT_EQUAL_INT(Successfull, mqtt(&shared, ACTION_INIT, NULL));
+    TEST_ASSERT_TRUE(mqtt_receive(&shared, connack, sizeof(connack)));
+    g_output_len = 0;
+    TEST_ASSERT_TRUE(mqtt_inflight_window(&shared, &window));
+
+    TEST_ASSERT_EQUAL_UINT32(0, g_output_len);
+    TEST_ASSERT_EQUAL_UINT32(1, g_published_cntr);
+    TEST_ASSERT_EQUAL_UINT16(packet_id, g_published_id);
+    TEST_ASSERT_EQUAL_INT(PayloadNotKept, g_published_status);
+    TEST_ASSERT_EQUAL_UINT16(2, mqtt_inflight_free(&shared));
+}
+
+void test_stream_acks_held_until_payload_sent()
+{
+    uint8_t qos1_publish[] = {0x32, 0x06, 0x00, 0x01, 't', 0x00, 0x07, 'x'};
+    uint8_t qos2_publish[] = {0x34, 0x06, 0x00, 0x01, 't', 0x00, 0x08, 'y'};
+    uint8_t expected[]     = {0x30, 0x07, 0x00, 0x01, 'a', 'a', 'b', 'c', 'd',
+                              0x40, 0x02, 0x00, 0x07,  /* PUBACK */
+                              0x50, 0x02, 0x00, 0x08}; /* PUBREC */
+
+    stream_setup();
+    TEST_ASSERT_TRUE(mqtt_publish_begin(&shared, "a", 1, 4));
+    TEST_ASSERT_TRUE(mqtt_publish_append(&shared, "ab", 2));
+
+    /* Received publishes are acknowledged only after the payload, not inside it */
+    TEST_ASSERT_TRUE(mqtt_receive(&shared, qos1_publish, sizeof(qos1_publish)));
+    TEST_ASSERT_TRUE(mqtt_receive(&shared, qos2_publish, sizeof(qos2_publish)));
+    TEST_ASSERT_EQUAL_UINT32(7, g_output_len);
+    TEST_ASSERT_EQUAL_UINT8(2, shared.publish_stream.acks_held);
+
+    TEST_ASSERT_TRUE(mqtt_publish_append(&shared, "cd", 2));
+    TEST_ASSERT_EQUAL_UINT32(sizeof(expected), g_output_len);
+    TEST_ASSERT_EQUAL_MEMORY(expected, g_output, sizeof(expected));
+    TEST_ASSERT_EQUAL_UINT8(0, shared.publish_stream.acks_held);
+
+    /* Payload sent, stream not yet ended: acks go directly */
+    uint8_t pubrel[] = {0x62, 0x02, 0x00, 0x08};
+    TEST_ASSERT_TRUE(mqtt_receive(&shared, pubrel, sizeof(pubrel)));
+    TEST_ASSERT_EQUAL_UINT32(sizeof(expected) + 4, g_output_len);
+    TEST_ASSERT_EQUAL_HEX8(0x70, g_output[sizeof(expected)]);
+    TEST_ASSERT_TRUE(mqtt_publish_end(&shared));
+}
+
+/****************************************************************************************
+ * TEST main                                                                            *
+ ****************************************************************************************/
+int main(void)
+{
+    UnityBegin("Publish stream");
+    unsigned int tCntr = 1;
+
+    RUN_TEST(test_stream_same_as_publish,    tCntr++);
+    RUN_TEST(test_stream_bigger_than_buffer, tCntr++);
+    RUN_TEST(test_stream_owns_output,        tCntr++);
+    RUN_TEST(test_stream_topic_does_not_fit, tCntr++);
+    RUN_TEST(test_stream_qos1_acknowledged,  tCntr++);
+    RUN_TEST(test_stream_qos1_not_resent,    tCntr++);
+    RUN_TEST(test_stream_acks_held_until_payload_sent, tCntr++);
+    return (UnityEnd());
+}
@@ -0,0 +1,356 @@
+#include "mqtt.h"
+#include "unity.h"
+#include "client_fixture.h"
+
+#include <string.h>
+
+extern uint32_t mqtt_reconnect_delay(MQTT_reconnect_t * a_reconnect_ptr);
+
+#define BASE_DELAY 100
+#define MAX_DELAY  1000
+
+static MQTT_shared_data_t     shared;
+static MQTT_reconnect_t       reconnect;
+static MQTT_connect_t         connect_params;
+static uint8_t                tx_buffer[64];
+static MQTT_inflight_entry_t  entries[2];
+static MQTT_inflight_window_t window;
+static MQTT_store_ring_t      ring;
+static uint8_t                ring_buffer[128];
+static uint8_t                coalesce_buffer[32];
+static uint8_t                rx_buffer[16];
+
+static bool     g_open_result = true;
+static uint32_t g_open_cntr   = 0;
+static uint32_t g_close_cntr  = 0;
+static uint32_t g_event_cntr[3];
+static uint32_t g_stream_cntr = 0;
+
+void reconnect_stream_topic(MQTT_shared_data_t * a_shared_ptr, uint8_t * a_topic_ptr, uint16_t a_topic_len, uint32_t a_payload_size)
+{
+    a_shared_ptr = a_shared_ptr;
+    TEST_ASSERT_EQUAL_UINT16(1, a_topic_len);
+    TEST_ASSERT_EQUAL_HEX8('x', a_topic_ptr[0]);
+    TEST_ASSERT_EQUAL_UINT32(4, a_payload_size);
+    g_stream_cntr++;
+}
+
+void reconnect_stream_chunk(MQTT_shared_data_t * a_shared_ptr, uint8_t * a_data_ptr, uint32_t a_data_len)
+{
+    a_shared_ptr = a_shared_ptr;
+    a_data_ptr   = a_data_ptr;
+    g_stream_cntr += a_data_len * 10;
+}
+
+void reconnect_stream_complete(MQTT_shared_data_t * a_shared_ptr, MQTTErrorCodes_t a_status)
+{
+    a_shared_ptr = a_shared_ptr;
+    TEST_ASSERT_EQUAL_INT(Successfull, a_status);
+    g_stream_cntr += 1000;
+}
+
+bool reconnect_open(MQTT_shared_data_t * a_shared_ptr)
+{
+    TEST_ASSERT_EQUAL_PTR(&shared, a_shared_ptr);
+    g_open_cntr++;
+    return g_open_result;
+}
+
+void reconnect_close(MQTT_shared_data_t * a_shared_ptr)
+{
+    TEST_ASSERT_EQUAL_PTR(&shared, a_shared_ptr);
+    g_close_cntr++;
+}
+
+void reconnect_event(MQTT_shared_data_t * a_shared_ptr, MQTTReconnectEvent_t a_event)
+{
+    TEST_ASSERT_EQUAL_PTR(&shared, a_shared_ptr);
+    g_event_cntr[a_event]++;
+}
+
+static void reconnect_setup(uint32_t a_seed)
+{
+    fixture_setup(&shared, tx_buffer, sizeof(tx_buffer), false);
+
+    memset(&connect_params, 0, sizeof(connect_params));
+    connect_params.client_id                   = (uint8_t*)"node";
+    connect_params.username                    = (uint8_t*)"";
+    connect_params.password                    = (uint8_t*)"";
+    connect_params.last_will_topic             = (uint8_t*)"";
+    connect_params.last_will_message           = (uint8_t*)"";
+    connect_params.keepalive                   = 10;
+    connect_params.connect_flags.clean_session = true;
+
+    TEST_ASSERT_TRUE(mqtt_reconnect_init(&reconnect,
+                                         &shared,
+                                         &connect_params,
+                                         &reconnect_open,
+                                         &reconnect_close,
+                                         &reconnect_event,
+                                         BASE_DELAY,
+                                         MAX_DELAY,
+                                         a_seed));
+    g_open_result = true;
+    g_open_cntr   = 0;
+    g_close_cntr  = 0;
+    g_stream_cntr = 0;
+    memset(g_event_cntr, 0, sizeof(g_event_cntr));
+}
+
+/****************************************************************************************
+ * Reconnect tests                                                                      *
+ ****************************************************************************************/
+void test_reconnect_init()
+{
+    reconnect_setup(1);
+
+    /* Resumed session */
+    TEST_ASSERT_FALSE(reconnect.connect.connect_flags.clean_session);
+    TEST_ASSERT_EQUAL_INT(RECONNECT_WAIT, reconnect.state);
+
+    /* Client id is needed for resumption, delays must be sane */
+    connect_params.client_id = NULL;
+    TEST_ASSERT_FALSE(mqtt_reconnect_init(&reconnect, &shared, &connect_params, &reconnect_open, &reconnect_close, NULL, 100, 1000, 0));
+    connect_params.client_id = (uint8_t*)"node";
+    TEST_ASSERT_FALSE(mqtt_reconnect_init(&reconnect, &shared, &connect_params, &reconnect_open, &reconnect_close, NULL, 0,   1000, 0));
+    TEST_ASSERT_FALSE(mqtt_reconnect_init(&reconnect, &shared, &connect_params, &reconnect_open, &reconnect_close, NULL, 100, 50,   0));
+    TEST_ASSERT_FALSE(mqtt_reconnect_init(&reconnect, &shared, &connect_params, NULL,            &reconnect_close, NULL, 100, 1000, 0));
+
+    /* Seed is derived when not given */
+    TEST_ASSERT_TRUE(mqtt_reconnect_init(&reconnect, &shared, &connect_params, &reconnect_open, &reconnect_close, NULL, 100, 1000, 0));
+    TEST_ASSERT_NOT_EQUAL(0, reconnect.random);
+}
+
+void test_reconnect_backoff()
+{
+    reconnect_setup(1);
+
+    for (uint32_t attempts = 1; attempts < 40; attempts++) {
+        uint32_t ceiling = (attempts < 5) ? (BASE_DELAY << (attempts - 1)) : MAX_DELAY;
+        uint32_t min     = ceiling;
+        uint32_t max     = 0;
+
+        reconnect.attempts = attempts;
+        for (uint32_t i = 0; i < 200; i++) {
+            uint32_t delay = mqtt_reconnect_delay(&reconnect);
+            TEST_ASSERT_TRUE(delay >= (ceiling - ceiling / 2));
+            TEST_ASSERT_TRUE(delay <= ceiling);
+            min = (delay < min) ? delay : min;
+            max = (delay > max) ? delay : max;
+        }
+
+        /* Delays spread over the range */
+        TEST_ASSERT_TRUE(min < (ceiling - ceiling / 2) + ceiling / 8);
+        TEST_ASSERT_TRUE(max > ceiling - ceiling / 8);
+    }
+
+    /* Clients with different seeds do not retry in synchronization */
+    MQTT_reconnect_t other = reconnect;
+    uint32_t         same  = 0;
+
+    reconnect.random = 1;
+    other.random     = 2;
+    reconnect.attempts = other.attempts = 4;
+    for (uint32_t i = 0; i < 100; i++)
+        same += (mqtt_reconnect_delay(&reconnect) == mqtt_reconnect_delay(&other)) ? 1 : 0;
+    TEST_ASSERT_TRUE(same < 10);
+}
+
+void test_reconnect_resume()
+{
+    MQTT_subscribe_t      topics[1] = {{QoS1, (uint8_t*)"cmd", 3}};
+    MQTT_subscribe_list_t list      = {topics, 1, NULL};
+    uint16_t              packet_id = 0;
+
+    reconnect_setup(1);
+    TEST_ASSERT_TRUE(mqtt_inflight_init(&window, entries, 2, 0, NULL));
+    TEST_ASSERT_TRUE(mqtt_store_ring_init(&ring, ring_buffer, sizeof(ring_buffer)));
+    TEST_ASSERT_TRUE(mqtt_reconnect_session(&reconnect, &list, NULL, &window, &(ring.store), NULL));
+
+    /* First attempt right away: CONNECT without clean session and SUBSCRIBE in one write */
+    TEST_ASSERT_FALSE(mqtt_reconnect_tick(&reconnect, 0));
+    TEST_ASSERT_EQUAL_INT(RECONNECT_CONNECTING, reconnect.state);
+    TEST_ASSERT_EQUAL_UINT32(1, g_open_cntr);
+    TEST_ASSERT_EQUAL_UINT32(1, g_write_cntr);
+    TEST_ASSERT_EQUAL_HEX8(0x10, g_out[0]);
+    TEST_ASSERT_EQUAL_HEX8(0x00, g_out[9] & 0x02);
+    TEST_ASSERT_EQUAL_HEX8(0x82, g_out[18]);
+
+    uint8_t suback[] = {0x90, 0x03, g_out[18 + 2], g_out[18 + 3], 0x01};
+    TEST_ASSERT_TRUE(mqtt_receive(&shared, connack, sizeof(connack)));
+    TEST_ASSERT_TRUE(mqtt_receive(&shared, suback, sizeof(suback)));
+    TEST_ASSERT_TRUE(mqtt_reconnect_tick(&reconnect, 10));
+    TEST_ASSERT_EQUAL_UINT32(1, g_event_cntr[RECONNECT_EVENT_ONLINE]);
+    TEST_ASSERT_EQUAL_PTR(&window, shared.inflight);
+    TEST_ASSERT_EQUAL_PTR(&(ring.store), shared.store);
+
+    /* QoS 1 publish stays unacknowledged */
+    TEST_ASSERT_TRUE(mqtt_publish_qos(&shared, "t", 1, "a", 1, QoS1, &packet_id));
+    TEST_ASSERT_EQUAL_UINT16(1, window.used);
+
+    /* Transport reports loss */
+    mqtt_reconnect_lost(&reconnect);
+    TEST_ASSERT_FALSE(mqtt_reconnect_tick(&reconnect, 10));
+    TEST_ASSERT_EQUAL_UINT32(1, g_close_cntr);
+    TEST_ASSERT_EQUAL_UINT32(1, g_event_cntr[RECONNECT_EVENT_LOST]);
+    TEST_ASSERT_EQUAL_INT(RECONNECT_WAIT, reconnect.state);
+    TEST_ASSERT_TRUE(reconnect.time_left_in_ms >= BASE_DELAY / 2);
+    TEST_ASSERT_TRUE(reconnect.time_left_in_ms <= BASE_DELAY);
+
+    /* Publish while offline goes to the store */
+    g_out_len    = 0;
+    g_write_cntr = 0;
+    TEST_ASSERT_TRUE(mqtt_publish(&shared, "s", 1, "b", 1));
+    TEST_ASSERT_EQUAL_UINT32(0, g_write_cntr);
+    TEST_ASSERT_EQUAL_UINT32(1, ring.store.count);
+
+    /* Nothing before the delay */
+    TEST_ASSERT_FALSE(mqtt_reconnect_tick(&reconnect, BASE_DELAY / 2 - 1));
+    TEST_ASSERT_EQUAL_UINT32(1, g_open_cntr);
+    TEST_ASSERT_FALSE(mqtt_reconnect_tick(&reconnect, BASE_DELAY));
+    TEST_ASSERT_EQUAL_UINT32(2, g_open_cntr);
+    TEST_ASSERT_EQUAL_UINT32(1, g_write_cntr);
+    TEST_ASSERT_EQUAL_HEX8(0x82, g_out[18]);
+
+    /* Subscribe does not reuse identifier of the in-flight publish */
+    uint16_t subscribe_id = (uint16_t)((g_out[18 + 2] << 8) | g_out[18 + 3]);
+    TEST_ASSERT_NOT_EQUAL(packet_id, subscribe_id);
+
+    /* CONNACK sends stored publish, tick resends unacknowledged one with DUP flag */
+    g_out_len = 0;
+    TEST_ASSERT_TRUE(mqtt_receive(&shared, connack, sizeof(connack)));
+    TEST_ASSERT_EQUAL_HEX8(0x30, g_out[0]);
+    TEST_ASSERT_EQUAL_UINT32(0, ring.store.count);
+
+    g_out_len = 0;
+    TEST_ASSERT_TRUE(mqtt_reconnect_tick(&reconnect, 10));
+    TEST_ASSERT_EQUAL_UINT32(2, g_event_cntr[RECONNECT_EVENT_ONLINE]);
+    TEST_ASSERT_EQUAL_HEX8(0x3A, g_out[0]);
+    TEST_ASSERT_EQUAL_UINT32(0, reconnect.attempts);
+
+    uint8_t puback[] = {0x40, 0x02, (uint8_t)(packet_id >> 8), (uint8_t)packet_id};
+    TEST_ASSERT_TRUE(mqtt_receive(&shared, puback, sizeof(puback)));
+    TEST_ASSERT_EQUAL_UINT16(0, window.used);
+}
+
+void test_reconnect_failures()
+{
+    reconnect_setup(7);
+
+    /* Transport does not open, nothing to close */
+    g_open_result = false;
+    TEST_ASSERT_FALSE(mqtt_reconnect_tick(&reconnect, 0));
+    TEST_ASSERT_EQUAL_UINT32(1, g_open_cntr);
+    TEST_ASSERT_EQUAL_UINT32(0, g_close_cntr);
+    TEST_ASSERT_EQUAL_UINT32(1, g_event_cntr[RECONNECT_EVENT_FAILED]);
+    TEST_ASSERT_EQUAL_UINT32(1, reconnect.attempts);
+
+    /* Broker refuses */
+    g_open_result = true;
+    TEST_ASSERT_FALSE(mqtt_reconnect_tick(&reconnect, BASE_DELAY));
+    TEST_ASSERT_EQUAL_INT(RECONNECT_CONNECTING, reconnect.state);
+    uint8_t refused[] = {0x20, 0x02, 0x00, 0x05};
+    TEST_ASSERT_TRUE(mqtt_receive(&shared, refused, sizeof(refused)));
+    TEST_ASSERT_FALSE(mqtt_reconnect_tick(&reconnect, 10));
+    TEST_ASSERT_EQUAL_UINT32(1, g_close_cntr);
+    TEST_ASSERT_EQUAL_UINT32(2, reconnect.attempts);
+    TEST_ASSERT_TRUE(reconnect.time_left_in_ms >= BASE_DELAY);
+    TEST_ASSERT_TRUE(reconnect.time_left_in_ms <= BASE_DELAY * 2);
+
+    /* CONNACK does not come */
+    TEST_ASSERT_FALSE(mqtt_reconnect_tick(&reconnect, BASE_DELAY * 2));
+    TEST_ASSERT_FALSE(mqtt_reconnect_tick(&reconnect, MQTT_RECONNECT_CONNACK_TIMEOUT_MS - 1));
+    TEST_ASSERT_EQUAL_INT(RECONNECT_CONNECTING, reconnect.state);
+    TEST_ASSERT_FALSE(mqtt_reconnect_tick(&reconnect, 1));
+    TEST_ASSERT_EQUAL_UINT32(2, g_close_cntr);
+    TEST_ASSERT_EQUAL_UINT32(3, reconnect.attempts);
+    TEST_ASSERT_EQUAL_UINT32(3, g_event_cntr[RECONNECT_EVENT_FAILED]);
+
+    /* Online, then keepalive can not be sent */
+    TEST_ASSERT_FALSE(mqtt_reconnect_tick(&reconnect, MAX_DELAY));
+    TEST_ASSERT_TRUE(mqtt_receive(&shared, connack, sizeof(connack)));
+    TEST_ASSERT_TRUE(mqtt_reconnect_tick(&reconnect, 10));
+    TEST_ASSERT_TRUE(mqtt_reconnect_tick(&reconnect, 10));
+    g_write_fails = true;
+    TEST_ASSERT_FALSE(mqtt_reconnect_tick(&reconnect, 10000));
+    TEST_ASSERT_EQUAL_UINT32(3, g_close_cntr);
+    TEST_ASSERT_EQUAL_UINT32(1, g_event_cntr[RECONNECT_EVENT_LOST]);
+    TEST_ASSERT_EQUAL_INT(STATE_DISCONNECTED, shared.state);
+}
+
+void test_reconnect_keeps_settings()
+{
+    char    payload[40];
+    uint8_t publish[] = {0x30, 0x07, 0x00, 0x01, 'x', 'a', 'b', 'c', 'd'};
+
+    reconnect_setup(3);
+    memset(payload, 'p', sizeof(payload));
+    TEST_ASSERT_TRUE(mqtt_store_ring_init(&ring, ring_buffer, sizeof(ring_buffer)));
+    TEST_ASSERT_TRUE(mqtt_reconnect_session(&reconnect, NULL, NULL, NULL, &(ring.store), NULL));
+
+    /* Set by the application once, before the first attempt */
+    TEST_ASSERT_TRUE(mqtt_output_vector(&shared, &fixture_outv_fptr));
+    TEST_ASSERT_TRUE(mqtt_output_coalesce(&shared, coalesce_buffer, sizeof(coalesce_buffer), 0, 1000));
+    TEST_ASSERT_TRUE(mqtt_receive_buffer(&shared, rx_buffer, sizeof(rx_buffer)));
+    TEST_ASSERT_TRUE(mqtt_receive_stream(&shared, &reconnect_stream_topic, &reconnect_stream_chunk, &reconnect_stream_complete));
+
+    TEST_ASSERT_FALSE(mqtt_reconnect_tick(&reconnect, 0));
+    TEST_ASSERT_TRUE(mqtt_receive(&shared, connack, sizeof(connack)));
+    TEST_ASSERT_TRUE(mqtt_reconnect_tick(&reconnect, 10));
+    mqtt_reconnect_lost(&reconnect);
+    TEST_ASSERT_FALSE(mqtt_reconnect_tick(&reconnect, 10));
+
+    /* Second attempt, publish before CONNACK goes to the store */
+    g_out_len    = 0;
+    g_write_cntr = 0;
+    TEST_ASSERT_FALSE(mqtt_reconnect_tick(&reconnect, BASE_DELAY));
+    TEST_ASSERT_EQUAL_INT(RECONNECT_CONNECTING, reconnect.state);
+    TEST_ASSERT_EQUAL_UINT32(1, g_write_cntr);
+    TEST_ASSERT_TRUE(mqtt_publish(&shared, "s", 1, "b", 1));
+    TEST_ASSERT_EQUAL_UINT32(1, ring.store.count);
+    TEST_ASSERT_EQUAL_UINT32(1, g_write_cntr);
+
+    TEST_ASSERT_TRUE(mqtt_receive(&shared, connack, sizeof(connack)));
+    TEST_ASSERT_TRUE(mqtt_reconnect_tick(&reconnect, 10));
+    TEST_ASSERT_EQUAL_UINT32(0, ring.store.count);
+
+    TEST_ASSERT_EQUAL_PTR(&fixture_outv_fptr, shared.outv_fptr);
+    TEST_ASSERT_EQUAL_PTR(coalesce_buffer, shared.coalesce.buffer);
+    TEST_ASSERT_EQUAL_PTR(rx_buffer, shared.framer.buffer);
+
+    /* Small publishes are still staged, stored one first */
+    g_out_len = 0;
+    TEST_ASSERT_TRUE(mqtt_publish(&shared, "t", 1, "c", 1));
+    TEST_ASSERT_EQUAL_UINT32(1, g_write_cntr);
+    TEST_ASSERT_TRUE(mqtt_flush(&shared));
+    TEST_ASSERT_EQUAL_UINT32(2, g_write_cntr);
+    TEST_ASSERT_EQUAL_UINT32(12, g_out_len);
+    TEST_ASSERT_EQUAL_HEX8('s', g_out[4]);
+    TEST_ASSERT_EQUAL_HEX8('t', g_out[10]);
+
+    /* Big publish goes out as a vector */
+    TEST_ASSERT_TRUE(mqtt_publish(&shared, "t", 1, payload, sizeof(payload)));
+    TEST_ASSERT_EQUAL_UINT32(3, g_write_cntr);
+    TEST_ASSERT_NOT_EQUAL(0, g_iov_cnt);
+
+    /* Split incoming publish is streamed */
+    TEST_ASSERT_TRUE(mqtt_receive(&shared, publish, 5));
+    TEST_ASSERT_TRUE(mqtt_receive(&shared, &(publish[5]), sizeof(publish) - 5));
+    TEST_ASSERT_EQUAL_UINT32(1 + 40 + 1000, g_stream_cntr);
+}
+
+/****************************************************************************************
+ * TEST main                                                                            *
+ ****************************************************************************************/
+int main(void)
+{
+    UnityBegin("Reconnect");
+    unsigned int tCntr = 1;
+
+    RUN_TEST(test_reconnect_init,     tCntr++);
+    RUN_TEST(test_reconnect_backoff,  tCntr++);
+    RUN_TEST(test_reconnect_resume,   tCntr++);
+    RUN_TEST(test_reconnect_failures, tCntr++);
+    RUN_TEST(test_reconnect_keeps_settings, tCntr++);
+    return (UnityEnd());
+}
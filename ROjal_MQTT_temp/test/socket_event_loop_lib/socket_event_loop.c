@@ -0,0 +1,581 @@
+#include <stdio.h>       // printf
+#include <string.h>      // memcpy, memmove
+#include <errno.h>       // errno
+#include <time.h>        // clock_gettime
+#include <unistd.h>      // close
+#include <sys/socket.h>  // socket, sendmsg
+#include <sys/uio.h>     // iovec
+#include <sys/epoll.h>   // epoll
+#include <netinet/in.h>  // sockaddr_in
+#include <netinet/tcp.h> // TCP_NODELAY
+#include <arpa/inet.h>   // inet_addr
+#include "socket_event_loop.h"
+
+static uint64_t event_loop_now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000) + ((uint64_t)ts.tv_nsec / 1000000);
+}
+
+static bool event_session_watch(MQTT_event_session_t * a_session_ptr, uint32_t a_events)
+{
+    struct epoll_event event;
+    event.events   = a_events;
+    event.data.ptr = a_session_ptr;
+    return (0 == epoll_ctl(a_session_ptr->loop->epoll_fd, EPOLL_CTL_MOD, a_session_ptr->fd, &event));
+}
+
+static void event_session_close(MQTT_event_session_t * a_session_ptr, bool a_notify)
+{
+    if (0 <= a_session_ptr->fd) {
+        epoll_ctl(a_session_ptr->loop->epoll_fd, EPOLL_CTL_DEL, a_session_ptr->fd, NULL);
+        close(a_session_ptr->fd);
+        a_session_ptr->fd = -1;
+    }
+    a_session_ptr->state        = EVENT_SESSION_CLOSED;
+    a_session_ptr->tx_fill      = 0;
+    a_session_ptr->shared.state = STATE_DISCONNECTED;
+
+    if ((true == a_notify) &&
+        (NULL != a_session_ptr->closed_fptr))
+        a_session_ptr->closed_fptr(a_session_ptr);
+}
+
+static void event_session_unlink(MQTT_event_session_t * a_session_ptr)
+{
+    MQTT_event_session_t ** link_ptr = &(a_session_ptr->loop->sessions);
+
+    while (NULL != *link_ptr) {
+        if (*link_ptr == a_session_ptr) {
+            *link_ptr = a_session_ptr->next;
+            a_session_ptr->loop->session_cnt--;
+            break;
+        }
+        link_ptr = &((*link_ptr)->next);
+    }
+    a_session_ptr->next = NULL;
+}
+
+/****************************************************************************************
+ * Session                                                                              *
+ ****************************************************************************************/
+bool event_session_init(MQTT_event_session_t        * a_session_ptr,
+                        uint8_t                     * a_tx_buffer_ptr,
+                        size_t                        a_tx_buffer_size,
+                        uint8_t                     * a_rx_buffer_ptr,
+                        size_t                        a_rx_buffer_size,
+                        uint8_t                     * a_backlog_ptr,
+                        size_t                        a_backlog_size,
+                        MQTT_connect_t              * a_connect_ptr,
+                        connected_fptr_t              a_connected_fptr,
+                        subscrbe_fptr_t               a_subscribe_fptr,
+                        event_session_closed_fptr_t   a_closed_fptr)
+{
+    if ((NULL == a_session_ptr)   ||
+        (NULL == a_tx_buffer_ptr) ||
+        (NULL == a_backlog_ptr)   ||
+        (0    == a_backlog_size)  ||
+        (NULL == a_connect_ptr))
+        return false;
+
+    void * user_ptr = a_session_ptr->shared.user_ptr;
+    memset(a_session_ptr, 0, sizeof(MQTT_event_session_t));
+
+    a_session_ptr->shared.buffer            = a_tx_buffer_ptr;
+    a_session_ptr->shared.buffer_size       = a_tx_buffer_size;
+    a_session_ptr->shared.out_fptr          = &event_session_write;
+    a_session_ptr->shared.connected_cb_fptr = a_connected_fptr;
+    a_session_ptr->shared.subscribe_cb_fptr = a_subscribe_fptr;
+    a_session_ptr->shared.user_ptr          = user_ptr;
+
+    if (Successfull != mqtt(&(a_session_ptr->shared), ACTION_INIT, NULL))
+        return false;
+
+    if (NULL != a_rx_buffer_ptr)
+        mqtt_receive_buffer(&(a_session_ptr->shared), a_rx_buffer_ptr, a_rx_buffer_size);
+
+    a_session_ptr->connect         = *a_connect_ptr;
+    a_session_ptr->fd              = -1;
+    a_session_ptr->state           = EVENT_SESSION_IDLE;
+    a_session_ptr->tx_backlog      = a_backlog_ptr;
+    a_session_ptr->tx_backlog_size = a_backlog_size;
+    a_session_ptr->closed_fptr     = a_closed_fptr;
+    return true;
+}
+
+int event_session_write(MQTT_shared_data_t * a_shared_ptr,
+                        uint8_t            * a_data_ptr,
+                        size_t               a_amount)
+{
+    /* Client context is the first member of the session */
+    MQTT_event_session_t * session = (MQTT_event_session_t *) a_shared_ptr;
+
+    if ((NULL == session) ||
+        (0     > session->fd))
+        return -1;
+
+    /* Nothing goes to the wire unless the rest of the packet fits into the backlog,
+       a partially sent packet would corrupt the stream */
+    if (a_amount > (session->tx_backlog_size - session->tx_fill)) {
+        #ifdef DEBUG
+            printf("Session %i backlog full\n", session->fd);
+        #endif
+        return -1;
+    }
+
+    size_t sent = 0;
+
+    /* Keep order - send directly only when nothing is waiting */
+    if (0 == session->tx_fill) {
+        ssize_t ret = send(session->fd, a_data_ptr, a_amount, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (0 <= ret) {
+            sent = (size_t)ret;
+        } else if ((EAGAIN != errno) &&
+                   (EWOULDBLOCK != errno)) {
+            return -1;
+        }
+    }
+
+    if (sent < a_amount) {
+        size_t rest = a_amount - sent;
+
+        memcpy(&(session->tx_backlog[session->tx_fill]), &(a_data_ptr[sent]), rest);
+        if (0 == session->tx_fill)
+            event_session_watch(session, EPOLLIN | EPOLLOUT);
+        session->tx_fill += rest;
+    }
+    return (int)a_amount;
+}
+
+int event_session_writev(MQTT_shared_data_t * a_shared_ptr,
+                         MQTT_iovec_t       * a_iov_ptr,
+                         uint32_t             a_iov_cnt)
+{
+    MQTT_event_session_t * session = (MQTT_event_session_t *) a_shared_ptr;
+    struct iovec           iov[MQTT_OUTPUT_VECTOR_MAX];
+    size_t                 total = 0;
+
+    if ((NULL == session) ||
+        (0     > session->fd) ||
+        (MQTT_OUTPUT_VECTOR_MAX < a_iov_cnt))
+        return -1;
+
+    for (uint32_t i = 0; i < a_iov_cnt; i++) {
+        iov[i].iov_base = a_iov_ptr[i].data;
+        iov[i].iov_len  = a_iov_ptr[i].size;
+        total += a_iov_ptr[i].size;
+    }
+
+    /* Whole packet fits into the backlog, @see event_session_write */
+    if (total > (session->tx_backlog_size - session->tx_fill)) {
+        #ifdef DEBUG
+            printf("Session %i backlog full\n", session->fd);
+        #endif
+        return -1;
+    }
+
+    size_t sent = 0;
+
+    /* Keep order - send directly only when nothing is waiting */
+    if (0 == session->tx_fill) {
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov    = iov;
+        msg.msg_iovlen = a_iov_cnt;
+
+        ssize_t ret = sendmsg(session->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (0 <= ret) {
+            sent = (size_t)ret;
+        } else if ((EAGAIN != errno) &&
+                   (EWOULDBLOCK != errno)) {
+            return -1;
+        }
+    }
+
+    if (sent < total) {
+        size_t fill = session->tx_fill;
+        for (uint32_t i = 0; i < a_iov_cnt; i++) {
+            if (sent >= iov[i].iov_len) {
+                sent -= iov[i].iov_len;
+                continue;
+            }
+            memcpy(&(session->tx_backlog[fill]), (uint8_t *)iov[i].iov_base + sent, iov[i].iov_len - sent);
+            fill += iov[i].iov_len - sent;
+            sent  = 0;
+        }
+
+        if (0 == session->tx_fill)
+            event_session_watch(session, EPOLLIN | EPOLLOUT);
+        session->tx_fill = fill;
+    }
+    return (int)total;
+}
+
+static bool event_session_flush(MQTT_event_session_t * a_session_ptr)
+{
+    while (0 < a_session_ptr->tx_fill) {
+        ssize_t ret = send(a_session_ptr->fd,
+                           a_session_ptr->tx_backlog,
+                           a_session_ptr->tx_fill,
+                           MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (0 > ret) {
+            if ((EAGAIN == errno) ||
+                (EWOULDBLOCK == errno))
+                return true;
+            return false;
+        }
+
+        a_session_ptr->tx_fill -= (size_t)ret;
+        memmove(a_session_ptr->tx_backlog, &(a_session_ptr->tx_backlog[ret]), a_session_ptr->tx_fill);
+    }
+    return event_session_watch(a_session_ptr, EPOLLIN);
+}
+
+static bool event_session_established(MQTT_event_session_t * a_session_ptr)
+{
+    int       error     = 0;
+    socklen_t error_len = sizeof(error);
+
+    if ((0 != getsockopt(a_session_ptr->fd, SOL_SOCKET, SO_ERROR, &error, &error_len)) ||
+        (0 != error))
+        return false;
+
+    a_session_ptr->state = EVENT_SESSION_OPEN;
+    if (false == event_session_watch(a_session_ptr, EPOLLIN))
+        return false;
+
+    MQTT_action_data_t action;
+    action.action_argument.connect_ptr = &(a_session_ptr->connect);
+
+    if (Successfull != mqtt(&(a_session_ptr->shared), ACTION_INIT, NULL))
+        return false;
+
+    mqtt_output_vector(&(a_session_ptr->shared), &event_session_writev);
+
+    return (Successfull == mqtt(&(a_session_ptr->shared), ACTION_CONNECT, &action));
+}
+
+static bool event_session_read(MQTT_event_session_t * a_session_ptr)
+{
+    MQTT_event_loop_t * loop = a_session_ptr->loop;
+
+    for (;;) {
+        ssize_t bytes_read = recv(a_session_ptr->fd, loop->read_buffer, sizeof(loop->read_buffer), 0);
+
+        if (0 < bytes_read) {
+            if (false == mqtt_receive(&(a_session_ptr->shared), loop->read_buffer, (size_t)bytes_read)) {
+                #ifdef DEBUG
+                    printf("Session %i receive failed\n", a_session_ptr->fd);
+                #endif
+            }
+
+            /* Callback may have closed the session */
+            if (0 > a_session_ptr->fd)
+                return true;
+        } else if (0 == bytes_read) {
+            return false; /* Peer closed */
+        } else {
+            return ((EAGAIN == errno) || (EWOULDBLOCK == errno));
+        }
+    }
+}
+
+void event_session_lock(MQTT_event_session_t * a_session_ptr)
+{
+    pthread_mutex_lock(&(a_session_ptr->loop->lock));
+}
+
+void event_session_unlock(MQTT_event_session_t * a_session_ptr)
+{
+    pthread_mutex_unlock(&(a_session_ptr->loop->lock));
+}
+
+/****************************************************************************************
+ * Loop                                                                                 *
+ ****************************************************************************************/
+bool event_loop_init(MQTT_event_loop_t * a_loop_ptr, uint32_t a_tick_in_ms)
+{
+    if ((NULL == a_loop_ptr) ||
+        (0    == a_tick_in_ms))
+        return false;
+
+    a_loop_ptr->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (0 > a_loop_ptr->epoll_fd)
+        return false;
+
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&(a_loop_ptr->lock), &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    a_loop_ptr->tick_in_ms      = a_tick_in_ms;
+    a_loop_ptr->last_tick_in_ms = event_loop_now_ms();
+    a_loop_ptr->session_cnt     = 0;
+    a_loop_ptr->sessions        = NULL;
+    a_loop_ptr->running         = false;
+    return true;
+}
+
+void event_loop_destroy(MQTT_event_loop_t * a_loop_ptr)
+{
+    event_loop_stop(a_loop_ptr);
+
+    pthread_mutex_lock(&(a_loop_ptr->lock));
+    while (NULL != a_loop_ptr->sessions) {
+        MQTT_event_session_t * session = a_loop_ptr->sessions;
+        event_session_close(session, false);
+        event_session_unlink(session);
+        session->loop = NULL;
+    }
+    pthread_mutex_unlock(&(a_loop_ptr->lock));
+
+    pthread_mutex_destroy(&(a_loop_ptr->lock));
+    close(a_loop_ptr->epoll_fd);
+    a_loop_ptr->epoll_fd = -1;
+}
+
+bool event_loop_add(MQTT_event_loop_t    * a_loop_ptr,
+                    MQTT_event_session_t * a_session_ptr,
+                    const char           * a_inet_addr,
+                    uint16_t               a_port)
+{
+    if ((NULL == a_loop_ptr)    ||
+        (NULL == a_session_ptr) ||
+        (NULL == a_inet_addr)   ||
+        (0    <= a_session_ptr->fd))
+        return false;
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (0 > fd)
+        return false;
+
+    int value = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &value, sizeof(value));
+
+    struct sockaddr_in server;
+    memset(&server, 0, sizeof(server));
+    server.sin_addr.s_addr = inet_addr(a_inet_addr);
+    server.sin_family      = AF_INET;
+    server.sin_port        = htons(a_port);
+
+    if ((0 != connect(fd, (struct sockaddr *)&server, sizeof(server))) &&
+        (EINPROGRESS != errno)) {
+        close(fd);
+        return false;
+    }
+
+    pthread_mutex_lock(&(a_loop_ptr->lock));
+
+    a_session_ptr->fd      = fd;
+    a_session_ptr->loop    = a_loop_ptr;
+    a_session_ptr->state   = EVENT_SESSION_CONNECTING;
+    a_session_ptr->tx_fill = 0;
+
+    /* Writable = TCP connect completed */
+    struct epoll_event event;
+    event.events   = EPOLLIN | EPOLLOUT;
+    event.data.ptr = a_session_ptr;
+
+    bool ret = (0 == epoll_ctl(a_loop_ptr->epoll_fd, EPOLL_CTL_ADD, fd, &event));
+    if (ret) {
+        a_session_ptr->next  = a_loop_ptr->sessions;
+        a_loop_ptr->sessions = a_session_ptr;
+        a_loop_ptr->session_cnt++;
+    } else {
+        close(fd);
+        a_session_ptr->fd    = -1;
+        a_session_ptr->state = EVENT_SESSION_CLOSED;
+    }
+
+    pthread_mutex_unlock(&(a_loop_ptr->lock));
+    return ret;
+}
+
+void event_loop_remove(MQTT_event_session_t * a_session_ptr)
+{
+    if ((NULL == a_session_ptr) ||
+        (NULL == a_session_ptr->loop))
+        return;
+
+    MQTT_event_loop_t * loop = a_session_ptr->loop;
+
+    pthread_mutex_lock(&(loop->lock));
+    event_session_close(a_session_ptr, false);
+    event_session_unlink(a_session_ptr);
+    a_session_ptr->loop = NULL;
+    pthread_mutex_unlock(&(loop->lock));
+}
+
+static void event_loop_dispatch(MQTT_event_session_t * a_session_ptr, uint32_t a_events)
+{
+    bool ok = true;
+
+    if (0 > a_session_ptr->fd)
+        return; /* Closed during this iteration */
+
+    if (EVENT_SESSION_CONNECTING == a_session_ptr->state) {
+        if (a_events & (EPOLLOUT | EPOLLERR | EPOLLHUP))
+            ok = event_session_established(a_session_ptr);
+    } else {
+        if (a_events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+            ok = event_session_read(a_session_ptr);
+
+        if ((true == ok)                &&
+            (0    <= a_session_ptr->fd) &&
+            (a_events & EPOLLOUT))
+            ok = event_session_flush(a_session_ptr);
+    }
+
+    if ((false == ok) &&
+        (0    <= a_session_ptr->fd))
+        event_session_close(a_session_ptr, true);
+}
+
+static void event_loop_keepalive(MQTT_event_loop_t * a_loop_ptr)
+{
+    uint64_t now     = event_loop_now_ms();
+    uint64_t elapsed = now - a_loop_ptr->last_tick_in_ms;
+
+    if (elapsed < a_loop_ptr->tick_in_ms)
+        return;
+
+    a_loop_ptr->last_tick_in_ms = now;
+
+    MQTT_event_session_t * session = a_loop_ptr->sessions;
+    while (NULL != session) {
+        MQTT_event_session_t * next = session->next;
+
+        if ((EVENT_SESSION_OPEN == session->state) &&
+            (STATE_CONNECTED    == session->shared.state)) {
+            if (false == mqtt_keepalive(&(session->shared), (uint32_t)elapsed))
+                event_session_close(session, true);
+        }
+        session = next;
+    }
+}
+
+int event_loop_poll(MQTT_event_loop_t * a_loop_ptr, int a_timeout_in_ms)
+{
+    struct epoll_event events[EVENT_LOOP_MAX_EVENTS];
+
+    if (NULL == a_loop_ptr)
+        return -1;
+
+    int cnt = epoll_wait(a_loop_ptr->epoll_fd, events, EVENT_LOOP_MAX_EVENTS, a_timeout_in_ms);
+    if (0 > cnt) {
+        if (EINTR != errno)
+            return -1;
+        cnt = 0;
+    }
+
+    pthread_mutex_lock(&(a_loop_ptr->lock));
+    for (int i = 0; i < cnt; i++)
+        event_loop_dispatch((MQTT_event_session_t *) events[i].data.ptr, events[i].events);
+
+    event_loop_keepalive(a_loop_ptr);
+    pthread_mutex_unlock(&(a_loop_ptr->lock));
+
+    return cnt;
+}
+
+static void * event_loop_thread(void * a_ptr)
+{
+    MQTT_event_loop_t * loop = (MQTT_event_loop_t *) a_ptr;
+
+    while (loop->running) {
+        if (0 > event_loop_poll(loop, (int)loop->tick_in_ms))
+            break;
+    }
+    return NULL;
+}
+
+bool event_loop_start(MQTT_event_loop_t * a_loop_ptr)
+{
+    if ((NULL == a_loop_ptr) ||
+        (true == a_loop_ptr->running))
+        return false;
+
+    a_loop_ptr->running = true;
+    if (0 != pthread_create(&(a_loop_ptr->thread), NULL, event_loop_thread, a_loop_ptr)) {
+        a_loop_ptr->running = false;
+        return false;
+    }
+    return true;
+}
+
+void event_loop_stop(MQTT_event_loop_t * a_loop_ptr)
+{
+    if ((NULL != a_loop_ptr) &&
+        (true == a_loop_ptr->running)) {
+        a_loop_ptr->running = false;
+        pthread_join(a_loop_ptr->thread, NULL);
+    }
+}
+
+/****************************************************************************************
+ * Loop group                                                                           *
+ ****************************************************************************************/
+bool event_loop_group_init(MQTT_event_loop_group_t * a_group_ptr,
+                           MQTT_event_loop_t       * a_loops_ptr,
+                           uint32_t                  a_loop_cnt,
+                           uint32_t                  a_tick_in_ms)
+{
+    if ((NULL == a_group_ptr) ||
+        (NULL == a_loops_ptr) ||
+        (0    == a_loop_cnt))
+        return false;
+
+    a_group_ptr->loops    = a_loops_ptr;
+    a_group_ptr->loop_cnt = 0;
+    a_group_ptr->next     = 0;
+
+    for (uint32_t i = 0; i < a_loop_cnt; i++) {
+        if (false == event_loop_init(&(a_loops_ptr[i]), a_tick_in_ms)) {
+            event_loop_group_destroy(a_group_ptr);
+            return false;
+        }
+        a_group_ptr->loop_cnt++;
+    }
+    return true;
+}
+
+bool event_loop_group_start(MQTT_event_loop_group_t * a_group_ptr)
+{
+    for (uint32_t i = 0; i < a_group_ptr->loop_cnt; i++) {
+        if (false == event_loop_start(&(a_group_ptr->loops[i]))) {
+            event_loop_group_stop(a_group_ptr);
+            return false;
+        }
+    }
+    return true;
+}
+
+void event_loop_group_stop(MQTT_event_loop_group_t * a_group_ptr)
+{
+    for (uint32_t i = 0; i < a_group_ptr->loop_cnt; i++)
+        event_loop_stop(&(a_group_ptr->loops[i]));
+}
+
+void event_loop_group_destroy(MQTT_event_loop_group_t * a_group_ptr)
+{
+    for (uint32_t i = 0; i < a_group_ptr->loop_cnt; i++)
+        event_loop_destroy(&(a_group_ptr->loops[i]));
+    a_group_ptr->loop_cnt = 0;
+}
+
+bool event_loop_group_add(MQTT_event_loop_group_t * a_group_ptr,
+                          MQTT_event_session_t    * a_session_ptr,
+                          const char              * a_inet_addr,
+                          uint16_t                  a_port)
+{
+    if ((NULL == a_group_ptr) ||
+        (0    == a_group_ptr->loop_cnt))
+        return false;
+
+    MQTT_event_loop_t * loop = &(a_group_ptr->loops[a_group_ptr->next]);
+    a_group_ptr->next = (a_group_ptr->next + 1) % a_group_ptr->loop_cnt;
+
+    return event_loop_add(loop, a_session_ptr, a_inet_addr, a_port);
+}
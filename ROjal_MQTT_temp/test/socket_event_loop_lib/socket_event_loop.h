@@ -0,0 +1,188 @@
+#ifndef SOCKET_EVENT_LOOP_H
+#define SOCKET_EVENT_LOOP_H
+
+#include <stdint.h>  // uint
+#include <stdbool.h> // bool
+#include <pthread.h> // pthread_t
+
+#include "mqtt.h"
+
+/* mqtt.h packs structures, pthread types need their natural alignment */
+#pragma pack(push)
+#pragma pack()
+
+#define EVENT_LOOP_MAX_EVENTS       64
+#define EVENT_LOOP_READ_BUFFER_SIZE (16*1024)
+
+/****************************************************************************************
+ * @section event loop                                                                  *
+ * One epoll instance drives non-blocking sockets of many MQTT sessions: reads, pending *
+ * writes and keepalive timers. Loop is run by the caller (event_loop_poll) or by its   *
+ * own worker thread (event_loop_start). Sessions can be sharded over several loops     *
+ * with the loop group.                                                                 *
+ ****************************************************************************************/
+typedef enum MQTTEventSessionState
+{
+    EVENT_SESSION_IDLE = 0,
+    EVENT_SESSION_CONNECTING,   /* TCP connect in progress    */
+    EVENT_SESSION_OPEN,         /* TCP up, MQTT CONNECT sent  */
+    EVENT_SESSION_CLOSED
+} MQTTEventSessionState_t;
+
+typedef struct MQTT_event_session MQTT_event_session_t;
+typedef struct MQTT_event_loop    MQTT_event_loop_t;
+
+typedef void (*event_session_closed_fptr_t)(MQTT_event_session_t * a_session_ptr);
+
+struct MQTT_event_session
+{
+    MQTT_shared_data_t            shared;        /* Client context, must be the first member */
+    MQTT_connect_t                connect;       /* CONNECT parameters sent when TCP is up   */
+    int                           fd;            /* Non-blocking socket, -1 when closed      */
+    MQTTEventSessionState_t       state;         /* Socket state                             */
+    uint8_t                     * tx_backlog;    /* Output not yet accepted by the socket    */
+    size_t                        tx_backlog_size;
+    size_t                        tx_fill;
+    event_session_closed_fptr_t   closed_fptr;   /* Called when the socket is closed         */
+    MQTT_event_loop_t           * loop;          /* Loop which owns the session              */
+    MQTT_event_session_t        * next;          /* Next session of the same loop            */
+};
+
+struct MQTT_event_loop
+{
+    int                    epoll_fd;
+    uint32_t               tick_in_ms;           /* Keepalive resolution                     */
+    uint64_t               last_tick_in_ms;
+    uint32_t               session_cnt;
+    MQTT_event_session_t * sessions;
+    pthread_mutex_t        lock;                 /* Recursive, held while dispatching        */
+    pthread_t              thread;
+    volatile bool          running;
+    uint8_t                read_buffer[EVENT_LOOP_READ_BUFFER_SIZE];
+};
+
+typedef struct MQTT_event_loop_group
+{
+    MQTT_event_loop_t    * loops;
+    uint32_t               loop_cnt;
+    uint32_t               next;                 /* Round robin index for new sessions       */
+} MQTT_event_loop_group_t;
+
+/**
+ * Initialize session.
+ *
+ * Buffers are owned by the caller and must stay valid while the session is in a loop.
+ *
+ * @param a_session_ptr [in] session to initialize.
+ * @param a_tx_buffer_ptr [in] transmit buffer of the client context.
+ * @param a_tx_buffer_size [in] size of the transmit buffer.
+ * @param a_rx_buffer_ptr [in] reassembly buffer for split packets.
+ * @param a_rx_buffer_size [in] size of the reassembly buffer.
+ * @param a_backlog_ptr [in] buffer for output which socket could not take immediately.
+ * @param a_backlog_size [in] size of the backlog, output fails when it can not hold the
+ *                       whole packet. Must be at least the biggest packet sent.
+ * @param a_connect_ptr [in] CONNECT parameters, copied (strings must stay valid).
+ * @param a_connected_fptr [in] @see connected_fptr_t.
+ * @param a_subscribe_fptr [in] @see subscrbe_fptr_t.
+ * @param a_closed_fptr [in] called when socket is closed, can be NULL.
+ * @return true when session is ready to be added into a loop.
+ */
+bool event_session_init(MQTT_event_session_t        * a_session_ptr,
+                        uint8_t                     * a_tx_buffer_ptr,
+                        size_t                        a_tx_buffer_size,
+                        uint8_t                     * a_rx_buffer_ptr,
+                        size_t                        a_rx_buffer_size,
+                        uint8_t                     * a_backlog_ptr,
+                        size_t                        a_backlog_size,
+                        MQTT_connect_t              * a_connect_ptr,
+                        connected_fptr_t              a_connected_fptr,
+                        subscrbe_fptr_t               a_subscribe_fptr,
+                        event_session_closed_fptr_t   a_closed_fptr);
+
+/**
+ * Output stream function of the session.
+ *
+ * Set as out_fptr of the client context by event_session_init. Data is sent without
+ * blocking, rest is queued into the backlog and sent when socket is writable.
+ * Packet which does not fit into free backlog is not sent at all, -1 is returned.
+ */
+int event_session_write(MQTT_shared_data_t * a_shared_ptr,
+                        uint8_t            * a_data_ptr,
+                        size_t               a_amount);
+
+/**
+ * Vector output function of the session.
+ *
+ * Set as outv_fptr of the client context when TCP is up. Chunks are gathered
+ * by sendmsg, rest is queued into the backlog like with event_session_write.
+ */
+int event_session_writev(MQTT_shared_data_t * a_shared_ptr,
+                         MQTT_iovec_t       * a_iov_ptr,
+                         uint32_t             a_iov_cnt);
+
+/**
+ * Lock / unlock the loop of the session.
+ *
+ * MQTT API calls (publish, subscribe, disconnect) for a session in a running loop must
+ * be done while the lock is held, or from callbacks which are called with lock held.
+ */
+void event_session_lock(MQTT_event_session_t * a_session_ptr);
+void event_session_unlock(MQTT_event_session_t * a_session_ptr);
+
+bool event_loop_init(MQTT_event_loop_t * a_loop_ptr, uint32_t a_tick_in_ms);
+void event_loop_destroy(MQTT_event_loop_t * a_loop_ptr);
+
+/**
+ * Open connection for the session and add it into the loop.
+ *
+ * TCP connect is started without blocking, MQTT CONNECT is sent when it completes and
+ * connected_fptr of the session is called when CONNACK is received.
+ *
+ * @param a_loop_ptr [in] event loop.
+ * @param a_session_ptr [in] initialized session.
+ * @param a_inet_addr [in] broker IPv4 address.
+ * @param a_port [in] broker port.
+ * @return true when connecting was started.
+ */
+bool event_loop_add(MQTT_event_loop_t    * a_loop_ptr,
+                    MQTT_event_session_t * a_session_ptr,
+                    const char           * a_inet_addr,
+                    uint16_t               a_port);
+
+/**
+ * Close socket of the session and remove it from its loop. closed_fptr is not called.
+ */
+void event_loop_remove(MQTT_event_session_t * a_session_ptr);
+
+/**
+ * Run one loop iteration: wait events at most a_timeout_in_ms, dispatch them and run
+ * keepalive timers of all sessions.
+ *
+ * @return number of handled socket events, -1 in case of failure.
+ */
+int event_loop_poll(MQTT_event_loop_t * a_loop_ptr, int a_timeout_in_ms);
+
+/**
+ * Run loop in own worker thread until event_loop_stop is called.
+ */
+bool event_loop_start(MQTT_event_loop_t * a_loop_ptr);
+void event_loop_stop(MQTT_event_loop_t * a_loop_ptr);
+
+/**
+ * Shard sessions over several loops, each run by own worker thread.
+ */
+bool event_loop_group_init(MQTT_event_loop_group_t * a_group_ptr,
+                           MQTT_event_loop_t       * a_loops_ptr,
+                           uint32_t                  a_loop_cnt,
+                           uint32_t                  a_tick_in_ms);
+bool event_loop_group_start(MQTT_event_loop_group_t * a_group_ptr);
+void event_loop_group_stop(MQTT_event_loop_group_t * a_group_ptr);
+void event_loop_group_destroy(MQTT_event_loop_group_t * a_group_ptr);
+bool event_loop_group_add(MQTT_event_loop_group_t * a_group_ptr,
+                          MQTT_event_session_t    * a_session_ptr,
+                          const char              * a_inet_addr,
+                          uint16_t                  a_port);
+
+#pragma pack(pop)
+
+#endif
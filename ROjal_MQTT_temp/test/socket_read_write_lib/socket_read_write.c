@@ -4,8 +4,7 @@
 #include <arpa/inet.h>  // inet_addr
 #include <pthread.h>    // pthread_create
 #include <signal.h>     // pthread_kill
-#include <stdlib.h>     // malloc/free
-#include <string.h>     // memcpy
+#include <sys/uio.h>    // writev
 #include "socket_read_write.h"
 
 static int test_socket = -1;
@@ -20,13 +19,52 @@ void ctrlc_handler()
     socket_OK = false;
 }
 
-#define BUFFER_SIZE (1024*1024)
+#define BUFFER_SIZE (64*1024)
 
-int socket_write(uint8_t * a_data, size_t a_amount)
+static uint8_t socket_read_buffer[BUFFER_SIZE];
+
+int socket_write(MQTT_shared_data_t * a_shared_ptr, uint8_t * a_data, size_t a_amount)
 {
+    a_shared_ptr = a_shared_ptr;
     return send(test_socket, a_data, a_amount , 0);
 }
 
+int socket_writev(MQTT_shared_data_t * a_shared_ptr, MQTT_iovec_t * a_iov_ptr, uint32_t a_iov_cnt)
+{
+    struct iovec iov[MQTT_OUTPUT_VECTOR_MAX];
+    struct iovec * iov_ptr = iov;
+    int total = 0;
+    a_shared_ptr = a_shared_ptr;
+
+    if (MQTT_OUTPUT_VECTOR_MAX < a_iov_cnt)
+        return -1;
+
+    for (uint32_t i = 0; i < a_iov_cnt; i++) {
+        iov[i].iov_base = a_iov_ptr[i].data;
+        iov[i].iov_len  = a_iov_ptr[i].size;
+    }
+
+    /* Kernel gathers the chunks, blocking socket may still return partial write */
+    while (0 < a_iov_cnt) {
+        ssize_t sent = writev(test_socket, iov_ptr, (int)a_iov_cnt);
+        if (0 > sent)
+            return -1;
+        total += (int)sent;
+
+        while ((0 < a_iov_cnt) &&
+               ((size_t)sent >= iov_ptr->iov_len)) {
+            sent -= (ssize_t)iov_ptr->iov_len;
+            iov_ptr++;
+            a_iov_cnt--;
+        }
+        if (0 < a_iov_cnt) {
+            iov_ptr->iov_base  = (uint8_t *)iov_ptr->iov_base + sent;
+            iov_ptr->iov_len  -= (size_t)sent;
+        }
+    }
+    return total;
+}
+
 void sleep_ms_(int milliseconds)
 {
     struct timespec ts;
@@ -35,29 +73,6 @@ void sleep_ms_(int milliseconds)
     nanosleep(&ts, NULL);
 }
 
-int32_t get_remainingsize(uint8_t * a_input_ptr)
-{
-    uint32_t multiplier = 1;
-    uint32_t value      = 0;
-    uint8_t  cnt        = 1;
-    uint8_t  aByte      = 0;
-
-    /* Verify input parameters */
-    if (NULL == a_input_ptr)
-        return -1;
-
-    do {
-        aByte = a_input_ptr[cnt++];
-        value += (aByte & 127) * multiplier;
-        if (multiplier > (128*128*128))
-            return -2;
-
-        multiplier *= 128;
-    } while ((aByte & 128) != 0);
-    value += (cnt); //Add count header to the overal size of MQTT packet to be received
-    return value;
-}
-
 void read_signal_handler()
 {
     printf("Killing reading thread\n");
@@ -74,29 +89,11 @@ void *socket_receive_thread(void * a_ptr)
            (NULL != socket_data_received_callback) &&
            (read_thread_running)) {
 
-        char header[32] = {0};
-        int bytes_read = recv((test_socket), header, sizeof(header) - 1, 0);
-
-        if (2 <= bytes_read) {
-            uint32_t remaining_bytes = get_remainingsize((uint8_t*)header) - bytes_read;
-
-        if (0 < remaining_bytes) {
+        /* Read as much as available, MQTT client reassembles packets from the stream */
+        int bytes_read = recv(test_socket, socket_read_buffer, sizeof(socket_read_buffer), 0);
 
-            /* Need to read more data */
-            char * buff = (char*)malloc(remaining_bytes + bytes_read + 1024 /* safety buffer*/);
-            memcpy(buff, header, bytes_read);
-            while (remaining_bytes) {
-                int nxt_bytes_read = recv(test_socket, &buff[bytes_read], remaining_bytes, 0);
-                remaining_bytes -= nxt_bytes_read;
-                bytes_read += nxt_bytes_read;
-            }
-
-            socket_data_received_callback((uint8_t*)buff, (uint32_t)bytes_read);
-            free(buff);
-            } else {
-                /* Send packets dirctly to the MQTT client, which fit into 32B buffer */
-                socket_data_received_callback((uint8_t*)header, (uint32_t)bytes_read);
-            }
+        if (0 < bytes_read) {
+            socket_data_received_callback(socket_read_buffer, (uint32_t)bytes_read);
         } else {
             char data = 0;
             if( send(test_socket, &data, 0 , 0) < 0)
@@ -4,10 +4,13 @@
 #include <stdint.h>  // uint
 #include <stdbool.h> // bool
 
+#include "mqtt.h"
+
 typedef void (*socket_data_received_fptr_t)(uint8_t * a_data, size_t amount);
 
 bool socket_initialize(char * a_inet_addr, uint32_t a_port, socket_data_received_fptr_t);
-int socket_write(uint8_t * a_data, size_t a_amount);
+int socket_write(MQTT_shared_data_t * a_shared_ptr, uint8_t * a_data, size_t a_amount);
+int socket_writev(MQTT_shared_data_t * a_shared_ptr, MQTT_iovec_t * a_iov_ptr, uint32_t a_iov_cnt);
 bool stop_reading_thread();
 
 #endif
\ No newline at end of file
@@ -9,7 +9,7 @@
 #include "unity.h"
 #include "../help/help.h"
 
-extern MQTTErrorCodes_t mqtt_connect_parse_ack(uint8_t * a_message_in_ptr);
+extern MQTTErrorCodes_t mqtt_connect_parse_ack(uint8_t * a_message_in_ptr, uint32_t a_input_size);
 extern bool g_auto_state_connection_completed_;
 extern bool socket_OK_;
 
@@ -24,8 +24,8 @@ void test_sm_connect_manual_ack()
 
 
     MQTT_action_data_t action;
-    action.action_argument.shared_ptr = &shared;
-    MQTTErrorCodes_t state = mqtt(ACTION_INIT,
+    MQTTErrorCodes_t state = mqtt(&shared,
+                                  ACTION_INIT,
                                   &action);
 
     MQTT_connect_t connect_params;
@@ -45,7 +45,8 @@ void test_sm_connect_manual_ack()
 
     action.action_argument.connect_ptr = &connect_params;
 
-    state = mqtt(ACTION_CONNECT,
+    state = mqtt(&shared,
+                 ACTION_CONNECT,
                  &action);
 
     TEST_ASSERT_EQUAL_INT(Successfull, state);
@@ -53,16 +54,17 @@ void test_sm_connect_manual_ack()
     asleep(1400);
 
     // Wait response from borker
-    int rcv = data_stream_in_fptr_(buffer, sizeof(MQTT_fixed_header_t));
+    int rcv = data_stream_in_fptr_(&shared, buffer, sizeof(MQTT_fixed_header_t));
     if (0 < rcv)
-        state = mqtt_connect_parse_ack(buffer);
+        state = mqtt_connect_parse_ack(buffer, (uint32_t)rcv);
     else
         state = NoConnection;
 
     TEST_ASSERT_EQUAL_INT(Successfull, state);
     shared.state = STATE_CONNECTED;
 
-    state = mqtt(ACTION_DISCONNECT,
+    state = mqtt(&shared,
+                 ACTION_DISCONNECT,
                  NULL);
 
     TEST_ASSERT_EQUAL_INT(Successfull, state);
@@ -11,7 +11,7 @@
 #include "unity.h"
 #include "../help/help.h"
 
-extern MQTTErrorCodes_t mqtt_connect_parse_ack(uint8_t * a_message_in_ptr);
+extern MQTTErrorCodes_t mqtt_connect_parse_ack(uint8_t * a_message_in_ptr, uint32_t a_input_size);
 extern bool g_auto_state_connection_completed_;
 extern bool socket_OK_;
 
@@ -27,8 +27,8 @@ void test_sm_connect_auto_ack_keepalive()
     g_auto_state_connection_completed_ = false;
 
     MQTT_action_data_t action;
-    action.action_argument.shared_ptr = &shared;
-    MQTTErrorCodes_t state = mqtt(ACTION_INIT,
+    MQTTErrorCodes_t state = mqtt(&shared,
+                                  ACTION_INIT,
                                   &action);
 
     MQTT_connect_t connect_params;
@@ -47,7 +47,8 @@ void test_sm_connect_auto_ack_keepalive()
 
     action.action_argument.connect_ptr = &connect_params;
 
-    state = mqtt(ACTION_CONNECT,
+    state = mqtt(&shared,
+                 ACTION_CONNECT,
                  &action);
 
     TEST_ASSERT_EQUAL_INT(Successfull, state);
@@ -55,14 +56,15 @@ void test_sm_connect_auto_ack_keepalive()
     asleep(10);
     // Wait response and request parse for it
     // Parse will call given callback which will set global flag to true
-    int rcv = data_stream_in_fptr_(buffer, sizeof(MQTT_fixed_header_t));
+    int rcv = data_stream_in_fptr_(&shared, buffer, sizeof(MQTT_fixed_header_t));
     if (0 < rcv) {
         MQTT_input_stream_t input;
         input.data = buffer;
         input.size_of_data = (uint32_t)rcv;
         action.action_argument.input_stream_ptr = &input;
 
-        state = mqtt(ACTION_PARSE_INPUT_STREAM,
+        state = mqtt(&shared,
+                     ACTION_PARSE_INPUT_STREAM,
                      &action);
     } else {
         TEST_ASSERT(0);
@@ -75,7 +77,7 @@ void test_sm_connect_auto_ack_keepalive()
 
     MQTT_action_data_t ap;
     ap.action_argument.epalsed_time_in_ms = 500;
-    state = mqtt(ACTION_KEEPALIVE, &ap);
+    state = mqtt(&shared, ACTION_KEEPALIVE, &ap);
 
     printf("Keepalive cmd status %i\n", state);
     ap.action_argument.epalsed_time_in_ms = 500;
@@ -85,14 +87,15 @@ void test_sm_connect_auto_ack_keepalive()
         printf("g_shared_data->state %u\n", shared.state);
 
         if (Successfull == state) {
-            int rcv = data_stream_in_fptr_(buffer, sizeof(MQTT_fixed_header_t));
+            int rcv = data_stream_in_fptr_(&shared, buffer, sizeof(MQTT_fixed_header_t));
             if (0 < rcv) {
                 MQTT_input_stream_t input;
                 input.data = buffer;
                 input.size_of_data = (uint32_t)rcv;
                 action.action_argument.input_stream_ptr = &input;
 
-                state = mqtt(ACTION_PARSE_INPUT_STREAM,
+                state = mqtt(&shared,
+                            ACTION_PARSE_INPUT_STREAM,
                             &action);
                 TEST_ASSERT_EQUAL_INT(Successfull, state);
             } else {
@@ -105,11 +108,12 @@ void test_sm_connect_auto_ack_keepalive()
         printf("sleeping..\n");
         asleep(300); // 100ms safe guard because given time is at least time...
         printf("slept\n");
-        state = mqtt(ACTION_KEEPALIVE, &ap);
+        state = mqtt(&shared, ACTION_KEEPALIVE, &ap);
         //TEST_ASSERT_EQUAL_INT(Successfull, state);
 
     }
-    state = mqtt(ACTION_DISCONNECT,
+    state = mqtt(&shared,
+                 ACTION_DISCONNECT,
                  NULL);
 
     TEST_ASSERT_EQUAL_INT(Successfull, state);
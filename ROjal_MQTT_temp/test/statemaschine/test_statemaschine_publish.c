@@ -11,7 +11,7 @@
 #include "unity.h"
 #include "../help/help.h"
 
-extern MQTTErrorCodes_t mqtt_connect_parse_ack(uint8_t * a_message_in_ptr);
+extern MQTTErrorCodes_t mqtt_connect_parse_ack(uint8_t * a_message_in_ptr, uint32_t a_input_size);
 extern bool g_auto_state_connection_completed_;
 extern bool socket_OK_;
 
@@ -30,8 +30,8 @@ void test_sm_publish()
     g_auto_state_connection_completed_ = false;
 
     MQTT_action_data_t action;
-    action.action_argument.shared_ptr = &shared;
-    MQTTErrorCodes_t state = mqtt(ACTION_INIT,
+    MQTTErrorCodes_t state = mqtt(&shared,
+                                  ACTION_INIT,
                                   &action);
 
     MQTT_connect_t connect_params;
@@ -50,14 +50,15 @@ void test_sm_publish()
 
     action.action_argument.connect_ptr = &connect_params;
 
-    state = mqtt(ACTION_CONNECT,
+    state = mqtt(&shared,
+                 ACTION_CONNECT,
                  &action);
 
     TEST_ASSERT_EQUAL_INT(Successfull, state);
 
     // Wait response and request parse for it
     // Parse will call given callback which will set global flag to true
-    int rcv = data_stream_in_fptr_(buffer, sizeof(MQTT_fixed_header_t));
+    int rcv = data_stream_in_fptr_(&shared, buffer, sizeof(MQTT_fixed_header_t));
 
     TEST_ASSERT_TRUE(socket_OK_ == true);
 
@@ -67,7 +68,8 @@ void test_sm_publish()
         input.size_of_data = (uint32_t)rcv;
         action.action_argument.input_stream_ptr = &input;
 
-        state = mqtt(ACTION_PARSE_INPUT_STREAM,
+        state = mqtt(&shared,
+                     ACTION_PARSE_INPUT_STREAM,
                      &action);
     } else {
         TEST_ASSERT(0);
@@ -99,12 +101,14 @@ void test_sm_publish()
 
     action.action_argument.publish_ptr = &publish;
 
-    state = mqtt(ACTION_PUBLISH,
+    state = mqtt(&shared,
+                 ACTION_PUBLISH,
                  &action);
 
     TEST_ASSERT_EQUAL_INT(Successfull, state);
 
-    state = mqtt(ACTION_DISCONNECT,
+    state = mqtt(&shared,
+                 ACTION_DISCONNECT,
                  NULL);
 
     TEST_ASSERT_EQUAL_INT(Successfull, state);
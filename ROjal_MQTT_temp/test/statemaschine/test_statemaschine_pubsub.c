@@ -11,10 +11,29 @@
 #include "unity.h"
 #include "../help/help.h"
 
-extern MQTTErrorCodes_t mqtt_connect_parse_ack(uint8_t * a_message_in_ptr);
+extern MQTTErrorCodes_t mqtt_connect_parse_ack(uint8_t * a_message_in_ptr, uint32_t a_input_size);
 extern bool g_auto_state_connection_completed_;
 extern bool g_auto_state_subscribe_completed_;
 extern bool socket_OK_;
+extern MQTTErrorCodes_t get_packet_size(uint8_t * a_input_ptr, uint32_t a_input_size, uint32_t * a_packet_size_ptr);
+
+/* Packets bigger than one read are parsed only when whole packet is received */
+static int receive_packet(MQTT_shared_data_t * a_shared_ptr, uint8_t * a_buffer_ptr, size_t a_buffer_size)
+{
+    uint32_t packet_size = 0;
+    int      rcv         = data_stream_in_fptr_(a_shared_ptr, a_buffer_ptr, sizeof(MQTT_fixed_header_t));
+
+    while ((0 < rcv) &&
+           (Successfull == get_packet_size(a_buffer_ptr, (uint32_t)rcv, &packet_size)) &&
+           (packet_size > (uint32_t)rcv) &&
+           (packet_size <= a_buffer_size)) {
+        int more = data_stream_in_fptr_(a_shared_ptr, &(a_buffer_ptr[rcv]), packet_size - (uint32_t)rcv);
+        if (0 >= more)
+            return more;
+        rcv += more;
+    }
+    return rcv;
+}
 
 void test_sm_subscrbe_with_receive()
 {
@@ -34,8 +53,8 @@ void test_sm_subscrbe_with_receive()
     g_auto_state_subscribe_completed_  = false;
 
     MQTT_action_data_t action;
-    action.action_argument.shared_ptr = &shared;
-    MQTTErrorCodes_t state = mqtt(ACTION_INIT,
+    MQTTErrorCodes_t state = mqtt(&shared,
+                                  ACTION_INIT,
                                   &action);
 
     MQTT_connect_t connect_params;
@@ -54,14 +73,15 @@ void test_sm_subscrbe_with_receive()
 
     action.action_argument.connect_ptr = &connect_params;
 
-    state = mqtt(ACTION_CONNECT,
+    state = mqtt(&shared,
+                 ACTION_CONNECT,
                  &action);
 
     TEST_ASSERT_EQUAL_INT(Successfull, state);
 
     // Wait response and request parse for it
     // Parse will call given callback which will set global flag to true
-    int rcv = data_stream_in_fptr_(buffer, sizeof(MQTT_fixed_header_t));
+    int rcv = data_stream_in_fptr_(&shared, buffer, sizeof(MQTT_fixed_header_t));
 
 
     if (0 < rcv) {
@@ -70,7 +90,8 @@ void test_sm_subscrbe_with_receive()
         input.size_of_data = (uint32_t)rcv;
         action.action_argument.input_stream_ptr = &input;
 
-        state = mqtt(ACTION_PARSE_INPUT_STREAM,
+        state = mqtt(&shared,
+                     ACTION_PARSE_INPUT_STREAM,
                      &action);
     } else {
         TEST_ASSERT(0);
@@ -94,14 +115,15 @@ void test_sm_subscrbe_with_receive()
 
     action.action_argument.subscribe_ptr = &subscribe;
 
-    state = mqtt(ACTION_SUBSCRIBE,
+    state = mqtt(&shared,
+                 ACTION_SUBSCRIBE,
                  &action);
 
     TEST_ASSERT_EQUAL_INT(Successfull, state);
 
     // Wait response and request parse for it
     // Parse will call given callback which will set global flag to true
-    rcv = data_stream_in_fptr_(buffer, sizeof(MQTT_fixed_header_t));
+    rcv = data_stream_in_fptr_(&shared, buffer, sizeof(MQTT_fixed_header_t));
 
     MQTT_input_stream_t input;
 
@@ -110,7 +132,8 @@ void test_sm_subscrbe_with_receive()
         input.size_of_data = (uint32_t)rcv;
         action.action_argument.input_stream_ptr = &input;
 
-        state = mqtt(ACTION_PARSE_INPUT_STREAM,
+        state = mqtt(&shared,
+                     ACTION_PARSE_INPUT_STREAM,
                      &action);
     } else {
         TEST_ASSERT(0);
@@ -139,13 +162,14 @@ void test_sm_subscrbe_with_receive()
     g_auto_state_subscribe_completed_ = false;
 
     action.action_argument.publish_ptr = &publish;
-    state = mqtt(ACTION_PUBLISH,
+    state = mqtt(&shared,
+                 ACTION_PUBLISH,
                  &action);
 
     TEST_ASSERT_EQUAL_INT(Successfull, state);
 
     g_auto_state_subscribe_completed_ = false;
-    rcv = data_stream_in_fptr_(buffer, sizeof(MQTT_fixed_header_t));
+    rcv = receive_packet(&shared, buffer, sizeof(buffer));
 
     // MQTT_input_stream_t input;
 
@@ -154,7 +178,8 @@ void test_sm_subscrbe_with_receive()
         input.size_of_data = (uint32_t)rcv;
         action.action_argument.input_stream_ptr = &input;
 
-        state = mqtt(ACTION_PARSE_INPUT_STREAM,
+        state = mqtt(&shared,
+                     ACTION_PARSE_INPUT_STREAM,
                      &action);
     } else {
         TEST_ASSERT(0);
@@ -165,7 +190,8 @@ void test_sm_subscrbe_with_receive()
     while (false == g_auto_state_subscribe_completed_)
         asleep(10);
 
-    state = mqtt(ACTION_DISCONNECT,
+    state = mqtt(&shared,
+                 ACTION_DISCONNECT,
                  NULL);
 
     TEST_ASSERT_EQUAL_INT(Successfull, state);
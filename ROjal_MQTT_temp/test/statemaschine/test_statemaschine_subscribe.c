@@ -30,8 +30,8 @@ void test_sm_subscrbe()
     g_auto_state_subscribe_completed_  = false;
 
     MQTT_action_data_t action;
-    action.action_argument.shared_ptr = &shared;
-    MQTTErrorCodes_t state = mqtt(ACTION_INIT,
+    MQTTErrorCodes_t state = mqtt(&shared,
+                                  ACTION_INIT,
                                   &action);
 
     MQTT_connect_t connect_params;
@@ -50,14 +50,15 @@ void test_sm_subscrbe()
 
     action.action_argument.connect_ptr = &connect_params;
 
-    state = mqtt(ACTION_CONNECT,
+    state = mqtt(&shared,
+                 ACTION_CONNECT,
                  &action);
 
     TEST_ASSERT_EQUAL_INT(Successfull, state);
 
     // Wait response and request parse for it
     // Parse will call given callback which will set global flag to true
-    int rcv = data_stream_in_fptr_(buffer, sizeof(MQTT_fixed_header_t));
+    int rcv = data_stream_in_fptr_(&shared, buffer, sizeof(MQTT_fixed_header_t));
 
     if (0 < rcv) {
         MQTT_input_stream_t input;
@@ -65,7 +66,8 @@ void test_sm_subscrbe()
         input.size_of_data = (uint32_t)rcv;
 
         action.action_argument.input_stream_ptr = &input;
-        state = mqtt(ACTION_PARSE_INPUT_STREAM,
+        state = mqtt(&shared,
+                     ACTION_PARSE_INPUT_STREAM,
                      &action);
     } else {
         TEST_ASSERT(0);
@@ -87,12 +89,14 @@ void test_sm_subscrbe()
 
     action.action_argument.subscribe_ptr = &subscribe;
 
-    state = mqtt(ACTION_SUBSCRIBE,
+    state = mqtt(&shared,
+                 ACTION_SUBSCRIBE,
                  &action);
 
     TEST_ASSERT_EQUAL_INT(Successfull, state);
 
-    state = mqtt(ACTION_DISCONNECT,
+    state = mqtt(&shared,
+                 ACTION_DISCONNECT,
                  NULL);
 
     TEST_ASSERT_EQUAL_INT(Successfull, state);
@@ -101,7 +105,7 @@ void test_sm_subscrbe()
     // Parse will call given callback which will set global flag to true
     rcv = 0;
     while (0 == rcv) {
-        rcv = data_stream_in_fptr_(buffer, sizeof(MQTT_fixed_header_t));
+        rcv = data_stream_in_fptr_(&shared, buffer, sizeof(MQTT_fixed_header_t));
         if (0 == rcv)
             asleep(10);
     }
@@ -111,7 +115,8 @@ void test_sm_subscrbe()
     input.size_of_data = (uint32_t)rcv;
 
     action.action_argument.input_stream_ptr = &input;
-    state = mqtt(ACTION_PARSE_INPUT_STREAM,
+    state = mqtt(&shared,
+                ACTION_PARSE_INPUT_STREAM,
                 &action);
 
     TEST_ASSERT_EQUAL_INT(Successfull, state);
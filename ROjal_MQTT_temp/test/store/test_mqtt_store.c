@@ -0,0 +1,308 @@
+#include "mqtt.h"
+#include "unity.h"
+#include "client_fixture.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define STORE_FILE "store_test.bin"
+
+static MQTT_shared_data_t shared;
+static uint8_t            tx_buffer[64];
+static MQTT_store_ring_t  ring;
+static uint8_t            ring_buffer[34];
+
+/* CONNACK - not authorized */
+static uint8_t connack_refused[] = {0x20, 0x02, 0x00, 0x05};
+
+static void store_setup(bool a_connected)
+{
+    fixture_setup(&shared, tx_buffer, sizeof(tx_buffer), a_connected);
+}
+
+/* PUBLISH QoS0 with one character topic and payload */
+static void assert_publish(uint32_t a_offset, char a_topic, char a_payload)
+{
+    uint8_t expected[] = {0x30, 0x04, 0x00, 0x01, (uint8_t)a_topic, (uint8_t)a_payload};
+
+    TEST_ASSERT_TRUE((a_offset + sizeof(expected)) <= g_out_len);
+    TEST_ASSERT_EQUAL_MEMORY(expected, &(g_out[a_offset]), sizeof(expected));
+}
+
+static void assert_oldest(MQTT_store_t * a_store_ptr, const char * a_topic, const char * a_payload)
+{
+    uint8_t  * topic_ptr;
+    uint16_t   topic_length;
+    uint8_t  * message_ptr;
+    uint32_t   message_size;
+
+    TEST_ASSERT_TRUE(a_store_ptr->peek_fptr(a_store_ptr, &topic_ptr, &topic_length, &message_ptr, &message_size));
+    TEST_ASSERT_EQUAL_UINT16(strlen(a_topic), topic_length);
+    TEST_ASSERT_EQUAL_UINT32(strlen(a_payload), message_size);
+    TEST_ASSERT_EQUAL_MEMORY(a_topic, topic_ptr, topic_length);
+    TEST_ASSERT_EQUAL_MEMORY(a_payload, message_ptr, message_size);
+}
+
+static bool put(MQTT_store_t * a_store_ptr, const char * a_topic, const char * a_payload)
+{
+    return a_store_ptr->put_fptr(a_store_ptr,
+                                 (uint8_t *)a_topic,
+                                 (uint16_t)strlen(a_topic),
+                                 (uint8_t *)a_payload,
+                                 (uint32_t)strlen(a_payload));
+}
+
+/****************************************************************************************
+ * Outbound store tests                                                                 *
+ ****************************************************************************************/
+void test_store_ring_order_and_wrap()
+{
+    MQTT_store_t * store = &(ring.store);
+
+    TEST_ASSERT_FALSE(mqtt_store_ring_init(&ring, ring_buffer, 4));
+    TEST_ASSERT_TRUE(mqtt_store_ring_init(&ring, ring_buffer, sizeof(ring_buffer)));
+
+    /* Record is 6 + 1 + 2 = 9 bytes, three fit into 34 bytes */
+    TEST_ASSERT_TRUE(put(store, "a", "11"));
+    TEST_ASSERT_TRUE(put(store, "b", "22"));
+    TEST_ASSERT_TRUE(put(store, "c", "33"));
+    TEST_ASSERT_FALSE(put(store, "d", "44"));
+    TEST_ASSERT_EQUAL_UINT32(3, store->count);
+
+    assert_oldest(store, "a", "11");
+    TEST_ASSERT_TRUE(store->pop_fptr(store));
+    assert_oldest(store, "b", "22");
+    TEST_ASSERT_TRUE(store->pop_fptr(store));
+
+    /* Does not fit to the end, goes to the beginning */
+    TEST_ASSERT_TRUE(put(store, "d", "44"));
+    TEST_ASSERT_FALSE(put(store, "e", "555555555555555555555"));
+    TEST_ASSERT_EQUAL_UINT32(2, store->count);
+
+    assert_oldest(store, "c", "33");
+    TEST_ASSERT_TRUE(store->pop_fptr(store));
+    assert_oldest(store, "d", "44");
+    TEST_ASSERT_TRUE(store->pop_fptr(store));
+    TEST_ASSERT_FALSE(store->pop_fptr(store));
+    TEST_ASSERT_EQUAL_UINT32(0, store->count);
+
+    /* Empty ring starts from the beginning, whole ring can be used */
+    TEST_ASSERT_TRUE(put(store, "e", "555555555555555555555555555"));
+    TEST_ASSERT_EQUAL_UINT32(0, ring.head);
+    TEST_ASSERT_FALSE(put(store, "f", ""));
+}
+
+void test_store_publish_while_disconnected()
+{
+    store_setup(false);
+    TEST_ASSERT_TRUE(mqtt_store_ring_init(&ring, ring_buffer, sizeof(ring_buffer)));
+    TEST_ASSERT_TRUE(mqtt_outbound_store(&shared, &(ring.store)));
+
+    TEST_ASSERT_TRUE(mqtt_publish(&shared, "a", 1, "1", 1));
+    TEST_ASSERT_TRUE(mqtt_publish(&shared, "b", 1, "2", 1));
+    TEST_ASSERT_EQUAL_UINT32(2, ring.store.count);
+    TEST_ASSERT_EQUAL_UINT32(0, g_out_len);
+
+    /* Flushed in order when connection is accepted */
+    TEST_ASSERT_TRUE(mqtt_receive(&shared, connack, sizeof(connack)));
+    TEST_ASSERT_EQUAL_UINT32(0, ring.store.count);
+    TEST_ASSERT_EQUAL_UINT32(12, g_out_len);
+    assert_publish(0, 'a', '1');
+    assert_publish(6, 'b', '2');
+
+    /* Empty store, publish goes directly */
+    TEST_ASSERT_TRUE(mqtt_publish(&shared, "c", 1, "3", 1));
+    TEST_ASSERT_EQUAL_UINT32(18, g_out_len);
+    assert_publish(12, 'c', '3');
+}
+
+void test_store_flush_on_attach()
+{
+    TEST_ASSERT_TRUE(mqtt_store_ring_init(&ring, ring_buffer, sizeof(ring_buffer)));
+    TEST_ASSERT_TRUE(put(&(ring.store), "a", "1"));
+
+    /* mqtt_connect (ACTION_INIT) detaches the store, it is attached again when connected */
+    store_setup(true);
+    TEST_ASSERT_NULL(shared.store);
+    TEST_ASSERT_TRUE(mqtt_outbound_store(&shared, &(ring.store)));
+    TEST_ASSERT_EQUAL_UINT32(0, ring.store.count);
+    TEST_ASSERT_EQUAL_UINT32(6, g_out_len);
+    assert_publish(0, 'a', '1');
+}
+
+void test_store_send_failure()
+{
+    store_setup(true);
+    TEST_ASSERT_TRUE(mqtt_store_ring_init(&ring, ring_buffer, sizeof(ring_buffer)));
+    TEST_ASSERT_TRUE(mqtt_outbound_store(&shared, &(ring.store)));
+
+    /* Failed publish is stored, next ones wait behind it */
+    g_write_fails = true;
+    TEST_ASSERT_TRUE(mqtt_publish(&shared, "a", 1, "1", 1));
+    TEST_ASSERT_TRUE(mqtt_publish(&shared, "b", 1, "2", 1));
+    TEST_ASSERT_EQUAL_UINT32(2, ring.store.count);
+
+    g_write_fails = false;
+    TEST_ASSERT_TRUE(mqtt_publish(&shared, "c", 1, "3", 1));
+    TEST_ASSERT_EQUAL_UINT32(0, ring.store.count);
+    TEST_ASSERT_EQUAL_UINT32(18, g_out_len);
+    assert_publish(0,  'a', '1');
+    assert_publish(6,  'b', '2');
+    assert_publish(12, 'c', '3');
+
+    /* Store full, publish fails */
+    g_write_fails = true;
+    TEST_ASSERT_TRUE(mqtt_publish(&shared, "d", 1, "4", 1));
+    TEST_ASSERT_TRUE(mqtt_publish(&shared, "e", 1, "5", 1));
+    TEST_ASSERT_TRUE(mqtt_publish(&shared, "f", 1, "6", 1));
+    TEST_ASSERT_TRUE(mqtt_publish(&shared, "g", 1, "7", 1));
+    TEST_ASSERT_FALSE(mqtt_publish(&shared, "h", 1, "8", 1));
+    TEST_ASSERT_EQUAL_UINT32(4, ring.store.count);
+}
+
+void test_store_connack_refused()
+{
+    MQTT_connect_t     connect_params;
+    MQTT_action_data_t action;
+
+    memset(&connect_params, 0, sizeof(connect_params));
+    connect_params.client_id                   = (uint8_t*)"store";
+    connect_params.username                    = (uint8_t*)"";
+    connect_params.password                    = (uint8_t*)"";
+    connect_params.last_will_topic             = (uint8_t*)"";
+    connect_params.last_will_message           = (uint8_t*)"";
+    connect_params.connect_flags.clean_session = true;
+    action.action_argument.connect_ptr         = &connect_params;
+
+    store_setup(false);
+    TEST_ASSERT_TRUE(mqtt_store_ring_init(&ring, ring_buffer, sizeof(ring_buffer)));
+    TEST_ASSERT_TRUE(put(&(ring.store), "a", "1"));
+    TEST_ASSERT_TRUE(mqtt_outbound_store(&shared, &(ring.store)));
+
+    /* CONNECT is written, nothing is flushed before CONNACK */
+    TEST_ASSERT_EQUAL_INT(Successfull, mqtt(&shared, ACTION_CONNECT, &action));
+    uint32_t connect_len = g_out_len;
+    TEST_ASSERT_TRUE(mqtt_publish(&shared, "b", 1, "2", 1));
+    TEST_ASSERT_EQUAL_UINT32(2, ring.store.count);
+    TEST_ASSERT_EQUAL_UINT32(connect_len, g_out_len);
+
+    /* Refused session keeps the store */
+    TEST_ASSERT_TRUE(mqtt_receive(&shared, connack_refused, sizeof(connack_refused)));
+    TEST_ASSERT_EQUAL_INT(STATE_DISCONNECTED, shared.state);
+    TEST_ASSERT_EQUAL_UINT32(2, ring.store.count);
+    TEST_ASSERT_EQUAL_UINT32(connect_len, g_out_len);
+
+    /* Accepted session gets the messages in order */
+    g_out_len = 0;
+    TEST_ASSERT_EQUAL_INT(Successfull, mqtt(&shared, ACTION_CONNECT, &action));
+    connect_len = g_out_len;
+    TEST_ASSERT_TRUE(mqtt_receive(&shared, connack, sizeof(connack)));
+    TEST_ASSERT_EQUAL_UINT32(0, ring.store.count);
+    TEST_ASSERT_EQUAL_UINT32(connect_len + 12, g_out_len);
+    assert_publish(connect_len,     'a', '1');
+    assert_publish(connect_len + 6, 'b', '2');
+}
+
+void test_store_not_for_permanent_failure()
+{
+    store_setup(true);
+    TEST_ASSERT_TRUE(mqtt_store_ring_init(&ring, ring_buffer, sizeof(ring_buffer)));
+    TEST_ASSERT_TRUE(mqtt_outbound_store(&shared, &(ring.store)));
+    shared.buffer_size = 20;
+
+    /* Never fits into the transmit buffer, storing would block the store */
+    TEST_ASSERT_FALSE(mqtt_publish(&shared, "a", 1, "12345678901234567890", 20));
+    TEST_ASSERT_EQUAL_UINT32(0, ring.store.count);
+
+    for (char c = '1'; c <= '5'; c++)
+        TEST_ASSERT_TRUE(mqtt_publish(&shared, "b", 1, &c, 1));
+    TEST_ASSERT_EQUAL_UINT32(5, g_write_cntr);
+    TEST_ASSERT_EQUAL_UINT32(0, ring.store.count);
+    assert_publish(24, 'b', '5');
+}
+
+void test_store_drops_undeliverable()
+{
+    store_setup(false);
+    TEST_ASSERT_TRUE(mqtt_store_ring_init(&ring, ring_buffer, sizeof(ring_buffer)));
+    TEST_ASSERT_TRUE(mqtt_outbound_store(&shared, &(ring.store)));
+    shared.buffer_size = 12;
+
+    /* With vector output only header must fit, without it record can not be flushed */
+    shared.outv_fptr = &fixture_outv_fptr;
+    TEST_ASSERT_TRUE(mqtt_publish(&shared, "a", 1, "1234567890", 10));
+    TEST_ASSERT_TRUE(mqtt_publish(&shared, "b", 1, "2", 1));
+    TEST_ASSERT_EQUAL_UINT32(2, ring.store.count);
+    shared.outv_fptr = NULL;
+
+    /* Undeliverable record is dropped, it does not block the ones behind it */
+    TEST_ASSERT_TRUE(mqtt_receive(&shared, connack, sizeof(connack)));
+    TEST_ASSERT_EQUAL_UINT32(0, ring.store.count);
+    TEST_ASSERT_EQUAL_UINT32(6, g_out_len);
+    assert_publish(0, 'b', '2');
+}
+
+void test_store_file_survives_reopen()
+{
+    MQTT_store_file_t file_store;
+    uint8_t           scratch[16];
+
+    remove(STORE_FILE);
+    TEST_ASSERT_TRUE(mqtt_store_file_open(&file_store, STORE_FILE, scratch, sizeof(scratch)));
+    TEST_ASSERT_EQUAL_UINT32(0, file_store.store.count);
+    TEST_ASSERT_TRUE(put(&(file_store.store), "a", "1"));
+    TEST_ASSERT_TRUE(put(&(file_store.store), "b", "2"));
+    TEST_ASSERT_TRUE(put(&(file_store.store), "c", "3"));
+    TEST_ASSERT_FALSE(put(&(file_store.store), "topic", "does not fit"));
+    mqtt_store_file_close(&file_store);
+
+    /* Messages are kept over restart, pop is persistent */
+    TEST_ASSERT_TRUE(mqtt_store_file_open(&file_store, STORE_FILE, scratch, sizeof(scratch)));
+    TEST_ASSERT_EQUAL_UINT32(3, file_store.store.count);
+    assert_oldest(&(file_store.store), "a", "1");
+    TEST_ASSERT_TRUE(file_store.store.pop_fptr(&(file_store.store)));
+    mqtt_store_file_close(&file_store);
+
+    /* Crash while writing leaves partial record */
+    FILE * file = fopen(STORE_FILE, "ab");
+    TEST_ASSERT_NOT_NULL(file);
+    TEST_ASSERT_EQUAL_UINT32(3, fwrite("\x00\x01\x00", 1, 3, file));
+    fclose(file);
+
+    TEST_ASSERT_TRUE(mqtt_store_file_open(&file_store, STORE_FILE, scratch, sizeof(scratch)));
+    TEST_ASSERT_EQUAL_UINT32(2, file_store.store.count);
+    assert_oldest(&(file_store.store), "b", "2");
+
+    /* Rest is flushed when attached to connected context */
+    store_setup(true);
+    TEST_ASSERT_TRUE(mqtt_outbound_store(&shared, &(file_store.store)));
+    TEST_ASSERT_EQUAL_UINT32(0, file_store.store.count);
+    TEST_ASSERT_EQUAL_UINT32(12, g_out_len);
+    assert_publish(0, 'b', '2');
+    assert_publish(6, 'c', '3');
+    mqtt_store_file_close(&file_store);
+
+    TEST_ASSERT_TRUE(mqtt_store_file_open(&file_store, STORE_FILE, scratch, sizeof(scratch)));
+    TEST_ASSERT_EQUAL_UINT32(0, file_store.store.count);
+    mqtt_store_file_close(&file_store);
+    remove(STORE_FILE);
+}
+
+/****************************************************************************************
+ * TEST main                                                                            *
+ ****************************************************************************************/
+int main(void)
+{
+    UnityBegin("Outbound store");
+    unsigned int tCntr = 1;
+
+    RUN_TEST(test_store_ring_order_and_wrap,        tCntr++);
+    RUN_TEST(test_store_publish_while_disconnected, tCntr++);
+    RUN_TEST(test_store_flush_on_attach,            tCntr++);
+    RUN_TEST(test_store_send_failure,               tCntr++);
+    RUN_TEST(test_store_connack_refused,            tCntr++);
+    RUN_TEST(test_store_not_for_permanent_failure,  tCntr++);
+    RUN_TEST(test_store_drops_undeliverable,        tCntr++);
+    RUN_TEST(test_store_file_survives_reopen,       tCntr++);
+    return (UnityEnd());
+}
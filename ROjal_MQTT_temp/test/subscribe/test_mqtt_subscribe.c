@@ -0,0 +1,191 @@
+#include "mqtt.h"
+#include "unity.h"
+#include "client_fixture.h"
+
+#include <string.h>
+
+static MQTT_shared_data_t shared;
+static uint8_t            tx_buffer[64];
+
+static uint32_t         g_suback_cntr = 0;
+static MQTTErrorCodes_t g_suback_status;
+
+void subscribe_cb(MQTT_shared_data_t * a_shared_ptr,
+                  MQTTErrorCodes_t     a_status,
+                  uint8_t            * a_data_ptr,
+                  uint32_t             a_data_len,
+                  uint8_t            * a_topic_ptr,
+                  uint16_t             a_topic_len)
+{
+    a_shared_ptr = a_shared_ptr;
+    a_data_ptr   = a_data_ptr;
+    a_data_len   = a_data_len;
+    a_topic_len  = a_topic_len;
+    if (NULL == a_topic_ptr) {
+        g_suback_status = a_status;
+        g_suback_cntr++;
+    }
+}
+
+static void subscribe_setup()
+{
+    fixture_setup(&shared, tx_buffer, sizeof(tx_buffer), true);
+    shared.subscribe_cb_fptr = &subscribe_cb;
+
+    g_suback_cntr = 0;
+}
+
+static uint16_t sent_packet_id()
+{
+    return (uint16_t)((g_out[2] << 8) | g_out[3]);
+}
+
+/****************************************************************************************
+ * Subscribe tests                                                                      *
+ ****************************************************************************************/
+void test_subscribe_list_encode()
+{
+    MQTT_subscribe_t topics[] = {{QoS0, (uint8_t *)"a/b", 3},
+                                 {QoS1, (uint8_t *)"c",   1},
+                                 {QoS2, (uint8_t *)"d/#", 3}};
+    uint8_t expected[] = {0x82, 0x15, 0x00, 0x00,
+                          0x00, 0x03, 'a', '/', 'b', 0x00,
+                          0x00, 0x01, 'c', 0x01,
+                          0x00, 0x03, 'd', '/', '#', 0x02};
+
+    subscribe_setup();
+    TEST_ASSERT_TRUE(mqtt_subscribe_list(&shared, topics, 3, NULL, 0));
+
+    expected[1] = (uint8_t)(sizeof(expected) - 2);
+    TEST_ASSERT_EQUAL_UINT32(sizeof(expected), g_out_len);
+    TEST_ASSERT_NOT_EQUAL(0, sent_packet_id());
+    expected[2] = g_out[2];
+    expected[3] = g_out[3];
+    TEST_ASSERT_EQUAL_MEMORY(expected, g_out, sizeof(expected));
+
+    /* Single topic subscribe uses the same packet layout */
+    g_out_len = 0;
+    TEST_ASSERT_TRUE(mqtt_subscribe(&shared, "a/b", 3, 0));
+    TEST_ASSERT_EQUAL_UINT32(10, g_out_len);
+    TEST_ASSERT_EQUAL_HEX8(0x82, g_out[0]);
+    TEST_ASSERT_EQUAL_HEX8(0x08, g_out[1]);
+}
+
+void test_subscribe_list_suback_codes()
+{
+    MQTT_subscribe_t topics[] = {{QoS0, (uint8_t *)"a", 1},
+                                 {QoS2, (uint8_t *)"b", 1},
+                                 {QoS1, (uint8_t *)"c", 1}};
+    uint8_t          codes[3] = {0xFF, 0xFF, 0xFF};
+
+    subscribe_setup();
+    TEST_ASSERT_TRUE(mqtt_subscribe_list(&shared, topics, 3, codes, 0));
+    uint16_t packet_id = sent_packet_id();
+
+    /* Ack of other request is ignored */
+    uint8_t other[] = {0x90, 0x05, (uint8_t)((packet_id + 1) >> 8), (uint8_t)(packet_id + 1), 0x00, 0x01, 0x01};
+    TEST_ASSERT_FALSE(mqtt_receive(&shared, other, sizeof(other)));
+    TEST_ASSERT_FALSE(shared.subscribe_status);
+    TEST_ASSERT_EQUAL_HEX8(0xFF, codes[0]);
+
+    /* Every filter has own return code, b is granted QoS 1 only */
+    uint8_t suback[] = {0x90, 0x05, (uint8_t)(packet_id >> 8), (uint8_t)packet_id, 0x00, 0x01, 0x01};
+    TEST_ASSERT_TRUE(mqtt_receive(&shared, suback, sizeof(suback)));
+    TEST_ASSERT_TRUE(shared.subscribe_status);
+    TEST_ASSERT_EQUAL_HEX8(0x00, codes[0]);
+    TEST_ASSERT_EQUAL_HEX8(0x01, codes[1]);
+    TEST_ASSERT_EQUAL_HEX8(0x01, codes[2]);
+    TEST_ASSERT_EQUAL_UINT32(1, g_suback_cntr);
+    TEST_ASSERT_EQUAL_INT(Successfull, g_suback_status);
+    TEST_ASSERT_EQUAL_INT(Successfull, shared.subscribe_pending.result);
+
+    /* Ack is handled once */
+    TEST_ASSERT_FALSE(mqtt_receive(&shared, suback, sizeof(suback)));
+    TEST_ASSERT_EQUAL_UINT32(1, g_suback_cntr);
+}
+
+void test_subscribe_list_refused()
+{
+    MQTT_subscribe_t topics[] = {{QoS0, (uint8_t *)"a",       1},
+                                 {QoS0, (uint8_t *)"$SYS/#",  6}};
+    uint8_t          codes[2];
+
+    subscribe_setup();
+    TEST_ASSERT_TRUE(mqtt_subscribe_list(&shared, topics, 2, codes, 0));
+    uint16_t packet_id = sent_packet_id();
+
+    uint8_t suback[] = {0x90, 0x04, (uint8_t)(packet_id >> 8), (uint8_t)packet_id, 0x00, MQTT_SUBACK_FAILURE};
+    TEST_ASSERT_TRUE(mqtt_receive(&shared, suback, sizeof(suback)));
+    TEST_ASSERT_EQUAL_HEX8(0x00, codes[0]);
+    TEST_ASSERT_EQUAL_HEX8(MQTT_SUBACK_FAILURE, codes[1]);
+    TEST_ASSERT_EQUAL_INT(NotAuthorized, g_suback_status);
+    TEST_ASSERT_EQUAL_INT(NotAuthorized, shared.subscribe_pending.result);
+}
+
+void test_unsubscribe_list()
+{
+    MQTT_subscribe_t topics[] = {{QoS1, (uint8_t *)"a/b", 3},
+                                 {QoS0, (uint8_t *)"c",   1}};
+    uint8_t expected[] = {0xA2, 0x0A, 0x00, 0x00,
+                          0x00, 0x03, 'a', '/', 'b',
+                          0x00, 0x01, 'c'};
+
+    subscribe_setup();
+    TEST_ASSERT_TRUE(mqtt_unsubscribe_list(&shared, topics, 2, 0));
+    TEST_ASSERT_EQUAL_UINT32(sizeof(expected), g_out_len);
+    expected[2] = g_out[2];
+    expected[3] = g_out[3];
+    TEST_ASSERT_EQUAL_MEMORY(expected, g_out, sizeof(expected));
+
+    uint16_t packet_id  = sent_packet_id();
+    uint8_t  unsuback[] = {0xB0, 0x02, (uint8_t)(packet_id >> 8), (uint8_t)packet_id};
+    TEST_ASSERT_TRUE(mqtt_receive(&shared, unsuback, sizeof(unsuback)));
+    TEST_ASSERT_TRUE(shared.subscribe_status);
+    TEST_ASSERT_EQUAL_UINT16(0, shared.subscribe_pending.packet_id);
+
+    /* UNSUBACK is not reported as SUBACK */
+    TEST_ASSERT_EQUAL_UINT32(0, g_suback_cntr);
+
+    g_out_len = 0;
+    TEST_ASSERT_TRUE(mqtt_unsubscribe(&shared, "a/b", 3, 0));
+    TEST_ASSERT_EQUAL_UINT32(9, g_out_len);
+    TEST_ASSERT_EQUAL_HEX8(0xA2, g_out[0]);
+}
+
+void test_subscribe_list_invalid()
+{
+    MQTT_subscribe_t topics[] = {{QoS0,       (uint8_t *)"a", 1},
+                                 {QoSInvalid, (uint8_t *)"b", 1}};
+    MQTT_subscribe_t big[]    = {{QoS0, (uint8_t *)"0123456789012345678901234567890123456789", 40},
+                                 {QoS0, (uint8_t *)"0123456789012345678901234567890123456789", 40}};
+
+    /* Not connected */
+    fixture_setup(&shared, tx_buffer, sizeof(tx_buffer), false);
+    TEST_ASSERT_FALSE(mqtt_subscribe_list(&shared, topics, 1, NULL, 0));
+
+    subscribe_setup();
+    TEST_ASSERT_FALSE(mqtt_subscribe_list(&shared, topics, 0, NULL, 0));
+    TEST_ASSERT_FALSE(mqtt_subscribe_list(&shared, topics, 2, NULL, 0));
+    TEST_ASSERT_FALSE(mqtt_unsubscribe_list(&shared, NULL, 1, 0));
+
+    /* Does not fit into the transmit buffer */
+    TEST_ASSERT_TRUE(mqtt_subscribe_list(&shared, big, 1, NULL, 0));
+    TEST_ASSERT_FALSE(mqtt_subscribe_list(&shared, big, 2, NULL, 0));
+    TEST_ASSERT_EQUAL_UINT16(0, shared.subscribe_pending.packet_id);
+}
+
+/****************************************************************************************
+ * TEST main                                                                            *
+ ****************************************************************************************/
+int main(void)
+{
+    UnityBegin("Subscribe list");
+    unsigned int tCntr = 1;
+
+    RUN_TEST(test_subscribe_list_encode,       tCntr++);
+    RUN_TEST(test_subscribe_list_suback_codes, tCntr++);
+    RUN_TEST(test_subscribe_list_refused,      tCntr++);
+    RUN_TEST(test_unsubscribe_list,            tCntr++);
+    RUN_TEST(test_subscribe_list_invalid,      tCntr++);
+    return (UnityEnd());
+}
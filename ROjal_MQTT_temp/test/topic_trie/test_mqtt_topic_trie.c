@@ -0,0 +1,283 @@
+#include "mqtt.h"
+#include "unity.h"
+#include "client_fixture.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define NODE_CNT   16
+#define DEVICE_CNT 1000
+
+static MQTT_topic_trie_t  trie;
+static MQTT_topic_node_t  nodes[NODE_CNT];
+static MQTT_topic_node_t  big_nodes[DEVICE_CNT * 2 + 8];
+static char               device_filters[DEVICE_CNT][24];
+
+static MQTT_shared_data_t shared;
+static uint8_t            tx_buffer[64];
+
+static uint32_t g_handler_a = 0;
+static uint32_t g_handler_b = 0;
+static uint32_t g_handler_c = 0;
+static uint32_t g_default   = 0;
+
+static void count(uint32_t * a_cntr_ptr, MQTTErrorCodes_t a_status, uint8_t * a_data_ptr, uint32_t a_data_len)
+{
+    TEST_ASSERT_EQUAL_INT(Successfull, a_status);
+    if (0 < a_data_len)
+        TEST_ASSERT_EQUAL_UINT8('x', a_data_ptr[0]);
+    (*a_cntr_ptr)++;
+}
+
+void handler_a(MQTT_shared_data_t * a_shared_ptr, MQTTErrorCodes_t a_status, uint8_t * a_data_ptr,
+               uint32_t a_data_len, uint8_t * a_topic_ptr, uint16_t a_topic_len)
+{
+    a_shared_ptr = a_shared_ptr;
+    a_topic_ptr  = a_topic_ptr;
+    a_topic_len  = a_topic_len;
+    count(&g_handler_a, a_status, a_data_ptr, a_data_len);
+}
+
+void handler_b(MQTT_shared_data_t * a_shared_ptr, MQTTErrorCodes_t a_status, uint8_t * a_data_ptr,
+               uint32_t a_data_len, uint8_t * a_topic_ptr, uint16_t a_topic_len)
+{
+    a_shared_ptr = a_shared_ptr;
+    a_topic_ptr  = a_topic_ptr;
+    a_topic_len  = a_topic_len;
+    count(&g_handler_b, a_status, a_data_ptr, a_data_len);
+}
+
+void handler_c(MQTT_shared_data_t * a_shared_ptr, MQTTErrorCodes_t a_status, uint8_t * a_data_ptr,
+               uint32_t a_data_len, uint8_t * a_topic_ptr, uint16_t a_topic_len)
+{
+    a_shared_ptr = a_shared_ptr;
+    a_topic_ptr  = a_topic_ptr;
+    a_topic_len  = a_topic_len;
+    count(&g_handler_c, a_status, a_data_ptr, a_data_len);
+}
+
+void default_cb(MQTT_shared_data_t * a_shared_ptr, MQTTErrorCodes_t a_status, uint8_t * a_data_ptr,
+                uint32_t a_data_len, uint8_t * a_topic_ptr, uint16_t a_topic_len)
+{
+    a_shared_ptr = a_shared_ptr;
+    a_topic_ptr  = a_topic_ptr;
+    a_topic_len  = a_topic_len;
+    if (NULL != a_topic_ptr)
+        count(&g_default, a_status, a_data_ptr, a_data_len);
+}
+
+static void reset_counters()
+{
+    g_handler_a = 0;
+    g_handler_b = 0;
+    g_handler_c = 0;
+    g_default   = 0;
+}
+
+static uint16_t dispatch(const char * a_topic)
+{
+    uint8_t data = 'x';
+    reset_counters();
+    return mqtt_topic_dispatch(&shared, &trie, (uint8_t *)a_topic, (uint16_t)strlen(a_topic), &data, 1);
+}
+
+static bool reg(const char * a_filter, subscrbe_fptr_t a_handler_fptr)
+{
+    return mqtt_topic_register(&trie, a_filter, (uint16_t)strlen(a_filter), a_handler_fptr);
+}
+
+static bool unreg(const char * a_filter)
+{
+    return mqtt_topic_unregister(&trie, a_filter, (uint16_t)strlen(a_filter));
+}
+
+/****************************************************************************************
+ * Topic trie tests                                                                     *
+ ****************************************************************************************/
+void test_topic_trie_exact()
+{
+    TEST_ASSERT_FALSE(mqtt_topic_trie_init(&trie, nodes, 1));
+    TEST_ASSERT_TRUE(mqtt_topic_trie_init(&trie, nodes, NODE_CNT));
+
+    TEST_ASSERT_TRUE(reg("ilto/h/1", &handler_a));
+    TEST_ASSERT_TRUE(reg("ilto/t/1", &handler_b));
+    TEST_ASSERT_EQUAL_UINT16(1 + 5, trie.used); /* ilto shared */
+
+    TEST_ASSERT_EQUAL_UINT16(1, dispatch("ilto/h/1"));
+    TEST_ASSERT_EQUAL_UINT32(1, g_handler_a);
+    TEST_ASSERT_EQUAL_UINT32(0, g_handler_b);
+
+    TEST_ASSERT_EQUAL_UINT16(0, dispatch("ilto/h"));
+    TEST_ASSERT_EQUAL_UINT16(0, dispatch("ilto/h/1/x"));
+    TEST_ASSERT_EQUAL_UINT16(0, dispatch("ilto/h/12"));
+    TEST_ASSERT_EQUAL_UINT16(0, dispatch("ilto/h/"));
+
+    /* Handler is replaced */
+    TEST_ASSERT_TRUE(reg("ilto/h/1", &handler_c));
+    TEST_ASSERT_EQUAL_UINT16(1, dispatch("ilto/h/1"));
+    TEST_ASSERT_EQUAL_UINT32(0, g_handler_a);
+    TEST_ASSERT_EQUAL_UINT32(1, g_handler_c);
+}
+
+void test_topic_trie_wildcards()
+{
+    TEST_ASSERT_TRUE(mqtt_topic_trie_init(&trie, nodes, NODE_CNT));
+
+    TEST_ASSERT_TRUE(reg("ilto/+/1", &handler_a));
+    TEST_ASSERT_TRUE(reg("ilto/#",   &handler_b));
+    TEST_ASSERT_TRUE(reg("+/+/+",    &handler_c));
+
+    /* All overlapping filters get the message */
+    TEST_ASSERT_EQUAL_UINT16(3, dispatch("ilto/h/1"));
+    TEST_ASSERT_EQUAL_UINT32(1, g_handler_a);
+    TEST_ASSERT_EQUAL_UINT32(1, g_handler_b);
+    TEST_ASSERT_EQUAL_UINT32(1, g_handler_c);
+
+    TEST_ASSERT_EQUAL_UINT16(2, dispatch("ilto/t/2"));
+    TEST_ASSERT_EQUAL_UINT32(0, g_handler_a);
+
+    /* # matches parent level too */
+    TEST_ASSERT_EQUAL_UINT16(1, dispatch("ilto"));
+    TEST_ASSERT_EQUAL_UINT32(1, g_handler_b);
+
+    /* + matches empty level */
+    TEST_ASSERT_EQUAL_UINT16(3, dispatch("ilto//1"));
+
+    TEST_ASSERT_EQUAL_UINT16(0, dispatch("other/h/1/2"));
+}
+
+void test_topic_trie_dollar_topics()
+{
+    TEST_ASSERT_TRUE(mqtt_topic_trie_init(&trie, nodes, NODE_CNT));
+
+    TEST_ASSERT_TRUE(reg("#",                 &handler_a));
+    TEST_ASSERT_TRUE(reg("+/broker/uptime",   &handler_b));
+    TEST_ASSERT_TRUE(reg("$SYS/broker/+",     &handler_c));
+
+    /* Wildcard at first level does not match $ topics */
+    TEST_ASSERT_EQUAL_UINT16(1, dispatch("$SYS/broker/uptime"));
+    TEST_ASSERT_EQUAL_UINT32(1, g_handler_c);
+
+    TEST_ASSERT_EQUAL_UINT16(2, dispatch("x/broker/uptime"));
+    TEST_ASSERT_EQUAL_UINT32(1, g_handler_a);
+    TEST_ASSERT_EQUAL_UINT32(1, g_handler_b);
+}
+
+void test_topic_trie_invalid_and_full()
+{
+    TEST_ASSERT_TRUE(mqtt_topic_trie_init(&trie, nodes, 4));
+
+    TEST_ASSERT_FALSE(reg("",       &handler_a));
+    TEST_ASSERT_FALSE(reg("a/b#",   &handler_a));
+    TEST_ASSERT_FALSE(reg("a/#/b",  &handler_a));
+    TEST_ASSERT_FALSE(reg("a+/b",   &handler_a));
+    TEST_ASSERT_FALSE(reg("a/+b",   &handler_a));
+    TEST_ASSERT_FALSE(reg("a/b",    NULL));
+    TEST_ASSERT_EQUAL_UINT16(1, trie.used);
+
+    /* Nothing is added when the whole filter does not fit */
+    TEST_ASSERT_TRUE(reg("a/b",     &handler_a));
+    TEST_ASSERT_FALSE(reg("c/d",    &handler_b));
+    TEST_ASSERT_EQUAL_UINT16(3, trie.used);
+    TEST_ASSERT_TRUE(reg("a/c",     &handler_b));
+    TEST_ASSERT_EQUAL_UINT16(4, trie.used);
+    TEST_ASSERT_FALSE(reg("a/d",    &handler_c));
+    TEST_ASSERT_TRUE(reg("a",       &handler_c));
+    TEST_ASSERT_EQUAL_UINT16(1, dispatch("a"));
+}
+
+void test_topic_trie_unregister()
+{
+    TEST_ASSERT_TRUE(mqtt_topic_trie_init(&trie, nodes, NODE_CNT));
+
+    TEST_ASSERT_TRUE(reg("a/b/c", &handler_a));
+    TEST_ASSERT_TRUE(reg("a/b",   &handler_b));
+    TEST_ASSERT_TRUE(reg("a/x",   &handler_c));
+    TEST_ASSERT_EQUAL_UINT16(5, trie.used);
+
+    TEST_ASSERT_FALSE(unreg("a"));
+    TEST_ASSERT_FALSE(unreg("a/b/c/d"));
+    TEST_ASSERT_FALSE(unreg("q"));
+
+    /* Leaf is freed, a/b still has a handler */
+    TEST_ASSERT_TRUE(unreg("a/b/c"));
+    TEST_ASSERT_FALSE(unreg("a/b/c"));
+    TEST_ASSERT_EQUAL_UINT16(4, trie.used);
+    TEST_ASSERT_EQUAL_UINT16(0, dispatch("a/b/c"));
+    TEST_ASSERT_EQUAL_UINT16(1, dispatch("a/b"));
+
+    TEST_ASSERT_TRUE(unreg("a/b"));
+    TEST_ASSERT_EQUAL_UINT16(3, trie.used);
+    TEST_ASSERT_TRUE(unreg("a/x"));
+    TEST_ASSERT_EQUAL_UINT16(1, trie.used);
+    TEST_ASSERT_EQUAL_UINT16(0, nodes[0].child);
+
+    /* Freed nodes are reused */
+    TEST_ASSERT_TRUE(reg("z/y", &handler_a));
+    TEST_ASSERT_EQUAL_UINT16(1, dispatch("z/y"));
+}
+
+void test_topic_trie_many_filters()
+{
+    TEST_ASSERT_TRUE(mqtt_topic_trie_init(&trie, big_nodes, sizeof(big_nodes) / sizeof(big_nodes[0])));
+
+    for (uint32_t i = 0; i < DEVICE_CNT; i++) {
+        snprintf(device_filters[i], sizeof(device_filters[i]), "gw/%u/temp", i);
+        TEST_ASSERT_TRUE(reg(device_filters[i], (i == 777) ? &handler_a : &handler_b));
+    }
+    TEST_ASSERT_TRUE(reg("gw/+/hum", &handler_c));
+    TEST_ASSERT_EQUAL_UINT16(1 + 1 + DEVICE_CNT * 2 + 2, trie.used);
+
+    TEST_ASSERT_EQUAL_UINT16(1, dispatch("gw/777/temp"));
+    TEST_ASSERT_EQUAL_UINT32(1, g_handler_a);
+    TEST_ASSERT_EQUAL_UINT16(1, dispatch("gw/778/hum"));
+    TEST_ASSERT_EQUAL_UINT32(1, g_handler_c);
+    TEST_ASSERT_EQUAL_UINT16(0, dispatch("gw/1000/temp"));
+}
+
+void test_topic_trie_receive()
+{
+    /* PUBLISH QoS0 - topic "a/b", payload "x" */
+    uint8_t publish_ab[] = {0x30, 0x06, 0x00, 0x03, 'a', '/', 'b', 'x'};
+    uint8_t publish_cd[] = {0x30, 0x06, 0x00, 0x03, 'c', '/', 'd', 'x'};
+
+    fixture_setup(&shared, tx_buffer, sizeof(tx_buffer), true);
+    shared.subscribe_cb_fptr = &default_cb;
+    TEST_ASSERT_NULL(shared.topics);
+
+    TEST_ASSERT_TRUE(mqtt_topic_trie_init(&trie, nodes, NODE_CNT));
+    TEST_ASSERT_FALSE(mqtt_subscribe_handler(&shared, "a/+", 3, &handler_a, 0)); /* No trie */
+    TEST_ASSERT_TRUE(mqtt_topic_trie(&shared, &trie));
+
+    g_out_len = 0;
+    TEST_ASSERT_TRUE(mqtt_subscribe_handler(&shared, "a/+", 3, &handler_a, 0));
+    TEST_ASSERT_EQUAL_HEX8(0x82, g_out[0]); /* SUBSCRIBE sent */
+
+    reset_counters();
+    TEST_ASSERT_TRUE(mqtt_receive(&shared, publish_ab, sizeof(publish_ab)));
+    TEST_ASSERT_EQUAL_UINT32(1, g_handler_a);
+    TEST_ASSERT_EQUAL_UINT32(0, g_default);
+
+    /* Not matching topic goes to subscribe callback */
+    TEST_ASSERT_TRUE(mqtt_receive(&shared, publish_cd, sizeof(publish_cd)));
+    TEST_ASSERT_EQUAL_UINT32(1, g_handler_a);
+    TEST_ASSERT_EQUAL_UINT32(1, g_default);
+}
+
+/****************************************************************************************
+ * TEST main                                                                            *
+ ****************************************************************************************/
+int main(void)
+{
+    UnityBegin("Topic trie");
+    unsigned int tCntr = 1;
+
+    RUN_TEST(test_topic_trie_exact,            tCntr++);
+    RUN_TEST(test_topic_trie_wildcards,        tCntr++);
+    RUN_TEST(test_topic_trie_dollar_topics,    tCntr++);
+    RUN_TEST(test_topic_trie_invalid_and_full, tCntr++);
+    RUN_TEST(test_topic_trie_unregister,       tCntr++);
+    RUN_TEST(test_topic_trie_many_filters,     tCntr++);
+    RUN_TEST(test_topic_trie_receive,          tCntr++);
+    return (UnityEnd());
+}
@@ -0,0 +1,189 @@
+#include "mqtt.h"
+#include "unity.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/* Functions not declared in mqtt.h - internal functions */
+extern uint8_t          mqtt_varint_size(uint32_t a_value);
+extern uint8_t          mqtt_varint_encode(uint8_t * a_output_ptr, uint32_t a_value);
+extern MQTTErrorCodes_t mqtt_varint_decode(const uint8_t * a_input_ptr,
+                                           uint32_t        a_input_size,
+                                           uint32_t      * a_value_ptr,
+                                           uint8_t       * a_size_ptr);
+extern MQTTErrorCodes_t get_packet_size(uint8_t  * a_input_ptr,
+                                        uint32_t   a_input_size,
+                                        uint32_t * a_packet_size_ptr);
+
+/* Remaining length loops as they were before the codec, see the spec */
+static uint8_t loop_encode(uint8_t * a_output_ptr, uint32_t a_value)
+{
+    uint8_t cnt = 0;
+    do {
+        uint8_t encodedByte = a_value % 128;
+        a_value             = a_value / 128;
+        if (a_value > 0)
+            encodedByte = encodedByte | 128;
+        a_output_ptr[cnt++] = encodedByte;
+    } while (a_value > 0);
+    return cnt;
+}
+
+static uint8_t loop_decode(const uint8_t * a_input_ptr, uint32_t * a_value_ptr)
+{
+    uint32_t multiplier = 1;
+    uint32_t value      = 0;
+    uint8_t  cnt        = 0;
+    uint8_t  aByte      = 0;
+    do {
+        aByte       = a_input_ptr[cnt++];
+        value      += ((aByte & 127) * multiplier);
+        multiplier *= 128;
+    } while (0 != (aByte & 128));
+    *a_value_ptr = value;
+    return cnt;
+}
+
+/* Boundaries of every length class */
+static const uint32_t g_boundaries[] = {0, 1, 127, 128, 129, 16383, 16384, 16385,
+                                        2097151, 2097152, 2097153, MQTT_MAX_MESSAGE_SIZE};
+
+/****************************************************************************************
+ * Varint tests                                                                         *
+ ****************************************************************************************/
+void test_varint_encode_same_as_loop()
+{
+    uint8_t expected[4];
+    uint8_t actual[4];
+
+    for (uint32_t i = 0; i < sizeof(g_boundaries) / sizeof(g_boundaries[0]); i++) {
+        uint8_t size = loop_encode(expected, g_boundaries[i]);
+        TEST_ASSERT_EQUAL_UINT8(size, mqtt_varint_size(g_boundaries[i]));
+        TEST_ASSERT_EQUAL_UINT8(size, mqtt_varint_encode(actual, g_boundaries[i]));
+        TEST_ASSERT_EQUAL_MEMORY(expected, actual, size);
+    }
+
+    /* Every 1-3 byte length and a sample of 4 byte lengths */
+    for (uint32_t value = 0; value <= MQTT_MAX_MESSAGE_SIZE; value += ((value < 2097152) ? 1 : 997)) {
+        uint8_t size = loop_encode(expected, value);
+        TEST_ASSERT_EQUAL_UINT8(size, mqtt_varint_encode(actual, value));
+        TEST_ASSERT_EQUAL_MEMORY(expected, actual, size);
+    }
+
+    TEST_ASSERT_EQUAL_UINT8(0, mqtt_varint_encode(actual, MQTT_MAX_MESSAGE_SIZE + 1));
+}
+
+void test_varint_decode_same_as_loop()
+{
+    uint8_t  input[4];
+    uint32_t value;
+    uint8_t  size;
+
+    for (uint32_t i = 0; i <= MQTT_MAX_MESSAGE_SIZE; i += ((i < 2097152) ? 1 : 997)) {
+        uint32_t expected;
+        uint8_t  expected_size;
+
+        mqtt_varint_encode(input, i);
+        expected_size = loop_decode(input, &expected);
+        TEST_ASSERT_EQUAL_INT(Successfull, mqtt_varint_decode(input, sizeof(input), &value, &size));
+        TEST_ASSERT_EQUAL_UINT32(expected, value);
+        TEST_ASSERT_EQUAL_UINT8(expected_size, size);
+    }
+}
+
+void test_varint_decode_partial()
+{
+    uint8_t  input[] = {0xFF, 0xFF, 0xFF, 0x7F, 0x00};
+    uint32_t value   = 0;
+    uint8_t  size    = 0;
+
+    /* Bytes needed so far is reported for each partial input */
+    for (uint32_t available = 0; available < 4; available++) {
+        TEST_ASSERT_EQUAL_INT(PacketIncomplete, mqtt_varint_decode(input, available, &value, &size));
+        TEST_ASSERT_EQUAL_UINT8(available + 1, size);
+    }
+    TEST_ASSERT_EQUAL_INT(Successfull, mqtt_varint_decode(input, 4, &value, &size));
+    TEST_ASSERT_EQUAL_UINT32(MQTT_MAX_MESSAGE_SIZE, value);
+    TEST_ASSERT_EQUAL_UINT8(4, size);
+
+    /* Continuation bit in the 4th byte */
+    input[3] = 0xFF;
+    TEST_ASSERT_EQUAL_INT(InvalidArgument, mqtt_varint_decode(input, sizeof(input), &value, &size));
+
+    /* Short length does not need more than is there */
+    input[0] = 0x05;
+    TEST_ASSERT_EQUAL_INT(Successfull, mqtt_varint_decode(input, 1, &value, &size));
+    TEST_ASSERT_EQUAL_UINT32(5, value);
+    TEST_ASSERT_EQUAL_UINT8(1, size);
+
+    /* Packet without remaining bytes is complete with its fixed header */
+    uint8_t  pingresp[]  = {0xD0, 0x00};
+    uint32_t packet_size = 0;
+    TEST_ASSERT_EQUAL_INT(PacketIncomplete, get_packet_size(pingresp, 1, &packet_size));
+    TEST_ASSERT_EQUAL_INT(Successfull, get_packet_size(pingresp, sizeof(pingresp), &packet_size));
+    TEST_ASSERT_EQUAL_UINT32(2, packet_size);
+}
+
+/****************************************************************************************
+ * Microbenchmark - printed only, not a pass criteria                                   *
+ ****************************************************************************************/
+#define BENCH_ROUNDS 2000000
+
+static double elapsed_ms(struct timespec * a_start_ptr)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - a_start_ptr->tv_sec) * 1000.0 + (now.tv_nsec - a_start_ptr->tv_nsec) / 1000000.0;
+}
+
+static void bench(const char * a_name_ptr, uint32_t a_max)
+{
+    static volatile uint32_t sink;
+    uint8_t         buffer[4];
+    uint32_t        value;
+    uint8_t         size;
+    struct timespec start;
+    double          loop_ms;
+    double          codec_ms;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (uint32_t i = 0; i < BENCH_ROUNDS; i++) {
+        loop_encode(buffer, i % a_max);
+        loop_decode(buffer, &value);
+        sink += value;
+    }
+    loop_ms = elapsed_ms(&start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (uint32_t i = 0; i < BENCH_ROUNDS; i++) {
+        mqtt_varint_encode(buffer, i % a_max);
+        mqtt_varint_decode(buffer, sizeof(buffer), &value, &size);
+        sink += value;
+    }
+    codec_ms = elapsed_ms(&start);
+
+    printf("varint %-8s loop %8.2f ms codec %8.2f ms (%u rounds)\n", a_name_ptr, loop_ms, codec_ms, BENCH_ROUNDS);
+}
+
+void test_varint_bench()
+{
+    bench("1 byte",  128);
+    bench("2 bytes", 16384);
+    bench("mixed",   MQTT_MAX_MESSAGE_SIZE + 1);
+}
+
+/****************************************************************************************
+ * TEST main                                                                            *
+ ****************************************************************************************/
+int main(void)
+{
+    UnityBegin("Varint");
+    unsigned int tCntr = 1;
+
+    RUN_TEST(test_varint_encode_same_as_loop, tCntr++);
+    RUN_TEST(test_varint_decode_same_as_loop, tCntr++);
+    RUN_TEST(test_varint_decode_partial,      tCntr++);
+    RUN_TEST(test_varint_bench,               tCntr++);
+    return (UnityEnd());
+}